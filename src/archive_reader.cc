@@ -7,7 +7,9 @@
 
 #include <unistd.h>
 #include <filesystem>
+#include <cinttypes>
 #include "libmerc/archive.h"
+#include "libmerc/indexed_archive.hpp"
 #include "options.h"
 
 // hex_to_raw() reads a string in hexadecimal, and writes the raw
@@ -38,6 +40,82 @@ ssize_t hex_to_raw(const void *output,
     return count;
 }
 
+// read_key_file(filename, key) reads a key, as 32 hex characters,
+// from the file filename into key, and returns true on success
+//
+bool read_key_file(const char *filename, unsigned char key[16]) {
+    FILE *keyfile = fopen(filename, "r");
+    if (keyfile == nullptr) {
+        fprintf(stderr, "error: could not open key file %s\n", filename);
+        return false;
+    }
+    char raw_key[32];
+    size_t bytes_read = fread(raw_key, sizeof(char), sizeof(raw_key), keyfile);
+    fclose(keyfile);
+    if (bytes_read != sizeof(raw_key)) {
+        fprintf(stderr, "error: could not read key from file %s (got %zu)\n", filename, bytes_read);
+        return false;
+    }
+    ssize_t raw_bytes = hex_to_raw(key, 16, raw_key);
+    if (raw_bytes != 16) {
+        fprintf(stderr, "error: could not convert input string into raw key (expected 32 hex chars)\n");
+        return false;
+    }
+    return true;
+}
+
+// process_indexed_archive() lists, dumps, or extracts the members of
+// an indexed archive
+//
+int process_indexed_archive(const char *archive_file_name, const uint8_t *k, bool list, bool dump, bool extract) {
+    indexed_archive archive{archive_file_name, k};
+    if (!archive.is_valid()) {
+        fprintf(stderr, "error: could not read any entries from archive file %s\n", archive_file_name);
+        return EXIT_FAILURE;
+    }
+    for (const auto &info : archive.get_members()) {
+        if (list | dump) {
+            fprintf(stderr, "name:\t%s\n", info.name.c_str());
+            fprintf(stderr, "size: %" PRIu64 " bytes\n", info.size);
+            fprintf(stderr, "compressed size: %" PRIu64 " bytes\n", info.length);
+        }
+        if (dump) {
+            auto member = archive.open(info);
+            std::string_view line;
+            while (member->getline(line)) {
+                fprintf(stdout, "%.*s\n", (int)line.length(), line.data());
+            }
+        }
+        if (extract) {
+
+            // copy the member into a file, creating its directory if need be
+            //
+            std::filesystem::path path{info.name};
+            if (path.has_parent_path()) {
+                std::error_code e;
+                std::filesystem::create_directories(path.parent_path(), e);
+            }
+            FILE *file = fopen(info.name.c_str(), "w");
+            if (file == nullptr) {
+                fprintf(stderr, "error: could not create file %s\n", info.name.c_str());
+                return EXIT_FAILURE;
+            }
+            auto member = archive.open(info);
+            std::vector<uint8_t> buffer(1 << 20);
+            ssize_t bytes_read;
+            while ((bytes_read = member->read(buffer.data(), buffer.size())) > 0) {
+                fwrite(buffer.data(), 1, bytes_read, file);
+            }
+            fclose(file);
+            if (bytes_read < 0) {
+                fprintf(stderr, "error: could not read archive member %s\n", info.name.c_str());
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
 using namespace mercury_option;
 
 int main(int argc, char *argv[]) {
@@ -52,6 +130,8 @@ int main(int argc, char *argv[]) {
         { argument::required,   "--archive",   "read file <archive>" },
         { argument::required,   "--directory", "set the directory to <arg>" },
         { argument::required,   "--decrypt",   "decrypt using key from file <arg>" },
+        { argument::required,   "--create",    "write archive entries to indexed archive <arg>" },
+        { argument::required,   "--encrypt",   "encrypt indexed archive using key from file <arg>" },
         { argument::none,       "--extract",   "extract archive" },
         { argument::none,       "--list",      "list archive entries" },
         { argument::none,       "--dump",      "dump archive entries" },
@@ -65,6 +145,8 @@ int main(int argc, char *argv[]) {
     auto [ archive_is_set, archive ] = opt.get_value("--archive");
     auto [ dir_is_set, directory ] = opt.get_value("--directory");
     auto [ key_is_set, key_str ] = opt.get_value("--decrypt");
+    auto [ create_is_set, create_file ] = opt.get_value("--create");
+    auto [ enc_key_is_set, enc_key_str ] = opt.get_value("--encrypt");
     bool list       = opt.is_set("--list");
     bool dump       = opt.is_set("--dump");
     bool extract    = opt.is_set("--extract");
@@ -76,7 +158,7 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    if (!list && !dump && !extract && !print_help) {
+    if (!list && !dump && !extract && !create_is_set && !print_help) {
         fprintf(stderr, "warning: no actions specified on command line\n");
     }
 
@@ -98,20 +180,7 @@ int main(int argc, char *argv[]) {
     uint8_t *k = nullptr;
     unsigned char key[16] = { 0x00, };
     if (key_is_set) {
-        FILE *keyfile = fopen(key_str.c_str(), "r");
-        if (keyfile == nullptr) {
-            fprintf(stderr, "error: could not open key file %s\n", key_str.c_str());
-            return EXIT_FAILURE;
-        }
-        char raw_key[32];
-        size_t bytes_read = fread(raw_key, sizeof(char), sizeof(raw_key), keyfile);
-        if (bytes_read != sizeof(raw_key)) {
-            fprintf(stderr, "error: could not read key from file %s (got %zu)\n", key_str.c_str(), bytes_read);
-            return EXIT_FAILURE;
-        }
-        ssize_t raw_bytes = hex_to_raw(key, sizeof(key), raw_key);
-        if (raw_bytes != 16) {
-            fprintf(stderr, "error: could not convert input string into raw key (expected 32 hex chars)\n");
+        if (!read_key_file(key_str.c_str(), key)) {
             opt.usage(stderr, argv[0], summary);
             return EXIT_FAILURE;
         }
@@ -119,6 +188,14 @@ int main(int argc, char *argv[]) {
     }
 
     const char *archive_file_name = archive.c_str();
+    if (indexed_archive::is_indexed_archive(archive_file_name)) {
+        if (create_is_set) {
+            fprintf(stderr, "error: %s is already an indexed archive\n", archive_file_name);
+            return EXIT_FAILURE;
+        }
+        return process_indexed_archive(archive_file_name, k, list, dump, extract);
+    }
+
     class encrypted_compressed_archive tar{archive_file_name, k};
     const class archive_node *entry = tar.get_next_entry();
     if (entry == nullptr) {
@@ -154,6 +231,47 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (create_is_set) {
+
+        // copy each regular file in the archive into a member of an
+        // indexed archive
+        //
+        uint8_t *out_k = nullptr;
+        unsigned char out_key[16] = { 0x00, };
+        if (enc_key_is_set) {
+            if (!read_key_file(enc_key_str.c_str(), out_key)) {
+                return EXIT_FAILURE;
+            }
+            out_k = out_key;
+        }
+        indexed_archive_writer writer{create_file.c_str(), out_k};
+        if (!writer.is_valid()) {
+            return EXIT_FAILURE;
+        }
+        std::vector<uint8_t> data;
+        while (entry != nullptr) {
+            if (entry->is_regular_file()) {
+                std::string name = entry->get_name();
+                if (name.compare(0, 2, "./") == 0) {
+                    name.erase(0, 2);
+                }
+                data.resize(entry->get_size());
+                if (tar.read(data.data(), data.size()) != (ssize_t)data.size()) {
+                    fprintf(stderr, "error: could not read archive entry %s\n", name.c_str());
+                    return EXIT_FAILURE;
+                }
+                if (!writer.add_member(name, data.data(), data.size())) {
+                    return EXIT_FAILURE;
+                }
+            }
+            entry = tar.get_next_entry();
+        }
+        if (!writer.close()) {
+            fprintf(stderr, "error: could not write indexed archive %s\n", create_file.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
     if (extract) {
         while (entry != nullptr) {
 
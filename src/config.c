@@ -141,6 +141,16 @@ static enum status mercury_config_parse_line(struct mercury_config *cfg,
     } else if ((arg = command_get_argument("output-time=", line)) != NULL) {
         return argument_parse_as_uint64(arg, &cfg->out_rotation_duration);
 
+    } else if ((arg = command_get_argument("output-size=", line)) != NULL) {
+        return argument_parse_as_uint64(arg, &cfg->out_rotation_size);
+
+    } else if ((arg = command_get_argument("capture-flows=", line)) != NULL) {
+        return argument_parse_as_uint64(arg, &cfg->capture_flows);
+
+    } else if ((arg = command_get_argument("pcapng", line)) != NULL) {
+        cfg->write_pcapng = true;
+        return status_ok;
+
     } else if ((arg = command_get_argument("user=", line)) != NULL) {
         cfg->user = strdup(arg);
         return status_ok;
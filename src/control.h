@@ -41,13 +41,14 @@ public:
         out_file->file_num = 0;
         out_file->mode = cfg.mode;
         out_file->rotate_time = cfg.out_rotation_duration;
+        out_file->max_bytes = cfg.out_rotation_size;
 
         if (cfg.fingerprint_filename) {
             out_file->outfile_name = cfg.fingerprint_filename;
             out_file->type = file_type_json;
         } else if (cfg.write_filename) {
             out_file->outfile_name = cfg.write_filename;
-            out_file->type = file_type_pcap;
+            out_file->type = cfg.write_pcapng ? file_type_pcapng : file_type_pcap;
         } else {
             out_file->type = file_type_stdout;  // default output type
         }
@@ -58,6 +59,9 @@ public:
         if (out_file->rotate_time == 0) {
             out_file->rotate_time = UINT64_MAX;
         }
+        if (out_file->max_bytes == 0) {
+            out_file->max_bytes = UINT64_MAX;
+        }
         out_count = out_file->rotate_time;
 
         start();
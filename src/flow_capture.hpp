@@ -0,0 +1,324 @@
+// flow_capture.hpp
+//
+// selective capture of the packets of flows that analysis finds
+// interesting
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef FLOW_CAPTURE_HPP
+#define FLOW_CAPTURE_HPP
+
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <unordered_map>
+#include "libmerc/pkt_proc.h"
+#include "libmerc/eth.h"
+
+// get_flow_key(frame, length, linktype, tunnels) returns the flow key
+// of the IP packet in a frame with the given link type, or a zero key
+// if there is no IP packet in the frame.  The tunnels that tunnels is
+// configured to strip are removed first, and the key of a tunneled
+// packet is that of the innermost packet, so that the packets of an
+// inner flow are handled together, even when the outer headers of the
+// two directions differ, as the source ports of VXLAN tunnels do.
+// The decapsulator should be configured as the packet processors'
+// are (see mercury::get_decapsulator()), so that the flows match
+// theirs.
+//
+static inline key get_flow_key(const uint8_t *frame, size_t length, uint16_t linktype, decapsulator tunnels) {
+    key k;
+    datum pkt{frame, frame + length};
+    switch(linktype) {
+    case LINKTYPE_ETHERNET:
+        {
+            eth ethernet{pkt};
+            uint16_t ethertype = ethernet.get_ethertype();
+            if (ethertype != ETH_TYPE_IP && ethertype != ETH_TYPE_IPV6) {
+                return k;
+            }
+        }
+        break;
+    case LINKTYPE_NULL:
+        pkt.skip(4);
+        break;
+    case LINKTYPE_RAW:
+        break;
+    default:
+        return k;
+    }
+    ip ip_pkt{pkt, k};
+    uint8_t protocol = tunnels.decapsulate(pkt, ip_pkt, k, ip_pkt.transport_protocol());
+    if (protocol == ip::protocol::tcp) {
+        tcp_packet tcp{pkt, &ip_pkt};
+        tcp.set_key(k);
+    } else if (protocol == ip::protocol::udp) {
+        class udp udp_pkt{pkt};
+        udp_pkt.set_key(k);
+    }
+    return k;
+}
+
+// class flow_capture_buffer holds the first packets of each flow
+// seen by a single packet processing thread, until that flow is
+// found to be interesting, at which point those packets and all of
+// the later packets of the flow are written out.  The packets of
+// flows that are never found to be interesting are discarded without
+// being written.
+//
+// Packets are stored in a ring of fixed size, which is shared by all
+// of the flows.  Each stored packet is preceded by a header that
+// holds the position of the previous packet of the same flow, so that
+// the packets of a flow form a chain running backwards from the most
+// recent one, and no per-flow allocation is needed.  Positions are
+// absolute byte counts, so a packet that has been overwritten by
+// newer ones can be recognized, and the chain ends there.  If a flow
+// is found to be interesting after some of its packets have been
+// overwritten, only the packets that remain in the ring are written.
+//
+// Flows are identified by their bidirectional flow key, and are
+// forgotten after flow_timeout seconds without a packet.  If the flow
+// table is full, the packets of new flows are not buffered, but are
+// still written if they are themselves interesting.
+//
+class flow_capture_buffer {
+
+    static constexpr uint64_t no_record = UINT64_MAX;
+
+    struct record_header {
+        uint64_t prev;          // position of previous packet in flow
+        uint32_t ts_sec;
+        uint32_t ts_usec;
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    struct flow {
+        uint64_t last;          // position of most recent packet in flow
+        uint32_t count;         // number of packets buffered
+        uint32_t last_seen;     // time of most recent packet in flow
+        bool capturing;         // flow has been found to be interesting
+    };
+
+    std::vector<uint8_t> ring;
+    uint64_t head = 0;
+    std::unordered_map<key, flow> flows;
+    std::vector<uint64_t> chain;
+    size_t max_packets;
+    size_t max_flows;
+    uint32_t flow_timeout;
+    uint32_t next_sweep = 0;
+
+    static constexpr size_t record_length(size_t packet_length) {
+        return (sizeof(record_header) + packet_length + 7) & ~(size_t)7;
+    }
+
+    bool is_intact(uint64_t position) const {
+        return position != no_record && head <= position + ring.size();
+    }
+
+    // store(prev, data, length, ts) copies a packet into the ring,
+    // and returns its position
+    //
+    uint64_t store(uint64_t prev, const uint8_t *data, size_t length, const struct timespec &ts) {
+        size_t len = record_length(length);
+        size_t offset = head % ring.size();
+        if (offset + len > ring.size()) {
+            head += ring.size() - offset;       // wrap around to the start of the ring
+            offset = 0;
+        }
+        record_header hdr{prev, (uint32_t)ts.tv_sec, (uint32_t)(ts.tv_nsec / 1000), (uint32_t)length, 0};
+        memcpy(&ring[offset], &hdr, sizeof(hdr));
+        memcpy(&ring[offset + sizeof(hdr)], data, length);
+        uint64_t position = head;
+        head += len;
+        return position;
+    }
+
+    const record_header *header_at(uint64_t position) const {
+        return (const record_header *)&ring[position % ring.size()];
+    }
+
+    // write_buffered_packets(f, write) writes out the packets of flow
+    // f that are still in the ring, oldest first
+    //
+    template <typename W>
+    void write_buffered_packets(const flow &f, W &write) {
+        chain.clear();
+        for (uint64_t p = f.last; is_intact(p); p = header_at(p)->prev) {
+            chain.push_back(p);
+        }
+        for (auto p = chain.rbegin(); p != chain.rend(); ++p) {
+            const record_header *hdr = header_at(*p);
+            write((const uint8_t *)(hdr + 1), hdr->length, hdr->ts_sec, hdr->ts_usec);
+        }
+    }
+
+    // remove_idle_flows(now) removes the flows that have not had a
+    // packet in the last flow_timeout seconds; it does a full pass
+    // over the flow table at most once every flow_timeout seconds
+    //
+    void remove_idle_flows(uint32_t now) {
+        if (now < next_sweep) {
+            return;
+        }
+        for (auto it = flows.begin(); it != flows.end(); ) {
+            if (it->second.last_seen + flow_timeout < now) {
+                it = flows.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        next_sweep = now + flow_timeout;
+    }
+
+public:
+
+    static constexpr size_t default_ring_size    = 16 * 1024 * 1024;
+    static constexpr size_t default_max_flows    = 65536;
+    static constexpr uint32_t default_flow_timeout = 60;
+
+    flow_capture_buffer(size_t packets_per_flow,
+                        size_t ring_size=default_ring_size,
+                        size_t flows=default_max_flows,
+                        uint32_t timeout=default_flow_timeout) :
+        ring(ring_size),
+        max_packets{packets_per_flow},
+        max_flows{flows},
+        flow_timeout{timeout}
+    {
+        chain.reserve(packets_per_flow);
+    }
+
+    // canonical_key(k) returns the key k with its source and
+    // destination ordered so that both directions of a flow have the
+    // same key
+    //
+    static key canonical_key(const key &k) {
+        bool swap;
+        if (k.ip_vers == 4) {
+            swap = k.addr.ipv4.src > k.addr.ipv4.dst
+                || (k.addr.ipv4.src == k.addr.ipv4.dst && k.src_port > k.dst_port);
+        } else {
+            int cmp = memcmp(&k.addr.ipv6.src, &k.addr.ipv6.dst, sizeof(ipv6_address));
+            swap = cmp > 0 || (cmp == 0 && k.src_port > k.dst_port);
+        }
+        if (!swap) {
+            return k;
+        }
+        if (k.ip_vers == 4) {
+            return key{k.dst_port, k.src_port, k.addr.ipv4.dst, k.addr.ipv4.src, k.protocol};
+        }
+        return key{k.dst_port, k.src_port, k.addr.ipv6.dst, k.addr.ipv6.src, k.protocol};
+    }
+
+    // process(k, data, length, ts, interesting, write) handles a
+    // single packet of the flow with key k; if that packet, or an
+    // earlier one in the same flow, is interesting, then the packet
+    // and any buffered packets are passed to write, which is invoked
+    // as write(data, length, ts_sec, ts_usec).  Packets that are not
+    // part of an IP flow (k.is_zero()) are written only if they are
+    // interesting.
+    //
+    template <typename W>
+    void process(const key &k,
+                 const uint8_t *data,
+                 size_t length,
+                 const struct timespec &ts,
+                 bool interesting,
+                 W write) {
+
+        uint32_t ts_usec = ts.tv_nsec / 1000;
+        if (k.is_zero()) {
+            if (interesting) {
+                write(data, length, ts.tv_sec, ts_usec);
+            }
+            return;
+        }
+        remove_idle_flows(ts.tv_sec);
+
+        auto it = flows.find(canonical_key(k));
+        if (it == flows.end()) {
+            if (flows.size() >= max_flows) {
+                if (interesting) {
+                    write(data, length, ts.tv_sec, ts_usec);
+                }
+                return;
+            }
+            it = flows.emplace(canonical_key(k), flow{no_record, 0, 0, false}).first;
+        }
+        flow &f = it->second;
+        f.last_seen = ts.tv_sec;
+
+        if (f.capturing) {
+            write(data, length, ts.tv_sec, ts_usec);
+
+        } else if (interesting) {
+            write_buffered_packets(f, write);
+            write(data, length, ts.tv_sec, ts_usec);
+            f.capturing = true;
+
+        } else if (f.count < max_packets && record_length(length) <= ring.size() / 4) {
+            f.last = store(f.last, data, length, ts);
+            f.count++;
+        }
+    }
+
+    size_t num_flows() const { return flows.size(); }
+
+    static bool unit_test() {
+        flow_capture_buffer b{2, 1024};
+        uint8_t pkt[100] = { 0, };
+        struct timespec ts{1, 0};
+        std::vector<uint8_t> written;
+        auto write = [&written](const uint8_t *data, size_t, uint32_t, uint32_t) { written.push_back(data[0]); };
+
+        key a{1000, 443, 0x01010101, 0x02020202, 6};
+        key a_reply{443, 1000, 0x02020202, 0x01010101, 6};
+        key c{2000, 443, 0x01010101, 0x02020202, 6};
+
+        // three packets of flow a are seen, only two are buffered
+        //
+        for (uint8_t i = 1; i <= 3; i++) {
+            pkt[0] = i;
+            b.process(a, pkt, sizeof(pkt), ts, false, write);
+        }
+        pkt[0] = 10;
+        b.process(c, pkt, sizeof(pkt), ts, false, write);
+        if (!written.empty() || b.num_flows() != 2) {
+            return false;
+        }
+
+        // a reply packet marks flow a as interesting
+        //
+        pkt[0] = 4;
+        b.process(a_reply, pkt, sizeof(pkt), ts, true, write);
+        pkt[0] = 5;
+        b.process(a, pkt, sizeof(pkt), ts, false, write);
+        if (written != std::vector<uint8_t>{ 1, 2, 4, 5 }) {
+            return false;
+        }
+
+        // packets of flow c are overwritten by those of many other flows
+        //
+        for (uint16_t port = 3000; port < 3010; port++) {
+            b.process(key{port, 443, 0x01010101, 0x02020202, 6}, pkt, sizeof(pkt), ts, false, write);
+        }
+        written.clear();
+        pkt[0] = 11;
+        b.process(c, pkt, sizeof(pkt), ts, true, write);
+        if (written != std::vector<uint8_t>{ 11 }) {
+            return false;
+        }
+
+        // idle flows are removed
+        //
+        ts.tv_sec += 2 * default_flow_timeout;
+        b.process(a, pkt, sizeof(pkt), ts, false, write);
+        return b.num_flows() == 1;
+    }
+
+};
+
+#endif // FLOW_CAPTURE_HPP
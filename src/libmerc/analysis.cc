@@ -19,6 +19,7 @@
 #include "analysis.h"
 #include "utils.h"
 #include "libmerc.h"
+#include "os_identification.hpp"
 
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
@@ -43,10 +44,53 @@ classifier *analysis_init_from_archive(int, //verbosity
         archive_name = DEFAULT_RESOURCE_FILE;
     }
 
+    if (indexed_archive::is_indexed_archive(archive_name)) {
+        indexed_archive archive{archive_name, enc_key};
+        return new classifier(archive, fp_proc_threshold, proc_dst_threshold, report_os);
+    }
     encrypted_compressed_archive archive{archive_name, enc_key}; // TODO: key type
     return new classifier(archive, fp_proc_threshold, proc_dst_threshold, report_os);
 }
 
+classifier *analysis_init_deferred(const char *archive_name,
+                                   const uint8_t *enc_key,
+                                   float fp_proc_threshold,
+                                   float proc_dst_threshold,
+                                   bool report_os,
+                                   double approximate_matching) {
+
+    if (archive_name == nullptr) {
+        archive_name = DEFAULT_RESOURCE_FILE;
+    }
+
+    return new classifier(archive_name, enc_key, fp_proc_threshold, proc_dst_threshold, report_os, approximate_matching);
+}
+
+
+struct os_model *os_identification_init_from_archive(const char *archive_name,
+                                                     const uint8_t *enc_key) {
+
+    if (archive_name == nullptr) {
+        archive_name = DEFAULT_RESOURCE_FILE;
+    }
+
+    os_model *model = new os_model;
+    bool loaded = false;
+    if (indexed_archive::is_indexed_archive(archive_name)) {
+        indexed_archive archive{archive_name, enc_key};
+        loaded = model->load(archive);
+    } else {
+        encrypted_compressed_archive archive{archive_name, enc_key};
+        loaded = model->load(archive);
+    }
+    if (!loaded) {
+        printf_err(log_err, "resource archive %s does not contain an OS identification model\n", archive_name);
+        delete model;
+        return nullptr;
+    }
+    return model;
+}
+
 
 int analysis_finalize(classifier *c) {
 
@@ -128,6 +172,21 @@ uint16_t flow_key_get_dst_port(const struct key &key) {
     return ntoh(key.dst_port);
 }
 
+// flow_key_get_dst_addr(key, dst_addr) copies the destination address
+// of key, in network byte order, into dst_addr, and returns its IP
+// version (4 or 6), or 0 if key has no address
+//
+uint8_t flow_key_get_dst_addr(const struct key &key, uint8_t dst_addr[16]) {
+    if (key.ip_vers == 4) {
+        memcpy(dst_addr, &key.addr.ipv4.dst, 4);
+        return 4;
+    } else if (key.ip_vers == 6) {
+        memcpy(dst_addr, &key.addr.ipv6.dst, 16);
+        return 6;
+    }
+    return 0;
+}
+
 
 std::string get_port_app(uint16_t dst_port) {
     std::unordered_map<uint16_t, std::string> port_mapping = {{443, "https"},  {448,"database"}, {465,"email"},
@@ -18,6 +18,11 @@
 #include "dict.h"
 
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <iterator>
 #include <shared_mutex>
 #include <map>
 #include <list>
@@ -31,7 +36,10 @@
 #include "rapidjson/stringbuffer.h"
 #include "util_obj.h"
 #include "archive.h"
+#include "indexed_archive.hpp"
 #include "watchlist.hpp"
+#include "public_suffix_list.hpp"
+#include "fingerprint_index.hpp"
 
 // TBD - move flow_key_sprintf_src_addr() to the right file
 //
@@ -46,8 +54,26 @@ class classifier *analysis_init_from_archive(int verbosity,
                                float proc_dst_threshold,
                                bool report_os);
 
+// analysis_init_deferred() returns a newly allocated classifier that
+// reads its resource files on first use, or when classifier::warm_up()
+// is called, rather than during initialization
+//
+class classifier *analysis_init_deferred(const char *archive_name,
+                                         const uint8_t *enc_key,
+                                         float fp_proc_threshold,
+                                         float proc_dst_threshold,
+                                         bool report_os,
+                                         double approximate_matching);
+
 int analysis_finalize(classifier *c);
 
+// os_identification_init_from_archive() returns a newly allocated
+// OS identification model read from the resource archive, or nullptr
+// if the archive does not contain one
+//
+struct os_model *os_identification_init_from_archive(const char *archive_name,
+                                                     const uint8_t *enc_key);
+
 
 // process and malware classifier classes
 //
@@ -150,6 +176,7 @@ struct common_data {
     //    std::vector<std::string> tag_names;
     attribute_names attr_name;
     watchlist doh_watchlist;
+    public_suffix_list public_suffixes;
     ssize_t doh_idx = -1;
 };
 
@@ -540,38 +567,30 @@ public:
     }
 #endif
 
-    // get_tld_domain_name() returns the string containing the top two
-    // domains of the input string; that is, given "s3.amazonaws.com",
-    // it returns "amazonaws.com".  If there is only one name, it is
-    // returned.
+    // get_tld_domain_name() returns the registrable domain of the
+    // input string, as determined by the public suffix list in the
+    // resource file; that is, given "www.example.co.uk", it returns
+    // "example.co.uk".  If the resource file has no public suffix
+    // list, it returns the top two domains of the input string; that
+    // is, given "s3.amazonaws.com", it returns "amazonaws.com".  If
+    // there is only one name, it is returned.
     //
-    std::string get_tld_domain_name(const char* server_name) {
-
-        const char *separator = NULL;
-        const char *previous_separator = NULL;
-        const char *c = server_name;
-        while (*c) {
-            if (*c == '.') {
-                if (separator) {
-                    previous_separator = separator;
-                }
-                separator = c;
-            }
-            c++;
-        }
-        if (previous_separator) {
-            previous_separator++;  // increment past '.'
-            return previous_separator;
-        }
-        return server_name;
+    std::string_view get_tld_domain_name(const char* server_name) const {
+        return common->public_suffixes.get_registrable_domain(server_name);
     }
 
+    // perform_analysis() analyzes the destination context of a
+    // fingerprint; if dst_ip_addr is not nullptr, it holds the
+    // destination address in binary form, as in a flow key, which
+    // is used in place of the string dst_ip for watchlist checks
+    //
     struct analysis_result perform_analysis(const char *server_name, const char *dst_ip, uint16_t dst_port,
-                                            const char *user_agent, enum fingerprint_status status) {
+                                            const char *user_agent, enum fingerprint_status status,
+                                            uint8_t dst_ip_vers=0, const uint8_t *dst_ip_addr=nullptr) {
 
         uint32_t asn_int = subnet_data_ptr->get_asn_info(dst_ip);
         uint16_t port_app = remap_port(dst_port);
-        std::string domain = get_tld_domain_name(server_name);
+        std::string domain{get_tld_domain_name(server_name)};
         std::string server_name_str(server_name);
         std::string dst_ip_str(dst_ip);
 
@@ -636,7 +655,10 @@ public:
         // check encrypted dns watchlist
         //
         attribute_result::bitset attr_tags = attr[index_max];
-        if (common->doh_watchlist.contains(server_name) || common->doh_watchlist.contains_addr(dst_ip)) {
+        bool dst_addr_on_watchlist = dst_ip_addr ?
+            common->doh_watchlist.contains_addr(dst_ip_vers, dst_ip_addr) :
+            common->doh_watchlist.contains_addr(dst_ip);
+        if (dst_addr_on_watchlist || common->doh_watchlist.contains_dns_name(server_name)) {
             attr_tags[common->doh_idx] = true;
             attr_prob[common->doh_idx] = 1.0;
         }
@@ -778,6 +800,11 @@ class classifier {
     std::unordered_map<std::string, class fingerprint_data> fpdb;
     fingerprint_prevalence fp_prevalence{100000};
 
+    // approximate matching of fingerprints that are not in fpdb, if
+    // enable_approximate_matching() has been called
+    //
+    std::unique_ptr<approximate_fingerprint_index<class fingerprint_data>> approx_fpdb;
+
     std::string resource_version;  // as reported by VERSION file in resource archive
 
     std::vector<fingerprint_type> fp_types;
@@ -790,6 +817,37 @@ class classifier {
     //
     common_data common;
 
+    // when a classifier is constructed with a deferred constructor,
+    // its resource files are read by a loader thread, which is
+    // started by warm_up() or by the first analysis.  The resources
+    // are loaded in two stages: the core stage holds everything that
+    // is needed to analyze a fingerprint that is in the fingerprint
+    // database, and the complete stage adds the prevalence list and
+    // the approximate matching index, which are needed only for the
+    // fingerprints that are not.  An analysis waits only for the
+    // stage that it needs.  If loading fails, the stage is failed,
+    // and no analysis uses the partially loaded data.
+    //
+    // deferred_report_os is applied as the fingerprint database is
+    // read, as it is by the other constructors: when it is false, the
+    // os_info of the database entries is skipped, and os_dictionary
+    // stays empty.  The OS identification model (os_identification.hpp)
+    // is a separate resource, read only if os-identification is set.
+    //
+    enum class load_stage { none, core, complete, failed };
+
+    std::string archive_name;
+    cryptovar<16> archive_key{(const unsigned char *)nullptr};
+    float deferred_fp_proc_threshold = 0.0;
+    float deferred_proc_dst_threshold = 0.0;
+    bool deferred_report_os = false;
+    double deferred_approximate_matching = 0.0;
+    std::atomic<load_stage> stage{load_stage::complete};
+    std::mutex stage_mutex;
+    std::condition_variable stage_changed;
+    std::once_flag loader_once;
+    std::thread loader_thread;
+
 public:
 
     static fingerprint_type get_fingerprint_type(const std::string &s) {
@@ -1113,6 +1171,117 @@ public:
                float proc_dst_threshold,
                bool report_os) : os_dictionary{}, subnets{}, fpdb{}, resource_version{} {
 
+        init();
+        load(archive, fp_proc_threshold, proc_dst_threshold, report_os);
+    }
+
+    // this constructor reads an indexed archive, in which each
+    // resource file can be read on its own; each of the resource
+    // files updates a different part of the classifier, so they are
+    // read concurrently, each on its own thread
+    //
+    classifier(const indexed_archive &archive,
+               float fp_proc_threshold,
+               float proc_dst_threshold,
+               bool report_os) : os_dictionary{}, subnets{}, fpdb{}, resource_version{} {
+
+        init();
+        load(archive, fp_proc_threshold, proc_dst_threshold, report_os);
+    }
+
+    // this constructor creates a classifier whose resource files are
+    // read on first use, or by a background thread started with
+    // warm_up(), so that a sensor that is not configured to analyze
+    // any fingerprints does not pay for reading them.  The archive is
+    // checked, and the TLS fingerprint format of its fingerprint
+    // database is read, during construction, so that errors in the
+    // archive are still reported at startup, and the fingerprint
+    // format is available before the resources are loaded.
+    //
+    classifier(const char *resource_archive_name,
+               const uint8_t *enc_key,
+               float fp_proc_threshold,
+               float proc_dst_threshold,
+               bool report_os,
+               double approximate_matching) :
+        os_dictionary{},
+        subnets{},
+        fpdb{},
+        resource_version{},
+        archive_name{resource_archive_name},
+        archive_key{enc_key},
+        deferred_fp_proc_threshold{fp_proc_threshold},
+        deferred_proc_dst_threshold{proc_dst_threshold},
+        deferred_report_os{report_os},
+        deferred_approximate_matching{approximate_matching},
+        stage{load_stage::none}
+    {
+        init();
+        if (indexed_archive::is_indexed_archive(resource_archive_name)) {
+            indexed_archive archive{resource_archive_name, enc_key};
+            if (archive.get_members().empty()) {
+                throw std::runtime_error("error: could not read any entries from resource archive file");
+            }
+            const indexed_archive::member_info *info = archive.find("fingerprint_db.json");
+            if (info != nullptr) {
+                auto member = archive.open(*info);
+                tls_fingerprint_format = read_tls_fingerprint_format(*member);
+            }
+        } else {
+            encrypted_compressed_archive archive{resource_archive_name, enc_key};
+            const class archive_node *entry = archive.get_next_entry();
+            if (entry == nullptr) {
+                throw std::runtime_error("error: could not read any entries from resource archive file");
+            }
+            while (entry != nullptr) {
+                if (entry->is_regular_file() && std::string{entry->get_name()} == "fingerprint_db.json") {
+                    tls_fingerprint_format = read_tls_fingerprint_format(archive);
+                    break;
+                }
+                entry = archive.get_next_entry();
+            }
+        }
+    }
+
+    ~classifier() {
+        if (loader_thread.joinable()) {
+            loader_thread.join();
+        }
+    }
+
+    // warm_up() starts the loader thread of a deferred classifier,
+    // so that its resources are likely to be ready by the time that
+    // the first fingerprint is analyzed; it has no effect on a
+    // classifier whose loader has already been started, or that is
+    // not deferred
+    //
+    void warm_up() {
+        if (stage.load(std::memory_order_acquire) == load_stage::none) {
+            std::call_once(loader_once, [this]() { loader_thread = std::thread{[this]() { load_deferred(); }}; });
+        }
+    }
+
+    // ensure_loaded(s) starts the loader thread of a deferred
+    // classifier, if needed, and waits until the resources of stage
+    // s have been loaded; it returns true if they have, and false if
+    // loading failed, in which case the classifier must not be used
+    // for analysis
+    //
+    bool ensure_loaded(load_stage s=load_stage::complete) {
+        load_stage current = stage.load(std::memory_order_acquire);
+        if (current < s) {
+            warm_up();
+            std::unique_lock<std::mutex> lock{stage_mutex};
+            stage_changed.wait(lock, [this, s]() { return stage.load(std::memory_order_acquire) >= s; });
+            current = stage.load(std::memory_order_acquire);
+        }
+        return current != load_stage::failed;
+    }
+
+private:
+
+    void init() {
+
         // reserve attribute for encrypted_dns watchlist
         //
         common.doh_idx = common.attr_name.get_index("encrypted_dns");
@@ -1120,6 +1289,20 @@ public:
         // by default, we expect that tls fingerprints will be present in the resource file
         //
         fp_types.push_back(fingerprint_type_tls);
+    }
+
+    // load(archive, ...) reads the resource files from a tar
+    // archive, in the order in which they appear, and stops once the
+    // required files have been read.  The public suffix list is
+    // optional, and is not waited for, so it is read only if it comes
+    // before the last of the required files, as it does in
+    // resources.tgz; otherwise, the last two labels of a server name
+    // are used as its domain
+    //
+    void load(class encrypted_compressed_archive &archive,
+              float fp_proc_threshold,
+              float proc_dst_threshold,
+              bool report_os) {
 
         bool got_fp_prevalence = false;
         bool got_fp_db = false;
@@ -1132,38 +1315,17 @@ public:
         }
         while (entry != nullptr) {
             if (entry->is_regular_file()) {
-                std::string line_str;
-
                 std::string name = entry->get_name();
-                if (name == "fp_prevalence_tls.txt") {
-                    while (archive.getline(line_str)) {
-                        process_fp_prevalence_line(line_str);
-                    }
-                    got_fp_prevalence = true;
-
-                } else if (name == "fingerprint_db.json") {
-                    while (archive.getline(line_str)) {
-                        process_fp_db_line(line_str, fp_proc_threshold, proc_dst_threshold, report_os);
-                    }
-                    got_fp_db = true;
-
-                } else if (name == "VERSION") {
-                    while (archive.getline(line_str)) {
-                        resource_version += line_str;
-                    }
-                    got_version = true;
-
-                } else if (name == "pyasn.db") {
-                    while (archive.getline(line_str)) {
-                        subnets.process_line(line_str);
+                if (load_resource(name, archive, fp_proc_threshold, proc_dst_threshold, report_os)) {
+                    if (name == "fp_prevalence_tls.txt") {
+                        got_fp_prevalence = true;
+                    } else if (name == "fingerprint_db.json") {
+                        got_fp_db = true;
+                    } else if (name == "VERSION" || name == "pyasn.db") {
+                        got_version = true;
+                    } else if (name == "doh-watchlist.txt") {
+                        got_doh_watchlist = true;
                     }
-                    got_version = true;
-
-                } else if (name == "doh-watchlist.txt") {
-                    while (archive.getline(line_str)) {
-                        common.doh_watchlist.process_line(line_str);
-                    }
-                    got_doh_watchlist = true;
                 }
             }
             if (got_fp_db && got_fp_prevalence && got_version && got_doh_watchlist) {   // TODO: Do we want to require a VERSION file?
@@ -1171,8 +1333,212 @@ public:
             }
             entry = archive.get_next_entry();
         }
+        if (archive.has_error()) {
+            throw std::runtime_error("error: could not read all of the entries of the resource archive file");
+        }
 
         subnets.process_final();
+        common.doh_watchlist.process_final();
+    }
+
+    // set_stage(s) advances the load stage of a deferred classifier
+    // to s, and wakes the threads that are waiting for it; it has no
+    // effect on a classifier that has reached a later stage
+    //
+    void set_stage(load_stage s) {
+        std::lock_guard<std::mutex> lock{stage_mutex};
+        if (stage.load(std::memory_order_relaxed) < s) {
+            stage.store(s, std::memory_order_release);
+            stage_changed.notify_all();
+        }
+    }
+
+    // load(archive, ...) reads the resource files from an indexed
+    // archive, each on its own thread, and advances a deferred
+    // classifier to the core stage as soon as all of the files other
+    // than the prevalence list have been read
+    //
+    void load(const indexed_archive &archive,
+              float fp_proc_threshold,
+              float proc_dst_threshold,
+              bool report_os) {
+
+        if (archive.get_members().empty()) {
+            throw std::runtime_error("error: could not read any entries from resource archive file");
+        }
+
+        static const char *resource_files[] = {
+            "fp_prevalence_tls.txt",      // the only file that is not in the core stage
+            "fingerprint_db.json",
+            "VERSION",
+            "pyasn.db",
+            "doh-watchlist.txt",
+            "public_suffix_list.dat"
+        };
+        std::vector<std::thread> loaders(std::size(resource_files));
+        std::vector<std::exception_ptr> errors(std::size(resource_files));
+        for (size_t i = 0; i < std::size(resource_files); i++) {
+            const indexed_archive::member_info *info = archive.find(resource_files[i]);
+            if (info == nullptr) {
+                continue;
+            }
+            loaders[i] = std::thread{[&, i, info]() {
+                try {
+                    auto member = archive.open(*info);
+                    load_resource(info->name, *member, fp_proc_threshold, proc_dst_threshold, report_os);
+                }
+                catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }};
+        }
+        for (size_t i = 1; i < std::size(resource_files); i++) {
+            if (loaders[i].joinable()) {
+                loaders[i].join();
+            }
+        }
+        bool core_loaded = std::none_of(errors.begin() + 1, errors.end(), [](const std::exception_ptr &e) { return (bool)e; });
+        if (core_loaded) {
+            subnets.process_final();
+            common.doh_watchlist.process_final();
+            set_stage(load_stage::core);
+        }
+        if (loaders[0].joinable()) {
+            loaders[0].join();
+        }
+        for (auto &e : errors) {
+            if (e) {
+                std::rethrow_exception(e);
+            }
+        }
+    }
+
+    // load_deferred() reads the resource files of a deferred
+    // classifier, on the loader thread.  Since the archive was
+    // checked by the constructor, an error here is reported, and
+    // moves the classifier to the failed stage, after which all of
+    // its analyses return fingerprint_status_unanalyzed.  A tar
+    // archive is read in a single pass, so the core stage is reached
+    // only when all of its files have been read.
+    //
+    void load_deferred() {
+        try {
+            if (indexed_archive::is_indexed_archive(archive_name.c_str())) {
+                indexed_archive archive{archive_name.c_str(), archive_key.is_null() ? nullptr : archive_key.value};
+                load(archive, deferred_fp_proc_threshold, deferred_proc_dst_threshold, deferred_report_os);
+            } else {
+                encrypted_compressed_archive archive{archive_name.c_str(), archive_key.is_null() ? nullptr : archive_key.value};
+                load(archive, deferred_fp_proc_threshold, deferred_proc_dst_threshold, deferred_report_os);
+            }
+            set_stage(load_stage::core);
+            if (deferred_approximate_matching > 0.0) {
+                build_approximate_index(deferred_approximate_matching);
+            }
+            printf_err(log_info, "loaded resource archive %s\n", archive_name.c_str());
+            set_stage(load_stage::complete);
+        }
+        catch (std::exception &e) {
+            printf_err(log_err, "could not load resource archive %s (%s); fingerprints will not be analyzed\n", archive_name.c_str(), e.what());
+            set_stage(load_stage::failed);
+        }
+    }
+
+    // read_tls_fingerprint_format(source) returns the format of the
+    // first TLS fingerprint in the fingerprint database read from
+    // source, in the same way as process_fp_db_line()
+    //
+    template <typename line_source>
+    static size_t read_tls_fingerprint_format(line_source &source) {
+        std::string line_str;
+        while (source.getline(line_str)) {
+            rapidjson::Document fp;
+            fp.Parse(line_str.c_str());
+            if (!fp.IsObject() || !fp.HasMember("str_repr") || !fp["str_repr"].IsString()) {
+                continue;
+            }
+            if (fp.HasMember("fp_type") && fp["fp_type"].IsString()
+                && get_fingerprint_type(fp["fp_type"].GetString()) != fingerprint_type_tls) {
+                continue;
+            }
+            std::string fp_string = fp["str_repr"].GetString();
+            if (fp_string.length() == 0 || fp_string.length() >= fingerprint::max_length()) {
+                continue;
+            }
+            if (fp_string.at(0) == '(' || fp_string == "randomized") {
+                fp_string = "tls/" + fp_string;
+            }
+            std::pair<fingerprint_type, size_t> fingerprint_type_and_version = get_fingerprint_type_and_version(fp_string);
+            if (fingerprint_type_and_version.first == fingerprint_type_tls) {
+                return fingerprint_type_and_version.second;
+            }
+        }
+        return 0;
+    }
+
+    void build_approximate_index(double max_relative_distance) {
+        approx_fpdb = std::make_unique<approximate_fingerprint_index<class fingerprint_data>>(max_relative_distance);
+        for (auto &fpdb_entry : fpdb) {
+            approx_fpdb->add(fpdb_entry.first, &fpdb_entry.second);
+        }
+        printf_err(log_info, "approximate fingerprint matching index holds %zu fingerprints\n", approx_fpdb->size());
+    }
+
+public:
+
+    // load_resource(name, source, ...) reads the resource file called
+    // name one line at a time from source, which is either a tar
+    // archive positioned at that file or an indexed archive member,
+    // and returns false if the classifier does not use that file
+    //
+    template <typename line_source>
+    bool load_resource(const std::string &name,
+                       line_source &source,
+                       float fp_proc_threshold,
+                       float proc_dst_threshold,
+                       bool report_os) {
+        std::string line_str;
+        if (name == "fp_prevalence_tls.txt") {
+            while (source.getline(line_str)) {
+                process_fp_prevalence_line(line_str);
+            }
+        } else if (name == "fingerprint_db.json") {
+            while (source.getline(line_str)) {
+                process_fp_db_line(line_str, fp_proc_threshold, proc_dst_threshold, report_os);
+            }
+        } else if (name == "VERSION") {
+            while (source.getline(line_str)) {
+                resource_version += line_str;
+            }
+        } else if (name == "pyasn.db") {
+            while (source.getline(line_str)) {
+                subnets.process_line(line_str);
+            }
+        } else if (name == "doh-watchlist.txt") {
+            while (source.getline(line_str)) {
+                common.doh_watchlist.process_line(line_str);
+            }
+        } else if (name == "public_suffix_list.dat") {
+            while (source.getline(line_str)) {
+                common.public_suffixes.process_line(line_str);
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // enable_approximate_matching(max_relative_distance) builds an
+    // index over the fingerprints in fpdb, so that a fingerprint that
+    // is not in fpdb can be analyzed with the data of its closest
+    // neighbor, if there is one within max_relative_distance (as a
+    // fraction of the number of elements in the fingerprint); the
+    // result then has the status fingerprint_status_approximate
+    //
+    void enable_approximate_matching(double max_relative_distance) {
+        if (!ensure_loaded()) {
+            return;
+        }
+        build_approximate_index(max_relative_distance);
     }
 
 #if 0
@@ -1223,12 +1589,27 @@ public:
     }
 
     struct analysis_result perform_analysis(const char *fp_str, const char *server_name, const char *dst_ip,
-                                            uint16_t dst_port, const char *user_agent) {
+                                            uint16_t dst_port, const char *user_agent,
+                                            uint8_t dst_ip_vers=0, const uint8_t *dst_ip_addr=nullptr) {
+
+        if (!ensure_loaded(load_stage::core)) {
+            return analysis_result(fingerprint_status_unanalyzed);
+        }
 
         // fp_stats.observe(fp_str, server_name, dst_ip, dst_port); // TBD - decide where this call should go
 
         const auto fpdb_entry = fpdb.find(fp_str);
         if (fpdb_entry == fpdb.end()) {
+            if (!ensure_loaded(load_stage::complete)) {
+                return analysis_result(fingerprint_status_unanalyzed);
+            }
+            if (approx_fpdb) {
+                auto nearest = approx_fpdb->find(fp_str);
+                if (nearest.is_valid()) {
+                    fp_prevalence.update(fp_str);
+                    return nearest.value->perform_analysis(server_name, dst_ip, dst_port, user_agent, fingerprint_status_approximate, dst_ip_vers, dst_ip_addr);
+                }
+            }
             if (fp_prevalence.contains(fp_str)) {
                 fp_prevalence.update(fp_str);
                 return analysis_result(fingerprint_status_unlabled);
@@ -1252,12 +1633,12 @@ public:
                     return analysis_result(fingerprint_status_randomized);  // TODO: does this actually happen?
                 }
                 class fingerprint_data &fp_data = fpdb_entry_randomized->second;
-                return fp_data.perform_analysis(server_name, dst_ip, dst_port, user_agent, fingerprint_status_randomized);
+                return fp_data.perform_analysis(server_name, dst_ip, dst_port, user_agent, fingerprint_status_randomized, dst_ip_vers, dst_ip_addr);
             }
         }
         class fingerprint_data &fp_data = fpdb_entry->second;
 
-        return fp_data.perform_analysis(server_name, dst_ip, dst_port, user_agent, fingerprint_status_labeled);
+        return fp_data.perform_analysis(server_name, dst_ip, dst_port, user_agent, fingerprint_status_labeled, dst_ip_vers, dst_ip_addr);
     }
 
     /*
@@ -1274,6 +1655,10 @@ public:
                                  floating_point_type new_port_weight, floating_point_type new_ip_weight,
                                  floating_point_type new_sni_weight, floating_point_type new_ua_weight) {
 
+        if (!ensure_loaded()) {
+            return analysis_result(fingerprint_status_unanalyzed);
+        }
+
         // fp_stats.observe(fp_str, server_name, dst_ip, dst_port); // TBD - decide where this call should go
 
         const auto fpdb_entry = fpdb.find(fp_str);
@@ -1319,15 +1704,19 @@ public:
         if (fp.is_null()) {
             return true;  // no fingerprint to analyze
         }
-        if (std::find(fp_types.begin(), fp_types.end(), fp.get_type()) == fp_types.end()) {
+        if (!ensure_loaded(load_stage::core) || std::find(fp_types.begin(), fp_types.end(), fp.get_type()) == fp_types.end()) {
             result = analysis_result(fingerprint_status_unanalyzed);
-            return true;  // not configured to analyze fingerprints of this type
+            return true;  // not configured to analyze fingerprints of this type, or no resources
         }
-        result = this->perform_analysis(fp.string(), dc.sn_str, dc.dst_ip_str, dc.dst_port, dc.ua_str);
+        result = this->perform_analysis(fp.string(), dc.sn_str, dc.dst_ip_str, dc.dst_port, dc.ua_str,
+                                        dc.dst_ip_vers, dc.dst_ip_vers ? dc.dst_ip_addr : nullptr);
         return true;
     }
 
     const char *get_resource_version() {
+        if (!ensure_loaded(load_stage::core)) {
+            return "";
+        }
         return resource_version.c_str();
     }
 };
@@ -15,7 +15,12 @@
 
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <zlib.h>
 
@@ -333,232 +338,448 @@ public:
 };
 
 
-class gz_file {
-    unsigned char file_buffer[512];
-    std::string remaining_file_buffer; // this buffer is used to cache the extra characters read.
-    ssize_t remaining_file_buffer_len;
-    ssize_t characters_to_read = 512;
-    z_stream_s z = {};
-    encrypted_file enc_file;
+// class block_queue is a bounded, single-producer, single-consumer
+// queue of data blocks, which connects the stages of the gz_file
+// pipeline.  At most capacity blocks are in circulation; the consumer
+// returns each block to the producer through recycle(), so that once
+// the pipeline has filled, no further memory is allocated.
+//
+class block_queue {
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> full;
+    std::vector<std::vector<uint8_t>> empty;
+    size_t capacity;
+    size_t allocated = 0;
+    bool closed = false;      // producer has finished
+    bool failed = false;      // producer encountered an error
+    bool cancelled = false;   // consumer has no further use for blocks
 
 public:
 
-    explicit operator bool() const {
-        return enc_file.is_readable();
-    }
-
-    gz_file(const char *filename, const uint8_t *key) : enc_file{filename, key, nullptr} {
-        //fprintf(stderr, "gz_file::%s\n", __func__);
+    explicit block_queue(size_t capacity) : capacity{capacity} { }
 
-        // fd = open(filename, O_RDONLY, "r");
-        // if (fd == 0) {
-        //     fprintf(stderr, "error: could not open archive file %s\n", filename);
-        //     return;  // error; not reading a compressed archive file
-        // }
-        ssize_t file_buffer_bytes = enc_file.read(file_buffer, sizeof(file_buffer));
-        if (file_buffer_bytes < 0) { // (ssize_t)sizeof(file_buffer)) {
-            printf_err(log_err, "could not read archive file %s (%ld)\n", filename, file_buffer_bytes);
-            return;  // error; not reading a compressed archive file
+    // get_empty_block(block) waits for a block to become available
+    // to the producer and moves it into block, or returns false if
+    // the queue has been cancelled
+    //
+    bool get_empty_block(std::vector<uint8_t> &block) {
+        std::unique_lock lock{m};
+        cv.wait(lock, [this]() { return cancelled || !empty.empty() || allocated < capacity; });
+        if (cancelled) {
+            return false;
         }
-
-        //fprintf(stderr, "read %zd bytes from file\n", file_buffer_bytes);
-        //fprintf(stderr, "file_buffer: '%.*s'\n", (int)file_buffer_bytes, file_buffer);
-        //fprintf_raw_as_hex(stderr, file_buffer, file_buffer_bytes);
-        //fputc('\n', stderr);
-
-        //  set next_in, avail_in, zalloc, zfree and opaque
-        z.next_in = file_buffer;
-        z.avail_in = file_buffer_bytes;
-        z.zalloc = _zalloc;
-        z.zfree = _zfree;
-        z.opaque = nullptr; // ???
-        z.next_out = nullptr;
-        z.avail_out = 0;
-
-        // int err = inflateInit(&z);
-        int err = inflateInit2(&z, MAX_WBITS + 32); // enable automatic header detection; see zlib.h version 1.2.1
-        if (err != Z_OK) {
-            printf_err(log_err, "error in InflateInit (code %d)\n", err);
-            //close(fd);
-            //fd = 0;
+        if (empty.empty()) {
+            allocated++;
+            block = std::vector<uint8_t>{};
+        } else {
+            block = std::move(empty.back());
+            empty.pop_back();
         }
-
-        remaining_file_buffer = "";
-        remaining_file_buffer_len = 0;
+        return true;
     }
 
-    ~gz_file() {
-        int retcode = inflateEnd(&z);
-        if (retcode != Z_OK) {
-            printf_err(log_warning, "error code %d in %s\n", retcode, __func__);
+    void push(std::vector<uint8_t> &&block) {
+        {
+            std::lock_guard lock{m};
+            full.push_back(std::move(block));
         }
+        cv.notify_all();
     }
 
-    // the read() function mimics zlib's gzread()
+    // pop(block) waits for a full block and moves it into block, or
+    // returns false if the producer has finished and all blocks have
+    // been consumed
     //
-    ssize_t read(uint8_t *buffer, size_t len) {
-        //fprintf(stderr, "gz_file::%s\n", __func__);
-        //fprintf(stderr, "\tavail_in: %u\tavail_out: %u\n", z.avail_in, z.avail_out);
-        if (buffer == nullptr || len == 0) {
-            return 0;  // error, or no work needed
+    bool pop(std::vector<uint8_t> &block) {
+        std::unique_lock lock{m};
+        cv.wait(lock, [this]() { return closed || cancelled || !full.empty(); });
+        if (full.empty()) {
+            return false;
         }
-        z.next_out = buffer;
-        z.avail_out = len;
-        while (z.avail_out > 0) {
-
-            if (z.avail_in == 0) {
-                ssize_t file_buffer_bytes = enc_file.read(file_buffer, sizeof(file_buffer));
-                if (file_buffer_bytes < 0) { // (ssize_t)sizeof(file_buffer)) {
-                    printf_err(log_err, "could not read archive file (%ld)\n", file_buffer_bytes);
-                    return -1;  // error
-                }
-                z.next_in = file_buffer;
-                z.avail_in = file_buffer_bytes;
-            }
-
-            //fprintf(stderr, "\tavail_in: %u\tavail_out: %u\n", z.avail_in, z.avail_out);
-
-            int err = inflate(&z, Z_NO_FLUSH);
-            //if (err) { fprintf(stderr, "\tgot error code %d (message: %s)\n", err, z.msg); }
-            if (err == Z_STREAM_END) {
-                //fprintf(stderr, "\tgot Z_STREAM_END\n");
-                return len - z.avail_out;
-            }
-            if (err != Z_OK) {
-                //fprintf(stderr, "\terror: could not initialize zlib decompressor\n");
-                return len - z.avail_out;
-            }
+        block = std::move(full.front());
+        full.pop_front();
+        return true;
+    }
 
-            // dump buffer
-            //fprintf(stdout, "buffer:      '%.*s'\n", z.avail_out, buffer);
-            //fprintf_raw_as_hex(stderr, buffer, z.avail_out);
-            //fputc('\n', stderr);
+    void recycle(std::vector<uint8_t> &&block) {
+        {
+            std::lock_guard lock{m};
+            empty.push_back(std::move(block));
+        }
+        cv.notify_all();
+    }
 
+    void close(bool error=false) {
+        {
+            std::lock_guard lock{m};
+            closed = true;
+            failed |= error;
         }
+        cv.notify_all();
+    }
 
-        //fprintf(stderr, "\tread %zd bytes (%zu requested)\n", len - z.avail_out, len);
-        //fprintf(stderr, "\tavail_in: %u\tavail_out: %u\n", z.avail_in, z.avail_out);
-        return len - z.avail_out;
+    void cancel() {
+        {
+            std::lock_guard lock{m};
+            cancelled = true;
+        }
+        cv.notify_all();
     }
 
-    ssize_t tell() {
-        //fprintf(stderr, "gz_file::%s\n", __func__);
-        return z.total_out;
+    bool has_failed() const {
+        std::lock_guard lock{m};
+        return failed;
     }
+};
 
-    ssize_t seek(size_t location) {
-        uint8_t tmp_buf[512];
 
-        //fprintf(stderr, "gz_file::%s\n", __func__);
+// class gz_file reads a gzip-compressed file that may be encrypted
+// (see encrypted_file).  A large file is read through a pipeline of
+// three stages, each on its own thread: one thread reads and decrypts
+// the file in large blocks, another inflates the plaintext into large
+// blocks, and the thread that owns the gz_file consumes the inflated
+// data through read(), seek(), and getline().  The stages are
+// connected by bounded block_queues, so that memory use is fixed,
+// and the time needed to read a file is that of the slowest stage
+// rather than the sum of all of them.
+//
+// A file (or segment) with less than pipeline_threshold bytes of
+// compressed data is instead read and inflated on demand, in small
+// blocks, by the thread that owns the gz_file, since the pipeline
+// would not save much time, and many small files, such as the
+// members of an indexed_archive, might be open at once.
+//
+class gz_file {
+    static constexpr size_t block_size = 1 << 20;
+    static constexpr size_t blocks_in_flight = 4;
+    static constexpr size_t small_block_size = 1 << 16;
 
-        size_t jump_len = location - z.total_out;
-        //fprintf(stderr, "\tseeking to location %zu, which is %zd bytes ahead\n", location, jump_len);
+public:
 
-        //size_t init = z.total_out;
-        while (z.total_out < location) {
-            z.next_out = tmp_buf;
-            jump_len = location - z.total_out;
-            z.avail_out = jump_len > sizeof(tmp_buf) ? sizeof(tmp_buf) : jump_len;
+    static constexpr size_t pipeline_threshold = 2 * block_size;
 
-            if (z.avail_in == 0) {
-                ssize_t file_buffer_bytes = enc_file.read(file_buffer, sizeof(file_buffer));
-                if (file_buffer_bytes < 0) { // (ssize_t)sizeof(file_buffer)) {
-                    printf_err(log_err, "could not read archive file (%ld)\n", file_buffer_bytes);
-                    return -1;  // error
-                }
+private:
 
-                z.next_in = file_buffer;
-                z.avail_in = file_buffer_bytes;
+    encrypted_file enc_file;
+    bool readable;                   // file was readable when opened
+    bool pipelined;
+    block_queue plaintext{blocks_in_flight};
+    block_queue inflated{blocks_in_flight};
+    std::thread decrypt_thread;
+    std::thread inflate_thread;
+
+    z_stream_s z = {};               // owned by inflate_thread, if pipelined
+    bool z_initialized = false;
+    std::vector<uint8_t> in;         // compressed data being inflated
+
+    enum class inflate_status { more, done, failed };
+    inflate_status status = inflate_status::more;  // of on-demand inflation
+
+    std::vector<uint8_t> block;      // inflated data being consumed
+    size_t block_offset = 0;         // position of next unread byte in block
+    bool holding_block = false;      // block was obtained from inflated
+    bool end_of_stream = false;
+    size_t total_out = 0;            // number of inflated bytes consumed
+    std::string line_buffer;         // holds lines that span blocks
+
+    // decrypt() runs on decrypt_thread, and feeds the plaintext queue
+    //
+    void decrypt() {
+        std::vector<uint8_t> buf;
+        while (plaintext.get_empty_block(buf)) {
+            buf.resize(block_size);
+            ssize_t bytes_read = enc_file.read(buf.data(), block_size);
+            if (bytes_read < 0) {
+                printf_err(log_err, "could not read archive file (%zd)\n", bytes_read);
+                plaintext.close(true);
+                return;
             }
+            if (bytes_read == 0) {
+                plaintext.recycle(std::move(buf));
+                break;
+            }
+            buf.resize(bytes_read);
+            plaintext.push(std::move(buf));
+        }
+        plaintext.close();
+    }
 
-            //fprintf(stderr, "\tavail_in: %u\tavail_out: %u\n", z.avail_in, z.avail_out);
+    bool init_stream() {
+        z.zalloc = _zalloc;
+        z.zfree = _zfree;
+        z.opaque = nullptr;
+        int err = inflateInit2(&z, MAX_WBITS + 32); // enable automatic header detection; see zlib.h version 1.2.1
+        if (err != Z_OK) {
+            printf_err(log_err, "error in InflateInit (code %d)\n", err);
+            return false;
+        }
+        z_initialized = true;
+        return true;
+    }
 
+    // inflate_block(out, length, get_input) inflates up to length
+    // bytes into out, which is resized to hold the bytes inflated.
+    // Compressed data is obtained by calling get_input(in), which
+    // returns the number of bytes that it put into in, zero at the
+    // end of the file, or a negative number on error.
+    //
+    template <typename F>
+    inflate_status inflate_block(std::vector<uint8_t> &out, size_t length, F get_input) {
+        inflate_status result = inflate_status::more;
+        out.resize(length);
+        z.next_out = out.data();
+        z.avail_out = length;
+        while (z.avail_out > 0) {
+            if (z.avail_in == 0) {
+                ssize_t bytes_read = get_input(in);
+                if (bytes_read <= 0) {
+                    // a truncated stream is not treated as an error
+                    result = bytes_read < 0 ? inflate_status::failed : inflate_status::done;
+                    break;
+                }
+                z.next_in = in.data();
+                z.avail_in = bytes_read;
+            }
             int err = inflate(&z, Z_NO_FLUSH);
             if (err == Z_STREAM_END) {
-                return z.total_out;
+                result = inflate_status::done;
+                break;
             }
-            //if (err) { fprintf(stderr, "got error code %d (message: %s)\n", err, z.msg); }
-            if (err != Z_OK) {
-                printf_err(log_err, "zlib decompressor failed\n");
-                return -1;
+            if (err != Z_OK && err != Z_BUF_ERROR) {
+                printf_err(log_err, "zlib decompressor failed (code %d)\n", err);
+                result = inflate_status::failed;
+                break;
             }
-            // dump buffer
-            //fprintf(stderr, "\tbuffer: (%d bytes) '%.*s'\n", z.avail_out, z.avail_out, tmp_buf);
-            //fprintf_raw_as_hex(stderr, tmp_buf, z.avail_out);
-            //fputc('\n', stderr);
+        }
+        out.resize(length - z.avail_out);
+        return result;
+    }
 
-            //fprintf(stderr, "\tlocation - z.total_out: %zd\n", location - z.total_out);
-            //fprintf(stderr, "\tseek advanced %zd bytes to location %zu\n", z.total_out-init, location);
-            //fprintf(stderr, "\tavail_in: %u\tavail_out: %u\n", z.avail_in, z.avail_out);
+    // inflate_stream() runs on inflate_thread; it consumes the
+    // plaintext queue and feeds the inflated queue
+    //
+    void inflate_stream() {
+        if (!init_stream()) {
+            plaintext.cancel();
+            inflated.close(true);
+            return;
+        }
+        auto get_input = [this](std::vector<uint8_t> &buf) -> ssize_t {
+            if (buf.capacity() > 0) {
+                plaintext.recycle(std::move(buf));
+            }
+            if (!plaintext.pop(buf)) {
+                return plaintext.has_failed() ? -1 : 0;
+            }
+            return buf.size();
+        };
+        inflate_status result = inflate_status::more;
+        std::vector<uint8_t> out;
+        while (result == inflate_status::more && inflated.get_empty_block(out)) {
+            result = inflate_block(out, block_size, get_input);
+            if (out.empty()) {
+                inflated.recycle(std::move(out));
+            } else {
+                inflated.push(std::move(out));
+            }
         }
-        return z.total_out;
+        inflateEnd(&z);
+        z_initialized = false;
+        plaintext.cancel();   // the decrypt thread may still be waiting for a block
+        inflated.close(result == inflate_status::failed);
     }
 
-    // getline read the characters until \n is found
-    // and returns the length of characters in current line
-    ssize_t getline(std::string &s, ssize_t read_len) {
-        s.clear();
-        ssize_t characters_in_s = 0;
-        int i;
-        bool newline_found = false;
+    // inflate_on_demand() sets block to the next block of inflated
+    // data, which is read and inflated by the calling thread, and
+    // returns false if there is no more data
+    //
+    bool inflate_on_demand() {
+        auto get_input = [this](std::vector<uint8_t> &buf) -> ssize_t {
+            buf.resize(small_block_size);
+            ssize_t bytes_read = enc_file.read(buf.data(), buf.size());
+            if (bytes_read < 0) {
+                printf_err(log_err, "could not read archive file (%zd)\n", bytes_read);
+                return -1;
+            }
+            buf.resize(bytes_read);
+            return bytes_read;
+        };
+        block.clear();
+        while (block.empty() && status == inflate_status::more) {
+            status = inflate_block(block, small_block_size, get_input);
+        }
+        return !block.empty();
+    }
 
-        std::string backup = remaining_file_buffer; // backup remaining_file_buffer
-        ssize_t backup_len = remaining_file_buffer_len;
+    bool has_failed() const {
+        return pipelined ? inflated.has_failed() : status == inflate_status::failed;
+    }
 
-        remaining_file_buffer = ""; // reset remaining_file_buffer
-        remaining_file_buffer_len = 0;
+    size_t bytes_available() const { return block.size() - block_offset; }
 
-        // processing the remaining characters from last read()
-        for (i = 0; i < backup_len; i++) {
-            if (backup[i] == '\n') { // backup string had an entire line
-                newline_found = true;
-                break;
+    // next_block() discards the current block of inflated data and
+    // waits for the next one; it returns false at the end of the
+    // stream
+    //
+    bool next_block() {
+        if (end_of_stream) {
+            return false;
+        }
+        if (!pipelined) {
+            holding_block = inflate_on_demand();
+        } else {
+            if (holding_block) {
+                inflated.recycle(std::move(block));
             }
-            s += backup[i];
-            characters_in_s += 1;
+            holding_block = inflated.pop(block);
         }
-
-        if (newline_found && characters_in_s != 0) {
-            i += 1; // skip \n
-            remaining_file_buffer.assign(backup, i); // update remaining_file_buffer
-            remaining_file_buffer_len = backup_len - i;
-            return characters_in_s;
+        block_offset = 0;
+        if (!holding_block) {
+            block.clear();
+            end_of_stream = true;
         }
+        return holding_block;
+    }
 
-        ssize_t characters_read_in_this_iteration = 0;
-        while (characters_read_in_this_iteration < read_len) {
+    void advance(size_t n) {
+        block_offset += n;
+        total_out += n;
+    }
 
-            if (characters_to_read > read_len - characters_read_in_this_iteration) {
-                characters_to_read = read_len - characters_read_in_this_iteration;
+public:
+
+    // operator bool() returns true if the file is readable, that is,
+    // if it could be opened, and no error has occurred in reading it
+    //
+    explicit operator bool() const {
+        return readable && !has_failed();
+    }
+
+    // the optional offset and length select a segment of the file
+    // that holds the compressed data (see encrypted_file)
+    //
+    gz_file(const char *filename, const uint8_t *key, size_t offset=0, size_t length=SIZE_MAX) :
+        enc_file{filename, key, nullptr, offset, length},
+        readable{enc_file.is_readable()},
+        pipelined{enc_file.get_bytes_remaining() >= pipeline_threshold}
+    {
+        if (!pipelined) {
+            if (!init_stream()) {
+                status = inflate_status::failed;
             }
+            return;
+        }
+        decrypt_thread = std::thread{[this]() { decrypt(); }};
+        inflate_thread = std::thread{[this]() { inflate_stream(); }};
+    }
 
-            char c[characters_to_read+1] = "";
-            ssize_t characters_read = read((uint8_t *)&c, characters_to_read);
-            characters_read_in_this_iteration += characters_read;
-            c[characters_to_read] = '\0';
-            if (characters_read <= 0) {
+    ~gz_file() {
+        if (pipelined) {
+            inflated.cancel();
+            plaintext.cancel();
+            inflate_thread.join();
+            decrypt_thread.join();
+        }
+        if (z_initialized) {
+            inflateEnd(&z);
+        }
+    }
+
+    bool is_pipelined() const { return pipelined; }
+
+    // the read() function mimics zlib's gzread()
+    //
+    ssize_t read(uint8_t *buffer, size_t len) {
+        if (buffer == nullptr || len == 0) {
+            return 0;  // error, or no work needed
+        }
+        size_t bytes_copied = 0;
+        while (bytes_copied < len) {
+            if (bytes_available() == 0 && !next_block()) {
+                if (has_failed()) {
+                    return -1;
+                }
                 break;
             }
+            size_t n = std::min(len - bytes_copied, bytes_available());
+            memcpy(buffer + bytes_copied, block.data() + block_offset, n);
+            advance(n);
+            bytes_copied += n;
+        }
+        return bytes_copied;
+    }
 
-            newline_found = false;
-            for (i = 0; i < characters_read; i++) {
-                if (c[i] == '\n') {
-                    newline_found = true;
-                    break;
+    ssize_t tell() {
+        return total_out;
+    }
+
+    // seek(location) advances the stream to location, which must not
+    // precede the current position
+    //
+    ssize_t seek(size_t location) {
+        if (location < total_out) {
+            printf_err(log_err, "cannot seek backwards in compressed file\n");
+            return -1;
+        }
+        while (total_out < location) {
+            if (bytes_available() == 0 && !next_block()) {
+                if (has_failed()) {
+                    printf_err(log_err, "zlib decompressor failed\n");
+                    return -1;
                 }
-                s += c[i];
-                characters_in_s += 1;
+                break;
             }
+            advance(std::min(location - total_out, bytes_available()));
+        }
+        return total_out;
+    }
 
-            if (newline_found) {
-                i += 1; // skip \n
-
-                remaining_file_buffer.assign(c+i); // update remaining_file_buffer
-                remaining_file_buffer_len = characters_read-i;
+    // getline(line, read_len) sets line to the characters before the
+    // next newline, reading at most read_len characters, and returns
+    // the length of the line.  The newline is consumed, but is not
+    // included in line.  The view refers to the inflated data, if the
+    // line lies within a single block, and to an internal buffer
+    // otherwise; in either case, it is valid only until the next call
+    // to a member function.
+    //
+    ssize_t getline(std::string_view &line, ssize_t read_len) {
+        line = std::string_view{};
+        line_buffer.clear();
+        bool spans_blocks = false;
+        size_t remaining = read_len > 0 ? read_len : 0;
+        while (remaining > 0) {
+            if (bytes_available() == 0 && !next_block()) {
                 break;
             }
+            size_t n = std::min(remaining, bytes_available());
+            const char *start = (const char *)block.data() + block_offset;
+            const char *newline = (const char *)memchr(start, '\n', n);
+            if (newline != nullptr) {
+                size_t length = newline - start;
+                if (spans_blocks) {
+                    line_buffer.append(start, length);
+                    line = line_buffer;
+                } else {
+                    line = std::string_view{start, length};
+                }
+                advance(length + 1);  // skip newline
+                return line.length();
+            }
+            line_buffer.append(start, n);
+            spans_blocks = true;
+            advance(n);
+            remaining -= n;
         }
-        return characters_in_s;
+        line = line_buffer;
+        return line.length();
+    }
+
+    ssize_t getline(std::string &s, ssize_t read_len) {
+        std::string_view line;
+        getline(line, read_len);
+        s.assign(line);
+        return s.length();
     }
 };
 
@@ -569,6 +790,7 @@ private:
     unsigned char buffer[512];
     ssize_t next_entry;
     ssize_t end_of_file;
+    bool read_error = false;
 
 public:
 
@@ -583,6 +805,12 @@ public:
 
     ssize_t next_entry_value() const { return next_entry; }
 
+    // has_error() returns true if get_next_entry() returned nullptr
+    // because the archive could not be read, rather than because its
+    // end was reached
+    //
+    bool has_error() const { return read_error; }
+
     encrypted_compressed_archive(const char *filename, const uint8_t *dec_key=nullptr) : gz{filename, dec_key}, entry{nullptr}, next_entry{0}, end_of_file{0} {
         //fprintf(stderr, "encrypted_compressed_archive::%s\n", __func__);
     }
@@ -603,6 +831,7 @@ public:
             // advance to next block
             if (gz.seek(next_entry) == -1) {
                 printf_err(log_err, "could not advance %zu bytes in archive file\n", entry->get_size());
+                read_error = true;
                 return nullptr;
             }
         }
@@ -616,6 +845,7 @@ public:
         ssize_t bytes_read = gz.read(buffer, sizeof(buffer));
         if (bytes_read != (ssize_t)sizeof(buffer)) {
             printf_err(log_err, "attempt to read %zu bytes from archive file failed\n", sizeof(buffer));
+            read_error = true;
             return nullptr;
         }
         entry = (class archive_node *)buffer;
@@ -626,6 +856,7 @@ public:
             printf_err(log_err, "archive entry is not valid\n");
             //fprintf_raw_as_hex(stderr, buffer, sizeof(buffer));
             //entry->print_all_fields(stderr);
+            read_error = true;
             return nullptr;
         }
         next_entry = entry->bytes_until_next_block() + gz.tell();
@@ -641,6 +872,25 @@ public:
         return gz.getline(s, end_of_file - gz.tell());
 
     }
+
+    // getline(line) sets line to a view of the next line of the
+    // current entry, which is valid until the next call to a member
+    // function, and returns its length
+    //
+    ssize_t getline(std::string_view &line) {
+        return gz.getline(line, end_of_file - gz.tell());
+    }
+
+    // read(buffer, len) reads up to len bytes of the current entry
+    // into buffer, and returns the number of bytes read
+    //
+    ssize_t read(uint8_t *buffer, size_t len) {
+        ssize_t remaining = end_of_file - gz.tell();
+        if (remaining <= 0) {
+            return 0;
+        }
+        return gz.read(buffer, std::min(len, (size_t)remaining));
+    }
 };
 
 
@@ -0,0 +1,62 @@
+// bit_parallel.hpp
+//
+// the column step of Myers' bit-vector edit distance algorithm
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef BIT_PARALLEL_HPP
+#define BIT_PARALLEL_HPP
+
+#include <cstdint>
+
+namespace bit_parallel {
+
+    // myers_step(pv, mv, eq, h_in_pos, h_in_neg, ph, mh) computes
+    // the next column of one block of the edit distance matrix, in
+    // the block-based form of Myers' algorithm given by Hyyro.  The
+    // vertical differences of the block are held in pv (+1) and mv
+    // (-1), eq has a bit set for each row whose pattern element
+    // matches the current text element, and h_in_pos and h_in_neg are
+    // one if the horizontal difference entering the first row of the
+    // block is +1 or -1, respectively, and zero otherwise.  On
+    // return, pv and mv hold the vertical differences of the new
+    // column, and ph and mh hold its horizontal differences, so that
+    // the caller can read the difference leaving the last row.
+    //
+    // W is uint64_t, or a GCC vector of them, in which case each lane
+    // holds a separate block.
+    //
+    template <typename W>
+    static inline void myers_step(W &pv, W &mv, W eq, W h_in_pos, W h_in_neg, W &ph, W &mh) {
+        W xv = eq | mv;
+        eq |= h_in_neg;
+        W xh = (((eq & pv) + pv) ^ pv) | eq;
+        ph = mv | ~(xh | pv);
+        mh = pv & xh;
+        W ph_shifted = (ph << 1) | h_in_pos;
+        W mh_shifted = (mh << 1) | h_in_neg;
+        pv = mh_shifted | ~(xv | ph_shifted);
+        mv = ph_shifted & xv;
+    }
+
+    // advance_block(pv, mv, eq, h_in, high_bit) applies myers_step()
+    // to a single 64-bit block, with the horizontal difference h_in
+    // (-1, 0, or +1) entering its first row, and returns the
+    // horizontal difference leaving the row whose bit is high_bit
+    //
+    static inline int advance_block(uint64_t &pv, uint64_t &mv, uint64_t eq, int h_in, uint64_t high_bit) {
+        uint64_t ph, mh;
+        myers_step<uint64_t>(pv, mv, eq, h_in > 0, h_in < 0, ph, mh);
+        if (ph & high_bit) {
+            return 1;
+        }
+        if (mh & high_bit) {
+            return -1;
+        }
+        return 0;
+    }
+
+} // namespace bit_parallel
+
+#endif // BIT_PARALLEL_HPP
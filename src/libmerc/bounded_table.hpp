@@ -0,0 +1,103 @@
+// bounded_table.hpp
+//
+// a hash table that holds at most a fixed number of entries, and
+// discards the oldest one to make room for a new one
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef BOUNDED_TABLE_HPP
+#define BOUNDED_TABLE_HPP
+
+#include <cstddef>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+// class bounded_table<K, V, H> maps keys of type K to values of type
+// V, like std::unordered_map, but holds at most max_entries entries.
+// When a key is inserted into a full table, the entry that was
+// inserted first is removed to make room for it; the caller can
+// provide a function that is passed each entry removed in that way,
+// so that it can be reported or moved elsewhere rather than lost.
+//
+// The order in which entries were inserted is kept in a deque, so
+// that insertion and eviction take constant time.  Erasing an entry
+// other than the oldest takes time proportional to the number of
+// entries, which is acceptable for the small tables of pending
+// messages that erase entries as they complete.
+//
+template <typename K, typename V, typename H=std::hash<K>>
+class bounded_table {
+    std::unordered_map<K, V, H> table;
+    std::deque<K> order;                  // keys in table, oldest first
+    size_t max_entries;
+
+public:
+
+    using iterator = typename std::unordered_map<K, V, H>::iterator;
+    using const_iterator = typename std::unordered_map<K, V, H>::const_iterator;
+
+    explicit bounded_table(size_t max) : max_entries{max} { }
+
+    iterator find(const K &k) { return table.find(k); }
+
+    const_iterator find(const K &k) const { return table.find(k); }
+
+    iterator end() { return table.end(); }
+
+    const_iterator end() const { return table.end(); }
+
+    // find_or_insert(k, evict) returns an iterator to the entry with
+    // key k, after inserting one with a value-initialized V if there
+    // is none.  If the table is full when an entry is inserted, its
+    // oldest entry is first removed and passed to evict(key, value),
+    // where value is an rvalue reference
+    //
+    template <typename F>
+    iterator find_or_insert(const K &k, F evict) {
+        auto it = table.find(k);
+        if (it != table.end()) {
+            return it;
+        }
+        if (table.size() >= max_entries && !order.empty()) {
+            auto oldest = table.find(order.front());
+            evict(oldest->first, std::move(oldest->second));
+            table.erase(oldest);
+            order.pop_front();
+        }
+        order.push_back(k);
+        return table.emplace(k, V{}).first;
+    }
+
+    iterator find_or_insert(const K &k) {
+        return find_or_insert(k, [](const K &, V &&) { });
+    }
+
+    // erase(it) removes the entry at it from the table
+    //
+    void erase(iterator it) {
+        order.erase(std::find(order.begin(), order.end(), it->first));
+        table.erase(it);
+    }
+
+    // remove_all(f) passes each entry, oldest first, to f(key, value),
+    // where value is an rvalue reference, and then empties the table
+    //
+    template <typename F>
+    void remove_all(F f) {
+        for (const auto &k : order) {
+            auto it = table.find(k);
+            f(it->first, std::move(it->second));
+        }
+        table.clear();
+        order.clear();
+    }
+
+    bool empty() const { return table.empty(); }
+
+    size_t size() const { return table.size(); }
+
+};
+
+#endif // BOUNDED_TABLE_HPP
@@ -18,8 +18,6 @@
 #include <openssl/evp.h>
 #include <openssl/err.h>
 
-#define pt_buf_len 2048
-
 class crypto_engine {
 
     EVP_CIPHER_CTX *gcm_ctx = nullptr;
@@ -77,6 +75,10 @@ public:
     // https://github.com/majek/openssl/blob/master/doc/crypto/EVP_EncryptInit.pod and
     // https://wiki.openssl.org/index.php/EVP_Authenticated_Encryption_and_Decryption
     //
+    // The whole ciphertext is decrypted, so the plaintext buffer must
+    // hold at least ciphertext_len - 16 bytes; plaintext may be the
+    // same as ciphertext, to decrypt in place.
+    //
     int gcm_decrypt(const uint8_t *ad,
                     unsigned int ad_len,
                     const unsigned char *ciphertext,
@@ -88,10 +90,6 @@ public:
         int len;
         int plaintext_len;
 
-        // trim ciphertext length so that plaintext length fits in buffer, if needed
-        //
-        ciphertext_len = (ciphertext_len < pt_buf_len) ? ciphertext_len : pt_buf_len;
-
         static constexpr size_t tag_len = 16;
 
         ciphertext_len -= tag_len;  // final 16 bytes of ciphertext is auth tag
@@ -115,8 +113,6 @@ public:
 
         // decrypt ciphertext into plaintext buffer
         //
-        // TODO: move length bound check here
-        //
         if(!EVP_DecryptUpdate(gcm_ctx, plaintext, &len, ciphertext, ciphertext_len)) {
             return -1;
         }
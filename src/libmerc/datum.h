@@ -1106,7 +1106,7 @@ template <size_t T> struct data_buffer : public writeable {
     /// reset this `data_buffer` so that the writeable part contains
     /// `T` bytes and the readable part is empty (zero length)
     ///
-    void reset() { data = buffer; }
+    void reset() { data = buffer; data_end = buffer + T; }
 
     /// returns true if the readable part is not empty
     ///
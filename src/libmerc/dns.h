@@ -732,6 +732,7 @@ struct dns_packet : public base_protocol {
     uint16_t qdcount, ancount, nscount, arcount;
     static const uint16_t max_count = 256;
     bool is_netbios;
+    size_t message_length = 0;   // from the length field, over TCP
 
     dns_packet(struct datum &d) : header{NULL}, records{NULL, NULL}, length{0}, is_netbios{false} {
         parse(d);
@@ -813,6 +814,23 @@ struct dns_packet : public base_protocol {
         return is_netbios;
     }
 
+    // set_message_length(len) records the length of a DNS over TCP
+    // message, from the two-byte length field that precedes it
+    //
+    void set_message_length(size_t len) { message_length = len; }
+
+    // bytes_needed() returns the number of bytes of a DNS over TCP
+    // message that were not present.  The length field is trusted
+    // only if the header and the questions that were present are
+    // valid, since the TCP matcher also matches some other TCP data.
+    //
+    size_t bytes_needed() const {
+        if (header == nullptr || message_length <= length) {
+            return 0;
+        }
+        return message_length - length;
+    }
+
     void write_json(struct json_object &o) const {
         if (header == NULL) {
             return;
@@ -9,9 +9,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdexcept>
+#include <vector>
+#include <algorithm>
 
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <openssl/evp.h>
 
@@ -83,10 +86,17 @@ class encrypted_file {
     cryptovar<16> iv;
     EVP_CIPHER_CTX *ctx;
 
-    unsigned char ct_buffer[512] = { 0, };     // ciphertext
-    unsigned char pt_buffer[512+16] = { 0, };  // plaintext
+    // the buffers are large, so that each call to fread() and
+    // EVP_DecryptUpdate() processes a lot of data; the plaintext
+    // buffer has room for the extra block that decryption can output
+    //
+    static constexpr size_t buffer_size = 1 << 20;
+    std::vector<unsigned char> ct_buffer;   // ciphertext
+    std::vector<unsigned char> pt_buffer;   // plaintext
     ssize_t bytes_in_ct_buffer = 0;
     ssize_t bytes_in_pt_buffer = 0;
+    ssize_t pt_offset = 0;                  // position of next unread plaintext byte
+    size_t bytes_remaining;                 // number of bytes of the file left to read
     bool err;
 
     // the function fill_pt_buffer() reads ciphertext data from the
@@ -106,18 +116,19 @@ class encrypted_file {
             if (file == nullptr) {
                 return true;    // no file to read from
             }
-            ssize_t bytes_read = fread(ct_buffer, sizeof(unsigned char), sizeof(ct_buffer), file);
+            ssize_t bytes_read = fread(ct_buffer.data(), sizeof(unsigned char), std::min(ct_buffer.size(), bytes_remaining), file);
             if (bytes_read < 0) {
                 printf_err(log_err, "could not read data from file\n");
                 return true;    // could not read ciphertext from file
             }
             //fprintf(stderr, "read %zd bytes of ciphertext from file\n", bytes_read);
             bytes_in_ct_buffer = bytes_read;
+            bytes_remaining -= bytes_read;
         }
 
         // decrypt ciphertext buffer into plaintext buffer
         //
-        int retval = decrypt_update(ct_buffer, bytes_in_ct_buffer, pt_buffer);
+        int retval = decrypt_update(ct_buffer.data(), bytes_in_ct_buffer, pt_buffer.data());
         if (retval < 0) {
             err = true;
             return true;  // error in decrypt_update
@@ -125,10 +136,11 @@ class encrypted_file {
         if (retval == 0) {
             // at end of ciphertext, time to finalize
             //
-            retval = decrypt_final(pt_buffer);
+            retval = decrypt_final(pt_buffer.data());
             no_more_ciphertext = true;
         }
         bytes_in_pt_buffer = retval;
+        pt_offset = 0;
         bytes_in_ct_buffer = 0;  // indicate that ciphertext buffer is empty
         //fprintf(stderr, "%s: bytes_in_pt_buffer: %d\n", __func__, retval);
 
@@ -182,9 +194,20 @@ public:
 
     FILE * get_file() const { return file; }
 
+    // get_bytes_remaining() returns the number of bytes of the file,
+    // or of its segment, that have not yet been read from it
+    //
+    size_t get_bytes_remaining() const { return bytes_remaining; }
+
+    // if offset or length are provided, only the length bytes
+    // starting at offset are read from the file, which allows an
+    // encrypted_file to be a segment of a larger file
+    //
     encrypted_file(const char *filename,
                    const unsigned char *key_in,
-                   const unsigned char *iv_in) : file{nullptr}, key{key_in}, iv{iv_in}, ctx{nullptr}, err{false} {
+                   const unsigned char *iv_in,
+                   size_t offset=0,
+                   size_t length=SIZE_MAX) : file{nullptr}, key{key_in}, iv{iv_in}, ctx{nullptr}, bytes_remaining{length}, err{false} {
 
 
         file = fopen(filename, "r");
@@ -192,12 +215,25 @@ public:
             printf_err(log_err, "could not open file %s\n", filename);
             throw std::runtime_error("error: cannot open file");
         }
+        if (offset != 0 && fseek(file, offset, SEEK_SET) != 0) {
+            printf_err(log_err, "could not seek to offset %zu in file %s\n", offset, filename);
+            throw std::runtime_error("error: cannot seek in file");
+        }
+        struct stat statbuf;
+        if (fstat(fileno(file), &statbuf) == 0 && (size_t)statbuf.st_size >= offset) {
+            bytes_remaining = std::min(bytes_remaining, (size_t)statbuf.st_size - offset);
+        }
 
         if (key.is_null()) {
             // fprintf(stderr, "note: key is null, no decryption will be performed\n");
             return;   // leave ctx null
         }
 
+        // a short file or segment is read in a single buffer
+        //
+        ct_buffer.resize(std::min(buffer_size, bytes_remaining));
+        pt_buffer.resize(ct_buffer.size() + EVP_MAX_BLOCK_LENGTH);
+
         // create and initialize decryption context
         ctx = EVP_CIPHER_CTX_new();
         if(!ctx) {
@@ -241,7 +277,9 @@ public:
         //fprintf(stderr, "%s\n", __func__);
 
         if (key.is_null() && file != nullptr) {
-            return fread(buf, sizeof(char), count, file);
+            size_t bytes_read = fread(buf, sizeof(char), std::min(count, bytes_remaining), file);
+            bytes_remaining -= bytes_read;
+            return bytes_read;
         }
 
         err = false;
@@ -262,20 +300,14 @@ public:
 
                 // copy plaintext into destination buffer
                 ssize_t outbytes = bytes_in_pt_buffer > pt_bytes_needed ? pt_bytes_needed : bytes_in_pt_buffer;
-                memcpy(outbuf, pt_buffer, outbytes);
+                memcpy(outbuf, pt_buffer.data() + pt_offset, outbytes);
                 outbuf += outbytes;
                 plaintext_length += outbytes;
                 pt_bytes_needed -= outbytes;
 
-                if (outbytes < bytes_in_pt_buffer) {
-                    // move remaining plaintext to the initial position inside the plaintext buffer
-                    ssize_t bytes_remaining = bytes_in_pt_buffer - outbytes;
-                    memmove(pt_buffer, pt_buffer + outbytes, bytes_remaining);
-                    bytes_in_pt_buffer = bytes_remaining;
-                } else {
-                    // indicate that plaintext buffer is empty
-                    bytes_in_pt_buffer = 0;
-                }
+                // advance past the plaintext that was copied
+                pt_offset += outbytes;
+                bytes_in_pt_buffer -= outbytes;
             }
 
             if (no_more_plaintext) {
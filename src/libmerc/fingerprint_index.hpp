@@ -0,0 +1,448 @@
+// fingerprint_index.hpp
+//
+// approximate nearest-neighbor search over fingerprint strings
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef FINGERPRINT_INDEX_HPP
+#define FINGERPRINT_INDEX_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+#include "bit_parallel.hpp"
+
+namespace fingerprint_similarity {
+
+    // a fingerprint is compared to others as a sequence of tokens,
+    // each of which is the hash of one of its elements (a cipher
+    // suite, an extension, a TCP option, and so on) combined with the
+    // nesting depth at which that element appears
+    //
+    using token = uint64_t;
+
+    // mix64(x) is the finalizer of the splitmix64 generator, which
+    // is a good, fast bijective mixing function
+    //
+    static inline uint64_t mix64(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static inline uint64_t hash_bytes(const char *s, size_t len, uint64_t seed) {
+        uint64_t h = 0xcbf29ce484222325ULL ^ seed;   // FNV-1a
+        for (size_t i = 0; i < len; i++) {
+            h ^= (uint8_t)s[i];
+            h *= 0x100000001b3ULL;
+        }
+        return mix64(h);
+    }
+
+    // tokenize(fp_str, tokens) sets tokens to the token sequence of
+    // the fingerprint string fp_str, and returns the hash of its
+    // type/format prefix (such as "tls/1/"), so that fingerprints of
+    // different types are never compared.  Each run of hex digits
+    // between delimiters is an element, except that the long runs at
+    // the top level, which hold lists of two-byte values like cipher
+    // suites, are split into one token per value.
+    //
+    static inline uint64_t tokenize(const char *fp_str, std::vector<token> &tokens) {
+        tokens.clear();
+        const char *p = strchr(fp_str, '(');
+        if (p == nullptr) {
+            return hash_bytes(fp_str, strlen(fp_str), 0);
+        }
+        uint64_t kind = hash_bytes(fp_str, p - fp_str, 0);
+        uint64_t depth = 0;
+        while (*p != '\0') {
+            char c = *p;
+            if (c == '(' || c == '[') {
+                depth++;
+                p++;
+                continue;
+            }
+            if (c == ')' || c == ']') {
+                if (depth > 0) {
+                    depth--;
+                }
+                p++;
+                continue;
+            }
+            const char *start = p;
+            while (*p != '\0' && *p != '(' && *p != ')' && *p != '[' && *p != ']') {
+                p++;
+            }
+            size_t len = p - start;
+            if (depth == 1 && len > 8 && len % 4 == 0) {
+                for (size_t i = 0; i < len; i += 4) {
+                    tokens.push_back(hash_bytes(start + i, 4, depth));
+                }
+            } else {
+                tokens.push_back(hash_bytes(start, len, depth));
+            }
+        }
+        return kind;
+    }
+
+    // class bitparallel_pattern computes the edit distance between a
+    // fixed pattern and any number of texts, using Myers' bit-vector
+    // algorithm (bit_parallel.hpp), with one 64-bit block per 64
+    // pattern tokens.  Each text token costs O(m/64) word operations,
+    // rather than the O(m) of the dynamic programming approach.  The
+    // pattern is preprocessed into a small open-addressed hash table
+    // that maps each distinct token to its match bitmasks (Peq).
+    //
+    class bitparallel_pattern {
+        size_t m = 0;
+        size_t num_blocks = 0;
+        std::vector<token> keys;            // distinct pattern tokens
+        std::vector<uint64_t> peq;          // num_blocks masks per key
+        std::vector<int32_t> slots;         // index into keys, or -1
+        uint64_t slot_mask = 0;
+        mutable std::vector<uint64_t> pv;   // scratch
+        mutable std::vector<uint64_t> mv;
+
+        const uint64_t *lookup(token t) const {
+            for (uint64_t i = t & slot_mask; ; i = (i + 1) & slot_mask) {
+                int32_t k = slots[i];
+                if (k < 0) {
+                    return nullptr;
+                }
+                if (keys[k] == t) {
+                    return &peq[k * num_blocks];
+                }
+            }
+        }
+
+    public:
+
+        void assign(const std::vector<token> &pattern) {
+            m = pattern.size();
+            num_blocks = (m + 63) / 64;
+            keys.clear();
+            peq.clear();
+            size_t table_size = 16;
+            while (table_size < 2 * m) {
+                table_size *= 2;
+            }
+            slots.assign(table_size, -1);
+            slot_mask = table_size - 1;
+            for (size_t i = 0; i < m; i++) {
+                uint64_t s = pattern[i] & slot_mask;
+                while (slots[s] >= 0 && keys[slots[s]] != pattern[i]) {
+                    s = (s + 1) & slot_mask;
+                }
+                if (slots[s] < 0) {
+                    slots[s] = keys.size();
+                    keys.push_back(pattern[i]);
+                    peq.resize(peq.size() + num_blocks, 0);
+                }
+                peq[slots[s] * num_blocks + i / 64] |= (uint64_t)1 << (i % 64);
+            }
+            pv.resize(num_blocks);
+            mv.resize(num_blocks);
+        }
+
+        size_t length() const { return m; }
+
+        // distance(text, max_distance) returns the edit distance
+        // between the pattern and text, if it is no greater than
+        // max_distance, and max_distance + 1 otherwise.  The
+        // computation stops as soon as the last row of the current
+        // column shows that max_distance cannot be met.
+        //
+        unsigned distance(const std::vector<token> &text, unsigned max_distance) const {
+            size_t n = text.size();
+            size_t length_difference = n > m ? n - m : m - n;
+            if (length_difference > max_distance) {
+                return max_distance + 1;
+            }
+            if (m == 0) {
+                return n;
+            }
+            std::fill(pv.begin(), pv.end(), ~(uint64_t)0);
+            std::fill(mv.begin(), mv.end(), 0);
+            const uint64_t last_bit = (uint64_t)1 << ((m - 1) % 64);
+            long score = m;
+            for (size_t j = 0; j < n; j++) {
+                const uint64_t *eq_masks = lookup(text[j]);
+                int h_in = 1;    // the top row of the table is D[0][j] = j
+                for (size_t b = 0; b < num_blocks; b++) {
+                    uint64_t high_bit = (b == num_blocks - 1) ? last_bit : (uint64_t)1 << 63;
+                    h_in = bit_parallel::advance_block(pv[b], mv[b], eq_masks ? eq_masks[b] : 0, h_in, high_bit);
+                }
+                score += h_in;
+                if (score - (long)(n - j - 1) > (long)max_distance) {
+                    return max_distance + 1;
+                }
+            }
+            return score > (long)max_distance ? max_distance + 1 : score;
+        }
+    };
+
+    // edit_distance(a, b) is the reference dynamic programming
+    // computation of the edit distance between two token sequences,
+    // for use in tests
+    //
+    static inline unsigned edit_distance(const std::vector<token> &a, const std::vector<token> &b) {
+        std::vector<unsigned> row(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); j++) {
+            row[j] = j;
+        }
+        for (size_t i = 1; i <= a.size(); i++) {
+            unsigned diagonal = row[0];
+            row[0] = i;
+            for (size_t j = 1; j <= b.size(); j++) {
+                unsigned tmp = row[j];
+                row[j] = std::min({ row[j] + 1, row[j-1] + 1, diagonal + (a[i-1] == b[j-1] ? 0 : 1) });
+                diagonal = tmp;
+            }
+        }
+        return row[b.size()];
+    }
+
+} // namespace fingerprint_similarity
+
+
+// class approximate_fingerprint_index<V> finds, for a fingerprint
+// that is not in a fingerprint database, the closest fingerprint that
+// is, in time that does not grow with the size of the database.
+// Each fingerprint in the index is summarized by a MinHash signature
+// of its token set, and the signature is split into bands that are
+// stored in a hash table (locality sensitive hashing), so that only
+// fingerprints that share at least one band with the query are
+// candidates.  The candidates are then ranked by their exact token
+// edit distance to the query, which is computed with the bit-parallel
+// algorithm, with a cutoff at the best distance seen so far.
+//
+// A fingerprint is accepted as a match only if its edit distance is
+// at most max_relative_distance times the number of tokens in the
+// longer of the two fingerprints.  The index stores pointers to the
+// values of type V, which must outlive it.  After construction, the
+// index is read-only, and find() can be called from any thread.
+//
+template <typename V>
+class approximate_fingerprint_index {
+public:
+
+    struct result {
+        V *value = nullptr;
+        const std::string *fingerprint = nullptr;
+        unsigned distance = 0;
+
+        bool is_valid() const { return value != nullptr; }
+    };
+
+private:
+
+    static constexpr size_t num_bands = 16;
+    static constexpr size_t rows_per_band = 2;
+    static constexpr size_t signature_len = num_bands * rows_per_band;
+
+    struct entry {
+        std::string fingerprint;
+        std::vector<fingerprint_similarity::token> tokens;
+        uint64_t kind;
+        V *value;
+    };
+
+    std::vector<entry> entries;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+    uint64_t seeds[signature_len];
+    double max_relative_distance;
+    size_t max_candidates;
+
+    void signature(const std::vector<fingerprint_similarity::token> &tokens, uint64_t sig[signature_len]) const {
+        for (size_t i = 0; i < signature_len; i++) {
+            sig[i] = UINT64_MAX;
+        }
+        for (const auto &t : tokens) {
+            for (size_t i = 0; i < signature_len; i++) {
+                sig[i] = std::min(sig[i], fingerprint_similarity::mix64(t ^ seeds[i]));
+            }
+        }
+    }
+
+    static uint64_t band_key(const uint64_t sig[signature_len], size_t band, uint64_t kind) {
+        uint64_t h = kind ^ fingerprint_similarity::mix64(band + 1);
+        for (size_t r = 0; r < rows_per_band; r++) {
+            h = fingerprint_similarity::mix64(h ^ sig[band * rows_per_band + r]);
+        }
+        return h;
+    }
+
+public:
+
+    approximate_fingerprint_index(double max_relative_dist=0.1, size_t max_cand=256) :
+        max_relative_distance{max_relative_dist},
+        max_candidates{max_cand}
+    {
+        std::mt19937_64 prng{0x6d657263757279ULL};   // fixed, so that results are reproducible
+        for (auto &s : seeds) {
+            s = prng();
+        }
+    }
+
+    // add(fp_str, value) adds a fingerprint and the value associated
+    // with it to the index; fingerprints without any elements, such
+    // as the "randomized" entries, are ignored
+    //
+    void add(const std::string &fp_str, V *value) {
+        entry e{fp_str, {}, 0, value};
+        e.kind = fingerprint_similarity::tokenize(fp_str.c_str(), e.tokens);
+        if (e.tokens.empty()) {
+            return;
+        }
+        uint64_t sig[signature_len];
+        signature(e.tokens, sig);
+        uint32_t idx = entries.size();
+        for (size_t band = 0; band < num_bands; band++) {
+            std::vector<uint32_t> &bucket = buckets[band_key(sig, band, e.kind)];
+            if (bucket.empty() || bucket.back() != idx) {
+                bucket.push_back(idx);
+            }
+        }
+        entries.push_back(std::move(e));
+    }
+
+    size_t size() const { return entries.size(); }
+
+    // find(fp_str) returns the closest fingerprint in the index that
+    // is within the distance threshold, or an invalid result if there
+    // is none
+    //
+    result find(const char *fp_str) const {
+        thread_local std::vector<fingerprint_similarity::token> query;
+        thread_local fingerprint_similarity::bitparallel_pattern pattern;
+        thread_local std::vector<uint32_t> last_seen;
+        thread_local uint32_t generation = 0;
+
+        result best;
+        if (entries.empty()) {
+            return best;
+        }
+        uint64_t kind = fingerprint_similarity::tokenize(fp_str, query);
+        if (query.empty()) {
+            return best;
+        }
+        uint64_t sig[signature_len];
+        signature(query, sig);
+        pattern.assign(query);
+
+        if (last_seen.size() < entries.size()) {
+            last_seen.resize(entries.size(), 0);
+        }
+        if (++generation == 0) {   // wrapped around; start over
+            std::fill(last_seen.begin(), last_seen.end(), 0);
+            generation = 1;
+        }
+
+        size_t candidates = 0;
+        unsigned best_distance = UINT32_MAX;
+        for (size_t band = 0; band < num_bands && candidates < max_candidates && best_distance != 0; band++) {
+            auto it = buckets.find(band_key(sig, band, kind));
+            if (it == buckets.end()) {
+                continue;
+            }
+            for (uint32_t idx : it->second) {
+                if (last_seen[idx] == generation) {
+                    continue;
+                }
+                last_seen[idx] = generation;
+                const entry &e = entries[idx];
+                if (e.kind != kind) {
+                    continue;
+                }
+                unsigned threshold = max_relative_distance * std::max(query.size(), e.tokens.size());
+                if (best_distance != UINT32_MAX && best_distance - 1 < threshold) {
+                    threshold = best_distance - 1;  // only look for strictly better matches
+                }
+                unsigned d = pattern.distance(e.tokens, threshold);
+                if (d <= threshold) {
+                    best_distance = d;
+                    best.value = e.value;
+                    best.fingerprint = &e.fingerprint;
+                    best.distance = d;
+                }
+                if (++candidates >= max_candidates || best_distance == 0) {
+                    break;
+                }
+            }
+        }
+        return best;
+    }
+
+    // unit_test() checks the bit-parallel edit distance against the
+    // dynamic programming reference, for random token sequences that
+    // span one, two, and three blocks, and then checks that find()
+    // returns the nearest fingerprint of the same type, and nothing
+    // for fingerprints that are too distant or of another type
+    //
+    static bool unit_test() {
+        std::mt19937_64 prng{1};
+        std::vector<fingerprint_similarity::token> a, b;
+        fingerprint_similarity::bitparallel_pattern p;
+        for (size_t trial = 0; trial < 1000; trial++) {
+            a.resize(prng() % 150);
+            b.resize(prng() % 150);
+            for (auto &x : a) { x = prng() % 8; }
+            for (auto &x : b) { x = prng() % 8; }
+            p.assign(a);
+            unsigned reference = fingerprint_similarity::edit_distance(a, b);
+            if (p.distance(b, UINT32_MAX - 1) != reference) {
+                return false;
+            }
+            unsigned cutoff = prng() % 100;
+            unsigned expected = reference <= cutoff ? reference : cutoff + 1;
+            if (p.distance(b, cutoff) != expected) {
+                return false;
+            }
+        }
+
+        int values[] = { 0, 1, 2 };
+        approximate_fingerprint_index<int> index;
+        index.add("tls/1/(0303)(130113021303c02bc02fc02cc030cca9cca8c013c014009c009d002f0035)((0000)(0017)(ff01)(000a)(000b)(0023)(0010)(0005)(000d)(0012)(0033)(002d)(002b)(001b))", &values[0]);
+        index.add("tls/1/(0303)(c02bc02fc00ac009c013c014009c009d002f0035000a)((0000)(0017)(ff01)(000a)(000b)(0023)(0010)(0005)(000d))", &values[1]);
+        index.add("tcp/(fffe)(020405b4)(01)(030308)(01)(01)(080a)(0402)", &values[2]);
+        index.add("tls/1/randomized", &values[0]);     // no elements; ignored
+        if (index.size() != 3) {
+            return false;
+        }
+
+        // one cipher suite removed from the first fingerprint
+        //
+        result r = index.find("tls/1/(0303)(130113021303c02bc02fc02cc030cca9cca8c013c014009c009d002f)((0000)(0017)(ff01)(000a)(000b)(0023)(0010)(0005)(000d)(0012)(0033)(002d)(002b)(001b))");
+        if (!r.is_valid() || r.value != &values[0] || r.distance != 1) {
+            return false;
+        }
+
+        // an exact match of the second fingerprint
+        //
+        r = index.find("tls/1/(0303)(c02bc02fc00ac009c013c014009c009d002f0035000a)((0000)(0017)(ff01)(000a)(000b)(0023)(0010)(0005)(000d))");
+        if (!r.is_valid() || r.value != &values[1] || r.distance != 0) {
+            return false;
+        }
+
+        // too many differences, and the right elements with the wrong
+        // type, are not matches
+        //
+        r = index.find("tls/1/(0303)(1301c02bc02f)((0000)(0017)(ff01))");
+        if (r.is_valid()) {
+            return false;
+        }
+        r = index.find("quic/1/(0303)(c02bc02fc00ac009c013c014009c009d002f0035000a)((0000)(0017)(ff01)(000a)(000b)(0023)(0010)(0005)(000d))");
+        return !r.is_valid();
+    }
+
+};
+
+#endif // FINGERPRINT_INDEX_HPP
@@ -0,0 +1,391 @@
+// flow_record.hpp
+//
+// per-flow packet, byte, and TCP flag counters, reported in a flow
+// record, along with the fingerprints and analysis of the flow, when
+// the flow ends
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef FLOW_RECORD_HPP
+#define FLOW_RECORD_HPP
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include "json_object.h"
+#include "fingerprint.h"
+#include "result.h"
+#include "tcp.h"
+
+void write_flow_key(struct json_object &o, const struct key &k);   // defined in pkt_proc.cc
+
+// class flow_record_table tracks each IP flow, in both directions,
+// so that mercury can report a flow summary in the manner of an
+// IPFIX biflow exporter (RFC 5103), alongside its per-message records.
+// A flow is identified by the key of its first packet, so its
+// "forward" direction is that of the initiator; packets with the
+// reversed key are counted in the "reverse" direction.
+//
+// A flow ends, and its record is queued, when it has been idle for
+// idle_timeout seconds, when a TCP RST or a FIN in each direction was
+// seen closing_timeout seconds earlier, or when the table is full
+// and it is the least recently active flow.  A flow that lasts longer
+// than active_timeout seconds is reported in a record that covers
+// that interval, and then counted anew, as IPFIX exporters do.  All
+// times are packet times.  Each direction has its own start and end
+// times, which are reported with its counters; a direction without
+// packets has none.
+//
+// Queued records are written into an output buffer alongside the
+// packet records, by write_records(), so that no second pass over the
+// traffic is needed to obtain flow summaries.
+//
+class flow_record_table {
+public:
+
+    enum class end_reason { idle, active, end, evicted, flush };
+
+private:
+
+    struct direction {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        uint8_t tcp_flags = 0;    // union of the flags of all packets
+        struct timespec start{0, 0};
+        struct timespec end{0, 0};
+
+        void update(size_t length, uint8_t flags, const struct timespec *ts) {
+            if (packets == 0) {
+                start = *ts;
+            }
+            end = *ts;
+            packets++;
+            bytes += length;
+            tcp_flags |= flags;
+        }
+    };
+
+    struct flow {
+        struct key k;
+        struct timespec start;
+        struct timespec end;
+        direction forward;
+        direction reverse;
+        bool closing = false;
+        std::vector<std::pair<fingerprint_type, std::string>> fingerprints;
+        std::string process;
+        double score = 0.0;
+        int malware = -1;         // -1 if not classified
+        double p_malware = 0.0;
+        end_reason reason = end_reason::idle;
+    };
+
+    using flow_list = std::list<flow>;
+
+    flow_list active;             // least recently active first
+    flow_list closing;            // oldest end first
+    std::unordered_map<key, flow_list::iterator> table;
+    std::deque<flow> pending;
+    size_t max_entries;
+    time_t next_check = 0;
+
+    // the longest flow record that we expect; longer ones are
+    // discarded rather than truncated
+    //
+    static constexpr size_t max_record_len = 8192;
+
+    void enqueue(flow_list &list, flow_list::iterator it, end_reason reason) {
+        table.erase(it->k);
+        it->reason = reason;
+        pending.push_back(std::move(*it));
+        list.erase(it);
+    }
+
+    // expire(now) queues the records of the flows that have ended as
+    // of time now
+    //
+    void expire(time_t now) {
+        while (!closing.empty() && closing.front().end.tv_sec + closing_timeout <= now) {
+            enqueue(closing, closing.begin(), end_reason::end);
+        }
+        while (!active.empty() && active.front().end.tv_sec + idle_timeout <= now) {
+            enqueue(active, active.begin(), end_reason::idle);
+        }
+    }
+
+    // find(k, is_reverse) returns an iterator to the flow with key k
+    // or its reverse, setting is_reverse accordingly, or table.end()
+    //
+    std::unordered_map<key, flow_list::iterator>::iterator find(const struct key &k, bool &is_reverse) {
+        auto it = table.find(k);
+        if (it != table.end()) {
+            is_reverse = false;
+            return it;
+        }
+        it = table.find(k.reverse());
+        is_reverse = (it != table.end());
+        return it;
+    }
+
+public:
+
+    static constexpr time_t idle_timeout = 60;
+    static constexpr time_t active_timeout = 1800;
+    static constexpr time_t closing_timeout = 2;
+    static constexpr size_t default_max_entries = 65536;
+
+    explicit flow_record_table(size_t max=default_max_entries) : max_entries{max} { }
+
+    flow_record_table(const flow_record_table &) = delete;
+    flow_record_table &operator=(const flow_record_table &) = delete;
+
+    // update(k, ts, length, tcp_flags) counts a packet of length bytes
+    // (including its IP header) with flow key k, observed at time ts;
+    // tcp_flags holds the flags of a TCP packet, and is zero otherwise
+    //
+    void update(const struct key &k, const struct timespec *ts, size_t length, uint8_t tcp_flags) {
+        if (ts->tv_sec >= next_check) {
+            expire(ts->tv_sec);
+            next_check = ts->tv_sec + 1;
+        }
+
+        bool is_reverse = false;
+        auto entry = find(k, is_reverse);
+        if (entry == table.end()) {
+            if (table.size() >= max_entries && !active.empty()) {
+                enqueue(active, active.begin(), end_reason::evicted);
+            }
+            active.push_back(flow{});
+            flow_list::iterator it = std::prev(active.end());
+            it->k = k;
+            it->start = *ts;
+            entry = table.emplace(k, it).first;
+        }
+        flow_list::iterator f = entry->second;
+
+        if (ts->tv_sec - f->start.tv_sec >= active_timeout) {
+            flow next;
+            next.k = f->k;
+            next.start = *ts;
+            next.fingerprints = f->fingerprints;
+            pending.push_back(std::move(*f));
+            pending.back().reason = end_reason::active;
+            *f = std::move(next);
+        }
+
+        f->end = *ts;
+        direction &d = is_reverse ? f->reverse : f->forward;
+        d.update(length, tcp_flags, ts);
+
+        if (f->closing) {
+            return;
+        }
+        bool ended = TCP_IS_RST(tcp_flags) || (TCP_IS_FIN(f->forward.tcp_flags) && TCP_IS_FIN(f->reverse.tcp_flags));
+        if (ended) {
+            f->closing = true;
+            closing.splice(closing.end(), active, f);
+        } else {
+            active.splice(active.end(), active, f);
+        }
+    }
+
+    // set_fingerprint(k, fp) records the fingerprint fp in the flow
+    // with key k (or its reverse), unless a fingerprint of the same
+    // type was already recorded
+    //
+    void set_fingerprint(const struct key &k, const fingerprint &fp) {
+        bool is_reverse = false;
+        auto entry = find(k, is_reverse);
+        if (entry == table.end() || fp.get_type() == fingerprint_type_unknown) {
+            return;
+        }
+        auto &fps = entry->second->fingerprints;
+        for (const auto &f : fps) {
+            if (f.first == fp.get_type()) {
+                return;
+            }
+        }
+        fps.emplace_back(fp.get_type(), fp.string());
+    }
+
+    // set_analysis(k, result) records the process and malware
+    // verdicts in result in the flow with key k (or its reverse)
+    //
+    void set_analysis(const struct key &k, const analysis_result &result) {
+        bool is_reverse = false;
+        auto entry = find(k, is_reverse);
+        const char *process = nullptr;
+        double score = 0.0;
+        if (entry == table.end() || !result.get_process_info(&process, &score)) {
+            return;
+        }
+        flow &f = *entry->second;
+        f.process = process;
+        f.score = score;
+        bool is_malware = false;
+        double p_malware = 0.0;
+        if (result.get_malware_info(&is_malware, &p_malware)) {
+            f.malware = is_malware;
+            f.p_malware = p_malware;
+        }
+    }
+
+    // flush() queues the records of all of the flows in the table,
+    // and empties it
+    //
+    void flush() {
+        while (!closing.empty()) {
+            enqueue(closing, closing.begin(), end_reason::end);
+        }
+        while (!active.empty()) {
+            enqueue(active, active.begin(), end_reason::flush);
+        }
+    }
+
+    bool has_records() const { return !pending.empty(); }
+
+    size_t size() const { return table.size(); }
+
+    static const char *end_reason_name(end_reason r) {
+        switch (r) {
+        case end_reason::idle:    return "idle";
+        case end_reason::active:  return "active";
+        case end_reason::end:     return "end";
+        case end_reason::evicted: return "evicted";
+        case end_reason::flush:   return "flush";
+        }
+        return "unknown";
+    }
+
+    // write_records(buf) writes as many queued flow records into buf
+    // as will fit, each as a JSON record on its own line, and returns
+    // the number written.  It never truncates buf, so it can be
+    // called after a packet's record has been written.
+    //
+    size_t write_records(struct buffer_stream &buf) {
+        size_t count = 0;
+        char tmp[max_record_len];
+        while (!pending.empty()) {
+            const flow &f = pending.front();
+            struct timespec start = f.start;
+            struct buffer_stream tmp_buf{tmp, sizeof(tmp)};
+            struct json_object record{&tmp_buf};
+            if (!f.fingerprints.empty()) {
+                struct json_object fps{record, "fingerprints"};
+                for (const auto &fp : f.fingerprints) {
+                    fps.print_key_string(fingerprint::get_type_name(fp.first), fp.second.c_str());
+                }
+                fps.close();
+            }
+            if (!f.process.empty()) {
+                struct json_object analysis{record, "analysis"};
+                analysis.print_key_string("process", f.process.c_str());
+                analysis.print_key_float("score", f.score);
+                if (f.malware >= 0) {
+                    analysis.print_key_uint("malware", f.malware);
+                    analysis.print_key_float("p_malware", f.p_malware);
+                }
+                analysis.close();
+            }
+            struct timespec forward_start = f.forward.start;
+            struct timespec forward_end = f.forward.end;
+            struct timespec reverse_start = f.reverse.start;
+            struct timespec reverse_end = f.reverse.end;
+            struct json_object flow_json{record, "flow"};
+            if (f.forward.packets) {
+                flow_json.print_key_timestamp("start", &forward_start);
+                flow_json.print_key_timestamp("end", &forward_end);
+            }
+            if (f.reverse.packets) {
+                flow_json.print_key_timestamp("reverse_start", &reverse_start);
+                flow_json.print_key_timestamp("reverse_end", &reverse_end);
+            }
+            flow_json.print_key_string("end_reason", end_reason_name(f.reason));
+            flow_json.print_key_uint("packets", f.forward.packets);
+            flow_json.print_key_uint("bytes", f.forward.bytes);
+            flow_json.print_key_uint("reverse_packets", f.reverse.packets);
+            flow_json.print_key_uint("reverse_bytes", f.reverse.bytes);
+            if (f.k.protocol == 6) {
+                flow_json.print_key_uint("tcp_flags", f.forward.tcp_flags);
+                flow_json.print_key_uint("reverse_tcp_flags", f.reverse.tcp_flags);
+            }
+            flow_json.close();
+            write_flow_key(record, f.k);
+            record.print_key_timestamp("event_start", &start);
+            record.close();
+            if (tmp_buf.trunc == 0) {
+                if ((size_t)(buf.dlen - buf.doff) <= tmp_buf.length() + 2) {
+                    break;   // no room left in buf; leave record in queue
+                }
+                buf.memcpy(tmp, tmp_buf.length());
+                buf.write_char('\n');
+                count++;
+            }
+            pending.pop_front();
+        }
+        return count;
+    }
+
+    static bool unit_test() {
+        flow_record_table t{2};
+        struct key k{1234, 80, 0x0100000a, 0x0200000a, 6};
+        struct timespec ts{1000, 0};
+        t.update(k, &ts, 60, 0x02);             // SYN
+        ts.tv_nsec = 500;
+        t.update(k.reverse(), &ts, 60, 0x12);   // SYN/ACK
+        ts.tv_sec++;
+        t.update(k, &ts, 1500, 0x10);
+        if (t.size() != 1 || t.has_records()) {
+            return false;
+        }
+
+        // a FIN in each direction ends the flow, which is reported
+        // closing_timeout seconds later
+        //
+        t.update(k, &ts, 40, 0x11);
+        t.update(k.reverse(), &ts, 40, 0x11);
+        ts.tv_sec += closing_timeout;
+        struct key other{5678, 53, 0x0100000a, 0x0300000a, 17};
+        t.update(other, &ts, 100, 0);
+        if (t.size() != 1 || !t.has_records()) {
+            return false;
+        }
+        const flow &f = t.pending.front();
+        if (f.forward.packets != 3 || f.forward.bytes != 1600 || f.reverse.packets != 2
+            || f.forward.tcp_flags != 0x13 || f.reason != end_reason::end) {
+            return false;
+        }
+        if (f.forward.start.tv_sec != 1000 || f.forward.end.tv_sec != 1001
+            || f.reverse.start.tv_nsec != 500 || f.reverse.end.tv_sec != 1001) {
+            return false;
+        }
+
+        // the udp flow ends after it has been idle
+        //
+        ts.tv_sec += idle_timeout;
+        t.update(k, &ts, 60, 0x02);
+        if (t.pending.size() != 2 || t.pending.back().reason != end_reason::idle) {
+            return false;
+        }
+
+        char out[4096];
+        struct buffer_stream buf{out, sizeof(out)};
+        if (t.write_records(buf) != 2 || t.has_records()) {
+            return false;
+        }
+        std::string json{out, (size_t)buf.length()};
+        if (json.find("\"reverse_start\":1000.000000") == std::string::npos
+            || json.find("\"end\":1001.000000") == std::string::npos) {
+            return false;
+        }
+        t.flush();
+        return t.size() == 0 && t.has_records();
+    }
+
+};
+
+#endif // FLOW_RECORD_HPP
@@ -3,6 +3,7 @@
 
 #include "libmerc.h"
 #include "config_generator.h"
+#include "tunnel_depth.hpp"
 #include <map>  
 #include <string>
 #include <algorithm>
@@ -40,6 +41,14 @@ public:
     std::string temp_proto_str;
     bool tcp_reassembly = false;          /* reassemble tcp segments      */
     size_t tls_fingerprint_format = 0;    // default fingerprint format
+    bool os_identification = false;       /* report per-host os verdicts  */
+    double os_window = 60.0;              // seconds between os verdicts
+    size_t os_max_hosts = 65536;          // max hosts per packet processor
+    double approximate_matching = 0.0;    // max relative fingerprint distance (0 = off)
+    bool eager_resources = false;         /* load resources at startup    */
+    bool tls_sessions = false;            /* correlate tls server, client */
+    bool flow_records = false;            /* report per-flow summaries    */
+    size_t decapsulation_depth = 0;       // max tunnel layers to strip (0 = off)
 
     void set_tls_fingerprint_format(size_t format) { tls_fingerprint_format = format; }
 
@@ -136,6 +145,23 @@ public:
         return true;
     }
 
+    // selects_analyzed_protocols() returns true if the protocol
+    // selection includes a protocol whose fingerprints are analyzed
+    // (that is, a TLS or QUIC client hello or an HTTP request), in
+    // which case the analysis resources will be needed
+    //
+    bool selects_analyzed_protocols() const {
+        if (protocols.at("none")) {
+            return false;
+        }
+        for (const char *p : { "all", "tls", "tls.client_hello", "http", "http.request", "quic" }) {
+            if (protocols.at(p)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     bool set_fingerprint_format(const std::string &s) {
         if (s == "tls") {
             tls_fingerprint_format = 0;
@@ -147,6 +173,60 @@ public:
         }
         return true;
     }
+
+    bool set_approximate_matching(const std::string &s) {
+        if (s.empty()) {
+            approximate_matching = 0.1;   // default relative distance
+            return true;
+        }
+        char *end = nullptr;
+        double tmp = strtod(s.c_str(), &end);
+        if (*end != '\0' || tmp <= 0.0 || tmp >= 1.0) {
+            printf_err(log_warning, "warning: invalid approximate-matching distance: %s; using default instead\n", s.c_str());
+            approximate_matching = 0.1;
+            return false;
+        }
+        approximate_matching = tmp;
+        return true;
+    }
+
+    bool set_os_window(const std::string &s) {
+        char *end = nullptr;
+        double tmp = strtod(s.c_str(), &end);
+        if (s.empty() || *end != '\0' || tmp < 0.0) {
+            printf_err(log_warning, "warning: invalid os-window: %s; using default instead\n", s.c_str());
+            return false;
+        }
+        os_window = tmp;
+        return true;
+    }
+
+    bool set_os_max_hosts(const std::string &s) {
+        char *end = nullptr;
+        unsigned long tmp = strtoul(s.c_str(), &end, 10);
+        if (s.empty() || *end != '\0' || tmp == 0) {
+            printf_err(log_warning, "warning: invalid os-max-hosts: %s; using default instead\n", s.c_str());
+            return false;
+        }
+        os_max_hosts = tmp;
+        return true;
+    }
+
+    bool set_decapsulation_depth(const std::string &s) {
+        if (s.empty()) {
+            decapsulation_depth = tunnel_depth::default_depth;
+            return true;
+        }
+        char *end = nullptr;
+        unsigned long tmp = strtoul(s.c_str(), &end, 10);
+        if (*end != '\0' || tmp > tunnel_depth::max_depth) {
+            printf_err(log_warning, "warning: invalid decapsulation depth: %s; using default instead\n", s.c_str());
+            decapsulation_depth = tunnel_depth::default_depth;
+            return false;
+        }
+        decapsulation_depth = tmp;
+        return true;
+    }
 };
 
 static void setup_extended_fields(global_config* lc, const std::string& config) {
@@ -155,7 +235,15 @@ static void setup_extended_fields(global_config* lc, const std::string& config)
         {"select", "-s", "--select", SETTER_FUNCTION(&lc){ lc->set_protocols(s); }},
         {"resources", "", "", SETTER_FUNCTION(&lc){ lc->set_resource_file(s); }},
         {"format", "", "", SETTER_FUNCTION(&lc){ lc->set_fingerprint_format(s); }},
-        {"tcp-reassembly", "", "", SETTER_FUNCTION(&lc){ lc->tcp_reassembly = true; }}
+        {"tcp-reassembly", "", "", SETTER_FUNCTION(&lc){ lc->tcp_reassembly = true; }},
+        {"os-identification", "", "", SETTER_FUNCTION(&lc){ lc->os_identification = true; }},
+        {"os-window", "", "", SETTER_FUNCTION(&lc){ lc->set_os_window(s); }},
+        {"os-max-hosts", "", "", SETTER_FUNCTION(&lc){ lc->set_os_max_hosts(s); }},
+        {"approximate-matching", "", "", SETTER_FUNCTION(&lc){ lc->set_approximate_matching(s); }},
+        {"eager-resources", "", "", SETTER_FUNCTION(&lc){ lc->eager_resources = true; }},
+        {"tls-sessions", "", "", SETTER_FUNCTION(&lc){ lc->tls_sessions = true; }},
+        {"flow-records", "", "", SETTER_FUNCTION(&lc){ lc->flow_records = true; }},
+        {"decapsulate", "", "", SETTER_FUNCTION(&lc){ lc->set_decapsulation_depth(s); }}
     };
 
     parse_additional_options(options, config, *lc);
@@ -19,6 +19,10 @@
 //     |      Checksum (optional)      |       Reserved1 (Optional)    |
 //     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 //
+//  RFC 2890 uses the second and third bits of Reserved0 as the K and
+//  S flags, which indicate that an optional Key field and an optional
+//  Sequence Number field, each four bytes long, follow the Checksum.
+//
 //  Note: RFC 1701 defines an obsolete and more elaborate earlier
 //  variant of the GRE header, which is little seen on modern
 //  networks.
@@ -26,12 +30,19 @@
 class gre_header {
     encoded<uint16_t> c_reserved_ver;
     encoded<uint16_t> protocol_type;
+    uint32_t key = 0;
 public:
 
     gre_header(struct datum &d) : c_reserved_ver{d}, protocol_type{d} {
         if (c_reserved_ver.bit<0>()) {
             d.skip(4);  // skip over Checksum and Reserved1 fields
         }
+        if (c_reserved_ver.bit<2>()) {
+            key = encoded<uint32_t>{d};
+        }
+        if (c_reserved_ver.bit<3>()) {
+            d.skip(4);  // skip over Sequence Number
+        }
         if (d.is_null()) {
             protocol_type = 0x0000; // ETH_TYPE_NONE
             return;
@@ -45,6 +56,10 @@ public:
     // https://www.iana.org/assignments/ieee-802-numbers/ieee-802-numbers.xhtml.
     //
     uint16_t get_protocol_type() const { return protocol_type; }
+
+    bool has_key() const { return c_reserved_ver.bit<2>(); }
+
+    uint32_t get_key() const { return key; }
 };
 
 #endif
@@ -0,0 +1,230 @@
+// handshake_buffer.hpp
+//
+// reassembly of TLS handshake messages that are carried in several
+// fragments, such as the CRYPTO frames of QUIC Initial packets and
+// fragmented DTLS handshakes
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef HANDSHAKE_BUFFER_HPP
+#define HANDSHAKE_BUFFER_HPP
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "datum.h"
+#include "bounded_table.hpp"
+
+// class handshake_buffer holds the fragments of a handshake message,
+// each copied to its offset within the message, and keeps track of
+// which parts of the message are present.
+//
+// The buffer starts out large enough for the common case of a
+// handshake that fits into a single packet.  It grows as needed,
+// up to max_size bytes, when a fragment with a larger offset is
+// added.  Because a buffer is reused by resetting it, a thread that
+// has seen a large handshake keeps the larger buffer, and no further
+// allocation happens after that.
+//
+class handshake_buffer {
+    std::vector<uint8_t> buffer;
+    size_t buf_len = 0;                               // end of highest fragment
+    std::vector<std::pair<size_t, size_t>> segments;  // [start, end) of data present, sorted and disjoint
+
+    // add_segment(start, end) records that the bytes in [start, end)
+    // are present, merging that range with any that it overlaps or
+    // adjoins
+    //
+    void add_segment(size_t start, size_t end) {
+        auto it = std::lower_bound(segments.begin(), segments.end(), std::pair<size_t, size_t>{start, start});
+        if (it != segments.begin() && std::prev(it)->second >= start) {
+            --it;
+        }
+        auto last = it;
+        while (last != segments.end() && last->first <= end) {
+            start = std::min(start, last->first);
+            end = std::max(end, last->second);
+            ++last;
+        }
+        it = segments.erase(it, last);
+        segments.insert(it, { start, end });
+    }
+
+public:
+
+    static constexpr size_t initial_size = 2048;
+    static constexpr size_t max_size = 65536;
+
+    handshake_buffer() : buffer(initial_size) { }
+
+    void reset() {
+        buf_len = 0;
+        segments.clear();
+    }
+
+    // extend(offset, fragment) copies fragment into the buffer at
+    // offset, and returns true, unless the fragment would extend past
+    // max_size, in which case the buffer is unchanged and false is
+    // returned
+    //
+    bool extend(uint64_t offset, datum fragment) {
+        if (fragment.length() <= 0) {
+            return true;
+        }
+        size_t length = fragment.length();
+        if (offset > max_size || length > max_size - offset) {
+            return false;
+        }
+        size_t end = offset + length;
+        if (end > buffer.size()) {
+            buffer.resize(std::max(end, std::min(2 * buffer.size(), max_size)));
+        }
+        memcpy(buffer.data() + offset, fragment.data, length);
+        if (end > buf_len) {
+            buf_len = end;
+        }
+        add_segment(offset, end);
+        return true;
+    }
+
+    // merge(other) adds all of the fragments in other to this buffer
+    //
+    void merge(const handshake_buffer &other) {
+        for (const auto &s : other.segments) {
+            extend(s.first, datum{other.buffer.data() + s.first, other.buffer.data() + s.second});
+        }
+    }
+
+    bool is_valid() const { return buf_len > 0; }
+
+    // contiguous_length() returns the number of bytes that are
+    // present at the start of the buffer, without a gap
+    //
+    size_t contiguous_length() const {
+        if (segments.empty() || segments[0].first != 0) {
+            return 0;
+        }
+        return segments[0].second;
+    }
+
+    // contents() returns the data in the buffer, up to the end of the
+    // highest fragment; any gaps hold stale data
+    //
+    datum contents() const { return { buffer.data(), buffer.data() + buf_len }; }
+
+    // contiguous_contents() returns the data at the start of the
+    // buffer, up to its first gap, which holds no stale data
+    //
+    datum contiguous_contents() const { return { buffer.data(), buffer.data() + contiguous_length() }; }
+
+    // tls_handshake_is_complete() returns true if the buffer holds a
+    // complete TLS handshake message, starting with its four-byte
+    // header, at its start
+    //
+    bool tls_handshake_is_complete() const {
+        size_t present = contiguous_length();
+        if (present < 4) {
+            return false;
+        }
+        size_t length = (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+        return present >= length + 4;
+    }
+
+    void swap(handshake_buffer &other) {
+        buffer.swap(other.buffer);
+        std::swap(buf_len, other.buf_len);
+        segments.swap(other.segments);
+    }
+
+    static bool unit_test() {
+        handshake_buffer b;
+        uint8_t data[3000];
+        for (size_t i = 0; i < sizeof(data); i++) {
+            data[i] = i & 0xff;
+        }
+        data[0] = 0x01;                      // client_hello
+        data[1] = 0x00;                      // length = 2996
+        data[2] = 0x0b;
+        data[3] = 0xb4;
+
+        // fragments arrive out of order, and the last one overlaps
+        //
+        b.extend(1200, datum{data + 1200, data + 2400});
+        b.extend(2400, datum{data + 2400, data + 3000});
+        if (b.tls_handshake_is_complete() || b.contiguous_length() != 0) {
+            return false;
+        }
+        handshake_buffer c;
+        c.extend(0, datum{data, data + 1300});
+        b.merge(c);
+        if (!b.tls_handshake_is_complete() || b.contents().length() != sizeof(data)) {
+            return false;
+        }
+        if (memcmp(b.contents().data, data, sizeof(data)) != 0) {
+            return false;
+        }
+
+        // fragments beyond max_size are rejected
+        //
+        if (b.extend(max_size, datum{data, data + 1})) {
+            return false;
+        }
+        b.reset();
+        if (b.is_valid() || b.contiguous_length() != 0) {
+            return false;
+        }
+
+        // after a reset, the gaps between fragments hold stale data,
+        // which is not part of the contiguous contents
+        //
+        b.extend(0, datum{data, data + 100});
+        b.extend(200, datum{data + 200, data + 300});
+        return b.contents().length() == 300 && b.contiguous_contents().length() == 100;
+    }
+
+};
+
+// class pending_handshakes holds the handshake_buffers of handshakes
+// that are not yet complete, each identified by a key, such as the
+// destination connection ID of a QUIC connection or the flow key of
+// a DTLS flow.  It holds at most max_entries buffers; when it is
+// full, the oldest one is discarded to make room for a new one.
+//
+// Only handshakes that do not fit into a single packet are held, so
+// the table is usually empty, and callers can check is_empty()
+// before constructing a key.
+//
+template <typename K, typename H=std::hash<K>>
+class pending_handshakes {
+    bounded_table<K, handshake_buffer, H> table{max_entries};
+
+public:
+
+    static constexpr size_t max_entries = 64;
+
+    bool is_empty() const { return table.empty(); }
+
+    // reassemble(k, b) adds the fragments in b to those of the pending
+    // handshake with key k, if there is one.  If that completes the
+    // TLS handshake message, the complete message is swapped into b,
+    // the pending handshake is removed, and true is returned.
+    // Otherwise, the combined fragments are kept as the pending
+    // handshake for k, and false is returned.
+    //
+    bool reassemble(const K &k, handshake_buffer &b) {
+        auto it = table.find_or_insert(k);
+        it->second.merge(b);
+        if (it->second.tls_handshake_is_complete()) {
+            b.swap(it->second);
+            table.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    size_t size() const { return table.size(); }
+
+};
+
+#endif // HANDSHAKE_BUFFER_HPP
@@ -91,6 +91,17 @@ struct http_request : public base_protocol {
 
     bool do_analysis(const struct key &k_, struct analysis_context &analysis_, classifier *c);
 
+    // end_marker() returns the empty line that ends the headers, if
+    // the request line was parsed but the end of the headers was not
+    // found, since the length of the headers is not known until then
+    //
+    const char *end_marker() const {
+        if (protocol.is_not_empty() && !headers.complete) {
+            return "\r\n\r\n";
+        }
+        return nullptr;
+    }
+
     // weight 14 bitmask that matches all HTTP methods
     //
     static constexpr mask_and_value<8> matcher{
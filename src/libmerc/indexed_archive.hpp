@@ -0,0 +1,393 @@
+// indexed_archive.hpp
+//
+// seekable resource archive, in which each member is compressed and
+// (optionally) encrypted on its own, and a trailing index holds the
+// location of each member
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef INDEXED_ARCHIVE_HPP
+#define INDEXED_ARCHIVE_HPP
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+#include <zlib.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "archive.h"
+
+// An indexed archive has the layout
+//
+//    member 0 | member 1 | ... | member n-1 | index | footer
+//
+// Each member, and the index, is a gzip stream (RFC 1952).  If a key
+// is used, each of those streams is encrypted in the same way as an
+// encrypted_file: a random block is prepended to the gzip stream,
+// and the result is encrypted with AES-128-CBC with a zero IV.
+// Because each member is independent, a reader can open any member
+// without touching the others, and can read several members at once.
+//
+// The index is a text file with one line per member, holding the
+// tab-separated fields
+//
+//    name, offset, length, size
+//
+// where offset and length locate the member in the archive file, and
+// size is the number of bytes in the uncompressed member, all in
+// decimal.  The footer is the last 24 bytes of the archive file: the
+// magic string "MERCIDX1", followed by the offset and length of the
+// index, as big-endian 64-bit integers.
+//
+namespace indexed_archive_format {
+
+    static constexpr char magic[8] = { 'M', 'E', 'R', 'C', 'I', 'D', 'X', '1' };
+    static constexpr size_t footer_length = sizeof(magic) + 2 * sizeof(uint64_t);
+
+    inline void encode_uint64(uint8_t *out, uint64_t x) {
+        for (int i = 7; i >= 0; i--) {
+            out[i] = x & 0xff;
+            x >>= 8;
+        }
+    }
+
+    inline uint64_t decode_uint64(const uint8_t *in) {
+        uint64_t x = 0;
+        for (size_t i = 0; i < 8; i++) {
+            x = (x << 8) | in[i];
+        }
+        return x;
+    }
+
+}
+
+
+// class indexed_archive reads an indexed archive.  The constructor
+// reads the footer and the index; open() returns a reader for a
+// single member.  An indexed_archive is not changed by open(), so
+// members can be opened and read concurrently from several threads.
+//
+class indexed_archive {
+public:
+
+    struct member_info {
+        std::string name;
+        uint64_t offset;
+        uint64_t length;
+        uint64_t size;
+    };
+
+    // class member reads the data of a single member, through a
+    // gz_file restricted to the segment of the archive file that
+    // holds that member
+    //
+    class member {
+        gz_file gz;
+        uint64_t size;
+
+    public:
+
+        member(const char *filename, const uint8_t *key, const member_info &info) :
+            gz{filename, key, info.offset, info.length},
+            size{info.size} { }
+
+        ssize_t read(uint8_t *buffer, size_t len) {
+            return gz.read(buffer, std::min(len, (size_t)(size - gz.tell())));
+        }
+
+        ssize_t getline(std::string &s) {
+            return gz.getline(s, size - gz.tell());
+        }
+
+        ssize_t getline(std::string_view &line) {
+            return gz.getline(line, size - gz.tell());
+        }
+    };
+
+private:
+
+    std::string filename;
+    cryptovar<16> key;
+    std::vector<member_info> members;
+    bool valid = false;
+
+    const uint8_t *key_or_null() const {
+        return key.is_null() ? nullptr : key.value;
+    }
+
+    // read_footer(f, offset, length) sets offset and length to the
+    // location of the index, and returns true if f has a valid footer
+    //
+    static bool read_footer(FILE *f, uint64_t &offset, uint64_t &length) {
+        uint8_t footer[indexed_archive_format::footer_length];
+        if (fseek(f, -(long)sizeof(footer), SEEK_END) != 0) {
+            return false;
+        }
+        long footer_offset = ftell(f);
+        if (fread(footer, 1, sizeof(footer), f) != sizeof(footer)) {
+            return false;
+        }
+        if (memcmp(footer, indexed_archive_format::magic, sizeof(indexed_archive_format::magic)) != 0) {
+            return false;
+        }
+        offset = indexed_archive_format::decode_uint64(footer + 8);
+        length = indexed_archive_format::decode_uint64(footer + 16);
+        return offset <= (uint64_t)footer_offset && length <= (uint64_t)footer_offset - offset;
+    }
+
+    bool parse_index_line(const std::string &line) {
+        std::string_view fields[4];
+        size_t start = 0;
+        for (size_t i = 0; i < 4; i++) {
+            size_t end = (i == 3) ? line.length() : line.find('\t', start);
+            if (end == std::string::npos) {
+                return false;
+            }
+            fields[i] = std::string_view{line}.substr(start, end - start);
+            start = end + 1;
+        }
+        uint64_t values[3];
+        for (size_t i = 0; i < 3; i++) {
+            std::string tmp{fields[i+1]};
+            char *end = nullptr;
+            values[i] = strtoull(tmp.c_str(), &end, 10);
+            if (tmp.empty() || *end != '\0') {
+                return false;
+            }
+        }
+        members.push_back({ std::string{fields[0]}, values[0], values[1], values[2] });
+        return true;
+    }
+
+public:
+
+    indexed_archive(const char *archive_filename, const uint8_t *dec_key=nullptr) :
+        filename{archive_filename},
+        key{dec_key}
+    {
+        FILE *f = fopen(archive_filename, "r");
+        if (f == nullptr) {
+            printf_err(log_err, "could not open archive file %s\n", archive_filename);
+            return;
+        }
+        uint64_t index_offset = 0;
+        uint64_t index_length = 0;
+        bool has_footer = read_footer(f, index_offset, index_length);
+        fclose(f);
+        if (!has_footer) {
+            printf_err(log_err, "archive file %s is not an indexed archive\n", archive_filename);
+            return;
+        }
+
+        gz_file index{archive_filename, key_or_null(), index_offset, index_length};
+        std::string line;
+        while (index.getline(line, SSIZE_MAX) > 0) {
+            if (!parse_index_line(line)) {
+                printf_err(log_err, "invalid index entry in archive file %s\n", archive_filename);
+                members.clear();
+                return;
+            }
+            const member_info &m = members.back();
+            if (m.length > index_offset || m.offset > index_offset - m.length) {
+                printf_err(log_err, "index entry for %s lies outside of archive file %s\n",
+                           m.name.c_str(), archive_filename);
+                members.clear();
+                return;
+            }
+        }
+        valid = !members.empty();
+    }
+
+    // is_indexed_archive(filename) returns true if filename ends with
+    // an indexed archive footer; it is used to decide which reader
+    // to use for a resource file
+    //
+    static bool is_indexed_archive(const char *filename) {
+        FILE *f = fopen(filename, "r");
+        if (f == nullptr) {
+            return false;
+        }
+        uint64_t offset, length;
+        bool result = read_footer(f, offset, length);
+        fclose(f);
+        return result;
+    }
+
+    bool is_valid() const { return valid; }
+
+    const std::vector<member_info> &get_members() const { return members; }
+
+    // find(name) returns the member_info with the given name, or
+    // nullptr if there is none
+    //
+    const member_info *find(std::string_view name) const {
+        for (const auto &m : members) {
+            if (m.name == name) {
+                return &m;
+            }
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<member> open(const member_info &info) const {
+        return std::make_unique<member>(filename.c_str(), key_or_null(), info);
+    }
+
+};
+
+
+// class indexed_archive_writer creates an indexed archive; members are
+// written with add_member(), and the index and footer are written by
+// close(), which must be called after the last member is added
+//
+class indexed_archive_writer {
+    FILE *file;
+    cryptovar<16> key;
+    EVP_CIPHER_CTX *ctx = nullptr;
+    std::vector<indexed_archive::member_info> members;
+    uint64_t position = 0;
+    bool ok = true;
+
+    // compress(data, len, out) sets out to the gzip compressed form of data
+    //
+    static bool compress(const uint8_t *data, size_t len, std::vector<uint8_t> &out) {
+        z_stream z = {};
+        if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        out.resize(deflateBound(&z, len) + 32);
+        z.next_in = (Bytef *)data;
+        z.avail_in = len;
+        z.next_out = out.data();
+        z.avail_out = out.size();
+        int err = deflate(&z, Z_FINISH);
+        out.resize(out.size() - z.avail_out);
+        deflateEnd(&z);
+        return err == Z_STREAM_END;
+    }
+
+    // encrypt(data) encrypts data in place, in the form read by
+    // encrypted_file, if a key is in use
+    //
+    bool encrypt(std::vector<uint8_t> &data) {
+        if (key.is_null()) {
+            return true;
+        }
+        uint8_t iv[16] = { 0, };
+        uint8_t random_block[16];
+        if (RAND_bytes(random_block, sizeof(random_block)) != 1) {
+            return false;
+        }
+        if (EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), nullptr, key.value, iv) != 1) {
+            return false;
+        }
+        std::vector<uint8_t> ct(data.size() + 2 * sizeof(random_block));
+        int len1 = 0, len2 = 0, len3 = 0;
+        if (EVP_EncryptUpdate(ctx, ct.data(), &len1, random_block, sizeof(random_block)) != 1
+            || EVP_EncryptUpdate(ctx, ct.data() + len1, &len2, data.data(), data.size()) != 1
+            || EVP_EncryptFinal_ex(ctx, ct.data() + len1 + len2, &len3) != 1) {
+            return false;
+        }
+        ct.resize(len1 + len2 + len3);
+        data.swap(ct);
+        return true;
+    }
+
+    bool write_stream(const uint8_t *data, size_t len, uint64_t &length) {
+        std::vector<uint8_t> out;
+        if (!compress(data, len, out) || !encrypt(out)) {
+            return false;
+        }
+        if (fwrite(out.data(), 1, out.size(), file) != out.size()) {
+            return false;
+        }
+        length = out.size();
+        position += length;
+        return true;
+    }
+
+public:
+
+    indexed_archive_writer(const char *filename, const uint8_t *enc_key=nullptr) :
+        file{fopen(filename, "w")},
+        key{enc_key}
+    {
+        if (file == nullptr) {
+            printf_err(log_err, "could not open archive file %s for writing\n", filename);
+            ok = false;
+            return;
+        }
+        if (!key.is_null()) {
+            ctx = EVP_CIPHER_CTX_new();
+            if (ctx == nullptr) {
+                ok = false;
+            }
+        }
+    }
+
+    ~indexed_archive_writer() {
+        if (file) {
+            close();
+        }
+        if (ctx) {
+            EVP_CIPHER_CTX_free(ctx);
+        }
+    }
+
+    bool is_valid() const { return ok; }
+
+    bool add_member(const std::string &name, const uint8_t *data, size_t len) {
+        if (!ok) {
+            return false;
+        }
+        if (name.empty() || name.find_first_of("\t\n") != std::string::npos) {
+            printf_err(log_err, "invalid archive member name '%s'\n", name.c_str());
+            return false;
+        }
+        uint64_t offset = position;
+        uint64_t length = 0;
+        if (!write_stream(data, len, length)) {
+            printf_err(log_err, "could not write archive member %s\n", name.c_str());
+            ok = false;
+            return false;
+        }
+        members.push_back({ name, offset, length, len });
+        return true;
+    }
+
+    // close() writes the index and the footer, and closes the file;
+    // it returns true if the whole archive was written successfully
+    //
+    bool close() {
+        if (file == nullptr) {
+            return false;
+        }
+        if (ok) {
+            std::string index;
+            for (const auto &m : members) {
+                index += m.name + '\t' + std::to_string(m.offset) + '\t' + std::to_string(m.length) + '\t' + std::to_string(m.size) + '\n';
+            }
+            uint64_t index_offset = position;
+            uint64_t index_length = 0;
+            ok = write_stream((const uint8_t *)index.data(), index.length(), index_length);
+            uint8_t footer[indexed_archive_format::footer_length];
+            memcpy(footer, indexed_archive_format::magic, sizeof(indexed_archive_format::magic));
+            indexed_archive_format::encode_uint64(footer + 8, index_offset);
+            indexed_archive_format::encode_uint64(footer + 16, index_length);
+            ok = ok && fwrite(footer, 1, sizeof(footer), file) == sizeof(footer);
+        }
+        ok = (fclose(file) == 0) && ok;
+        file = nullptr;
+        return ok;
+    }
+
+};
+
+#endif // INDEXED_ARCHIVE_HPP
@@ -129,6 +129,39 @@ size_t mercury_packet_processor_write_json_linktype(mercury_packet_processor pro
     return 0;
 }
 
+size_t mercury_packet_processor_write_os_identification(mercury_packet_processor processor, void *buffer, size_t buffer_size, struct timespec* ts)
+{
+    try {
+        return processor->write_os_verdicts(buffer, buffer_size, ts);
+    }
+    catch (std::exception &e) {
+        printf_err(log_err, "%s\n", e.what());
+    }
+    return 0;
+}
+
+size_t mercury_packet_processor_write_ssh_kex(mercury_packet_processor processor, void *buffer, size_t buffer_size)
+{
+    try {
+        return processor->write_ssh_kex(buffer, buffer_size);
+    }
+    catch (std::exception &e) {
+        printf_err(log_err, "%s\n", e.what());
+    }
+    return 0;
+}
+
+size_t mercury_packet_processor_write_flow_records(mercury_packet_processor processor, void *buffer, size_t buffer_size)
+{
+    try {
+        return processor->write_flow_records(buffer, buffer_size);
+    }
+    catch (std::exception &e) {
+        printf_err(log_err, "%s\n", e.what());
+    }
+    return 0;
+}
+
 const struct analysis_context *mercury_packet_processor_ip_get_analysis_context(mercury_packet_processor processor, uint8_t *packet, size_t length, struct timespec* ts)
 {
     try {
@@ -296,6 +296,78 @@ size_t mercury_packet_processor_write_json_linktype(mercury_packet_processor pro
                                            struct timespec* ts,
                                            uint16_t linktype);
 
+/**
+ * mercury_packet_processor_write_os_identification() writes the
+ * pending OS identification verdicts of a packet processor into a
+ * buffer, as JSON records, one per line.  All of the hosts that have
+ * not yet been reported are reported, so this function should be
+ * called after the last packet has been processed, and before the
+ * processor is destructed.  Call it repeatedly until it returns zero,
+ * to obtain all of the verdicts.  OS identification is enabled with
+ * the "os-identification" option in packet_filter_cfg, and requires
+ * a resource archive that contains an OS identification model.
+ *
+ * @param processor (input) is a packet processor context to be used
+ * @param buffer (output) - location to which JSON will be written
+ * @param buffer_size (input) - length of buffer in bytes
+ * @param ts (input) - timestamp to be reported in the records
+ *
+ * @return the number of bytes of JSON output written.
+ */
+#ifdef __cplusplus
+extern "C" LIBMERC_DLL_EXPORTED
+#endif
+size_t mercury_packet_processor_write_os_identification(mercury_packet_processor processor,
+                                                        void *buffer,
+                                                        size_t buffer_size,
+                                                        struct timespec* ts);
+
+/**
+ * mercury_packet_processor_write_ssh_kex() writes the SSH KEXINIT
+ * messages of a packet processor that are held waiting for the
+ * KEXINIT sent in the other direction of the same connection into a
+ * buffer, as JSON records, one per line.  All of the held messages
+ * are reported on their own, so this function should be called after
+ * the last packet has been processed, and before the processor is
+ * destructed.  Call it repeatedly until it returns zero, to obtain
+ * all of the records.
+ *
+ * @param processor (input) is a packet processor context to be used
+ * @param buffer (output) - location to which JSON will be written
+ * @param buffer_size (input) - length of buffer in bytes
+ *
+ * @return the number of bytes of JSON output written.
+ */
+#ifdef __cplusplus
+extern "C" LIBMERC_DLL_EXPORTED
+#endif
+size_t mercury_packet_processor_write_ssh_kex(mercury_packet_processor processor,
+                                              void *buffer,
+                                              size_t buffer_size);
+
+/**
+ * mercury_packet_processor_write_flow_records() writes the records of
+ * the flows of a packet processor that have not yet been reported
+ * into a buffer, as JSON records, one per line.  All of the flows in
+ * the processor's flow table are ended and reported, so this function
+ * should be called after the last packet has been processed, and
+ * before the processor is destructed.  Call it repeatedly until it
+ * returns zero, to obtain all of the records.  Flow records are
+ * enabled with the "flow-records" option in packet_filter_cfg.
+ *
+ * @param processor (input) is a packet processor context to be used
+ * @param buffer (output) - location to which JSON will be written
+ * @param buffer_size (input) - length of buffer in bytes
+ *
+ * @return the number of bytes of JSON output written.
+ */
+#ifdef __cplusplus
+extern "C" LIBMERC_DLL_EXPORTED
+#endif
+size_t mercury_packet_processor_write_flow_records(mercury_packet_processor processor,
+                                                   void *buffer,
+                                                   size_t buffer_size);
+
 /**
  * enum fingerprint_status represents the status of a fingerprint
  * relative to the library's knowledge about fingerprints, based on
@@ -308,6 +380,7 @@ enum fingerprint_status {
     fingerprint_status_randomized        = 2,  /**< fingerprint is not in FPDB or unlabeled set         */
     fingerprint_status_unlabled          = 3,  /**< fingerprint is not in FPDB, but is in unlabeled set */
     fingerprint_status_unanalyzed        = 4,  /**< fingerprint unanalyzed (no FPDB for this fp type)   */
+    fingerprint_status_approximate       = 5,  /**< fingerprint not in FPDB, but close to one that is   */
 };
 
 /**
@@ -0,0 +1,150 @@
+// media_session.hpp
+//
+// tracking of the UDP flows that carry STUN, DTLS, and RTP/SRTP
+// multiplexed on a single port, as WebRTC does
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef MEDIA_SESSION_HPP
+#define MEDIA_SESSION_HPP
+
+#include <time.h>
+#include <cinttypes>
+#include "libmerc.h"
+#include "datum.h"
+#include "tcp.h"
+#include "bounded_table.hpp"
+
+// class media_session_table remembers the UDP flows on which a STUN
+// message or a DTLS handshake has been seen, so that the RTP and
+// SRTP packets that follow on those flows, which make up nearly all
+// of the traffic of a WebRTC session, can be counted without being
+// run through the UDP protocol matchers and parsers.  Following RFC
+// 7983, a packet on such a flow whose first byte is in the range
+// 128-191 is RTP or RTCP; packets with other first bytes, such as
+// the STUN consent checks and DTLS messages of the session, are
+// processed as usual.
+//
+// A session is forgotten after idle_timeout seconds without a
+// packet, and the oldest session is discarded when the table holds
+// max_entries sessions.  Since packets are looked up only if their
+// first byte is in the RTP range and the table is not empty, other
+// UDP traffic pays for a single comparison.
+//
+class media_session_table {
+
+    struct session {
+        time_t last_seen;
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+    };
+
+    bounded_table<key, session> table;
+    uint64_t media_packets = 0;
+    uint64_t sessions_added = 0;
+
+public:
+
+    static constexpr time_t idle_timeout = 60;
+    static constexpr size_t default_max_entries = 4096;
+
+    explicit media_session_table(size_t max=default_max_entries) : table{max} { }
+
+    // is_rtp(pkt) returns true if the first byte of the UDP payload
+    // pkt is in the range that RFC 7983 assigns to RTP and RTCP
+    //
+    static bool is_rtp(const datum &pkt) {
+        return pkt.is_not_empty() && pkt.data[0] >= 128 && pkt.data[0] <= 191;
+    }
+
+    // add_session(k, ts) records that the UDP flow with key k, in
+    // either direction, carries a media session, as of time ts
+    //
+    void add_session(const key &k, time_t ts) {
+        auto it = table.find(k);
+        if (it == table.end()) {
+            it = table.find(k.reverse());
+        }
+        if (it != table.end()) {
+            it->second.last_seen = ts;
+            return;
+        }
+        table.find_or_insert(k)->second.last_seen = ts;
+        sessions_added++;
+    }
+
+    // count_media_packet(k, pkt, ts) returns true, and counts pkt
+    // against its session, if pkt is an RTP or RTCP packet on a flow
+    // with a media session; otherwise, it returns false, and the
+    // packet should be processed as usual
+    //
+    bool count_media_packet(const key &k, const datum &pkt, time_t ts) {
+        if (table.empty() || !is_rtp(pkt)) {
+            return false;
+        }
+        auto it = table.find(k);
+        if (it == table.end()) {
+            it = table.find(k.reverse());
+            if (it == table.end()) {
+                return false;
+            }
+        }
+        if (ts - it->second.last_seen > idle_timeout) {
+            return false;      // stale; removed when it is the oldest session
+        }
+        it->second.last_seen = ts;
+        it->second.packets++;
+        it->second.bytes += pkt.length();
+        media_packets++;
+        return true;
+    }
+
+    size_t size() const { return table.size(); }
+
+    uint64_t get_media_packets() const { return media_packets; }
+
+    // log_and_reset() reports the number of sessions and of the media
+    // packets counted through printf_err(), if there were any, and
+    // then sets those counts to zero
+    //
+    void log_and_reset() {
+        if (sessions_added) {
+            printf_err(log_info,
+                       "udp media sessions: %" PRIu64 " media packets counted without classification: %" PRIu64 "\n",
+                       sessions_added,
+                       media_packets);
+        }
+        sessions_added = 0;
+        media_packets = 0;
+    }
+
+    static bool unit_test() {
+        media_session_table t{2};
+        struct key k{5000, 6000, 0x0100000a, 0x0200000a, 17};
+        uint8_t rtp[] = { 0x80, 0x60, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78 };
+        uint8_t stun[] = { 0x00, 0x01, 0x00, 0x00, 0x21, 0x12, 0xa4, 0x42 };
+        datum rtp_pkt{rtp, rtp + sizeof(rtp)};
+        datum stun_pkt{stun, stun + sizeof(stun)};
+        if (t.count_media_packet(k, rtp_pkt, 100)) {
+            return false;                               // no session yet
+        }
+        t.add_session(k, 100);
+        if (!t.count_media_packet(k.reverse(), rtp_pkt, 101) || t.count_media_packet(k, stun_pkt, 101)) {
+            return false;
+        }
+        if (t.count_media_packet(k, rtp_pkt, 101 + idle_timeout + 1)) {
+            return false;                               // idle session
+        }
+
+        // the oldest session is discarded when the table is full
+        //
+        t.add_session(k.reverse(), 200);                // refreshes existing session
+        t.add_session(key{1, 2, 3, 4, 17}, 200);
+        t.add_session(key{5, 6, 7, 8, 17}, 200);
+        return t.size() == 2 && !t.count_media_packet(k, rtp_pkt, 200) && t.get_media_packets() == 1;
+    }
+
+};
+
+#endif // MEDIA_SESSION_HPP
@@ -424,6 +424,7 @@ namespace mysql_consts{
 };
 
 class mysql_server_greet : public base_protocol {
+    ssize_t available;  // bytes present, including the packet header
     uint32_t len;    // 3 bytes in little endian
     encoded<uint8_t> pkt_num;
     encoded<uint8_t> proto;    // fixed 0x0A
@@ -447,6 +448,7 @@ class mysql_server_greet : public base_protocol {
 public:
 
     mysql_server_greet (datum &pkt) :
+        available{pkt.length()},
         len{ (encoded<uint8_t>{pkt}.value()) + (encoded<uint8_t>{pkt}.value() << 8) + (encoded<uint8_t>{pkt}.value() << 16) },
         pkt_num{pkt},
         proto{pkt},
@@ -509,6 +511,27 @@ public:
 
         bool is_not_empty() { return valid; }
 
+        // bytes_needed() returns the number of bytes of the greeting,
+        // as given by the length in its packet header, that were not
+        // present.  Since the matcher for greetings is weak, the
+        // length is trusted only if it is no longer than any greeting
+        // that a server sends, and the protocol version is 10.
+        //
+        size_t bytes_needed() const {
+            if (len > max_greeting_length || proto.value() != 0x0a) {
+                return 0;
+            }
+            size_t total = len + header_length;
+            return total > (size_t)available ? total - available : 0;
+        }
+
+        static constexpr size_t header_length = 4;  // length and packet number
+
+        // the longest greeting that we expect: the version string,
+        // salt, and authentication plugin name are all short
+        //
+        static constexpr size_t max_greeting_length = 1024;
+
         void write_json(struct json_object &record, bool output_metadata) {
             if (!valid) {
                 return;
@@ -556,6 +579,29 @@ public:
         3,      // skip 3 bytes from start
     };
 
+    static bool unit_test() {
+        uint8_t greeting[] = {
+            0x4a, 0x00, 0x00,                                // length (74)
+            0x00,                                            // packet number
+            0x0a,                                            // protocol
+            '8', '.', '0', '.', '3', '2', 0x00,              // version
+            0x09, 0x00, 0x00, 0x00,                          // thread id
+            'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 0x00,    // salt
+        };
+        datum d{greeting, greeting + sizeof(greeting)};
+        mysql_server_greet truncated{d};
+        if (truncated.bytes_needed() != 74 + header_length - sizeof(greeting)) {
+            return false;
+        }
+
+        // a length longer than any greeting is not trusted
+        //
+        greeting[2] = 0x01;
+        d = datum{greeting, greeting + sizeof(greeting)};
+        mysql_server_greet bogus{d};
+        return bogus.bytes_needed() == 0;
+    }
+
 };
 
 namespace {
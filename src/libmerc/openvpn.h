@@ -350,11 +350,19 @@ public:
     bool get_keyid() const { return !key_id;  } // return true for zeroed key_id
 };
 
+// openvpn_reassembly_buffer holds the data of the control records of
+// an openvpn_tcp message, reassembled so that the TLS client hello
+// that they carry can be parsed; it is held by the packet processor
+// and reused for each message, so that it is not part of each
+// openvpn_tcp
+//
+using openvpn_reassembly_buffer = data_buffer<800>;
+
 class openvpn_tcp : public base_protocol {
     std::vector<openvpn_tcp_record> ctrl_records;
     std::vector<openvpn_tcp_record> ack_records;
     uint8_t num_records = 0;
-    data_buffer<800> reassembly_buff;
+    openvpn_reassembly_buffer &reassembly_buff;
     bool valid = false;
     tls_handshake handshake;
     tls_client_hello hello;
@@ -362,7 +370,8 @@ class openvpn_tcp : public base_protocol {
     bool fp_true = false;
 
 public:
-    openvpn_tcp(datum& d) {
+    openvpn_tcp(datum& d, openvpn_reassembly_buffer &buffer) : reassembly_buff{buffer} {
+        reassembly_buff.reset();
         while (d.is_not_empty()) {
             openvpn_tcp_record record{d};
             // TODO: set d null for non valid
@@ -504,7 +513,8 @@ namespace {
         struct json_object record(&buf_json);
         
 
-        openvpn_tcp pkt_openvpn{pkt_data};
+        openvpn_reassembly_buffer reassembly_buffer;
+        openvpn_tcp pkt_openvpn{pkt_data, reassembly_buffer};
         if (pkt_openvpn.is_not_empty()) {
             pkt_openvpn.write_json(record, true);
             pkt_openvpn.fingerprint(buf_fp);
@@ -0,0 +1,870 @@
+// os_identification.hpp
+//
+// passive operating system identification from the TCP, TLS, and
+// HTTP fingerprints observed from each host
+//
+// Copyright (c) 2021 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef OS_IDENTIFICATION_HPP
+#define OS_IDENTIFICATION_HPP
+
+#include <math.h>
+#include <zlib.h>
+#include <cinttypes>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+
+#include "libmerc.h"
+#include "archive.h"
+#include "indexed_archive.hpp"
+#include "json_object.h"
+
+#include "rapidjson/document.h"
+#include "rapidjson/istreamwrapper.h"
+
+
+static inline int gzgetline(gzFile f, std::vector<char>& v) {
+    v = std::vector<char>(256);
+    unsigned pos = 0;
+    for (;;) {
+        if (gzgets(f, &v[pos], v.size()-pos) == 0) {
+            // EOF
+            return 0;
+        }
+        unsigned read = strlen(&v[pos]);
+        if (v[pos+read-1] == '\n') {
+            pos = pos + read - 1;
+            break;
+        }
+        pos = v.size() - 1;
+        v.resize(v.size() * 2);
+    }
+    v.resize(pos);
+    return 1;
+}
+
+
+
+struct os_result {
+    std::string os_name;
+    double probability;
+};
+
+struct os_classifier {
+    std::vector<double> coefficients;
+    std::vector<double> intercepts;
+    std::vector<std::string> labels;
+    int os_len = 0;
+    int label_len = 0;
+    std::unordered_map<std::string, int> os_map;
+
+    os_classifier() = default;
+
+    os_classifier(const char *os_classifier_file) {
+        rapidjson::Document clf_params;
+
+        /* read OS classifiers parameters in rapidjson object */
+        std::ifstream ifs {os_classifier_file};
+        if (!ifs.is_open()) {
+            return ;
+        }
+        rapidjson::IStreamWrapper isw{ifs};
+        clf_params.ParseStream(isw);
+        set_parameters(clf_params);
+    };
+
+    // os_classifier(json, length) reads the classifier parameters
+    // from a JSON object held in memory, such as an entry in a
+    // resource archive
+    //
+    os_classifier(const char *json, size_t length) {
+        rapidjson::Document clf_params;
+        clf_params.Parse(json, length);
+        set_parameters(clf_params);
+    }
+
+    // is_valid() returns true if the parameters of this classifier
+    // were successfully read
+    //
+    bool is_valid() const { return label_len > 0 && os_len > 0; }
+
+    size_t feature_len() const { return os_len * 3; }
+
+    // classify(features, r) normalizes a copy of the raw feature
+    // vector (each of the tcp, tls, and http sections separately),
+    // then applies the multinomial logistic regression model; the
+    // features themselves are not modified, so that a host can be
+    // classified repeatedly as its observations accumulate
+    //
+    void classify(const double *features, struct os_result *r) const {
+        thread_local std::vector<double> normalized;
+        thread_local std::vector<double> scores;
+        normalized.assign(features, features + feature_len());
+        for (int section = 0; section < 3; section++) {
+            double *f = normalized.data() + section * os_len;
+            double sum = 0.0;
+            for (int i = 0; i < os_len; i++) {
+                sum += f[i];
+            }
+            if (sum > 0.0) {
+                for (int i = 0; i < os_len; i++) {
+                    f[i] /= sum;
+                }
+            }
+        }
+
+        scores.resize(label_len);
+        double score_sum = 0.0;
+        for (int i = 0; i < label_len; i++) {
+            scores[i] = intercepts[i];
+            const double *c = &coefficients[i*os_len*3];
+            for (int j = 0; j < os_len*3; j++) {
+                scores[i] += c[j]*normalized[j];
+            }
+            score_sum += exp(scores[i]);
+        }
+
+        double prob = 0.0;
+        double tmp_prob;
+        int label_idx = 0;
+        for (int i = 0; i < label_len; i++) {
+            tmp_prob = exp(scores[i])/score_sum;
+            if (tmp_prob > prob) {
+                prob = tmp_prob;
+                label_idx = i;
+            }
+        }
+
+        r->os_name = labels[label_idx];
+        r->probability = prob;
+    }
+
+private:
+
+    void set_parameters(const rapidjson::Document &clf_params) {
+        if (clf_params.HasParseError() || !clf_params.IsObject()) {
+            return;
+        }
+        for (const char *member : { "os_len", "labels", "intercepts", "coefficients", "os_map" }) {
+            if (!clf_params.HasMember(member)) {
+                return;
+            }
+        }
+        if (!clf_params["os_len"].IsInt() || !clf_params["labels"].IsArray() || !clf_params["intercepts"].IsArray()
+            || !clf_params["coefficients"].IsArray() || !clf_params["os_map"].IsObject()) {
+            return;
+        }
+        int num_features = clf_params["os_len"].GetInt();
+
+        /* read in labels */
+        const rapidjson::Value& lbls = clf_params["labels"];
+        std::vector<std::string> tmp_labels(lbls.Size());
+        for (rapidjson::SizeType i = 0; i < lbls.Size(); i++) {
+            if (!lbls[i].IsString()) {
+                return;
+            }
+            tmp_labels[i] = lbls[i].GetString();
+        }
+        int num_labels = tmp_labels.size();
+
+        /* read in intercepts */
+        const rapidjson::Value& intc = clf_params["intercepts"];
+        if ((int)intc.Size() != num_labels) {
+            return;
+        }
+        intercepts.resize(num_labels);
+        for (rapidjson::SizeType i = 0; i < intc.Size(); i++) {
+            intercepts[i] = intc[i].GetDouble();
+        }
+
+        /* read in coefficients */
+        const rapidjson::Value& cff = clf_params["coefficients"];
+        if ((int)cff.Size() != num_labels) {
+            return;
+        }
+        coefficients.assign(num_labels*num_features*3, 0.0);
+        for (rapidjson::SizeType i = 0; i < cff.Size(); i++) {
+            const rapidjson::Value& cff_inner = cff[i];
+            for (rapidjson::SizeType j = 0; j < cff_inner.Size() && (int)j < num_features*3; j++) {
+                coefficients[i*num_features*3+j] = cff_inner[j].GetDouble();
+            }
+        }
+
+        /* read in os_map */
+        const rapidjson::Value& os_m = clf_params["os_map"];
+        for (rapidjson::Value::ConstMemberIterator iter = os_m.MemberBegin(); iter != os_m.MemberEnd(); ++iter){
+            if (iter->value.IsInt() && iter->value.GetInt() >= 0 && iter->value.GetInt() < num_features) {
+                os_map[iter->name.GetString()] = iter->value.GetInt();
+            }
+        }
+
+        labels = std::move(tmp_labels);
+        os_len = num_features;
+        label_len = num_labels;
+    }
+
+};
+
+
+// enum os_fp_type identifies the section of the feature vector that a
+// fingerprint type contributes to
+//
+enum os_fp_type : uint8_t {
+    os_fp_tcp  = 0,
+    os_fp_tls  = 1,
+    os_fp_http = 2,
+    os_fp_unknown = 3,
+};
+
+static inline os_fp_type os_fp_type_from_fingerprint_type(fingerprint_type type) {
+    switch (type) {
+    case fingerprint_type_tcp:  return os_fp_tcp;
+    case fingerprint_type_tls:  return os_fp_tls;
+    case fingerprint_type_http: return os_fp_http;
+    default:
+        ;
+    }
+    return os_fp_unknown;
+}
+
+static inline os_fp_type os_fp_type_from_string(std::string_view s) {
+    if (s == "tcp")  { return os_fp_tcp; }
+    if (s == "tls")  { return os_fp_tls; }
+    if (s == "http") { return os_fp_http; }
+    return os_fp_unknown;
+}
+
+// class os_fingerprint_table maps each fingerprint string in an OS
+// fingerprint database to its sparse contribution to the feature
+// vector, as a list of (feature index, weight) pairs.  The OS names
+// are resolved to feature indices once, when the table is loaded, so
+// that a lookup is a single hash table probe.  The table is keyed by
+// views of the fingerprint strings, which are kept in a deque so that
+// they do not move, and so a fingerprint can be looked up without
+// copying it into a std::string.  After construction, the table is
+// read-only and can be shared across threads.
+//
+class os_fingerprint_table {
+public:
+    struct contribution {
+        uint32_t index;
+        double weight;
+    };
+
+private:
+    std::unordered_map<std::string_view, std::vector<contribution>> table;
+    std::deque<std::string> keys;
+
+public:
+
+    os_fingerprint_table() = default;
+
+    os_fingerprint_table(const os_fingerprint_table &) = delete;
+    os_fingerprint_table &operator=(const os_fingerprint_table &) = delete;
+
+    // load(resource_file, clf, section) reads a gzipped OS
+    // fingerprint database, and returns 0 on success and -1 otherwise
+    //
+    int load(const char *resource_file, const os_classifier &clf, os_fp_type section) {
+        table.clear();
+        keys.clear();
+        gzFile in_file = gzopen(resource_file, "r");
+        if (in_file == NULL) {
+            return -1;
+        }
+        std::vector<char> line;
+        while (gzgetline(in_file, line)) {
+            process_line(std::string(line.begin(), line.end()), clf, section);
+        }
+        gzclose(in_file);
+        return 0;
+    }
+
+    // process_line(line, clf, section) adds the fingerprint in a
+    // single line of an OS fingerprint database to the table
+    //
+    void process_line(const std::string &line_str, const os_classifier &clf, os_fp_type section) {
+        rapidjson::Document fp;
+        fp.Parse(line_str.c_str());
+        if (fp.HasParseError() || !fp.IsObject() || !fp.HasMember("str_repr") || !fp.HasMember("os_info")
+            || !fp["str_repr"].IsString() || !fp["os_info"].IsObject()) {
+            return;
+        }
+        std::string_view str_repr{fp["str_repr"].GetString(), fp["str_repr"].GetStringLength()};
+        if (table.find(str_repr) != table.end()) {
+            return;   // the first entry for a fingerprint takes precedence
+        }
+        keys.emplace_back(str_repr);
+        std::vector<contribution> &c = table[keys.back()];
+        const rapidjson::Value& os_keys = fp["os_info"];
+        for (rapidjson::Value::ConstMemberIterator iter = os_keys.MemberBegin(); iter != os_keys.MemberEnd(); ++iter){
+            auto it = clf.os_map.find(iter->name.GetString());
+            if (it != clf.os_map.end() && iter->value.IsNumber()) {
+                c.push_back({ (uint32_t)(it->second + section * clf.os_len), iter->value.GetDouble() });
+            }
+        }
+    }
+
+    const std::vector<contribution> *find(std::string_view str_repr) const {
+        auto it = table.find(str_repr);
+        if (it == table.end()) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    size_t size() const { return table.size(); }
+};
+
+// struct os_model holds the classifier and the three fingerprint
+// tables, all of which are read-only after initialization
+//
+struct os_model {
+    os_classifier clf;
+    os_fingerprint_table fp_tables[3];
+
+    // lookup(type, str_repr) returns the contribution of a
+    // fingerprint to the feature vector, or nullptr if it is not in
+    // the database.  The OS fingerprint databases omit the type and
+    // format prefix (such as "tls/1/") that libmerc writes, so any
+    // such prefix is ignored.
+    //
+    const std::vector<os_fingerprint_table::contribution> *lookup(os_fp_type type, std::string_view str_repr) const {
+        if (type >= os_fp_unknown) {
+            return nullptr;
+        }
+        size_t paren = str_repr.find('(');
+        if (paren != 0 && paren != std::string_view::npos) {
+            str_repr.remove_prefix(paren);
+        }
+        return fp_tables[type].find(str_repr);
+    }
+
+    // lookup_or_empty() is like lookup(), but returns an empty list
+    // for an unknown fingerprint, so that the host is still tracked
+    //
+    const std::vector<os_fingerprint_table::contribution> *lookup_or_empty(os_fp_type type, std::string_view str_repr) const {
+        static const std::vector<os_fingerprint_table::contribution> empty;
+        const auto *c = lookup(type, str_repr);
+        return c ? c : &empty;
+    }
+
+    // init(resource_dir) loads the model from the first directory that
+    // contains it, and returns 0 on success and -1 otherwise
+    //
+    int init(const char *resource_dir) {
+        const char *resource_dir_list[] =
+            {
+             DEFAULT_RESOURCE_DIR,
+             "resources",
+             "../resources",
+             NULL
+            };
+        if (resource_dir) {
+            resource_dir_list[0] = resource_dir;  // use directory from configuration
+            resource_dir_list[1] = NULL;          // fail otherwise
+        }
+
+        std::string dir;
+        for (unsigned int index = 0; resource_dir_list[index] != NULL; index++) {
+            dir = resource_dir_list[index];
+            clf = os_classifier((dir + "/os_detection_model.json").c_str());
+            if (!clf.is_valid()) {
+                continue;
+            }
+            int retcode = fp_tables[os_fp_tcp].load((dir + "/fingerprint-db-tcp-os.json.gz").c_str(), clf, os_fp_tcp);
+            retcode |= fp_tables[os_fp_tls].load((dir + "/fingerprint-db-tls-os.json.gz").c_str(), clf, os_fp_tls);
+            retcode |= fp_tables[os_fp_http].load((dir + "/fingerprint-db-http-os.json.gz").c_str(), clf, os_fp_http);
+            if (retcode == 0) {
+                return 0;
+            }
+        }
+        fprintf(stderr, "warning: could not initialize OS analysis module\n");
+        return -1;
+    }
+
+    // load(archive) reads the model from the entries of a resource
+    // archive named os_detection_model.json and
+    // fingerprint-db-{tcp,tls,http}-os.json, and returns true on
+    // success and false otherwise.  Because the fingerprint tables
+    // depend on the classifier's os_map, the archive must contain
+    // the model file ahead of the fingerprint databases.
+    //
+    bool load(encrypted_compressed_archive &archive) {
+        bool got_fp_table[3] = { false, false, false };
+        const class archive_node *entry = archive.get_next_entry();
+        while (entry != nullptr) {
+            if (entry->is_regular_file()) {
+                std::string name = entry->get_name();
+                std::string line_str;
+                if (name == "os_detection_model.json") {
+                    std::string json;
+                    while (archive.getline(line_str)) {
+                        json += line_str;
+                    }
+                    clf = os_classifier{json.data(), json.length()};
+                    if (!clf.is_valid()) {
+                        printf_err(log_err, "could not read OS classifier from resource archive\n");
+                        return false;
+                    }
+                } else {
+                    os_fp_type section = os_fp_unknown;
+                    if (name == "fingerprint-db-tcp-os.json") {
+                        section = os_fp_tcp;
+                    } else if (name == "fingerprint-db-tls-os.json") {
+                        section = os_fp_tls;
+                    } else if (name == "fingerprint-db-http-os.json") {
+                        section = os_fp_http;
+                    }
+                    if (section != os_fp_unknown) {
+                        if (!clf.is_valid()) {
+                            printf_err(log_err, "resource archive entry %s precedes os_detection_model.json\n", name.c_str());
+                            return false;
+                        }
+                        while (archive.getline(line_str)) {
+                            fp_tables[section].process_line(line_str, clf, section);
+                        }
+                        got_fp_table[section] = true;
+                    }
+                }
+            }
+            if (clf.is_valid() && got_fp_table[os_fp_tcp] && got_fp_table[os_fp_tls] && got_fp_table[os_fp_http]) {
+                return true;
+            }
+            entry = archive.get_next_entry();
+        }
+        return clf.is_valid() && (got_fp_table[os_fp_tcp] || got_fp_table[os_fp_tls] || got_fp_table[os_fp_http]);
+    }
+
+    // load(archive) reads the model from an indexed archive, as
+    // above; the members can be read in any order, so the model file
+    // is read first, and then only the fingerprint databases are read
+    //
+    bool load(const indexed_archive &archive) {
+        const indexed_archive::member_info *model_info = archive.find("os_detection_model.json");
+        if (model_info == nullptr) {
+            return false;
+        }
+        std::string json;
+        std::string line_str;
+        auto model_member = archive.open(*model_info);
+        while (model_member->getline(line_str)) {
+            json += line_str;
+        }
+        clf = os_classifier{json.data(), json.length()};
+        if (!clf.is_valid()) {
+            printf_err(log_err, "could not read OS classifier from resource archive\n");
+            return false;
+        }
+        const std::pair<const char *, os_fp_type> fp_table_files[] = {
+            { "fingerprint-db-tcp-os.json", os_fp_tcp },
+            { "fingerprint-db-tls-os.json", os_fp_tls },
+            { "fingerprint-db-http-os.json", os_fp_http },
+        };
+        bool got_fp_table = false;
+        for (const auto &[name, section] : fp_table_files) {
+            const indexed_archive::member_info *info = archive.find(name);
+            if (info == nullptr) {
+                continue;
+            }
+            auto member = archive.open(*info);
+            while (member->getline(line_str)) {
+                fp_tables[section].process_line(line_str, clf, section);
+            }
+            got_fp_table = true;
+        }
+        return got_fp_table;
+    }
+};
+
+
+// class os_host_table accumulates OS feature vectors, keyed by source
+// address.  The feature vectors are stored contiguously in a single
+// array, with one row of os_clf.feature_len() doubles per host, and
+// rows are recycled through a free list.  If max_hosts is nonzero,
+// the table holds at most that many hosts; when it is full, the least
+// recently seen host is evicted (and its verdict emitted if it has
+// not been already).
+//
+// Classification results are reported through the emit callback.  A
+// host is reported when it stabilizes, that is, when two consecutive
+// classifications that follow new observations agree; hosts that
+// have not stabilized are reported by flush().  An os_host_table is
+// not thread safe; os_identification_pipeline gives one to each
+// worker, and os_identification_stage gives one to each packet
+// processor.
+//
+class os_host_table {
+public:
+    using emit_function = std::function<void (const std::string &src_ip, const os_result &r, uint64_t observations)>;
+
+private:
+    static constexpr uint32_t null_row = UINT32_MAX;
+
+    struct host_state {
+        std::string src_ip;
+        double last_seen = 0.0;
+        uint64_t observations = 0;
+        uint64_t observations_at_check = 0;
+        std::string last_label;
+        bool reported = false;
+        uint32_t lru_prev = null_row;    // toward most recently seen
+        uint32_t lru_next = null_row;    // toward least recently seen
+    };
+
+    const os_model &model;
+    size_t row_len;
+    size_t max_hosts;
+    emit_function emit;
+
+    std::vector<double> features;        // row_len doubles per row
+    std::vector<host_state> hosts;       // one entry per row
+    std::vector<uint32_t> free_rows;
+    std::unordered_map<std::string, uint32_t> index;
+    std::string lookup_key;              // reused, to avoid allocation
+    uint32_t lru_head = null_row;        // most recently seen
+    uint32_t lru_tail = null_row;        // least recently seen
+
+public:
+
+    os_host_table(const os_model &m, emit_function f, size_t max=0) :
+        model{m},
+        row_len{m.clf.feature_len()},
+        max_hosts{max},
+        emit{std::move(f)}
+    {
+        if (max_hosts != 0) {
+            features.reserve(max_hosts * row_len);
+            hosts.reserve(max_hosts);
+            index.reserve(max_hosts);
+        }
+    }
+
+    size_t size() const { return index.size(); }
+
+    void update(std::string_view src_ip, const std::vector<os_fingerprint_table::contribution> &c, double timestamp) {
+        uint32_t row = find_or_insert(src_ip);
+        double *f = &features[row * row_len];
+        for (const auto &x : c) {
+            f[x.index] += x.weight;
+        }
+        host_state &h = hosts[row];
+        h.observations++;
+        if (timestamp > h.last_seen) {
+            h.last_seen = timestamp;
+        }
+        touch(row);
+    }
+
+    // classify_stable() classifies each host that has new
+    // observations since the last check, and emits the verdicts of
+    // the hosts whose verdict has not changed since that check
+    //
+    void classify_stable() {
+        for (uint32_t row = lru_head; row != null_row; row = hosts[row].lru_next) {
+            host_state &h = hosts[row];
+            if (h.observations == h.observations_at_check) {
+                continue;
+            }
+            h.observations_at_check = h.observations;
+            os_result r;
+            model.clf.classify(&features[row * row_len], &r);
+            if (r.os_name == h.last_label) {
+                if (!h.reported) {
+                    emit(h.src_ip, r, h.observations);
+                    h.reported = true;
+                }
+            } else {
+                h.last_label = r.os_name;
+                h.reported = false;
+            }
+        }
+    }
+
+    // flush() emits a verdict for every host that has not been
+    // reported with its current verdict, and empties the table
+    //
+    void flush() {
+        while (lru_tail != null_row) {
+            evict(lru_tail);
+        }
+    }
+
+private:
+
+    uint32_t find_or_insert(std::string_view src_ip) {
+        lookup_key.assign(src_ip);
+        auto it = index.find(lookup_key);
+        if (it != index.end()) {
+            return it->second;
+        }
+        if (max_hosts != 0 && index.size() >= max_hosts) {
+            evict(lru_tail);
+        }
+        uint32_t row;
+        if (!free_rows.empty()) {
+            row = free_rows.back();
+            free_rows.pop_back();
+            std::fill_n(&features[row * row_len], row_len, 0.0);
+            hosts[row] = host_state{};
+        } else {
+            row = hosts.size();
+            hosts.emplace_back();
+            features.resize(features.size() + row_len, 0.0);
+        }
+        hosts[row].src_ip = lookup_key;
+        index.emplace(lookup_key, row);
+        link_front(row);
+        return row;
+    }
+
+    void evict(uint32_t row) {
+        host_state &h = hosts[row];
+        os_result r;
+        model.clf.classify(&features[row * row_len], &r);
+        if (!h.reported || r.os_name != h.last_label) {
+            emit(h.src_ip, r, h.observations);
+        }
+        unlink(row);
+        index.erase(h.src_ip);
+        h.src_ip.clear();
+        free_rows.push_back(row);
+    }
+
+    void link_front(uint32_t row) {
+        hosts[row].lru_prev = null_row;
+        hosts[row].lru_next = lru_head;
+        if (lru_head != null_row) {
+            hosts[lru_head].lru_prev = row;
+        }
+        lru_head = row;
+        if (lru_tail == null_row) {
+            lru_tail = row;
+        }
+    }
+
+    void unlink(uint32_t row) {
+        host_state &h = hosts[row];
+        if (h.lru_prev != null_row) {
+            hosts[h.lru_prev].lru_next = h.lru_next;
+        } else {
+            lru_head = h.lru_next;
+        }
+        if (h.lru_next != null_row) {
+            hosts[h.lru_next].lru_prev = h.lru_prev;
+        } else {
+            lru_tail = h.lru_prev;
+        }
+        h.lru_prev = h.lru_next = null_row;
+    }
+
+    void touch(uint32_t row) {
+        if (row != lru_head) {
+            unlink(row);
+            link_front(row);
+        }
+    }
+
+};
+
+
+// class os_identification_stage performs OS identification inside a
+// packet processor, so that no second pass over mercury's JSON output
+// is needed.  Each packet processor owns one stage, so no locking is
+// needed; the model is shared, read-only, by all of them.  The TCP,
+// TLS, and HTTP fingerprints observed from each source address are
+// accumulated in a bounded os_host_table, which is checked every
+// window seconds (of packet time) for hosts whose verdicts have
+// stabilized.  Verdicts are queued until they can be written into an
+// output buffer alongside the packet records, by write_verdicts().
+//
+class os_identification_stage {
+
+    struct verdict {
+        std::string src_ip;
+        os_result result;
+        uint64_t observations;
+    };
+
+    const os_model &model;
+    os_host_table hosts;
+    double window;
+    double next_tick = 0.0;
+    size_t max_pending;
+    std::deque<verdict> pending;
+    bool reported_overflow = false;
+
+    // the longest verdict record that we expect; longer ones are
+    // discarded rather than truncated
+    //
+    static constexpr size_t max_verdict_len = 1024;
+
+public:
+
+    os_identification_stage(const os_model &m, double window_seconds, size_t max_hosts) :
+        model{m},
+        hosts{m, [this](const std::string &src_ip, const os_result &r, uint64_t n) { enqueue(src_ip, r, n); }, max_hosts},
+        window{window_seconds},
+        max_pending{std::max(max_hosts, (size_t)1024)}
+    { }
+
+    os_identification_stage(const os_identification_stage &) = delete;
+    os_identification_stage &operator=(const os_identification_stage &) = delete;
+
+    // is_observed(type) returns true if fingerprints of the given
+    // type are used for OS identification, that is, if they are tcp,
+    // tls, or http fingerprints
+    //
+    static bool is_observed(fingerprint_type type) {
+        return os_fp_type_from_fingerprint_type(type) != os_fp_unknown;
+    }
+
+    // observe(type, fp_str, src_ip, timestamp) adds a fingerprint
+    // observed from src_ip to that host's feature vector; fingerprints
+    // of types other than tcp, tls, and http are ignored
+    //
+    void observe(fingerprint_type type, std::string_view fp_str, std::string_view src_ip, double timestamp) {
+        os_fp_type section = os_fp_type_from_fingerprint_type(type);
+        if (section == os_fp_unknown) {
+            return;
+        }
+        if (window > 0.0) {
+            if (next_tick == 0.0) {
+                next_tick = timestamp + window;
+            } else if (timestamp >= next_tick) {
+                hosts.classify_stable();
+                next_tick = timestamp + window;
+            }
+        }
+        hosts.update(src_ip, *model.lookup_or_empty(section, fp_str), timestamp);
+    }
+
+    // flush() queues a verdict for each host that has not yet been
+    // reported, and empties the host table
+    //
+    void flush() { hosts.flush(); }
+
+    bool has_verdicts() const { return !pending.empty(); }
+
+    // write_verdicts(buf, ts) writes as many queued verdicts into buf
+    // as will fit, each as a JSON record on its own line, and returns
+    // the number written.  It never truncates buf, so it can be
+    // called after a packet's record has been written.
+    //
+    size_t write_verdicts(struct buffer_stream &buf, struct timespec *ts) {
+        size_t count = 0;
+        char tmp[max_verdict_len];
+        while (!pending.empty()) {
+            const verdict &v = pending.front();
+            struct buffer_stream tmp_buf{tmp, sizeof(tmp)};
+            struct json_object record{&tmp_buf};
+            struct json_object os_info{record, "os_identification"};
+            os_info.print_key_string("src_ip", v.src_ip.c_str());
+            os_info.print_key_string("os", v.result.os_name.c_str());
+            os_info.print_key_float("probability", v.result.probability);
+            os_info.print_key_uint("observations", v.observations);
+            os_info.close();
+            record.print_key_timestamp("event_start", ts);
+            record.close();
+            if (tmp_buf.trunc == 0) {
+                if ((size_t)(buf.dlen - buf.doff) <= tmp_buf.length() + 2) {
+                    break;   // no room left in buf; leave verdict in queue
+                }
+                buf.memcpy(tmp, tmp_buf.length());
+                buf.write_char('\n');
+                count++;
+            }
+            pending.pop_front();
+        }
+        return count;
+    }
+
+    static bool unit_test() {
+        os_model m;
+        const char clf_json[] = R"({"os_len":2,"labels":["linux","windows"],"intercepts":[0,0],)"
+                                R"("coefficients":[[4,0,4,0,4,0],[0,4,0,4,0,4]],"os_map":{"linux":0,"windows":1}})";
+        m.clf = os_classifier{clf_json, sizeof(clf_json) - 1};
+        if (!m.clf.is_valid()) {
+            return false;
+        }
+        m.fp_tables[os_fp_tls].process_line(R"json({"str_repr":"(0303)(1301)","os_info":{"linux":5}})json", m.clf, os_fp_tls);
+        m.fp_tables[os_fp_tls].process_line(R"json({"str_repr":"(0303)(c02b)","os_info":{"windows":5}})json", m.clf, os_fp_tls);
+        m.fp_tables[os_fp_tls].process_line(R"json({"str_repr":"(0303)(1301)","os_info":{"windows":5}})json", m.clf, os_fp_tls);
+
+        // lookups ignore the type and format prefix, take the first
+        // entry for a fingerprint, and need no null terminator
+        //
+        std::string_view fp{"tls/1/(0303)(1301)(0000)", 18};
+        const auto *c = m.lookup(os_fp_tls, fp);
+        if (c == nullptr || c->size() != 1 || (*c)[0].index != 2
+            || m.lookup(os_fp_tcp, fp) != nullptr || m.lookup(os_fp_tls, "(0303)") != nullptr) {
+            return false;
+        }
+
+        // with room for one host, a second host evicts the first, and
+        // fingerprints of other types are ignored
+        //
+        if (is_observed(fingerprint_type_quic) || !is_observed(fingerprint_type_tls)) {
+            return false;
+        }
+        os_identification_stage stage{m, 0.0, 1};
+        stage.observe(fingerprint_type_tls, "tls/1/(0303)(1301)", "10.0.0.1", 1.0);
+        stage.observe(fingerprint_type_quic, "quic/(0000)", "10.0.0.3", 1.5);
+        if (stage.has_verdicts()) {
+            return false;
+        }
+        stage.observe(fingerprint_type_tls, "tls/1/(0303)(c02b)", "10.0.0.2", 2.0);
+        if (!stage.has_verdicts() || stage.hosts.size() != 1) {
+            return false;
+        }
+        stage.flush();
+        char out[1024];
+        struct buffer_stream buf{out, sizeof(out)};
+        struct timespec ts{2, 0};
+        if (stage.write_verdicts(buf, &ts) != 2 || stage.has_verdicts()) {
+            return false;
+        }
+        std::string_view s{out, (size_t)buf.length()};
+        size_t first = s.find(R"("src_ip":"10.0.0.1","os":"linux")");
+        size_t second = s.find(R"("src_ip":"10.0.0.2","os":"windows")");
+        if (first == std::string_view::npos || second == std::string_view::npos || first > second
+            || s.find("10.0.0.3") != std::string_view::npos) {
+            return false;
+        }
+
+        // with a window, a host is reported once two consecutive
+        // checks that follow new observations agree
+        //
+        os_identification_stage windowed{m, 1.0, 0};
+        windowed.observe(fingerprint_type_tls, "tls/1/(0303)(1301)", "10.0.0.1", 1.0);
+        windowed.observe(fingerprint_type_tls, "tls/1/(0303)(1301)", "10.0.0.1", 2.0);
+        if (windowed.has_verdicts()) {
+            return false;
+        }
+        windowed.observe(fingerprint_type_tls, "tls/1/(0303)(1301)", "10.0.0.1", 3.0);
+        return windowed.has_verdicts() && windowed.pending.front().result.os_name == "linux";
+    }
+
+private:
+
+    void enqueue(const std::string &src_ip, const os_result &r, uint64_t observations) {
+        if (pending.size() >= max_pending) {
+            if (!reported_overflow) {
+                printf_err(log_warning, "OS identification verdict queue is full; discarding oldest verdicts\n");
+                reported_overflow = true;
+            }
+            pending.pop_front();
+        }
+        pending.push_back({ src_ip, r, observations });
+    }
+
+};
+
+#endif /* OS_IDENTIFICATION_HPP */
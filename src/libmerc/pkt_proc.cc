@@ -30,7 +30,6 @@
 #include "dhcp.h"
 #include "tcpip.h"
 #include "eth.h"
-#include "gre.h"
 #include "icmp.h"
 #include "udp.h"
 #include "quic.h"
@@ -54,6 +53,15 @@
 
 // double malware_prob_threshold = -1.0; // TODO: document hidden option
 
+// A protocol variant is constructed for every packet, so its size,
+// which is that of its largest alternative, is kept within a fixed
+// budget.  Large parsing buffers, such as the QUIC crypto buffer and
+// the OpenVPN reassembly buffer, belong in stateful_pkt_proc, where
+// they are reused for each packet, rather than in the alternatives.
+//
+static constexpr size_t protocol_size_budget = 640;
+static_assert(sizeof(protocol) <= protocol_size_budget, "protocol variant exceeds its size budget");
+
 void write_flow_key(struct json_object &o, const struct key &k) {
     if (k.ip_vers == 6) {
         const uint8_t *s = (const uint8_t *)&k.addr.ipv6.src;
@@ -169,6 +177,41 @@ struct do_observation {
 
 };
 
+// correlate_tls_session is a visitor that adds the summary of each
+// TLS client hello to the session table, and writes the client side
+// of the session into the record of each server hello or certificate
+//
+struct correlate_tls_session {
+    tls_session_table &sessions_;
+    const struct key &k_;
+    const class fingerprint &fp_;
+    struct json_object &record_;
+
+    correlate_tls_session(tls_session_table &sessions,
+                          const struct key &k,
+                          const class fingerprint &fp,
+                          struct json_object &record) :
+        sessions_{sessions},
+        k_{k},
+        fp_{fp},
+        record_{record}
+    {}
+
+    void operator()(tls_client_hello &hello) {
+        datum server_name, user_agent, alpn;
+        hello.extensions.set_meta_data(server_name, user_agent, alpn);
+        sessions_.add_client_hello(k_, fp_.get_type() != fingerprint_type_unknown ? fp_.string() : "", server_name);
+    }
+
+    void operator()(tls_server_hello_and_certificate &) {
+        sessions_.write_client_json(record_, k_);
+    }
+
+    template <typename T>
+    void operator()(T &) { }
+
+};
+
 // set_tcp_protocol() sets the protocol variant record to the data
 // structure resulting from the parsing of the TCP data field, which
 // will be one of the TCP protocols in that variant.  The default
@@ -177,7 +220,14 @@ struct do_observation {
 // unknown_initial_packet represents the TCP data field of an
 // unrecognized packet that is the first data packet in a flow.
 //
-void stateful_pkt_proc::set_tcp_protocol(protocol &x,
+// If the message is incomplete, the number of additional bytes that
+// it needs is passed to tcp_pkt->reassembly_needed(), or, if that is
+// not known, the bytes that end it are passed to
+// tcp_pkt->reassembly_needed_until().  The type of the message is
+// returned.
+//
+template <selector_profile P>
+enum tcp_msg_type stateful_pkt_proc::set_tcp_protocol(protocol &x,
                       struct datum &pkt,
                       bool is_new,
                       struct tcp_packet *tcp_pkt) {
@@ -185,9 +235,9 @@ void stateful_pkt_proc::set_tcp_protocol(protocol &x,
     // note: std::get<T>() throws exceptions; it might be better to
     // use get_if<T>(), which does not
 
-    enum tcp_msg_type msg_type = (tcp_msg_type) selector.get_tcp_msg_type(pkt);
+    enum tcp_msg_type msg_type = (tcp_msg_type) selector.get_tcp_msg_type<P>(pkt);
     if (msg_type == tcp_msg_type_unknown) {
-        msg_type = (tcp_msg_type) selector.get_tcp_msg_type_from_ports(tcp_pkt);
+        msg_type = (tcp_msg_type) selector.get_tcp_msg_type_from_ports<P>(tcp_pkt);
     }
 
     switch(msg_type) {
@@ -220,7 +270,7 @@ void stateful_pkt_proc::set_tcp_protocol(protocol &x,
             struct ssh_binary_packet ssh_pkt{pkt};
             if (tcp_pkt && ssh_pkt.additional_bytes_needed) {
                 tcp_pkt->reassembly_needed(ssh_pkt.additional_bytes_needed);
-                return;
+                return msg_type;
             }
             x.emplace<ssh_kex_init>(ssh_pkt.payload);
             break;
@@ -239,7 +289,7 @@ void stateful_pkt_proc::set_tcp_protocol(protocol &x,
         uint16_t len = 0;
         pkt.read_uint16(&len);
         pkt.trim_to_length(len);
-        x.emplace<dns_packet>(pkt);
+        x.emplace<dns_packet>(pkt).set_message_length(len);
         break;
     }
     case tcp_msg_type_smb1:
@@ -258,7 +308,7 @@ void stateful_pkt_proc::set_tcp_protocol(protocol &x,
         x.emplace<nbss_packet>(pkt);
         break;
     case tcp_msg_type_openvpn:
-        x.emplace<openvpn_tcp>(pkt);
+        x.emplace<openvpn_tcp>(pkt, openvpn_buffer);
         break;
     case tcp_msg_type_bittorrent:
         x.emplace<bittorrent_handshake>(pkt);
@@ -278,6 +328,15 @@ void stateful_pkt_proc::set_tcp_protocol(protocol &x,
         }
         break;
     }
+
+    if (tcp_pkt) {
+        if (size_t needed = std::visit(get_bytes_needed{}, x)) {
+            tcp_pkt->reassembly_needed(needed);
+        } else if (const char *marker = std::visit(get_end_marker{}, x)) {
+            tcp_pkt->reassembly_needed_until(marker);
+        }
+    }
+    return msg_type;
 }
 
 // set_udp_protocol() sets the protocol variant record to the data
@@ -288,6 +347,7 @@ void stateful_pkt_proc::set_tcp_protocol(protocol &x,
 // unknown_udp_initial_packet represents the UDP data field of an
 // unrecognized packet that is the first data packet in a flow.
 //
+template <selector_profile P>
 void stateful_pkt_proc::set_udp_protocol(protocol &x,
                       struct datum &pkt,
                       enum udp_msg_type msg_type,
@@ -304,14 +364,14 @@ void stateful_pkt_proc::set_udp_protocol(protocol &x,
     switch(msg_type) {
     case udp_msg_type_dns:
         if (mdns_packet::check_if_mdns(k)) {
-            if (!selector.mdns()) {
+            if (!selector.mdns<P>()) {
                 return;
             }
             x.emplace<mdns_packet>(pkt);
         } else {
             dns_packet packet{pkt};
-            if ((packet.netbios() and !selector.nbns()) or
-                (!packet.netbios() and !selector.dns())) {
+            if ((packet.netbios() and !selector.nbns<P>()) or
+                (!packet.netbios() and !selector.dns<P>())) {
                 return;
             }
             x = std::move(packet);
@@ -328,7 +388,33 @@ void stateful_pkt_proc::set_udp_protocol(protocol &x,
             struct dtls_record dtls_rec{pkt};
             struct dtls_handshake handshake{dtls_rec.fragment};
             if (handshake.msg_type == handshake_type::client_hello) {
-                x.emplace<dtls_client_hello>(handshake.body);
+                if (handshake.fragment_offset == 0 && handshake.fragment_length >= handshake.length) {
+                    x.emplace<dtls_client_hello>(handshake.body);
+
+                } else {
+
+                    // a client hello that is too large for a single
+                    // record is reassembled from its fragments, as a
+                    // TLS handshake message, and is processed once
+                    // all of its fragments have been seen
+                    //
+                    uint8_t header[4] = {
+                        (uint8_t)handshake_type::client_hello,
+                        (uint8_t)(handshake.length >> 16),
+                        (uint8_t)(handshake.length >> 8),
+                        (uint8_t)handshake.length
+                    };
+                    datum fragment = handshake.body;
+                    fragment.trim_to_length(handshake.fragment_length);
+                    dtls_buffer.reset();
+                    dtls_buffer.extend(0, datum{header, header + sizeof(header)});
+                    if (dtls_buffer.extend(sizeof(header) + handshake.fragment_offset, fragment)
+                        && dtls_handshakes.reassemble(k, dtls_buffer)) {
+                        datum body = dtls_buffer.contents();
+                        body.skip(sizeof(header));
+                        x.emplace<dtls_client_hello>(body);
+                    }
+                }
             }
         }
         break;
@@ -369,7 +455,18 @@ void stateful_pkt_proc::set_udp_protocol(protocol &x,
     }
 }
 
+// starts_message(x) returns true if x holds a message that was
+// recognized and parsed; a segment that holds one ends the
+// reassembly of the flow.  Data that matched a protocol but could
+// not be parsed, such as the middle of a message that happens to
+// match a weak matcher, does not.
+//
+static bool starts_message(protocol &x) {
+    return !std::holds_alternative<unknown_initial_packet>(x) && std::visit(is_not_empty{}, x);
+}
+
 // returns boolean whether to fingerprrint/analyze current tcp pkt
+template <selector_profile P>
 bool stateful_pkt_proc::process_tcp_data (protocol &x,
                           struct datum &pkt,
                           struct tcp_packet &tcp_pkt,
@@ -383,7 +480,10 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
         if (global_vars.output_tcp_initial_data) {
             is_new = tcp_flow_table.is_first_data_packet(k, ts->tv_sec, ntoh(tcp_pkt.header->seq));
         }
-        set_tcp_protocol(x, pkt, is_new, &tcp_pkt);
+        enum tcp_msg_type msg_type = set_tcp_protocol<P>(x, pkt, is_new, &tcp_pkt);
+        if (tcp_pkt.additional_bytes_needed) {
+            reassembly_hints.incomplete(msg_type);
+        }
         //reassembler->dump_pkt = false;
         return true;
     }
@@ -409,15 +509,17 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
         if (initial_seg) {
             // initial seg, try parsing
             datum pkt_copy{pkt};
-            set_tcp_protocol(x, pkt, true, &tcp_pkt);
+            enum tcp_msg_type msg_type = set_tcp_protocol<P>(x, pkt, true, &tcp_pkt);
             if(!tcp_pkt.additional_bytes_needed) {
                 reassembler->dump_pkt = false;
                 reassembler->curr_reassembly_state = reassembly_none;
                 return true;
             }
+            reassembly_hints.incomplete(msg_type);
             
             //reassembly required, add to reassembly table
             seg_context.additional_bytes_needed = tcp_pkt.additional_bytes_needed;
+            seg_context.end_marker = tcp_pkt.reassembly_end_marker;
             reassembler->init_segment(k, ts->tv_sec, seg_context, syn_seq, pkt_copy);
             //write_pkt = true;
             reassembler->dump_pkt = true;
@@ -427,7 +529,7 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
         else {
             // non initial seg
             // call set_tcp_protocol in case there is something worth fingerpriting
-            set_tcp_protocol(x, pkt, false, &tcp_pkt);
+            set_tcp_protocol<P>(x, pkt, false, &tcp_pkt);
             if (!tcp_pkt.additional_bytes_needed && !(std::holds_alternative<unknown_initial_packet>(x) || std::holds_alternative<std::monostate>(x)) ) {
                 reassembler->curr_reassembly_state = reassembly_none;
                 reassembler->dump_pkt = false;
@@ -446,10 +548,11 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
         //
         bool is_init_seg = false;
         datum pkt_copy{pkt};
+        enum tcp_msg_type msg_type = tcp_msg_type_unknown;
         is_init_seg = reassembler->is_init_seg(k, seg_context.seq);
         if (is_init_seg) {
-            set_tcp_protocol(x, pkt, true, &tcp_pkt);
-            if (!tcp_pkt.additional_bytes_needed && !(std::holds_alternative<unknown_initial_packet>(x) || std::holds_alternative<std::monostate>(x)) ) {
+            set_tcp_protocol<P>(x, pkt, true, &tcp_pkt);
+            if (!tcp_pkt.additional_bytes_needed && starts_message(x)) {
                 reassembler->curr_reassembly_state = reassembly_none;
                 reassembler->dump_pkt = false;
                 reassembler->remove_segment(k);
@@ -457,11 +560,12 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
             }
             else {
                 seg_context.additional_bytes_needed = tcp_pkt.additional_bytes_needed;
+                seg_context.end_marker = tcp_pkt.reassembly_end_marker;
             }
         }
         else {
-            set_tcp_protocol(x, pkt, false, &tcp_pkt);
-            if (!tcp_pkt.additional_bytes_needed && !(std::holds_alternative<unknown_initial_packet>(x) || std::holds_alternative<std::monostate>(x)) ) {
+            msg_type = set_tcp_protocol<P>(x, pkt, false, &tcp_pkt);
+            if (!tcp_pkt.additional_bytes_needed && starts_message(x)) {
                 reassembler->curr_reassembly_state = reassembly_none;
                 reassembler->dump_pkt = false;
                 reassembler->remove_segment(k);
@@ -487,7 +591,7 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
             
             if(seg->done) {
                 struct datum reassembled_data = seg->get_reassembled_segment();
-                set_tcp_protocol(x, reassembled_data, true, &tcp_pkt);
+                reassembly_hints.reassembled(set_tcp_protocol<P>(x, reassembled_data, true, &tcp_pkt));
                 reassembler->dump_pkt = false;
                 reassembler->curr_reassembly_consumed = true;
                 reassembler->curr_reassembly_state = reassembly_done;
@@ -498,6 +602,20 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
         }
 
         if (!in_reassembly && tcp_pkt.additional_bytes_needed) {
+
+            // a message that starts after the first data segment of
+            // the flow, such as an SSH KEXINIT that follows the
+            // identification string, is reassembled starting from
+            // its own first segment
+            //
+            reassembly_hints.incomplete(msg_type);
+            seg_context.additional_bytes_needed = tcp_pkt.additional_bytes_needed;
+            seg_context.end_marker = tcp_pkt.reassembly_end_marker;
+            if (reassembler->init_segment(k, ts->tv_sec, seg_context, seg_context.seq, pkt_copy)) {
+                reassembler->dump_pkt = true;
+                reassembler->curr_reassembly_state = reassembly_in_progress;
+                return true;
+            }
             reassembler->curr_reassembly_state = truncated;
         }
         return true;
@@ -506,7 +624,7 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
     if (!syn_seq && !in_reassembly) {
         // data pkt without syn, try to process as new data pkt
         // TODO: add to table to prevent processing again
-        set_tcp_protocol(x, pkt, false, &tcp_pkt);
+        set_tcp_protocol<P>(x, pkt, false, &tcp_pkt);
         reassembler->dump_pkt = false;
         reassembler->curr_reassembly_state = reassembly_none;
         return true;
@@ -516,6 +634,104 @@ bool stateful_pkt_proc::process_tcp_data (protocol &x,
 
 }
 
+// correlate_ssh_kex(x, k, ts, reassembler, has_data) pairs the SSH
+// KEXINIT in x, if there is one, with the KEXINIT sent in the other
+// direction of the same connection, so that a single record reports
+// both, and sets k to the flow key of the client; a KEXINIT that is
+// held until the other one is seen is removed from x.  If x holds no
+// message, the packet carries data (has_data), and a KEXINIT sent
+// with flow key k is held, the other one was not captured, and the
+// held one is reported in x on its own.
+//
+void stateful_pkt_proc::correlate_ssh_kex(protocol &x,
+                                          struct key &k,
+                                          const struct timespec *ts,
+                                          struct tcp_reassembler *reassembler,
+                                          bool has_data) {
+
+    if (ssh_kex_init *kex = std::get_if<ssh_kex_init>(&x)) {
+        if (kex->is_not_empty() && !ssh_kex_pairs.pair(*kex, k, *ts)) {
+            x = std::monostate{};
+            if (reassembler && reassembler->curr_reassembly_consumed) {
+                reassembler->remove_segment(reassembler->reap_it);
+                reassembler->curr_reassembly_consumed = false;
+            }
+        }
+    } else if (has_data && !ssh_kex_pairs.is_empty() && std::holds_alternative<std::monostate>(x)) {
+        datum held = ssh_kex_pairs.flush(k);
+        if (held.is_not_empty()) {
+            x.emplace<ssh_kex_init>(held);
+        }
+    }
+}
+
+// observe_os(k, ts) passes the fingerprint in analysis.fp, if OS
+// identification is configured and uses fingerprints of its type, to
+// the OS identification stage as an observation of the source address
+// of the flow key k at time ts.  The address is formatted into a
+// buffer on the stack, so that an observation does not allocate
+// memory unless it is the first one from that address.
+//
+void stateful_pkt_proc::observe_os(const struct key &k, const struct timespec *ts) {
+    if (!os_identifier || !os_identification_stage::is_observed(analysis.fp.get_type())) {
+        return;
+    }
+    char src_ip_str[MAX_ADDR_STR_LEN];
+    k.sprint_src_addr(src_ip_str);
+    os_identifier->observe(analysis.fp.get_type(), analysis.fp.string(), src_ip_str,
+                           ts->tv_sec + ts->tv_nsec / 1000000000.0);
+}
+
+// process_udp_data(x, pkt, udp_pkt, k, ts, check_new) identifies and
+// parses the payload pkt of the UDP packet udp_pkt, whose flow key is
+// k, into x.  If check_new is
+// true, the payload of the first packet of a flow is reported even
+// if its protocol is not recognized.  The RTP and SRTP packets of a
+// flow on which STUN or DTLS has been seen are counted, and are not
+// otherwise processed, since they are neither fingerprinted nor
+// reported.
+//
+template <selector_profile P>
+void stateful_pkt_proc::process_udp_data(protocol &x,
+                                         struct datum &pkt,
+                                         const class udp &udp_pkt,
+                                         const struct key &k,
+                                         struct timespec *ts,
+                                         bool check_new) {
+
+    if (media_sessions.count_media_packet(k, pkt, ts->tv_sec)) {
+        return;
+    }
+
+    enum udp_msg_type msg_type = (udp_msg_type) selector.get_udp_msg_type<P>(pkt);
+    if (msg_type == udp_msg_type_unknown) {  // TODO: wrap this up in a traffic_selector member function
+        udp::ports ports = udp_pkt.get_ports();
+        msg_type = (udp_msg_type) selector.get_udp_msg_type_from_ports<P>(ports);
+    }
+
+    bool is_new = false;
+    if (check_new && pkt.is_not_empty()) {
+        is_new = ip_flow_table.flow_is_new(k, ts->tv_sec);
+    }
+    set_udp_protocol<P>(x, pkt, msg_type, is_new, k);
+
+    // a STUN message or DTLS handshake marks the flow as a media
+    // session, as it is in WebRTC
+    //
+    switch (msg_type) {
+    case udp_msg_type_stun:
+    case udp_msg_type_dtls_client_hello:
+    case udp_msg_type_dtls_server_hello:
+        if (std::visit(is_not_empty{}, x)) {
+            media_sessions.add_session(k, ts->tv_sec);
+        }
+        break;
+    default:
+        ;
+    }
+}
+
+template <selector_profile P>
 size_t stateful_pkt_proc::ip_write_json(void *buffer,
                                         size_t buffer_size,
                                         const uint8_t *ip_packet,
@@ -534,31 +750,23 @@ size_t stateful_pkt_proc::ip_write_json(void *buffer,
         reassembler->curr_reassembly_state = reassembly_none;
     }
 
-    // process encapsulations
+    // process encapsulations; the key is overwritten with the
+    // addresses of the innermost ip header
     //
-    if (selector.gre() && transport_proto == ip::protocol::gre) {
-        gre_header gre{pkt};
-        switch(gre.get_protocol_type()) {
-        case ETH_TYPE_IP:
-        case ETH_TYPE_IPV6:
-            ip_pkt.parse(pkt, k);    // note: overwriting outer ip header in key
-            transport_proto = ip_pkt.transport_protocol();
-            break;
-        default:
-            ;
-        }
+    if (tunnels.is_enabled()) {
+        transport_proto = tunnels.decapsulate(pkt, ip_pkt, k, transport_proto);
     }
 
     // process transport/application protocols
     //
     protocol x;
-    if (selector.icmp() && (transport_proto == ip::protocol::icmp || transport_proto == ip::protocol::ipv6_icmp)) {
+    if (selector.icmp<P>() && (transport_proto == ip::protocol::icmp || transport_proto == ip::protocol::ipv6_icmp)) {
         x.emplace<icmp_packet>(pkt);
 
-    } else if (selector.ospf() && transport_proto == ip::protocol::ospfigp) {
+    } else if (selector.ospf<P>() && transport_proto == ip::protocol::ospfigp) {
         x.emplace<ospf>(pkt);
 
-    } else if (selector.sctp() && transport_proto == ip::protocol::sctp) {
+    } else if (selector.sctp<P>() && transport_proto == ip::protocol::sctp) {
         x.emplace<sctp_init>(pkt);
 
     } else if (transport_proto == ip::protocol::tcp) {
@@ -567,12 +775,15 @@ size_t stateful_pkt_proc::ip_write_json(void *buffer,
             return 0;  // incomplete tcp header; can't process packet
         }
         tcp_pkt.set_key(k);
+        if (flow_records) {
+            flow_records->update(k, ts, length, tcp_pkt.header->flags);
+        }
         if (tcp_pkt.is_SYN()) {
 
             if (global_vars.output_tcp_initial_data || reassembler) {
                 tcp_flow_table.syn_packet(k, ts->tv_sec, ntoh(tcp_pkt.header->seq));
             }
-            if (selector.tcp_syn()) {
+            if (selector.tcp_syn<P>()) {
                 x = tcp_pkt; // process tcp syn
             }
             // note: we could check for non-empty data field
@@ -581,56 +792,42 @@ size_t stateful_pkt_proc::ip_write_json(void *buffer,
             if (global_vars.output_tcp_initial_data || reassembler) {
                 tcp_flow_table.syn_packet(k, ts->tv_sec, ntoh(tcp_pkt.header->seq));
             }
-            if (selector.tcp_syn() and selector.tcp_syn_ack()) {
+            if (selector.tcp_syn<P>() and selector.tcp_syn_ack<P>()) {
                 x = tcp_pkt;  // process tcp syn/ack
             }
             // note: we could check for non-empty data field
 
         } else if (tcp_pkt.is_FIN() || tcp_pkt.is_RST()) {
                 tcp_flow_table.find_and_erase(k);
+                correlate_ssh_kex(x, k, ts, reassembler, tcp_pkt.data_length > 0);
         }
         else {
             //bool write_pkt = false;
-            if (!process_tcp_data(x, pkt, tcp_pkt, k, ts, reassembler)) {
+            if (!process_tcp_data<P>(x, pkt, tcp_pkt, k, ts, reassembler)) {
                 return 0;
             }
             else if (tcp_pkt.additional_bytes_needed) {
                 truncated_tcp = true;
             }
+            correlate_ssh_kex(x, k, ts, reassembler, tcp_pkt.data_length > 0);
         }
 
     } else if (transport_proto == ip::protocol::udp) {
         class udp udp_pkt{pkt};
         udp_pkt.set_key(k);
-        enum udp_msg_type msg_type = (udp_msg_type) selector.get_udp_msg_type(pkt);
-
-        if (msg_type == udp_msg_type_unknown) {  // TODO: wrap this up in a traffic_selector member function
-            udp::ports ports = udp_pkt.get_ports();
-            msg_type = (udp_msg_type) selector.get_udp_msg_type_from_ports(ports);
-            // if (ports.src == htons(53) || ports.dst == htons(53)) {
-            //     msg_type = udp_msg_type_dns;
-            // }
-            // if (selector.mdns() && (ports.src == htons(5353) || ports.dst == htons(5353))) {
-            //     msg_type = udp_msg_type_dns;
-            // }
-        /*    if (ports.dst == htons(4789)) {
-                msg_type = udp_msg_type_vxlan;
-            }
-        */
-        }
-
-        bool is_new = false;
-        if (global_vars.output_udp_initial_data && pkt.is_not_empty()) {
-            is_new = ip_flow_table.flow_is_new(k, ts->tv_sec);
-        }
-        set_udp_protocol(x, pkt, msg_type, is_new, k);
+        process_udp_data<P>(x, pkt, udp_pkt, k, ts, global_vars.output_udp_initial_data);
+    }
+    if (flow_records && transport_proto != ip::protocol::tcp) {
+        flow_records->update(k, ts, length, 0);
     }
 
     // process transport/application protocol
     //
     if (std::visit(is_not_empty{}, x)) {
         std::visit(compute_fingerprint{analysis.fp, global_vars.tls_fingerprint_format}, x);
+        observe_os(k, ts);
         bool output_analysis = false;
+        analysis.result.reinit();
         if (global_vars.do_analysis && analysis.fp.get_type() != fingerprint_type_unknown) {
             output_analysis = std::visit(do_analysis{k, analysis, c}, x);
 
@@ -644,6 +841,13 @@ size_t stateful_pkt_proc::ip_write_json(void *buffer,
             }
         }
 
+        if (flow_records) {
+            flow_records->set_fingerprint(k, analysis.fp);
+            if (output_analysis) {
+                flow_records->set_analysis(k, analysis.result);
+            }
+        }
+
         // if (malware_prob_threshold > -1.0 && (!output_analysis || analysis.result.malware_prob < malware_prob_threshold)) { return 0; } // TODO - expose hidden command
 
         struct json_object record{&buf};
@@ -651,6 +855,9 @@ size_t stateful_pkt_proc::ip_write_json(void *buffer,
             analysis.fp.write(record);
         }
         std::visit(write_metadata{record, global_vars.metadata_output, global_vars.certs_json_output, global_vars.dns_json_output}, x);
+        if (tls_sessions) {
+            std::visit(correlate_tls_session{*tls_sessions, k, analysis.fp, record}, x);
+        }
 
         if (output_analysis) {
             analysis.result.write_json(record, "analysis");
@@ -673,19 +880,64 @@ size_t stateful_pkt_proc::ip_write_json(void *buffer,
         }
 
         write_flow_key(record, k);
+        if (tunnels.is_enabled()) {
+            tunnels.write_json(record);
+        }
         record.print_key_timestamp("event_start", ts);
         record.close();
     }
 
-    // if buffer has JSON data, add newline and return buffer length
+    // if buffer has JSON data, add newline, followed by any pending
+    // os identification verdicts, unpaired SSH KEXINITs, and flow
+    // records, and return buffer length
     //
-    if (buf.length() != 0 && buf.trunc == 0) {
-        buf.strncpy("\n");
-        return buf.length();
+    if (buf.trunc == 0) {
+        if (buf.length() != 0) {
+            buf.strncpy("\n");
+        }
+        if (os_identifier && os_identifier->has_verdicts()) {
+            os_identifier->write_verdicts(buf, ts);
+        }
+        if (ssh_kex_pairs.has_unpaired()) {
+            ssh_kex_pairs.write_unpaired(buf, global_vars.metadata_output);
+        }
+        if (flow_records && flow_records->has_records()) {
+            flow_records->write_records(buf);
+        }
+        if (buf.length() != 0 && buf.trunc == 0) {
+            return buf.length();
+        }
     }
     return 0;
 }
 
+size_t stateful_pkt_proc::write_os_verdicts(void *buffer, size_t buffer_size, struct timespec *ts) {
+    if (!os_identifier) {
+        return 0;
+    }
+    os_identifier->flush();
+    struct buffer_stream buf{(char *)buffer, (int)buffer_size};
+    os_identifier->write_verdicts(buf, ts);
+    return buf.length();
+}
+
+size_t stateful_pkt_proc::write_ssh_kex(void *buffer, size_t buffer_size) {
+    ssh_kex_pairs.flush_all();
+    struct buffer_stream buf{(char *)buffer, (int)buffer_size};
+    ssh_kex_pairs.write_unpaired(buf, global_vars.metadata_output);
+    return buf.length();
+}
+
+size_t stateful_pkt_proc::write_flow_records(void *buffer, size_t buffer_size) {
+    if (!flow_records) {
+        return 0;
+    }
+    flow_records->flush();
+    struct buffer_stream buf{(char *)buffer, (int)buffer_size};
+    flow_records->write_records(buf);
+    return buf.length();
+}
+
 using link_layer_protocol = std::variant<std::monostate, arp_packet, cdp, lldp>;
 
 size_t stateful_pkt_proc::write_json(void *buffer,
@@ -789,6 +1041,7 @@ static void enumerate_protocol_types(FILE *f) {
     }
 }
 
+template <selector_profile P>
 bool stateful_pkt_proc::analyze_ip_packet(const uint8_t *packet,
                                           size_t length,
                                               struct timespec *ts,
@@ -800,6 +1053,9 @@ bool stateful_pkt_proc::analyze_ip_packet(const uint8_t *packet,
     ip ip_pkt{pkt, k};
     protocol x;
     uint8_t transport_proto = ip_pkt.transport_protocol();
+    if (tunnels.is_enabled()) {
+        transport_proto = tunnels.decapsulate(pkt, ip_pkt, k, transport_proto);
+    }
     if (transport_proto == ip::protocol::tcp) {
         tcp_packet tcp_pkt{pkt, &ip_pkt};
         if (!tcp_pkt.is_valid()) {
@@ -817,7 +1073,7 @@ bool stateful_pkt_proc::analyze_ip_packet(const uint8_t *packet,
                 tcp_flow_table.find_and_erase(k);
             } 
             else {
-                bool ret = process_tcp_data(x, pkt, tcp_pkt, k, ts, reassembler);
+                bool ret = process_tcp_data<P>(x, pkt, tcp_pkt, k, ts, reassembler);
                 if (reassembler->curr_reassembly_state == reassembly_in_progress) {
                         analysis.flow_state_pkts_needed = true;
                 }
@@ -827,30 +1083,21 @@ bool stateful_pkt_proc::analyze_ip_packet(const uint8_t *packet,
             }
         }
         else {
-            set_tcp_protocol(x, pkt, false, &tcp_pkt);
+            set_tcp_protocol<P>(x, pkt, false, &tcp_pkt);
         }
+        correlate_ssh_kex(x, k, ts, reassembler, tcp_pkt.data_length > 0);
 
     } else if (transport_proto == ip::protocol::udp) {
         class udp udp_pkt{pkt};
         udp_pkt.set_key(k);
-        enum udp_msg_type msg_type = (udp_msg_type) selector.get_udp_msg_type(pkt);
-
-        if (msg_type == udp_msg_type_unknown) {  // TODO: wrap this up in a traffic_selector member function
-            udp::ports ports = udp_pkt.get_ports();
-            msg_type = (udp_msg_type) selector.get_udp_msg_type_from_ports(ports);
-           /* if (ports.dst == htons(4789)) {
-                msg_type = udp_msg_type_vxlan; // could parse VXLAN header here
-            }
-        */
-        }
-
-        set_udp_protocol(x, pkt, msg_type, false, k);
+        process_udp_data<P>(x, pkt, udp_pkt, k, ts, false);
     }
 
     // process protocol data element
     //
     if (std::visit(is_not_empty{}, x)) {
         std::visit(compute_fingerprint{analysis.fp, global_vars.tls_fingerprint_format}, x);
+        observe_os(k, ts);
         if (global_vars.do_analysis && analysis.fp.get_type() != fingerprint_type_unknown) {
 
             // re-initialize the structure that holds analysis results
@@ -889,6 +1136,55 @@ bool stateful_pkt_proc::analyze_ip_packet(const uint8_t *packet,
     return false;  // indicate no analysis results were returned
 }
 
+// select_profile() sets the packet processing functions to the
+// instances that are specialized for the profile of the protocol
+// selection, so that the selection is made once, when the packet
+// processor is constructed, instead of being checked for each packet
+//
+void stateful_pkt_proc::select_profile() {
+    switch (selector.get_profile()) {
+    case selector_profile::all:
+        ip_write_json_fn = &stateful_pkt_proc::ip_write_json<selector_profile::all>;
+        analyze_ip_packet_fn = &stateful_pkt_proc::analyze_ip_packet<selector_profile::all>;
+        break;
+    case selector_profile::tls_quic:
+        ip_write_json_fn = &stateful_pkt_proc::ip_write_json<selector_profile::tls_quic>;
+        analyze_ip_packet_fn = &stateful_pkt_proc::analyze_ip_packet<selector_profile::tls_quic>;
+        break;
+    case selector_profile::dns:
+        ip_write_json_fn = &stateful_pkt_proc::ip_write_json<selector_profile::dns>;
+        analyze_ip_packet_fn = &stateful_pkt_proc::analyze_ip_packet<selector_profile::dns>;
+        break;
+    case selector_profile::general:
+    default:
+        ip_write_json_fn = &stateful_pkt_proc::ip_write_json<selector_profile::general>;
+        analyze_ip_packet_fn = &stateful_pkt_proc::analyze_ip_packet<selector_profile::general>;
+        break;
+    }
+}
+
+size_t stateful_pkt_proc::ip_write_json(void *buffer,
+                                        size_t buffer_size,
+                                        const uint8_t *ip_packet,
+                                        size_t length,
+                                        struct timespec *ts,
+                                        struct tcp_reassembler *reassembler) {
+    return (this->*ip_write_json_fn)(buffer, buffer_size, ip_packet, length, ts, reassembler);
+}
+
+bool stateful_pkt_proc::analyze_ip_packet(const uint8_t *packet,
+                                          size_t length,
+                                          struct timespec *ts,
+                                          struct tcp_reassembler *reassembler) {
+    return (this->*analyze_ip_packet_fn)(packet, length, ts, reassembler);
+}
+
+// set_tcp_protocol() and set_udp_protocol() are also used outside of
+// this file, with the general profile
+//
+template enum tcp_msg_type stateful_pkt_proc::set_tcp_protocol<selector_profile::general>(protocol &, struct datum &, bool, struct tcp_packet *);
+template void stateful_pkt_proc::set_udp_protocol<selector_profile::general>(protocol &, struct datum &, enum udp_msg_type, bool, const struct key &);
+
 bool stateful_pkt_proc::analyze_eth_packet(const uint8_t *packet,
                                            size_t length,
                                            struct timespec *ts,
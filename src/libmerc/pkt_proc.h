@@ -21,9 +21,17 @@
 #include "proto_identify.h"
 #include "global_config.h"
 #include "quic.h"
+#include "openvpn.h"
+#include "ssh.h"
 #include "perfect_hash.h"
 #include "crypto_assess.h"
 #include "pkt_proc_util.h"
+#include "os_identification.hpp"
+#include "tls_session.hpp"
+#include "flow_record.hpp"
+#include "tunnel.hpp"
+#include "media_session.hpp"
+#include "reassembly_hints.hpp"
 
 /**
  * enum linktype is a 16-bit enumeration that identifies a protocol
@@ -50,9 +58,33 @@ struct mercury {
     std::unique_ptr<data_aggregator> aggregator{nullptr};
     classifier *c;
     class traffic_selector selector;
+    std::unique_ptr<os_model> os_identification_model{nullptr};
 
     mercury(const struct libmerc_config *vars, int verbosity) : global_vars{*vars}, aggregator{ global_vars.do_stats? (std::make_unique<data_aggregator>(global_vars.max_stats_entries)) : nullptr}, c{nullptr}, selector{global_vars.protocols} {
-        if (global_vars.do_analysis) {
+        if (global_vars.do_analysis && !global_vars.eager_resources) {
+
+            // defer loading the analysis resources until they are
+            // used, and start loading them in the background only if
+            // the selected protocols include one that is analyzed
+            //
+            c = analysis_init_deferred(global_vars.get_resource_file(),
+                                       vars->enc_key,
+                                       global_vars.fp_proc_threshold,
+                                       global_vars.proc_dst_threshold,
+                                       global_vars.report_os,
+                                       global_vars.approximate_matching);
+            if (c == nullptr) {
+                throw std::runtime_error("error: analysis_init_deferred() failed"); // failure
+            }
+            size_t resources_tls_format = c->get_tls_fingerprint_format();
+            global_vars.set_tls_fingerprint_format(resources_tls_format);
+            printf_err(log_info, "setting tls fingerprint format to match resource file (format: %zu)\n", resources_tls_format);
+
+            if (global_vars.selects_analyzed_protocols()) {
+                c->warm_up();
+            }
+
+        } else if (global_vars.do_analysis) {
             c = analysis_init_from_archive(verbosity, global_vars.get_resource_file(),
                                            vars->enc_key, vars->key_type,
                                            global_vars.fp_proc_threshold,
@@ -67,12 +99,35 @@ struct mercury {
             size_t resources_tls_format = c->get_tls_fingerprint_format();
             global_vars.set_tls_fingerprint_format(resources_tls_format);
             printf_err(log_info, "setting tls fingerprint format to match resource file (format: %zu)\n", resources_tls_format);
+
+            if (global_vars.approximate_matching > 0.0) {
+                c->enable_approximate_matching(global_vars.approximate_matching);
+            }
+        }
+        if (global_vars.os_identification) {
+            os_identification_model.reset(os_identification_init_from_archive(global_vars.get_resource_file(), vars->enc_key));
+            if (os_identification_model == nullptr) {
+                throw std::runtime_error("error: os_identification_init_from_archive() failed");
+            }
         }
     }
 
     ~mercury() {
         analysis_finalize(c);
     }
+
+    // get_decapsulator() returns a decapsulator configured as the
+    // packet processors' are; without the decapsulate option, only a
+    // single layer of GRE is stripped, and only if GRE is selected
+    //
+    decapsulator get_decapsulator() const {
+        if (global_vars.decapsulation_depth > 0) {
+            return decapsulator{global_vars.decapsulation_depth};
+        } else if (selector.gre()) {
+            return decapsulator{1, true};
+        }
+        return decapsulator{};
+    }
 };
 
 struct stateful_pkt_proc {
@@ -89,7 +144,24 @@ struct stateful_pkt_proc {
     global_config global_vars;
     class traffic_selector &selector;
     quic_crypto_engine quic_crypto;
+    openvpn_reassembly_buffer openvpn_buffer;
+    handshake_buffer dtls_buffer;
+    pending_handshakes<key> dtls_handshakes;
+    ssh_kex_correlator ssh_kex_pairs;
+    reassembly_hint_counters reassembly_hints;
     crypto_policy::assessor *crypto_policy = nullptr;
+    std::unique_ptr<os_identification_stage> os_identifier{nullptr};
+    std::unique_ptr<tls_session_table> tls_sessions{nullptr};
+    std::unique_ptr<flow_record_table> flow_records{nullptr};
+    decapsulator tunnels;
+    media_session_table media_sessions;
+
+    // the instances of ip_write_json() and analyze_ip_packet() that
+    // are specialized for the protocol selection, set by
+    // select_profile()
+    //
+    size_t (stateful_pkt_proc::*ip_write_json_fn)(void *, size_t, const uint8_t *, size_t, struct timespec *, struct tcp_reassembler *) = nullptr;
+    bool (stateful_pkt_proc::*analyze_ip_packet_fn)(const uint8_t *, size_t, struct timespec *, struct tcp_reassembler *) = nullptr;
 
     explicit stateful_pkt_proc(mercury_context mc, size_t prealloc_size=0) :
         ip_flow_table{prealloc_size},
@@ -104,7 +176,12 @@ struct stateful_pkt_proc {
         ag{nullptr},
         global_vars{mc->global_vars},
         selector{mc->selector},
-        quic_crypto{}
+        quic_crypto{},
+        openvpn_buffer{},
+        dtls_buffer{},
+        dtls_handshakes{},
+        ssh_kex_pairs{},
+        reassembly_hints{}
     {
 
         constexpr bool DO_CRYPTO_ASSESSMENT = false;
@@ -136,6 +213,24 @@ struct stateful_pkt_proc {
             reassembler_ptr = nullptr;
         }
 
+        if (m->os_identification_model) {
+            os_identifier = std::make_unique<os_identification_stage>(*m->os_identification_model,
+                                                                      global_vars.os_window,
+                                                                      global_vars.os_max_hosts);
+        }
+
+        if (global_vars.tls_sessions) {
+            tls_sessions = std::make_unique<tls_session_table>();
+        }
+
+        if (global_vars.flow_records) {
+            flow_records = std::make_unique<flow_record_table>();
+        }
+
+        tunnels = m->get_decapsulator();
+
+        select_profile();
+
 //#ifndef USE_TCP_REASSEMBLY
 // #pragma message "omitting tcp reassembly; 'make clean' and recompile with OPTFLAGS=-DUSE_TCP_REASSEMBLY to use that option"
 //        reassembler_ptr = nullptr;
@@ -155,8 +250,31 @@ struct stateful_pkt_proc {
     void finalize() {
         reassembler.count_all();
         tcp_flow_table.count_all();
+        reassembly_hints.log_and_reset();
+        media_sessions.log_and_reset();
     }
 
+    // write_os_verdicts() flushes the OS identification host table,
+    // and then writes as many of its verdicts into buffer as will
+    // fit; it returns the number of bytes written, which is zero once
+    // all of the verdicts have been written
+    //
+    size_t write_os_verdicts(void *buffer, size_t buffer_size, struct timespec *ts);
+
+    // write_ssh_kex() reports the SSH KEXINITs that are held waiting
+    // for the KEXINIT sent in the other direction, by writing as many
+    // of them into buffer as will fit; it returns the number of bytes
+    // written, which is zero once all of them have been written
+    //
+    size_t write_ssh_kex(void *buffer, size_t buffer_size);
+
+    // write_flow_records() flushes the flow record table, and then
+    // writes as many of its records into buffer as will fit; it
+    // returns the number of bytes written, which is zero once all of
+    // the records have been written
+    //
+    size_t write_flow_records(void *buffer, size_t buffer_size);
+
     size_t write_json(void *buffer,
                       size_t buffer_size,
                       uint8_t *packet,
@@ -188,6 +306,16 @@ struct stateful_pkt_proc {
                              struct timespec *ts,
                              struct tcp_reassembler *reassembler);
 
+    void select_profile();
+
+    size_t ip_write_json(void *buffer,
+                         size_t buffer_size,
+                         const uint8_t *ip_packet,
+                         size_t length,
+                         struct timespec *ts,
+                         struct tcp_reassembler *reassembler);
+
+    template <selector_profile P>
     size_t ip_write_json(void *buffer,
                          size_t buffer_size,
                          const uint8_t *ip_packet,
@@ -221,6 +349,12 @@ struct stateful_pkt_proc {
                            struct timespec *ts,
                            struct tcp_reassembler *reassembler);
 
+    template <selector_profile P>
+    bool analyze_ip_packet(const uint8_t *ip_packet,
+                           size_t length,
+                           struct timespec *ts,
+                           struct tcp_reassembler *reassembler);
+
     bool tcp_data_set_analysis_result(struct analysis_result *r,
                                       struct datum &pkt,
                                       const struct key &k,
@@ -228,18 +362,37 @@ struct stateful_pkt_proc {
                                       struct timespec *ts,
                                       struct tcp_reassembler *reassembler);
 
+    template <selector_profile P>
     bool process_tcp_data (protocol &x,
                           struct datum &pkt,
                           struct tcp_packet &tcp_pkt,
                           struct key &k,
                           struct timespec *ts, 
                           struct tcp_reassembler *reassembler);
-    
-    void set_tcp_protocol(protocol &x,
+
+    template <selector_profile P>
+    void process_udp_data(protocol &x,
+                          struct datum &pkt,
+                          const class udp &udp_pkt,
+                          const struct key &k,
+                          struct timespec *ts,
+                          bool check_new);
+
+    void correlate_ssh_kex(protocol &x,
+                           struct key &k,
+                           const struct timespec *ts,
+                           struct tcp_reassembler *reassembler,
+                           bool has_data);
+
+    void observe_os(const struct key &k, const struct timespec *ts);
+
+    template <selector_profile P=selector_profile::general>
+    enum tcp_msg_type set_tcp_protocol(protocol &x,
                           struct datum &pkt,
                           bool is_new,
                           struct tcp_packet *tcp_pkt);
 
+    template <selector_profile P=selector_profile::general>
     void set_udp_protocol(protocol &x,
                           struct datum &pkt,
                           enum udp_msg_type msg_type,
@@ -171,6 +171,36 @@ struct is_not_empty {
     }
 };
 
+// get_bytes_needed returns the number of additional bytes that a
+// message needs in order to be complete (see
+// base_protocol::bytes_needed())
+//
+struct get_bytes_needed {
+    template <typename T>
+    size_t operator()(const T &r) {
+        return r.bytes_needed();
+    }
+
+    size_t operator()(const quic_init &) { return 0; }
+
+    size_t operator()(const std::monostate &) { return 0; }
+};
+
+// get_end_marker returns the sequence of bytes that ends an
+// incomplete message whose length is not known in advance, or
+// nullptr (see base_protocol::end_marker())
+//
+struct get_end_marker {
+    template <typename T>
+    const char *operator()(const T &r) {
+        return r.end_marker();
+    }
+
+    const char *operator()(const quic_init &) { return nullptr; }
+
+    const char *operator()(const std::monostate &) { return nullptr; }
+};
+
 struct write_metadata {
     struct json_object &record;
     bool metadata_output_;
@@ -18,6 +18,8 @@
 
 #include <vector>
 #include <array>
+#include <map>
+#include <string>
 #include "match.h"
 
 #include "tls.h"   // tcp protocols
@@ -63,6 +65,7 @@ enum tcp_msg_type {
     tcp_msg_type_bittorrent,
     tcp_msg_type_mysql_server,
     tcp_msg_type_tofsee_initial_message,
+    tcp_msg_type_max                       // note: must be last
 };
 
 enum udp_msg_type {
@@ -175,6 +178,22 @@ public:
 
 };
 
+// enum selector_profile identifies the protocol selections for which
+// the packet processing path is specialized at compile time.  When
+// the selection is exactly "all", "tls,quic", or "dns", the
+// corresponding profile is used, and the selections that it makes
+// are compile-time constants, so that the code for protocols that
+// are not selected is not even instantiated.  Any other selection
+// uses the general profile, for which the selections are checked at
+// run time.
+//
+enum class selector_profile {
+    general,
+    all,
+    tls_quic,
+    dns,
+};
+
 // class selector implements a protocol selection policy for TCP and
 // UDP traffic
 //
@@ -200,37 +219,144 @@ class traffic_selector {
     bool select_nbss;
     bool select_openvpn_tcp;
 
+    selector_profile profile;
+
+    // selection<P>(value, in_all, in_dns) returns the run time
+    // selection value if P is the general profile, and otherwise
+    // returns the selection that the profile P makes, which is in_all
+    // for the all profile, in_dns for the dns profile, and false for
+    // the tls_quic profile (which selects only the TCP and UDP
+    // messages identified by its matchers)
+    //
+    template <selector_profile P>
+    static bool selection(bool value, bool in_all, bool in_dns) {
+        if constexpr (P == selector_profile::all) {
+            return in_all;
+        } else if constexpr (P == selector_profile::dns) {
+            return in_dns;
+        } else if constexpr (P == selector_profile::tls_quic) {
+            return false;
+        } else {
+            return value;
+        }
+    }
+
+    // the matchers of the protocols that the specialized profiles
+    // select; the constructor adds them to the protocol_identifiers
+    // from these tables, and the specialized profiles use the tables
+    // directly, so that both identify the same messages
+    //
+    static constexpr std::array<matcher_and_type<8>, 3> tls_tcp_matchers{{
+        { tls_client_hello::matcher, tcp_msg_type_tls_client_hello },
+        { tls_server_hello::matcher, tcp_msg_type_tls_server_hello },
+        { tls_server_certificate::matcher, tcp_msg_type_tls_certificate },
+    }};
+    static constexpr std::array<matcher_and_type<8>, 1> quic_udp_matchers{{
+        { quic_initial_packet::matcher, udp_msg_type_quic },
+    }};
+    static constexpr std::array<matcher_and_type<8>, 1> dns_tcp_matchers{{
+        { dns_packet::tcp_matcher, tcp_msg_type_dns },
+    }};
+    static constexpr std::array<matcher_and_type<8>, 1> dns_udp_matchers{{
+        { dns_packet::matcher, udp_msg_type_dns },
+    }};
+
+    template <size_t M>
+    static void add_protocols(protocol_identifier<8> &identifier, const std::array<matcher_and_type<8>, M> &matchers) {
+        for (const auto &p : matchers) {
+            identifier.add_protocol(p.mv, p.type);
+        }
+    }
+
+    // first_match(matchers, pkt) returns the type of the first of the
+    // matchers that matches pkt, or zero (type unknown) if none do
+    //
+    template <size_t N, size_t M>
+    static size_t first_match(const std::array<matcher_and_type<N>, M> &matchers, const datum &pkt) {
+        if (pkt.length() < 4) {
+            return 0;   // type unknown
+        }
+        for (const auto &p : matchers) {
+            if (p.mv.matches(pkt.data, pkt.length())) {
+                return p.type;
+            }
+        }
+        return 0;   // type unknown
+    }
+
+    // set_profile(protocols) sets profile to the specialized profile
+    // that makes exactly the selections in protocols, if there is
+    // one, and to the general profile otherwise
+    //
+    void set_profile(const std::map<std::string, bool> &protocols) {
+        std::vector<std::string> selected;
+        for (const auto &pair : protocols) {
+            if (pair.second) {
+                selected.push_back(pair.first);
+            }
+        }
+        profile = selector_profile::general;
+        if (selected == std::vector<std::string>{ "all" }) {
+            profile = selector_profile::all;
+        } else if (selected == std::vector<std::string>{ "quic", "tls" }) {
+            profile = selector_profile::tls_quic;
+        } else if (selected == std::vector<std::string>{ "dns" }) {
+            profile = selector_profile::dns;
+        }
+    }
+
 public:
 
-    bool tcp_syn() const { return select_tcp_syn; }
+    selector_profile get_profile() const { return profile; }
 
-    bool dns() const { return select_dns; }
+    // the accessors below take the profile as a template parameter;
+    // when it is a specialized profile, they return a compile-time
+    // constant
+    //
+    template <selector_profile P=selector_profile::general>
+    bool tcp_syn() const { return selection<P>(select_tcp_syn, true, false); }
 
-    bool nbns() const { return select_nbns; }
+    template <selector_profile P=selector_profile::general>
+    bool dns() const { return selection<P>(select_dns, true, true); }
 
-    bool mdns() const { return select_mdns; }
+    template <selector_profile P=selector_profile::general>
+    bool nbns() const { return selection<P>(select_nbns, true, false); }
 
-    bool arp() const { return select_arp; }
+    template <selector_profile P=selector_profile::general>
+    bool mdns() const { return selection<P>(select_mdns, true, false); }
 
-    bool cdp() const { return select_cdp; }
+    template <selector_profile P=selector_profile::general>
+    bool arp() const { return selection<P>(select_arp, false, false); }
 
-    bool gre() const { return select_gre; }
+    template <selector_profile P=selector_profile::general>
+    bool cdp() const { return selection<P>(select_cdp, false, false); }
 
-    bool icmp() const { return select_icmp; }
+    template <selector_profile P=selector_profile::general>
+    bool gre() const { return selection<P>(select_gre, false, false); }
 
-    bool lldp() const { return select_lldp; }
+    template <selector_profile P=selector_profile::general>
+    bool icmp() const { return selection<P>(select_icmp, false, false); }
 
-    bool ospf() const { return select_ospf; }
+    template <selector_profile P=selector_profile::general>
+    bool lldp() const { return selection<P>(select_lldp, false, false); }
 
-    bool sctp() const { return select_sctp; }
+    template <selector_profile P=selector_profile::general>
+    bool ospf() const { return selection<P>(select_ospf, false, false); }
 
-    bool tcp_syn_ack() const { return select_tcp_syn_ack; }
+    template <selector_profile P=selector_profile::general>
+    bool sctp() const { return selection<P>(select_sctp, false, false); }
 
-    bool nbds() const { return select_nbds; }
+    template <selector_profile P=selector_profile::general>
+    bool tcp_syn_ack() const { return selection<P>(select_tcp_syn_ack, false, false); }
 
-    bool nbss() const { return select_nbss; }
+    template <selector_profile P=selector_profile::general>
+    bool nbds() const { return selection<P>(select_nbds, false, false); }
 
-    bool openvpn_tcp() const { return select_openvpn_tcp; }
+    template <selector_profile P=selector_profile::general>
+    bool nbss() const { return selection<P>(select_nbss, false, false); }
+
+    template <selector_profile P=selector_profile::general>
+    bool openvpn_tcp() const { return selection<P>(select_openvpn_tcp, true, false); }
 
     traffic_selector(std::map<std::string, bool> protocols) :
             tcp{},
@@ -249,7 +375,8 @@ public:
             select_tcp_syn_ack{false},
             select_nbds{false},
             select_nbss{false},
-            select_openvpn_tcp{false} {
+            select_openvpn_tcp{false},
+            profile{selector_profile::general} {
 
         // "none" is a special case; turn off all protocol selection
         //
@@ -258,11 +385,10 @@ public:
                 pair.second = false;
             }
         }
+        set_profile(protocols);
 
         if (protocols["tls"] || protocols["all"]) {
-            tcp.add_protocol(tls_client_hello::matcher, tcp_msg_type_tls_client_hello);
-            tcp.add_protocol(tls_server_hello::matcher, tcp_msg_type_tls_server_hello);
-            tcp.add_protocol(tls_server_certificate::matcher, tcp_msg_type_tls_certificate);
+            add_protocols(tcp, tls_tcp_matchers);
         }
         else if(protocols["tls.client_hello"])
         {
@@ -331,12 +457,12 @@ public:
             if (protocols["mdns"]) {
                 select_mdns = true;
             }
-            udp.add_protocol(dns_packet::matcher, udp_msg_type_dns);
+            add_protocols(udp, dns_udp_matchers);
             // udp.add_protocol(dns_packet::client_matcher, udp_msg_type_dns); // older matcher
             // udp.add_protocol(dns_packet::server_matcher, udp_msg_type_dns); // older matcher
         }
         if (protocols["dns"] || protocols["all"]) {
-            tcp.add_protocol(dns_packet::tcp_matcher, tcp_msg_type_dns);
+            add_protocols(tcp, dns_tcp_matchers);
         }
 
         if (protocols["dtls"] || protocols["all"]) {
@@ -403,7 +529,7 @@ public:
             tcp.add_protocol(mysql_server_greet::matcher, tcp_msg_type_mysql_server);
         }
         if (protocols["quic"] || protocols["all"]) {
-            udp.add_protocol(quic_initial_packet::matcher, udp_msg_type_quic);
+            add_protocols(udp, quic_udp_matchers);
         }
         // tell protocol_identification objects to compile lookup tables
         tcp.compile();
@@ -412,24 +538,39 @@ public:
 
     }
 
+    template <selector_profile P=selector_profile::general>
     size_t get_tcp_msg_type(datum &pkt) const {
-        size_t type = tcp.get_msg_type(pkt);
-        if (type == tcp_msg_type_unknown)  {
-            type = tcp4.get_msg_type(pkt);
+        if constexpr (P == selector_profile::tls_quic) {
+            return first_match(tls_tcp_matchers, pkt);
+        } else if constexpr (P == selector_profile::dns) {
+            return first_match(dns_tcp_matchers, pkt);
+        } else {
+            size_t type = tcp.get_msg_type(pkt);
+            if (type == tcp_msg_type_unknown)  {
+                type = tcp4.get_msg_type(pkt);
+            }
+            return type;
         }
-        return type;
     }
 
+    template <selector_profile P=selector_profile::general>
     size_t get_udp_msg_type(datum &pkt) const {
-        size_t type = udp.get_msg_type(pkt);
-        if (type == udp_msg_type_unknown)  {
-            type = udp16.get_msg_type(pkt);
+        if constexpr (P == selector_profile::tls_quic) {
+            return first_match(quic_udp_matchers, pkt);
+        } else if constexpr (P == selector_profile::dns) {
+            return first_match(dns_udp_matchers, pkt);
+        } else {
+            size_t type = udp.get_msg_type(pkt);
+            if (type == udp_msg_type_unknown)  {
+                type = udp16.get_msg_type(pkt);
+            }
+            return type;
         }
-        return type;
     }
 
+    template <selector_profile P=selector_profile::general>
     size_t get_udp_msg_type_from_ports(udp::ports ports) const {
-        if (nbds() and ports.src == hton<uint16_t>(138) and ports.dst == hton<uint16_t>(138)) {
+        if (nbds<P>() and ports.src == hton<uint16_t>(138) and ports.dst == hton<uint16_t>(138)) {
             return udp_msg_type_nbds;
         }
 
@@ -440,22 +581,70 @@ public:
         return udp_msg_type_unknown;
     }
 
+    template <selector_profile P=selector_profile::general>
     size_t get_tcp_msg_type_from_ports(struct tcp_packet *tcp_pkt) const {
         if (tcp_pkt == nullptr or tcp_pkt->header == nullptr) {
             return tcp_msg_type_unknown;
         }
 
-        if (nbss() and (tcp_pkt->header->src_port == hton<uint16_t>(139) or tcp_pkt->header->dst_port == hton<uint16_t>(139))) {
+        if (nbss<P>() and (tcp_pkt->header->src_port == hton<uint16_t>(139) or tcp_pkt->header->dst_port == hton<uint16_t>(139))) {
             return tcp_msg_type_nbss;
         }
 
-        if (openvpn_tcp() and (tcp_pkt->header->src_port == hton<uint16_t>(1194) or tcp_pkt->header->dst_port == hton<uint16_t>(1194)) ) {
+        if (openvpn_tcp<P>() and (tcp_pkt->header->src_port == hton<uint16_t>(1194) or tcp_pkt->header->dst_port == hton<uint16_t>(1194)) ) {
             return tcp_msg_type_openvpn;
         }
 
         return tcp_msg_type_unknown;
     }
 
+    // same_types<P>(pkt) returns true if the specialized profile P
+    // identifies the TCP and UDP message types of pkt as the general
+    // profile does
+    //
+    template <selector_profile P>
+    bool same_types(datum pkt) const {
+        datum tmp{pkt};
+        size_t tcp_type = get_tcp_msg_type<P>(tmp);
+        size_t udp_type = get_udp_msg_type<P>(tmp);
+        return tcp_type == get_tcp_msg_type(pkt) && udp_type == get_udp_msg_type(pkt);
+    }
+
+    static bool unit_test() {
+        std::vector<std::vector<uint8_t>> samples{
+            { 0x16, 0x03, 0x01, 0x02, 0x00, 0x01, 0x00, 0x01, 0xfc, 0x03, 0x03 },   // tls client hello
+            { 0x16, 0x03, 0x03, 0x00, 0x5d, 0x02, 0x00, 0x00, 0x59, 0x03, 0x03 },   // tls server hello
+            { 0x16, 0x03, 0x03, 0x0b, 0x00, 0x0b, 0x00, 0x0a, 0xfc, 0x00, 0x0a },   // tls certificate
+            { 0xc3, 0x00, 0x00, 0x00, 0x01, 0x08, 0x01, 0x02, 0x03, 0x04, 0x05 },   // quic initial
+            { 0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 },   // dns query
+            { 0x00, 0x1d, 0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00 },   // dns over tcp
+            { 'G', 'E', 'T', ' ', '/', ' ', 'H', 'T', 'T', 'P', '/' },             // http request
+            { 'S', 'S', 'H', '-', '2', '.', '0', '-', 'x', 'x', 'x' },             // ssh
+            { 0x16, 0x03 },                                                        // too short
+            { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+        };
+        traffic_selector tls_quic{{ { "tls", true }, { "quic", true } }};
+        traffic_selector dns{{ { "dns", true } }};
+        if (tls_quic.get_profile() != selector_profile::tls_quic || dns.get_profile() != selector_profile::dns) {
+            return false;
+        }
+        for (const auto &s : samples) {
+            datum pkt{s.data(), s.data() + s.size()};
+            if (!tls_quic.same_types<selector_profile::tls_quic>(pkt) || !dns.same_types<selector_profile::dns>(pkt)) {
+                return false;
+            }
+        }
+
+        // the samples are identified, so the test is not vacuous
+        //
+        datum client_hello{samples[0].data(), samples[0].data() + samples[0].size()};
+        datum quic{samples[3].data(), samples[3].data() + samples[3].size()};
+        datum dns_query{samples[4].data(), samples[4].data() + samples[4].size()};
+        return tls_quic.get_tcp_msg_type<selector_profile::tls_quic>(client_hello) == tcp_msg_type_tls_client_hello
+            && tls_quic.get_udp_msg_type<selector_profile::tls_quic>(quic) == udp_msg_type_quic
+            && dns.get_udp_msg_type<selector_profile::dns>(dns_query) == udp_msg_type_dns;
+    }
+
 };
 
 #endif /* PROTO_IDENTIFY_H */
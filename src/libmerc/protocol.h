@@ -30,6 +30,25 @@ public:
 
     bool do_analysis(const struct key &, struct analysis_context &, classifier*) { return false; }
 
+    // bytes_needed() returns the number of bytes beyond the end of
+    // the data that was parsed that are needed to complete the
+    // message, if the message carries its own length and was found
+    // to be incomplete, and zero otherwise.  A nonzero value is
+    // passed to the TCP reassembler, which buffers that many more
+    // bytes of the flow, and then parses the reassembled message.
+    //
+    size_t bytes_needed() const { return 0; }
+
+    // end_marker() returns the sequence of bytes that ends a message
+    // whose length is not known until its end is seen, such as the
+    // empty line that ends the headers of an HTTP request, if the
+    // message was found to be incomplete, and nullptr otherwise.  A
+    // marker is passed to the TCP reassembler, which buffers the flow
+    // until the marker is seen or its buffer is full, and then parses
+    // the reassembled message.
+    //
+    const char *end_marker() const { return nullptr; }
+
 };
 
 #endif // PROTOCOL_H
@@ -0,0 +1,211 @@
+// public_suffix_list.hpp
+//
+// registrable domain (eTLD+1) extraction using the Public Suffix List
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef PUBLIC_SUFFIX_LIST_HPP
+#define PUBLIC_SUFFIX_LIST_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+// class public_suffix_list holds the rules of the Public Suffix List
+// (https://publicsuffix.org/list/public_suffix_list.dat) in a trie of
+// labels, read from right to left, so that the public suffix of a
+// name can be found in a single pass over its labels.
+//
+// The rules are interpreted in the same way as by the scripts that
+// generate the domain features of the fingerprint database, so that
+// the domain names computed here match those in the database:
+//
+//    * a wildcard rule *.example is treated as the rule example,
+//    * exception rules (!www.example) are ignored, and
+//    * public suffixes with more than max_suffix_labels labels are
+//      not considered.
+//
+// If no rules have been loaded, the public suffix of a name is its
+// last label, and get_registrable_domain() returns the last two
+// labels of a name.
+//
+// A public_suffix_list is not changed by lookups, so once it has
+// been loaded, it can be shared by any number of threads.
+//
+class public_suffix_list {
+
+    static constexpr size_t max_suffix_labels = 6;
+
+    struct node {
+        std::string label;
+        bool is_suffix = false;
+        std::vector<uint32_t> children;   // sorted by label
+    };
+
+    std::vector<node> nodes{1};           // nodes[0] is the root
+
+    static char to_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    // compare(a, b) compares the lowercase label a with the label b,
+    // ignoring the case of b, and returns a value less than, equal
+    // to, or greater than zero, as with strcmp()
+    //
+    static int compare(std::string_view a, std::string_view b) {
+        size_t len = std::min(a.length(), b.length());
+        for (size_t i = 0; i < len; i++) {
+            uint8_t x = a[i];
+            uint8_t y = to_lower(b[i]);
+            if (x != y) {
+                return x < y ? -1 : 1;
+            }
+        }
+        return (a.length() > len) - (b.length() > len);
+    }
+
+    // find_child(parent, label) returns the index of the position of
+    // the child of parent with the given label, if there is one, or
+    // the position at which that child would be inserted otherwise
+    //
+    size_t find_child(const node &parent, std::string_view label) const {
+        auto it = std::lower_bound(parent.children.begin(), parent.children.end(), label,
+                                   [this](uint32_t child, std::string_view l) {
+                                       return compare(nodes[child].label, l) < 0;
+                                   });
+        return it - parent.children.begin();
+    }
+
+    const node *get_child(const node &parent, std::string_view label) const {
+        size_t i = find_child(parent, label);
+        if (i < parent.children.size() && compare(nodes[parent.children[i]].label, label) == 0) {
+            return &nodes[parent.children[i]];
+        }
+        return nullptr;
+    }
+
+public:
+
+    // process_line(line) adds the rule in a single line of the
+    // Public Suffix List, if that line contains one
+    //
+    void process_line(std::string_view line) {
+        size_t end = line.find_first_of(" \t\r\n");
+        if (end != std::string_view::npos) {
+            line = line.substr(0, end);
+        }
+        if (line.empty() || line.compare(0, 2, "//") == 0 || line[0] == '!') {
+            return;   // blank, comment, or exception rule
+        }
+        if (line.compare(0, 2, "*.") == 0) {
+            line.remove_prefix(2);
+        }
+
+        // insert labels from right to left
+        //
+        uint32_t current = 0;
+        while (!line.empty()) {
+            size_t dot = line.rfind('.');
+            std::string_view label = (dot == std::string_view::npos) ? line : line.substr(dot + 1);
+            line = (dot == std::string_view::npos) ? std::string_view{} : line.substr(0, dot);
+            if (label.empty()) {
+                return;   // malformed rule
+            }
+            size_t i = find_child(nodes[current], label);
+            if (i < nodes[current].children.size() && compare(nodes[nodes[current].children[i]].label, label) == 0) {
+                current = nodes[current].children[i];
+            } else {
+                std::string lowercase_label{label};
+                for (auto &c : lowercase_label) {
+                    c = to_lower(c);
+                }
+                uint32_t child = nodes.size();
+                nodes.push_back({ lowercase_label, false, {} });
+                nodes[current].children.insert(nodes[current].children.begin() + i, child);
+                current = child;
+            }
+        }
+        nodes[current].is_suffix = true;
+    }
+
+    // get_registrable_domain(name) returns the registrable domain of
+    // name, that is, its public suffix along with the label that
+    // precedes it (eTLD+1), as a view into name; given
+    // "www.example.co.uk", it returns "example.co.uk".  If name has
+    // no label before its public suffix, name is returned.
+    //
+    std::string_view get_registrable_domain(std::string_view name) const {
+        const node *current = &nodes[0];
+        size_t suffix_labels = 1;     // the last label is always a public suffix
+        size_t labels = 0;
+        size_t label_end = name.length();
+        while (labels < max_suffix_labels && label_end > 0) {
+            size_t dot = name.rfind('.', label_end - 1);
+            size_t label_start = (dot == std::string_view::npos) ? 0 : dot + 1;
+            current = get_child(*current, name.substr(label_start, label_end - label_start));
+            if (current == nullptr) {
+                break;
+            }
+            labels++;
+            if (current->is_suffix && labels > suffix_labels) {
+                suffix_labels = labels;
+            }
+            if (dot == std::string_view::npos) {
+                break;
+            }
+            label_end = dot;
+        }
+
+        // find the start of the label before the public suffix
+        //
+        size_t start = name.length();
+        for (size_t i = 0; i < suffix_labels + 1; i++) {
+            if (start == 0) {
+                return name;
+            }
+            size_t dot = name.rfind('.', start - 1);
+            if (dot == std::string_view::npos) {
+                return name;
+            }
+            start = dot;
+        }
+        return name.substr(start + 1);
+    }
+
+    size_t size() const { return nodes.size() - 1; }
+
+    static bool unit_test() {
+        public_suffix_list psl;
+        for (const char *rule : { "// comment", "com", "uk", "co.uk", "*.kawasaki.jp", "!city.kawasaki.jp", "jp" }) {
+            psl.process_line(rule);
+        }
+        const std::pair<const char *, const char *> examples[] = {
+            { "www.example.com",        "example.com"         },
+            { "example.com",            "example.com"         },
+            { "com",                    "com"                 },
+            { "www.example.co.uk",      "example.co.uk"       },
+            { "WWW.Example.CO.UK",      "Example.CO.UK"       },
+            { "co.uk",                  "co.uk"               },
+            { "a.b.kawasaki.jp",        "b.kawasaki.jp"       },
+            { "s3.amazonaws.test",      "amazonaws.test"      },
+            { "localhost",              "localhost"           },
+            { "",                       ""                    },
+        };
+        for (const auto &e : examples) {
+            if (psl.get_registrable_domain(e.first) != e.second) {
+                return false;
+            }
+        }
+
+        // with no rules, the last two labels are returned
+        //
+        public_suffix_list empty;
+        return empty.get_registrable_domain("www.example.co.uk") == "co.uk";
+    }
+
+};
+
+#endif // PUBLIC_SUFFIX_LIST_HPP
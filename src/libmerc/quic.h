@@ -26,6 +26,7 @@
 #include "util_obj.h"
 #include "match.h"
 #include "crypto_engine.h"
+#include "handshake_buffer.hpp"
 
 #define type_quic_user_agent 0x3129
 /*
@@ -861,6 +862,20 @@ public:
     }
 };
 
+// struct cryptographic_buffer holds the data of the CRYPTO frames of
+// a QUIC Initial packet, reassembled in order of their offsets.  It
+// is too large to be part of each quic_init, so each
+// quic_crypto_engine holds one, which is reused for every packet that
+// the engine decrypts.
+//
+struct cryptographic_buffer : public handshake_buffer {
+
+    void extend(crypto& d) {
+        handshake_buffer::extend(d.offset(), d.data());
+    }
+
+};
+
 class quic_crypto_engine {
 
     crypto_engine core_crypto;
@@ -878,13 +893,40 @@ class quic_crypto_engine {
 
     uint8_t pn_length = 0;
 
-    unsigned char plaintext[pt_buf_len] = {0};
-    int16_t plaintext_len = 0;
+    // the plaintext buffer starts out large enough for a typical
+    // Initial packet, and grows to fit any larger one
+    //
+    std::vector<unsigned char> plaintext = std::vector<unsigned char>(handshake_buffer::initial_size);
+    int plaintext_len = 0;
 
     const char *salt_str = nullptr;
 
+    cryptographic_buffer crypto_buffer;
+
+    // client hellos that are too large for a single Initial packet,
+    // such as those with post-quantum key shares, are reassembled
+    // across packets, keyed by their destination connection ID
+    //
+    pending_handshakes<std::string> pending;
+
 public:
 
+    // get_crypto_buffer() returns the reassembly buffer for the
+    // CRYPTO frames of the packet that is being processed; its
+    // contents are only valid until the next packet is processed
+    //
+    cryptographic_buffer &get_crypto_buffer() { return crypto_buffer; }
+
+    // reassemble(dcid, buffer) combines the CRYPTO frames in buffer
+    // with those seen earlier in Initial packets with the same
+    // destination connection ID, and returns true if buffer now
+    // holds a complete handshake message; otherwise, the frames are
+    // kept for the next Initial packet, and false is returned
+    //
+    bool reassemble(datum dcid, cryptographic_buffer &buffer) {
+        return pending.reassemble(std::string{(const char *)dcid.data, (size_t)dcid.length()}, buffer);
+    }
+
     datum decrypt(quic_initial_packet &quic_pkt) {
         if (!quic_pkt.is_not_empty()) {
             return {nullptr, nullptr};
@@ -924,7 +966,7 @@ public:
                 }
                 decrypt__(aad.buffer, aad.readable_length(),
                       quic_pkt.payload.data, quic_pkt.payload.length());
-                return {plaintext, plaintext+plaintext_len};
+                return {plaintext.data(), plaintext.data()+plaintext_len};
             }
             return {nullptr, nullptr}; 
         }
@@ -953,7 +995,7 @@ public:
                     //salt_str = quic_params.salts[i].get_name();
                     salt_str = initial_salt->get_name();
                     quic_params.add_param_mapping(version, param);
-                    return {plaintext, plaintext+plaintext_len};
+                    return {plaintext.data(), plaintext.data()+plaintext_len};
                 }
                 aad.reset();
             }
@@ -1058,7 +1100,10 @@ private:
     void decrypt__(const uint8_t *ad, unsigned int ad_len, const uint8_t *data, unsigned int length) {
 
         uint16_t cipher_len = length - pn_length;
-        plaintext_len = core_crypto.gcm_decrypt(ad, ad_len, data+pn_length, cipher_len, quic_key, quic_iv, plaintext);
+        if (plaintext.size() < cipher_len) {
+            plaintext.resize(cipher_len);
+        }
+        plaintext_len = core_crypto.gcm_decrypt(ad, ad_len, data+pn_length, cipher_len, quic_key, quic_iv, plaintext.data());
         if (plaintext_len == -1) {
             plaintext_len = 0;  // error; indicate that there is no plaintext in buffer
         }
@@ -1256,30 +1301,6 @@ public:
 
 };
 
-struct cryptographic_buffer
-{
-    uint64_t buf_len = 0;
-    unsigned char buffer[pt_buf_len] = {}; // pt_buf_len - decryption buffer trim size for gcm_decrypt
-
-    void extend(crypto& d)
-    {
-        if (d.offset() + d.length() <= sizeof(buffer)) {
-            memcpy(buffer + d.offset(), d.data().data, d.length());
-            if (d.offset() + d.length() > buf_len) {
-                buf_len = d.offset() + d.length();
-            }
-        }
-        // TODO: track segments to verify that all are present
-    }
-
-    bool is_valid()
-    {
-        return buf_len > 0;
-    }
-
-    void reset() {buf_len = 0;}
-};
-
 struct quic_hdr_fp {
     const datum &version;
 
@@ -1368,7 +1389,11 @@ public:
         }
         valid = true;
         if(crypto_buffer.is_valid()){
-            struct datum d{crypto_buffer.buffer, crypto_buffer.buffer + crypto_buffer.buf_len};
+
+            // the buffer is reused across packets, so only the data
+            // before its first gap belongs to this packet
+            //
+            struct datum d = crypto_buffer.contiguous_contents();
             tls_handshake tls{d};
             hello.parse(tls.body);
             hello.is_quic_hello = true;
@@ -1420,12 +1445,15 @@ public:
     }
 };
 
-// class quic_init represents an initial quic message
+// class quic_init represents an initial quic message.  Its TLS client
+// hello refers to the crypto buffer of its quic_crypto_engine, so a
+// quic_init can only be used until the next one is constructed with
+// the same engine.
 //
 class quic_init {
     quic_initial_packet initial_packet;
     quic_crypto_engine &quic_crypto;
-    cryptographic_buffer crypto_buffer;
+    cryptographic_buffer &crypto_buffer;
     quic_client_hello hello;
     datum plaintext;
     quic_frame cc;
@@ -1434,7 +1462,9 @@ class quic_init {
 
 public:
 
-    quic_init(struct datum &d, quic_crypto_engine &quic_crypto_) : initial_packet{d}, quic_crypto{quic_crypto_}, crypto_buffer{}, hello{}, plaintext{}, decry_pkt{initial_packet,crypto_buffer}, pre_decrypted{false} {
+    quic_init(struct datum &d, quic_crypto_engine &quic_crypto_) : initial_packet{d}, quic_crypto{quic_crypto_}, crypto_buffer{quic_crypto_.get_crypto_buffer()}, hello{}, plaintext{}, decry_pkt{initial_packet,crypto_buffer}, pre_decrypted{false} {
+
+        crypto_buffer.reset();
 
         // check reserved bits, if 0, try for decrypted quic packet
         //
@@ -1470,7 +1500,15 @@ public:
             }
         }
         if(crypto_buffer.is_valid()){
-            struct datum d{crypto_buffer.buffer, crypto_buffer.buffer + crypto_buffer.buf_len};
+
+            // if the client hello continues in a later Initial packet,
+            // wait for the rest of it before parsing it
+            //
+            if (!crypto_buffer.tls_handshake_is_complete()
+                && !quic_crypto.reassemble(initial_packet.dcid, crypto_buffer)) {
+                return;
+            }
+            struct datum d = crypto_buffer.contiguous_contents();
             tls_handshake tls{d};
             hello.parse(tls.body);
             hello.is_quic_hello = true;
@@ -0,0 +1,122 @@
+// reassembly_hints.hpp
+//
+// per-protocol counts of the TCP messages that were found to be
+// incomplete, and of those that were then reassembled
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef REASSEMBLY_HINTS_HPP
+#define REASSEMBLY_HINTS_HPP
+
+#include <array>
+#include <cinttypes>
+#include "libmerc.h"
+#include "proto_identify.h"
+
+// tcp_msg_type_name(type) returns a short name for a tcp_msg_type,
+// for use in log messages
+//
+inline const char *tcp_msg_type_name(enum tcp_msg_type type) {
+    switch (type) {
+    case tcp_msg_type_http_request:           return "http_request";
+    case tcp_msg_type_http_response:          return "http_response";
+    case tcp_msg_type_tls_client_hello:       return "tls_client_hello";
+    case tcp_msg_type_tls_server_hello:       return "tls_server_hello";
+    case tcp_msg_type_tls_certificate:        return "tls_certificate";
+    case tcp_msg_type_ssh:                    return "ssh";
+    case tcp_msg_type_ssh_kex:                return "ssh_kex";
+    case tcp_msg_type_smtp_client:            return "smtp_client";
+    case tcp_msg_type_smtp_server:            return "smtp_server";
+    case tcp_msg_type_dns:                    return "dns";
+    case tcp_msg_type_smb1:                   return "smb1";
+    case tcp_msg_type_smb2:                   return "smb2";
+    case tcp_msg_type_iec:                    return "iec";
+    case tcp_msg_type_dnp3:                   return "dnp3";
+    case tcp_msg_type_nbss:                   return "nbss";
+    case tcp_msg_type_openvpn:                return "openvpn";
+    case tcp_msg_type_bittorrent:             return "bittorrent";
+    case tcp_msg_type_mysql_server:           return "mysql_server";
+    case tcp_msg_type_tofsee_initial_message: return "tofsee_initial_message";
+    case tcp_msg_type_unknown:
+    case tcp_msg_type_max:
+    default:
+        ;
+    }
+    return "unknown";
+}
+
+// class reassembly_hint_counters counts, for each type of TCP
+// message, the messages that reported that they needed more bytes
+// than were present in their first segment, and the messages that
+// were parsed from reassembled data.  The difference between the two
+// is the number of messages that could not be recovered, because
+// reassembly was not enabled, the rest of the message was never
+// seen, or the message was too long to be buffered.
+//
+class reassembly_hint_counters {
+
+    struct counts {
+        uint64_t incomplete = 0;
+        uint64_t reassembled = 0;
+    };
+    std::array<counts, tcp_msg_type_max> table{};
+
+public:
+
+    void incomplete(enum tcp_msg_type type) {
+        if (type < tcp_msg_type_max) {
+            table[type].incomplete++;
+        }
+    }
+
+    void reassembled(enum tcp_msg_type type) {
+        if (type < tcp_msg_type_max) {
+            table[type].reassembled++;
+        }
+    }
+
+    uint64_t get_incomplete(enum tcp_msg_type type) const {
+        return type < tcp_msg_type_max ? table[type].incomplete : 0;
+    }
+
+    uint64_t get_reassembled(enum tcp_msg_type type) const {
+        return type < tcp_msg_type_max ? table[type].reassembled : 0;
+    }
+
+    // log_and_reset() reports the nonzero counts through printf_err(),
+    // one line per type of message, and then sets all of the counts to
+    // zero
+    //
+    void log_and_reset() {
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i].incomplete || table[i].reassembled) {
+                printf_err(log_info,
+                           "tcp messages needing reassembly: %s incomplete: %" PRIu64 " reassembled: %" PRIu64 "\n",
+                           tcp_msg_type_name((enum tcp_msg_type)i),
+                           table[i].incomplete,
+                           table[i].reassembled);
+            }
+        }
+        table = {};
+    }
+
+    static bool unit_test() {
+        reassembly_hint_counters c;
+        c.incomplete(tcp_msg_type_http_request);
+        c.incomplete(tcp_msg_type_http_request);
+        c.reassembled(tcp_msg_type_http_request);
+        c.incomplete(tcp_msg_type_max);            // ignored
+        if (c.get_incomplete(tcp_msg_type_http_request) != 2
+            || c.get_reassembled(tcp_msg_type_http_request) != 1
+            || c.get_incomplete(tcp_msg_type_dns) != 0
+            || c.get_incomplete(tcp_msg_type_max) != 0) {
+            return false;
+        }
+        c.table = {};
+        return c.get_incomplete(tcp_msg_type_http_request) == 0;
+    }
+
+};
+
+#endif // REASSEMBLY_HINTS_HPP
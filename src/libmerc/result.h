@@ -16,6 +16,7 @@
 #include "fingerprint.h"
 
 uint16_t flow_key_get_dst_port(const struct key &key);
+uint8_t flow_key_get_dst_addr(const struct key &key, uint8_t dst_addr[16]);
 
 void flow_key_sprintf_dst_addr(const struct key &key,
                                char *dst_addr_str);
@@ -85,7 +86,7 @@ public:
         record.close();
     }
 
-    bool is_valid() {
+    bool is_valid() const {
         return tags.any();
     }
 
@@ -190,7 +191,7 @@ public:
 
             attr.write_json(analysis);
 
-        } else if (status == fingerprint_status_randomized) {
+        } else if (status == fingerprint_status_randomized || status == fingerprint_status_approximate) {
             if (max_proc[0] != '\0') {
                 analysis.print_key_string("process", max_proc);
                 analysis.print_key_float("score", max_score);
@@ -206,7 +207,7 @@ public:
                     os_json.close();
                 }
             }
-            analysis.print_key_string("status", "randomized_fingerprint");
+            analysis.print_key_string("status", status == fingerprint_status_randomized ? "randomized_fingerprint" : "approximate_fingerprint");
         } else if (status == fingerprint_status_unlabled) {
             analysis.print_key_string("status", "unlabeled_fingerprint");
         } else {
@@ -280,14 +281,17 @@ struct destination_context {
     uint8_t alpn_array[MAX_ALPN_STR_LEN];
     size_t alpn_length;
     uint16_t dst_port;
+    uint8_t dst_ip_vers;           // 4, 6, or 0 if there is no address
+    uint8_t dst_ip_addr[16];       // in network byte order
 
-    destination_context() : dst_port{0} {}
+    destination_context() : dst_port{0}, dst_ip_vers{0} {}
 
     void init(struct datum domain, struct datum user_agent, datum alpn, const struct key &key) {
         user_agent.strncpy(ua_str, MAX_USER_AGENT_LEN);
         domain.strncpy(sn_str, MAX_SNI_LEN);
         flow_key_sprintf_dst_addr(key, dst_ip_str);
         dst_port = flow_key_get_dst_port(key);
+        dst_ip_vers = flow_key_get_dst_addr(key, dst_ip_addr);
 
         alpn.write_to_buffer(alpn_array, sizeof(alpn_array));
         alpn_length = alpn.length();
@@ -166,6 +166,34 @@ void smb2_negotiate_response::write_json (struct json_object &o) {
     neg_resp.close();
 }
 
+void smb2_session_setup_request::write_json(struct json_object &o) const {
+    if (base == nullptr) {
+        return;
+    }
+    json_object ss_req{o, "session_setup_request"};
+    ss_req.print_key_uint16("structure_size", fields::structure_size::get(base));
+    ss_req.print_key_uint8_hex("flags", fields::flags::get(base));
+    ss_req.print_key_uint8_hex("security_mode", fields::security_mode::get(base));
+    ss_req.print_key_uint_hex("capabilities", fields::capabilities::get(base));
+    ss_req.print_key_uint_hex("channel", fields::channel::get(base));
+    ss_req.print_key_uint16("security_buffer_offset", fields::security_buffer_offset::get(base));
+    ss_req.print_key_uint16("security_buffer_length", fields::security_buffer_length::get(base));
+    ss_req.print_key_uint64_hex("previous_session_id", fields::previous_session_id::get(base));
+    ss_req.close();
+}
+
+void smb2_session_setup_response::write_json(struct json_object &o) const {
+    if (base == nullptr) {
+        return;
+    }
+    json_object ss_resp{o, "session_setup_response"};
+    ss_resp.print_key_uint16("structure_size", fields::structure_size::get(base));
+    ss_resp.print_key_uint16_hex("session_flags", fields::session_flags::get(base));
+    ss_resp.print_key_uint16("security_buffer_offset", fields::security_buffer_offset::get(base));
+    ss_resp.print_key_uint16("security_buffer_length", fields::security_buffer_length::get(base));
+    ss_resp.close();
+}
+
 const char * smb2_command::get_string() const {
 switch (command) {
     case SMB2_NEGOTIATE:        return "smb2_negotiate";
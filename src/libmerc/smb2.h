@@ -27,6 +27,74 @@
  * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-smb2/5606ad47-5ee0-437a-817e-70c366052962
  */
 
+/*
+ * Fixed-length SMB2 structures are decoded through compile-time
+ * layout descriptors.  Each field is described by its type and its
+ * offset within the structure, and a fixed_layout<> lists the
+ * fields of a structure along with its length, which is checked
+ * against the fields at compile time.  A structure is parsed with a
+ * single bounds check, by fixed_layout<>::parse(), after which each
+ * field is read directly from its offset.
+ */
+
+// struct le_field<T, offset> describes a little-endian unsigned
+// integer of type T at a fixed offset in a structure; get(base)
+// reads it from the structure that starts at base, which the caller
+// must have checked to be long enough
+//
+template <typename T, size_t offset_>
+struct le_field {
+    static_assert(std::is_unsigned_v<T>, "T must be an unsigned integer");
+
+    static constexpr size_t offset = offset_;
+    static constexpr size_t end = offset + sizeof(T);
+
+    static T get(const uint8_t *base) {
+        T value = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            value |= (T)base[offset + i] << (8 * i);
+        }
+        return value;
+    }
+};
+
+// struct bytes_field<offset, length> describes a byte string of a
+// fixed length at a fixed offset in a structure
+//
+template <size_t offset_, size_t length_>
+struct bytes_field {
+    static constexpr size_t offset = offset_;
+    static constexpr size_t end = offset + length_;
+
+    static datum get(const uint8_t *base) {
+        return { base + offset, base + end };
+    }
+};
+
+// struct fixed_layout<length, Fields...> describes a structure of
+// length bytes that contains Fields
+//
+template <size_t length_, typename... Fields>
+struct fixed_layout {
+    static constexpr size_t length = length_;
+
+    static_assert(((Fields::end <= length) && ...), "field extends past the end of its structure");
+
+    // parse(d) returns a pointer to the structure at the start of d
+    // and advances d past it, or returns nullptr and sets d to null if
+    // d is too short to hold the structure
+    //
+    static const uint8_t *parse(datum &d) {
+        if (d.data == nullptr || d.data_end - d.data < (ssize_t)length) {
+            d.set_null();
+            return nullptr;
+        }
+        const uint8_t *base = d.data;
+        d.data += length;
+        return base;
+    }
+};
+
 /*
  * GUID--Packet Representation
  * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-dtyp/001eec5a-7f8b-4293-9e21-ca349392db40
@@ -42,6 +110,8 @@ class guid {
     bool valid;
 
 public:
+    guid() : a{0}, b{0}, c{0}, d{}, valid{false} { }
+
     guid(datum &data, bool byte_swap = true) :
         a(data, byte_swap),
         b(data, byte_swap),
@@ -70,6 +140,10 @@ class dialect {
     bool valid;
 
 public:
+    dialect () : val{0}, valid{false} { }
+
+    explicit dialect (uint16_t code) : val{code}, valid{true} { }
+
     dialect (datum &d, bool byte_swap = true) : val(d, byte_swap), valid(d.is_not_null()) { }
 
     const char * get_dialect_string() const;
@@ -92,7 +166,9 @@ public:
 class dialects {
 public:
     std::vector<dialect> dialects_list;
-    bool valid;
+    bool valid = false;
+
+    dialects () { }
 
     dialects (datum &d, uint16_t cnt, bool byte_swap = true) {
         for (auto i = 0; i < cnt; i++) {
@@ -142,6 +218,10 @@ class win_epoch_time {
     static constexpr uint64_t unixTimeBaseAsWin = 11644473600000000000ull; // The unix base time (January 1, 1970 UTC) as ns since Win32 epoch (1601-01-01)
     static constexpr uint64_t nsToSecFactor = 1000000000;
 public:
+    win_epoch_time () : value{0}, valid{false} { }
+
+    explicit win_epoch_time (uint64_t v) : value{v}, valid{true} { }
+
     win_epoch_time (datum &d, bool byte_swap = true) : value(d, byte_swap), valid(d.is_not_null()) { }
 
     void fingerprint(struct buffer_stream &b) { 
@@ -448,6 +528,8 @@ class negotiate_context_list {
     std::vector<negotiate_context> context_list;
 
 public:
+    negotiate_context_list () { }
+
     negotiate_context_list (struct datum &d, bool byte_swap) {
         while(d.is_not_empty()) {
             context_list.emplace_back(negotiate_context(d, byte_swap));
@@ -507,37 +589,63 @@ public:
     }
 };
          
+/*
+ * SMB2 NEGOTIATE Request, up to the variable-length Dialects array
+ * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-smb2/e14db7ff-763a-4263-8b10-0c3944f52fc5
+ */
+struct smb2_negotiate_request_layout {
+    using structure_size           = le_field<uint16_t, 0>;
+    using dialect_count            = le_field<uint16_t, 2>;
+    using security_mode            = le_field<uint16_t, 4>;
+    using capabilities             = le_field<uint32_t, 8>;
+    using client_guid              = bytes_field<12, 16>;
+    using negotiate_context_offset = le_field<uint32_t, 28>;
+    using negotiate_context_count  = le_field<uint16_t, 32>;
+
+    using layout = fixed_layout<36,
+                                structure_size,
+                                dialect_count,
+                                security_mode,
+                                capabilities,
+                                client_guid,
+                                negotiate_context_offset,
+                                negotiate_context_count>;
+};
+
 class smb2_negotiate_request {
-    encoded<uint16_t> structure_size;
-    encoded<uint16_t> dialect_count;
-    encoded<uint16_t> sec_mode;
-    skip_bytes<2> reserved1;
-    encoded<uint32_t> cap;
+    encoded<uint16_t> structure_size{0};
+    encoded<uint16_t> dialect_count{0};
+    encoded<uint16_t> sec_mode{0};
+    encoded<uint32_t> cap{0};
     guid id;
-    encoded<uint32_t> neg_context_offset;
-    encoded<uint16_t> neg_context_count;
-    skip_bytes<2> reserved2;
+    encoded<uint32_t> neg_context_offset{0};
+    encoded<uint16_t> neg_context_count{0};
     dialects dialect_list;
-    neg_req_padding padding;
     negotiate_context_list neg_contexts;
-    bool valid;
+    bool valid = false;
 
+    using fields = smb2_negotiate_request_layout;
     static constexpr bool byte_swap = true;
 public:
-    smb2_negotiate_request (datum &d) : 
-        structure_size(d, byte_swap),
-        dialect_count(d, byte_swap),
-        sec_mode(d, byte_swap),
-        reserved1(d),
-        cap(d, byte_swap),
-        id(d, byte_swap),
-        neg_context_offset(d, byte_swap),
-        neg_context_count(d, byte_swap),
-        reserved2(d),
-        dialect_list(d, dialect_count.value()),
-        padding(d, neg_context_offset.value(), dialect_count.value()),
-        neg_contexts(d, byte_swap),
-        valid(d.is_not_null()) { }
+    smb2_negotiate_request (datum &d) {
+        const uint8_t *base = fields::layout::parse(d);
+        if (base == nullptr) {
+            return;
+        }
+        structure_size = fields::structure_size::get(base);
+        dialect_count = fields::dialect_count::get(base);
+        sec_mode = fields::security_mode::get(base);
+        cap = fields::capabilities::get(base);
+        datum guid_bytes = fields::client_guid::get(base);
+        id = guid{guid_bytes, byte_swap};
+        neg_context_offset = fields::negotiate_context_offset::get(base);
+        neg_context_count = fields::negotiate_context_count::get(base);
+
+        dialect_list = dialects{d, dialect_count.value()};
+        neg_req_padding padding{d, neg_context_offset.value(), dialect_count.value()};
+        neg_contexts = negotiate_context_list{d, byte_swap};
+        valid = d.is_not_null();
+    }
 
     void write_raw_features(writeable &buf) const {
         if(!valid) {
@@ -586,47 +694,91 @@ public:
     }
 };
 
+/*
+ * SMB2 NEGOTIATE Response, up to the variable-length Buffer
+ * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-smb2/63abf97c-0d09-47e2-88d6-6bfa552949a5
+ */
+struct smb2_negotiate_response_layout {
+    using structure_size           = le_field<uint16_t, 0>;
+    using security_mode            = le_field<uint16_t, 2>;
+    using dialect_revision         = le_field<uint16_t, 4>;
+    using negotiate_context_count  = le_field<uint16_t, 6>;
+    using server_guid              = bytes_field<8, 16>;
+    using capabilities             = le_field<uint32_t, 24>;
+    using max_transact_size        = le_field<uint32_t, 28>;
+    using max_read_size            = le_field<uint32_t, 32>;
+    using max_write_size           = le_field<uint32_t, 36>;
+    using system_time              = le_field<uint64_t, 40>;
+    using server_start_time        = le_field<uint64_t, 48>;
+    using security_buffer_offset   = le_field<uint16_t, 56>;
+    using security_buffer_length   = le_field<uint16_t, 58>;
+    using negotiate_context_offset = le_field<uint32_t, 60>;
+
+    using layout = fixed_layout<64,
+                                structure_size,
+                                security_mode,
+                                dialect_revision,
+                                negotiate_context_count,
+                                server_guid,
+                                capabilities,
+                                max_transact_size,
+                                max_read_size,
+                                max_write_size,
+                                system_time,
+                                server_start_time,
+                                security_buffer_offset,
+                                security_buffer_length,
+                                negotiate_context_offset>;
+};
+
 class smb2_negotiate_response {
-    encoded<uint16_t> structure_size;
-    encoded<uint16_t> sec_mode;
+    encoded<uint16_t> structure_size{0};
+    encoded<uint16_t> sec_mode{0};
     dialect dialect_num;
-    encoded<uint16_t> neg_context_cnt;
+    encoded<uint16_t> neg_context_cnt{0};
     guid id;
-    encoded<uint32_t> capabilities;
-    encoded<uint32_t> max_transact_size;
-    encoded<uint32_t> max_read_size;
-    encoded<uint32_t> max_write_size;
+    encoded<uint32_t> capabilities{0};
+    encoded<uint32_t> max_transact_size{0};
+    encoded<uint32_t> max_read_size{0};
+    encoded<uint32_t> max_write_size{0};
     win_epoch_time system_time;
     win_epoch_time server_start_time;
-    encoded<uint16_t> security_buffer_offset;
-    encoded<uint16_t> security_buffer_length;
-    encoded<uint32_t> negotiate_context_offset;
+    encoded<uint16_t> security_buffer_offset{0};
+    encoded<uint16_t> security_buffer_length{0};
+    encoded<uint32_t> negotiate_context_offset{0};
     datum buffer;
-    neg_resp_padding padding;
     negotiate_context_list neg_contexts;
-    bool valid;
+    bool valid = false;
 
+    using fields = smb2_negotiate_response_layout;
     static constexpr bool byte_swap = true;
 public:
-    smb2_negotiate_response (datum &d) :
-        structure_size(d, byte_swap),
-        sec_mode(d, byte_swap),
-        dialect_num(d, byte_swap),
-        neg_context_cnt(d, byte_swap),
-        id(d, byte_swap),
-        capabilities(d, byte_swap),
-        max_transact_size(d, byte_swap),
-        max_read_size(d, byte_swap),
-        max_write_size(d, byte_swap),
-        system_time(d, byte_swap),
-        server_start_time(d, byte_swap),
-        security_buffer_offset(d, byte_swap),
-        security_buffer_length(d, byte_swap),
-        negotiate_context_offset(d, byte_swap),
-        buffer(d, security_buffer_length.value()),
-        padding(d, security_buffer_length.value()),
-        neg_contexts(d, byte_swap),
-        valid(d.is_not_null()) { }
+    smb2_negotiate_response (datum &d) {
+        const uint8_t *base = fields::layout::parse(d);
+        if (base == nullptr) {
+            return;
+        }
+        structure_size = fields::structure_size::get(base);
+        sec_mode = fields::security_mode::get(base);
+        dialect_num = dialect{fields::dialect_revision::get(base)};
+        neg_context_cnt = fields::negotiate_context_count::get(base);
+        datum guid_bytes = fields::server_guid::get(base);
+        id = guid{guid_bytes, byte_swap};
+        capabilities = fields::capabilities::get(base);
+        max_transact_size = fields::max_transact_size::get(base);
+        max_read_size = fields::max_read_size::get(base);
+        max_write_size = fields::max_write_size::get(base);
+        system_time = win_epoch_time{fields::system_time::get(base)};
+        server_start_time = win_epoch_time{fields::server_start_time::get(base)};
+        security_buffer_offset = fields::security_buffer_offset::get(base);
+        security_buffer_length = fields::security_buffer_length::get(base);
+        negotiate_context_offset = fields::negotiate_context_offset::get(base);
+
+        buffer.parse(d, security_buffer_length.value());
+        neg_resp_padding padding{d, security_buffer_length.value()};
+        neg_contexts = negotiate_context_list{d, byte_swap};
+        valid = d.is_not_null();
+    }
 
     void write_raw_features(writeable &buf) const {
         if(!valid) {
@@ -654,6 +806,74 @@ public:
     
 };
  
+/*
+ * SMB2 SESSION_SETUP Request, up to the variable-length Buffer
+ * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-smb2/5a3c2c28-d6b0-48ed-b917-a86b2ca4575f
+ */
+struct smb2_session_setup_request_layout {
+    using structure_size         = le_field<uint16_t, 0>;
+    using flags                  = le_field<uint8_t,  2>;
+    using security_mode          = le_field<uint8_t,  3>;
+    using capabilities           = le_field<uint32_t, 4>;
+    using channel                = le_field<uint32_t, 8>;
+    using security_buffer_offset = le_field<uint16_t, 12>;
+    using security_buffer_length = le_field<uint16_t, 14>;
+    using previous_session_id    = le_field<uint64_t, 16>;
+
+    using layout = fixed_layout<24,
+                                structure_size,
+                                flags,
+                                security_mode,
+                                capabilities,
+                                channel,
+                                security_buffer_offset,
+                                security_buffer_length,
+                                previous_session_id>;
+};
+
+class smb2_session_setup_request {
+    const uint8_t *base;
+
+    using fields = smb2_session_setup_request_layout;
+
+public:
+    smb2_session_setup_request (datum &d) : base{fields::layout::parse(d)} { }
+
+    bool is_not_empty() const { return base != nullptr; }
+
+    void write_json(struct json_object &o) const;
+};
+
+/*
+ * SMB2 SESSION_SETUP Response, up to the variable-length Buffer
+ * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-smb2/0324190f-a31b-4666-9fa9-5c624273a694
+ */
+struct smb2_session_setup_response_layout {
+    using structure_size         = le_field<uint16_t, 0>;
+    using session_flags          = le_field<uint16_t, 2>;
+    using security_buffer_offset = le_field<uint16_t, 4>;
+    using security_buffer_length = le_field<uint16_t, 6>;
+
+    using layout = fixed_layout<8,
+                                structure_size,
+                                session_flags,
+                                security_buffer_offset,
+                                security_buffer_length>;
+};
+
+class smb2_session_setup_response {
+    const uint8_t *base;
+
+    using fields = smb2_session_setup_response_layout;
+
+public:
+    smb2_session_setup_response (datum &d) : base{fields::layout::parse(d)} { }
+
+    bool is_not_empty() const { return base != nullptr; }
+
+    void write_json(struct json_object &o) const;
+};
+
 class smb2_command {
 public:
     encoded<uint16_t> command;
@@ -680,67 +900,124 @@ public:
         SMB2_OPLOCK_BREAK = 0x0012
     };
 
+    smb2_command(uint16_t code = 0) : command{code} { }
+
     smb2_command(datum &d, bool byte_swap = true) : command(d, byte_swap) { }
 
     const char * get_string() const;
 };
 
+/*
+ * SMB2 Packet Header - SYNC
+ * https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-smb2/fb188936-5050-48d3-b350-dc43059638a4
+ */
+struct smb2_header_layout {
+    using protocol_id     = le_field<uint32_t, 0>;
+    using structure_size  = le_field<uint16_t, 4>;
+    using credit_charge   = le_field<uint16_t, 6>;
+    using status          = le_field<uint32_t, 8>;
+    using command         = le_field<uint16_t, 12>;
+    using credit_req_resp = le_field<uint16_t, 14>;
+    using flags           = le_field<uint32_t, 16>;
+    using next_command    = le_field<uint32_t, 20>;
+    using message_id      = le_field<uint64_t, 24>;
+    using process_id      = le_field<uint32_t, 32>;
+    using tree_id         = le_field<uint32_t, 36>;
+    using session_id      = le_field<uint64_t, 40>;
+    using signature       = bytes_field<48, 16>;
+
+    using layout = fixed_layout<64,
+                                protocol_id,
+                                structure_size,
+                                credit_charge,
+                                status,
+                                command,
+                                credit_req_resp,
+                                flags,
+                                next_command,
+                                message_id,
+                                process_id,
+                                tree_id,
+                                session_id,
+                                signature>;
+
+    static constexpr uint32_t smb2_protocol_id = 0x424d53fe;   // 0xfe, 'S', 'M', 'B'
+
+    // is_valid(base) returns true if the header at base starts with
+    // the SMB2 ProtocolId
+    //
+    static bool is_valid(const uint8_t *base) {
+        return protocol_id::get(base) == smb2_protocol_id;
+    }
+};
+
 class smb2_header {
-    literal<4> proto;
-    encoded<uint16_t> structure_size;
-    encoded<uint16_t> credit_charge;
-    encoded<uint32_t> status; /* In a request, this field is interpreted in different ways depending on the SMB2 dialect.
-                               * In the SMB 3.x dialect family, this field is interpreted as the ChannelSequence field
-                               * followed by the Reserved field in a request. */
+    encoded<uint16_t> structure_size{0};
+    encoded<uint16_t> credit_charge{0};
+    encoded<uint32_t> status{0}; /* In a request, this field is interpreted in different ways depending on the SMB2 dialect.
+                                  * In the SMB 3.x dialect family, this field is interpreted as the ChannelSequence field
+                                  * followed by the Reserved field in a request. */
     smb2_command cmd;
-    encoded<uint16_t> credit_req_resp;
-    encoded<uint32_t> flags;
-    encoded<uint32_t> next_cmd;
-    encoded<uint64_t> msg_id;
-    encoded<uint32_t> process_id;
-    encoded<uint32_t> tree_id;
-    encoded<uint64_t> ssn_id;
+    encoded<uint16_t> credit_req_resp{0};
+    encoded<uint32_t> flags{0};
+    encoded<uint32_t> next_cmd{0};
+    encoded<uint64_t> msg_id{0};
+    encoded<uint32_t> process_id{0};
+    encoded<uint32_t> tree_id{0};
+    encoded<uint64_t> ssn_id{0};
     datum signature;
-    bool valid;
+    bool valid = false;
 
+    using fields = smb2_header_layout;
     static constexpr uint32_t req_mask = 0x00000001;
-    static constexpr bool byte_swap = true;
 
 public:
     enum packet_type {
         NEGOTIATE_REQUEST,
         NEGOTIATE_RESPONSE,
+        SESSION_SETUP_REQUEST,
+        SESSION_SETUP_RESPONSE,
 
         LAST_TYPE           //Should be the last field in enum
     };
 
-    smb2_header(datum &d) :
-        proto{d, {0xFE, 'S', 'M', 'B'}},
-        structure_size{d, byte_swap},
-        credit_charge{d, byte_swap},
-        status{d, byte_swap},
-        cmd{d},
-        credit_req_resp{d, byte_swap},
-        flags{d, byte_swap},
-        next_cmd{d, byte_swap},
-        msg_id{d, byte_swap},
-        process_id{d, byte_swap},
-        tree_id{d, byte_swap},
-        ssn_id{d, byte_swap},
-        signature{d, 16},
-        valid{d.is_not_null()} { }
-
-    bool is_response() {
+    smb2_header(datum &d) {
+        const uint8_t *base = fields::layout::parse(d);
+        if (base == nullptr || !fields::is_valid(base)) {
+            d.set_null();
+            return;
+        }
+        structure_size = fields::structure_size::get(base);
+        credit_charge = fields::credit_charge::get(base);
+        status = fields::status::get(base);
+        cmd = smb2_command{fields::command::get(base)};
+        credit_req_resp = fields::credit_req_resp::get(base);
+        flags = fields::flags::get(base);
+        next_cmd = fields::next_command::get(base);
+        msg_id = fields::message_id::get(base);
+        process_id = fields::process_id::get(base);
+        tree_id = fields::tree_id::get(base);
+        ssn_id = fields::session_id::get(base);
+        signature = fields::signature::get(base);
+        valid = true;
+    }
+
+    bool is_response() const {
         return flags & req_mask;
     }
 
-    packet_type get_packet_type() {
+    packet_type get_packet_type() const {
         switch(cmd.command) {
         case smb2_command::command_type::SMB2_NEGOTIATE:
             if (!is_response()) {
                 return packet_type::NEGOTIATE_REQUEST;
             }
             return packet_type::NEGOTIATE_RESPONSE;
+        case smb2_command::command_type::SMB2_SESSION_SETUP:
+            if (!is_response()) {
+                return packet_type::SESSION_SETUP_REQUEST;
+            }
+            return packet_type::SESSION_SETUP_RESPONSE;
         default:
             break;
         }
@@ -770,22 +1047,97 @@ public:
     const char* get_code_str() const {
         return cmd.get_string();
     }
-    
+
+    uint32_t get_next_command() const { return next_cmd.value(); }
+
 };
 
 class smb2_packet : public base_protocol {
     encoded<uint32_t> nbss_layer;
+    datum message;
     smb2_header hdr;
     datum& body;
 
+    static constexpr size_t max_compound_commands = 32;
+
 public:
     smb2_packet(datum &d) :
         nbss_layer(d),
+        message(d),
         hdr(d),
         body(d) { }
 
+    // for_each_compound_command(f) calls f(code) with the command
+    // code of each command that follows the first one in a compound
+    // message, walking the chain of NextCommand offsets and reading
+    // only the command code and offset from each header, without
+    // decoding the commands.  The walk stops at the first offset that
+    // runs past the end of the message or does not lead to an SMB2
+    // header, and after max_compound_commands commands.
+    //
+    template <typename F>
+    void for_each_compound_command(F f) const {
+        using fields = smb2_header_layout;
+        uint32_t next = hdr.get_next_command();
+        datum chain{message};
+        for (size_t i = 0; i < max_compound_commands && next != 0; i++) {
+            if (chain.length() < (ssize_t)next || !chain.skip(next)) {
+                break;
+            }
+            datum tmp{chain};
+            const uint8_t *base = fields::layout::parse(tmp);
+            if (base == nullptr || !fields::is_valid(base)) {
+                break;
+            }
+            f(fields::command::get(base));
+            next = fields::next_command::get(base);
+        }
+    }
+
+    // write_compound_json(o) writes the commands that follow the
+    // first one in a compound message into a json array
+    //
+    void write_compound_json(struct json_object &o) const {
+        if (hdr.get_next_command() == 0) {
+            return;
+        }
+        struct json_array commands{o, "compound_commands"};
+        for_each_compound_command([&commands](uint16_t code) {
+            smb2_command cmd{code};
+            const char *name = cmd.get_string();
+            if (name) {
+                commands.print_string(name);
+            } else {
+                commands.print_uint16_hex(code);
+            }
+        });
+        commands.close();
+    }
+
     bool is_not_empty() const { return hdr.is_valid(); }
 
+    // bytes_needed() returns the number of bytes of a negotiate or
+    // session setup message, as given by the length in its NBSS
+    // header, that were not present; other commands, such as reads
+    // and writes, are not decoded and never need reassembly
+    //
+    size_t bytes_needed() const {
+        if (!hdr.is_valid()) {
+            return 0;
+        }
+        switch (hdr.get_packet_type()) {
+        case smb2_header::packet_type::NEGOTIATE_REQUEST:
+        case smb2_header::packet_type::NEGOTIATE_RESPONSE:
+        case smb2_header::packet_type::SESSION_SETUP_REQUEST:
+        case smb2_header::packet_type::SESSION_SETUP_RESPONSE:
+            break;
+        default:
+            return 0;
+        }
+        size_t length = nbss_layer.value() & 0x00ffffff;
+        return length > (size_t)message.length() ? length - message.length() : 0;
+    }
+
     void write_json(struct json_object &o, bool) {
         if (this->is_not_empty()) {
             struct json_object smb2{o, "smb2"};
@@ -816,11 +1168,24 @@ public:
                     smb2.print_key_json_string("features", buf.contents());
                 }
                     break;
+                case smb2_header::packet_type::SESSION_SETUP_REQUEST:
+                {
+                    smb2_session_setup_request ss_req(body);
+                    ss_req.write_json(smb2);
+                }
+                    break;
+                case smb2_header::packet_type::SESSION_SETUP_RESPONSE:
+                {
+                    smb2_session_setup_response ss_resp(body);
+                    ss_resp.write_json(smb2);
+                }
+                    break;
                 case smb2_header::packet_type::LAST_TYPE:
 
                 default:
                     break;
             }
+            write_compound_json(smb2);
             smb2.close();
         }
     }
@@ -832,6 +1197,174 @@ public:
         },
         { 0x00, 0x00, 0x00, 0x00, 0xfe, 0x53, 0x4d, 0x42}
     };
+
+    // append_header(msg, command, flags, next) appends an SMB2 header
+    // to msg, followed by next - 64 bytes of zeros if next is nonzero
+    //
+    static void append_header(std::vector<uint8_t> &msg, uint16_t command, uint32_t flags, uint32_t next) {
+        std::vector<uint8_t> h(64, 0);
+        h[0] = 0xfe; h[1] = 'S'; h[2] = 'M'; h[3] = 'B';
+        h[4] = 64;
+        h[12] = command & 0xff;
+        h[13] = command >> 8;
+        for (size_t i = 0; i < 4; i++) {
+            h[16 + i] = flags >> (8 * i);
+            h[20 + i] = next >> (8 * i);
+        }
+        for (size_t i = 0; i < 8; i++) {
+            h[24 + i] = i + 1;                          // message_id 0x0807060504030201
+        }
+        msg.insert(msg.end(), h.begin(), h.end());
+        if (next > 64) {
+            msg.insert(msg.end(), next - 64, 0);
+        }
+    }
+
+    // nbss(msg, length) returns msg preceded by an NBSS header that
+    // gives its length as length
+    //
+    static std::vector<uint8_t> nbss(const std::vector<uint8_t> &msg, uint32_t length) {
+        std::vector<uint8_t> pkt{ 0x00, (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length };
+        pkt.insert(pkt.end(), msg.begin(), msg.end());
+        return pkt;
+    }
+
+    // compound_commands(pkt) returns the codes of the commands that
+    // follow the first one in the compound message in pkt
+    //
+    static std::vector<uint16_t> compound_commands(const std::vector<uint8_t> &pkt) {
+        datum d{pkt.data(), pkt.data() + pkt.size()};
+        smb2_packet smb2{d};
+        std::vector<uint16_t> codes;
+        smb2.for_each_compound_command([&codes](uint16_t code) { codes.push_back(code); });
+        return codes;
+    }
+
+    static bool unit_test() {
+        using cmd = smb2_command::command_type;
+        constexpr uint32_t response = 0x00000001;
+
+        // layout decoding: fields are little-endian, at their offsets
+        //
+        std::vector<uint8_t> msg;
+        append_header(msg, cmd::SMB2_SESSION_SETUP, response, 0);
+        using fields = smb2_header_layout;
+        if (!fields::is_valid(msg.data())
+            || fields::structure_size::get(msg.data()) != 64
+            || fields::command::get(msg.data()) != cmd::SMB2_SESSION_SETUP
+            || fields::flags::get(msg.data()) != response
+            || fields::message_id::get(msg.data()) != 0x0807060504030201
+            || fields::signature::get(msg.data()).length() != 16) {
+            return false;
+        }
+        datum short_header{msg.data(), msg.data() + 63};
+        if (fields::layout::parse(short_header) != nullptr || short_header.is_not_null()) {
+            return false;
+        }
+
+        // SESSION_SETUP request and response
+        //
+        std::vector<uint8_t> ss_req;
+        append_header(ss_req, cmd::SMB2_SESSION_SETUP, 0, 0);
+        std::vector<uint8_t> req_body{
+            0x19, 0x00, 0x01, 0x02, 0x01, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x58, 0x00, 0x4a, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+        };
+        ss_req.insert(ss_req.end(), req_body.begin(), req_body.end());
+        std::vector<uint8_t> req_pkt = nbss(ss_req, ss_req.size() + 0x4a);
+        datum req_data{req_pkt.data(), req_pkt.data() + req_pkt.size()};
+        smb2_packet req{req_data};
+        if (!req.is_not_empty()
+            || req.hdr.get_packet_type() != smb2_header::packet_type::SESSION_SETUP_REQUEST
+            || req.bytes_needed() != 0x4a) {
+            return false;
+        }
+        datum req_fixed{req.body};
+        const uint8_t *base = smb2_session_setup_request_layout::layout::parse(req_fixed);
+        if (base == nullptr
+            || smb2_session_setup_request_layout::structure_size::get(base) != 25
+            || smb2_session_setup_request_layout::security_mode::get(base) != 0x02
+            || smb2_session_setup_request_layout::security_buffer_offset::get(base) != 0x58
+            || smb2_session_setup_request_layout::security_buffer_length::get(base) != 0x4a
+            || !smb2_session_setup_request{req.body}.is_not_empty()) {
+            return false;
+        }
+
+        std::vector<uint8_t> ss_resp;
+        append_header(ss_resp, cmd::SMB2_SESSION_SETUP, response, 0);
+        std::vector<uint8_t> resp_body{ 0x09, 0x00, 0x01, 0x00, 0x48, 0x00, 0x00, 0x00 };
+        ss_resp.insert(ss_resp.end(), resp_body.begin(), resp_body.end() - 1);  // one byte short
+        std::vector<uint8_t> resp_pkt = nbss(ss_resp, ss_resp.size());
+        datum resp_data{resp_pkt.data(), resp_pkt.data() + resp_pkt.size()};
+        smb2_packet resp{resp_data};
+        if (resp.hdr.get_packet_type() != smb2_header::packet_type::SESSION_SETUP_RESPONSE
+            || resp.bytes_needed() != 0
+            || smb2_session_setup_response{resp.body}.is_not_empty()) {
+            return false;
+        }
+
+        // a short buffer is not an SMB2 message, and needs no bytes
+        //
+        std::vector<uint8_t> short_pkt = nbss(std::vector<uint8_t>(ss_req.begin(), ss_req.begin() + 40), ss_req.size());
+        datum short_data{short_pkt.data(), short_pkt.data() + short_pkt.size()};
+        smb2_packet short_msg{short_data};
+        if (short_msg.is_not_empty() || short_msg.bytes_needed() != 0) {
+            return false;
+        }
+
+        // commands other than negotiate and session setup never need
+        // reassembly
+        //
+        std::vector<uint8_t> read;
+        append_header(read, cmd::SMB2_READ, 0, 0);
+        std::vector<uint8_t> read_pkt = nbss(read, 65536);
+        datum read_data{read_pkt.data(), read_pkt.data() + read_pkt.size()};
+        if (smb2_packet{read_data}.bytes_needed() != 0) {
+            return false;
+        }
+
+        // compound message: each NextCommand offset is relative to the
+        // start of the header that holds it
+        //
+        std::vector<uint8_t> compound;
+        append_header(compound, cmd::SMB2_CREATE, 0, 120);
+        append_header(compound, cmd::SMB2_READ, 0, 72);
+        append_header(compound, 0x00ff, 0, 0);
+        if (compound_commands(nbss(compound, compound.size())) != std::vector<uint16_t>{ cmd::SMB2_READ, 0x00ff }) {
+            return false;
+        }
+
+        // truncated chain: the last offset runs past the message
+        //
+        std::vector<uint8_t> truncated;
+        append_header(truncated, cmd::SMB2_CREATE, 0, 64);
+        append_header(truncated, cmd::SMB2_CLOSE, 0, 64);
+        append_header(truncated, cmd::SMB2_READ, 0, 0);
+        truncated.resize(truncated.size() - 8);
+        truncated[64 + 20] = 200;                       // second NextCommand runs past the end
+        if (compound_commands(nbss(truncated, truncated.size())) != std::vector<uint16_t>{ cmd::SMB2_CLOSE }) {
+            return false;
+        }
+
+        // a chain whose headers never end it is cut off after
+        // max_compound_commands commands
+        //
+        std::vector<uint8_t> looping;
+        for (size_t i = 0; i < 2 * max_compound_commands; i++) {
+            append_header(looping, cmd::SMB2_ECHO, 0, 64);
+        }
+        if (compound_commands(nbss(looping, looping.size())).size() != max_compound_commands) {
+            return false;
+        }
+
+        // an offset that does not lead to a header ends the chain
+        //
+        std::vector<uint8_t> misaligned;
+        append_header(misaligned, cmd::SMB2_CREATE, 0, 8);
+        append_header(misaligned, cmd::SMB2_READ, 0, 0);
+        return compound_commands(nbss(misaligned, misaligned.size())).empty();
+    }
 };
 
 namespace {
@@ -11,12 +11,16 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <vector>
+#include <deque>
 #include "protocol.h"
 #include "datum.h"
 #include "analysis.h"
 #include "json_object.h"
 #include "fingerprint.h"
 #include "match.h"
+#include "tcp.h"
+#include "bounded_table.hpp"
 
 #define L_ssh_version_string                   8
 #define L_ssh_packet_length                    4
@@ -231,6 +235,7 @@ struct name_list : public datum {
  *
  */
 struct ssh_kex_init : public base_protocol {
+    struct datum payload;
     struct datum msg_type;
     struct datum cookie;
     struct name_list kex_algorithms;
@@ -244,10 +249,18 @@ struct ssh_kex_init : public base_protocol {
     struct name_list languages_client_to_server;
     struct name_list languages_server_to_client;
 
+    // the server's KEXINIT, if it has been correlated with this one
+    // by ssh_kex_correlator
+    //
+    const ssh_kex_init *server_kex = nullptr;
+
+    ssh_kex_init() { }
+
     ssh_kex_init(datum &p) { parse(p); };
 
     void parse(struct datum &p) {
 
+        payload = p;
         msg_type.parse(p, L_ssh_payload);
         cookie.parse(p, L_ssh_cookie);
         kex_algorithms.parse(p);
@@ -289,24 +302,31 @@ struct ssh_kex_init : public base_protocol {
         write_hex_data(buf, languages_server_to_client);
     }
 
+    void write_kex_json(json_object &o, const char *name) const {
+        struct json_object kex{o, name};
+        kex.print_key_json_string("kex_algorithms", kex_algorithms.data, kex_algorithms.length());
+        kex.print_key_json_string("server_host_key_algorithms", server_host_key_algorithms.data, server_host_key_algorithms.length());
+        kex.print_key_json_string("encryption_algorithms_client_to_server", encryption_algorithms_client_to_server.data, encryption_algorithms_client_to_server.length());
+        kex.print_key_json_string("encryption_algorithms_server_to_client", encryption_algorithms_server_to_client.data, encryption_algorithms_server_to_client.length());
+        kex.print_key_json_string("mac_algorithms_client_to_server", mac_algorithms_client_to_server.data, mac_algorithms_client_to_server.length());
+        kex.print_key_json_string("mac_algorithms_server_to_client", mac_algorithms_server_to_client.data, mac_algorithms_server_to_client.length());
+        kex.print_key_json_string("compression_algorithms_client_to_server", compression_algorithms_client_to_server.data, compression_algorithms_client_to_server.length());
+        kex.print_key_json_string("compression_algorithms_server_to_client", compression_algorithms_server_to_client.data, compression_algorithms_server_to_client.length());
+        kex.print_key_json_string("languages_client_to_server", languages_client_to_server.data, languages_client_to_server.length());
+        kex.print_key_json_string("languages_server_to_client", languages_server_to_client.data, languages_server_to_client.length());
+        kex.close();
+    }
+
     void write_json(json_object &o, bool output_metadata) const {
         if (kex_algorithms.is_not_readable()) {
             return;
         }
         if (output_metadata) {
             struct json_object ssh{o, "ssh"};
-            struct json_object ssh_client{ssh, "kex"};
-            ssh_client.print_key_json_string("kex_algorithms", kex_algorithms.data, kex_algorithms.length());
-            ssh_client.print_key_json_string("server_host_key_algorithms", server_host_key_algorithms.data, server_host_key_algorithms.length());
-            ssh_client.print_key_json_string("encryption_algorithms_client_to_server", encryption_algorithms_client_to_server.data, encryption_algorithms_client_to_server.length());
-            ssh_client.print_key_json_string("encryption_algorithms_server_to_client", encryption_algorithms_server_to_client.data, encryption_algorithms_server_to_client.length());
-            ssh_client.print_key_json_string("mac_algorithms_client_to_server", mac_algorithms_client_to_server.data, mac_algorithms_client_to_server.length());
-            ssh_client.print_key_json_string("mac_algorithms_server_to_client", mac_algorithms_server_to_client.data, mac_algorithms_server_to_client.length());
-            ssh_client.print_key_json_string("compression_algorithms_client_to_server", compression_algorithms_client_to_server.data, compression_algorithms_client_to_server.length());
-            ssh_client.print_key_json_string("compression_algorithms_server_to_client", compression_algorithms_server_to_client.data, compression_algorithms_server_to_client.length());
-            ssh_client.print_key_json_string("languages_client_to_server", languages_client_to_server.data, languages_client_to_server.length());
-            ssh_client.print_key_json_string("languages_server_to_client", languages_server_to_client.data, languages_server_to_client.length());
-            ssh_client.close();
+            write_kex_json(ssh, "kex");
+            if (server_kex && server_kex->kex_algorithms.is_readable()) {
+                server_kex->write_kex_json(ssh, "server_kex");
+            }
             ssh.close();
         }
     }
@@ -334,4 +354,261 @@ struct ssh_kex_init : public base_protocol {
 
 };
 
+void write_flow_key(struct json_object &o, const struct key &k);   // defined in pkt_proc.cc
+
+// class ssh_kex_correlator pairs the KEXINIT messages sent by the
+// client and the server of an SSH connection, so that both are
+// reported in a single record, with the flow key of the client.  The
+// first KEXINIT seen on a connection is copied into a table, keyed
+// by its flow key, and is reported along with the second one, when
+// that arrives in the opposite direction.  If another data packet is
+// sent in the direction of a held KEXINIT before that happens, the
+// other KEXINIT was not captured, and the held one is reported on
+// its own.
+//
+// The table holds at most max_entries KEXINITs; when it is full, the
+// oldest one is moved to the unpaired queue, as are all of the held
+// KEXINITs when flush_all() is called at the end of a capture.  The
+// queued KEXINITs are reported on their own, by write_unpaired().
+//
+class ssh_kex_correlator {
+
+    struct held_kex {
+        std::vector<uint8_t> payload;
+        struct timespec ts;
+    };
+
+    bounded_table<key, held_kex> table{max_entries};
+    std::deque<std::pair<key, held_kex>> unpaired;
+
+    std::vector<uint8_t> held;            // held KEXINIT being reported
+    ssh_kex_init server;
+
+    // the longest record of an unpaired KEXINIT that we expect;
+    // longer ones are discarded rather than truncated
+    //
+    static constexpr size_t max_record_len = 8192;
+
+    // is_from_client(k) returns true if the packet with flow key k
+    // was sent by the client, assuming that the server uses port 22
+    // or, failing that, the lower port number
+    //
+    static bool is_from_client(const key &k) {
+        if (k.dst_port == 22) {
+            return true;
+        }
+        if (k.src_port == 22) {
+            return false;
+        }
+        return k.dst_port < k.src_port;
+    }
+
+    void hold(const key &k, datum payload, const struct timespec &ts) {
+        auto it = table.find_or_insert(k, [this](const key &oldest, held_kex &&kex) {
+            enqueue_unpaired(oldest, std::move(kex));
+        });
+        it->second.payload.assign(payload.data, payload.data_end);
+        it->second.ts = ts;
+    }
+
+    // enqueue_unpaired(k, kex) queues the KEXINIT kex, sent with flow
+    // key k, to be reported on its own; the queue is bounded like the
+    // table, since nothing drains it if the caller never writes JSON
+    //
+    void enqueue_unpaired(const key &k, held_kex &&kex) {
+        if (unpaired.size() >= max_entries) {
+            unpaired.pop_front();
+        }
+        unpaired.emplace_back(k, std::move(kex));
+    }
+
+    // release(it) moves the KEXINIT at it out of the table and into
+    // held, and returns it
+    //
+    datum release(bounded_table<key, held_kex>::iterator it) {
+        held.swap(it->second.payload);
+        table.erase(it);
+        return { held.data(), held.data() + held.size() };
+    }
+
+public:
+
+    static constexpr size_t max_entries = 1024;
+
+    bool is_empty() const { return table.empty(); }
+
+    // pair(kex, k, ts) processes the KEXINIT kex, sent with flow key
+    // k at time ts.  If the KEXINIT sent in the opposite direction is
+    // held, the two are combined into kex, with the client's KEXINIT
+    // first, k is set to the flow key of the client, and true is
+    // returned.  Otherwise, kex is held until the other one is seen,
+    // and false is returned.
+    //
+    bool pair(ssh_kex_init &kex, key &k, const struct timespec &ts) {
+        auto it = table.find(k.reverse());
+        if (it == table.end()) {
+            hold(k, kex.payload, ts);
+            return false;
+        }
+        datum peer = release(it);
+        if (is_from_client(k)) {
+            server = ssh_kex_init{peer};
+        } else {
+            server = kex;
+            kex = ssh_kex_init{peer};
+            k = k.reverse();
+        }
+        kex.server_kex = &server;
+        return true;
+    }
+
+    // flush(k) returns the payload of the KEXINIT held for flow key
+    // k, which is no longer held, or an empty datum if there is none
+    //
+    datum flush(const key &k) {
+        auto it = table.find(k);
+        if (it == table.end()) {
+            return { nullptr, nullptr };
+        }
+        return release(it);
+    }
+
+    // flush_all() moves all of the held KEXINITs, oldest first, to
+    // the unpaired queue
+    //
+    void flush_all() {
+        table.remove_all([this](const key &k, held_kex &&kex) { enqueue_unpaired(k, std::move(kex)); });
+    }
+
+    bool has_unpaired() const { return !unpaired.empty(); }
+
+    // write_unpaired(buf, metadata) writes as many of the queued
+    // KEXINITs into buf as will fit, each as a JSON record on its own
+    // line, and returns the number written.  It never truncates buf,
+    // so it can be called after a packet's record has been written.
+    //
+    size_t write_unpaired(struct buffer_stream &buf, bool metadata) {
+        size_t count = 0;
+        char tmp[max_record_len];
+        while (!unpaired.empty()) {
+            const key &k = unpaired.front().first;
+            held_kex &h = unpaired.front().second;
+            datum payload{h.payload.data(), h.payload.data() + h.payload.size()};
+            ssh_kex_init kex{payload};
+            class fingerprint fp;
+            fp.init();
+            kex.compute_fingerprint(fp);
+            struct buffer_stream tmp_buf{tmp, sizeof(tmp)};
+            struct json_object record{&tmp_buf};
+            fp.write(record);
+            kex.write_json(record, metadata);
+            write_flow_key(record, k);
+            record.print_key_timestamp("event_start", &h.ts);
+            record.close();
+            if (tmp_buf.trunc == 0) {
+                if ((size_t)(buf.dlen - buf.doff) <= tmp_buf.length() + 2) {
+                    break;   // no room left in buf; leave record in queue
+                }
+                buf.memcpy(tmp, tmp_buf.length());
+                buf.write_char('\n');
+                count++;
+            }
+            unpaired.pop_front();
+        }
+        return count;
+    }
+
+    static bool unit_test() {
+        uint8_t client_kex[] = {
+            0x14,                                                 // SSH_MSG_KEXINIT
+            0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,       // cookie
+            0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+            0x00, 0x00, 0x00, 0x06, 'm', 'l', 'k', 'e', 'm', 'c', // kex_algorithms
+        };
+        uint8_t server_kex[] = {
+            0x14,                                                 // SSH_MSG_KEXINIT
+            0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,       // cookie
+            0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+            0x00, 0x00, 0x00, 0x06, 'm', 'l', 'k', 'e', 'm', 's', // kex_algorithms
+        };
+        key client_key{54321, 22, 0x0100000a, 0x0200000a, 6};
+        key server_key = client_key.reverse();
+        struct timespec ts{1000, 0};
+        ssh_kex_correlator correlator;
+
+        // the server's KEXINIT is held, then reported along with the
+        // client's, which comes first in the combined record
+        //
+        datum s{server_kex, server_kex + sizeof(server_kex)};
+        ssh_kex_init kex{s};
+        key k = server_key;
+        if (correlator.pair(kex, k, ts) || correlator.is_empty()) {
+            return false;
+        }
+        datum c{client_kex, client_kex + sizeof(client_kex)};
+        kex = ssh_kex_init{c};
+        k = client_key;
+        if (!correlator.pair(kex, k, ts) || !correlator.is_empty() || !(k == client_key)) {
+            return false;
+        }
+        if (kex.kex_algorithms.data[5] != 'c' || kex.server_kex == nullptr || kex.server_kex->kex_algorithms.data[5] != 's') {
+            return false;
+        }
+
+        // when the client's KEXINIT is held, the combined record
+        // still has the client's flow key
+        //
+        c = datum{client_kex, client_kex + sizeof(client_kex)};
+        kex = ssh_kex_init{c};
+        k = client_key;
+        if (correlator.pair(kex, k, ts)) {
+            return false;
+        }
+        s = datum{server_kex, server_kex + sizeof(server_kex)};
+        kex = ssh_kex_init{s};
+        k = server_key;
+        if (!correlator.pair(kex, k, ts) || !(k == client_key) || kex.kex_algorithms.data[5] != 'c') {
+            return false;
+        }
+
+        // a KEXINIT without a peer is flushed by the next packet
+        // sent in the same direction
+        //
+        c = datum{client_kex, client_kex + sizeof(client_kex)};
+        kex = ssh_kex_init{c};
+        k = client_key;
+        if (correlator.pair(kex, k, ts)) {
+            return false;
+        }
+        if (correlator.flush(server_key).is_not_empty()) {
+            return false;
+        }
+        datum flushed = correlator.flush(client_key);
+        if (flushed.length() != sizeof(client_kex) || !correlator.is_empty()) {
+            return false;
+        }
+
+        // a KEXINIT evicted from a full table, and those held at the
+        // end of a capture, are reported on their own
+        //
+        for (uint16_t port = 1; port <= max_entries + 1; port++) {
+            c = datum{client_kex, client_kex + sizeof(client_kex)};
+            kex = ssh_kex_init{c};
+            k = key{port, 22, 0x0100000a, 0x0200000a, 6};
+            correlator.pair(kex, k, ts);
+        }
+        if (correlator.unpaired.size() != 1 || correlator.unpaired.front().first.src_port != 1) {
+            return false;
+        }
+        char out[1024];
+        struct buffer_stream buf{out, sizeof(out)};
+        if (correlator.write_unpaired(buf, true) != 1 || correlator.has_unpaired()) {
+            return false;
+        }
+        correlator.flush_all();
+        return correlator.is_empty() && correlator.unpaired.size() == max_entries;
+    }
+
+};
+
 #endif // SSH_H
@@ -280,6 +280,7 @@ struct tcp_seg_context {
     uint32_t data_length;
     uint32_t seq;
     uint32_t additional_bytes_needed;
+    const char *end_marker = nullptr;   // if set, reassembly ends once it is seen
 
     tcp_seg_context(uint32_t len, uint32_t seq_no, uint32_t additional_bytes) : data_length{len}, seq{seq_no}, additional_bytes_needed{additional_bytes} {}
 };
@@ -298,6 +299,7 @@ struct tcp_segment {
     bool done;
     bool seg_overlap;  // current pkt overlaps with a previous segment
     bool max_seg_exceed;
+    const char *end_marker = nullptr;
 
     static const unsigned int timeout = 30;    // seconds before flow timeout
 
@@ -322,6 +324,7 @@ struct tcp_segment {
         if (is_initial) {
             total_bytes_needed = seg_len + tcp_pkt.additional_bytes_needed;
             max_index = total_bytes_needed;
+            end_marker = tcp_pkt.end_marker;
         }
 
         index = curr_seq - seq_init;
@@ -374,6 +377,7 @@ struct tcp_segment {
         if (is_initial) {
             total_bytes_needed = seg_len + tcp_pkt.additional_bytes_needed;
             max_index = total_bytes_needed;
+            end_marker = tcp_pkt.end_marker;
         }
 
         index = curr_seq - seq_init;
@@ -405,11 +409,47 @@ struct tcp_segment {
 
         if (current_bytes >= total_bytes_needed) {
             done = true;
+        } else if (end_marker) {
+            if (uint32_t end = end_of_marker()) {
+                total_bytes_needed = end;
+                done = true;
+            }
         }
 
         return this;
     }
 
+    // contiguous_length() returns the number of bytes at the start of
+    // the segment that have been received without a gap
+    //
+    uint32_t contiguous_length() const {
+        uint32_t end = 0;
+        uint32_t count = seg_count < max_seg_count ? seg_count : max_seg_count;
+        bool extended = true;
+        while (extended) {
+            extended = false;
+            for (uint32_t i = 0; i < count; i++) {
+                if (seg[i].first <= end && seg[i].second > end) {
+                    end = seg[i].second;
+                    extended = true;
+                }
+            }
+        }
+        return end < buffer_len ? end : buffer_len;
+    }
+
+    // end_of_marker() returns the offset just past the first
+    // occurrence of end_marker in the contiguous data at the start of
+    // the segment, or zero if there is none
+    //
+    uint32_t end_of_marker() const {
+        const void *found = memmem(data, contiguous_length(), end_marker, strlen(end_marker));
+        if (found == nullptr) {
+            return 0;
+        }
+        return ((const uint8_t *)found - data) + strlen(end_marker);
+    }
+
     struct datum get_reassembled_segment() {
         struct datum reassembled_tcp_data{data, data + total_bytes_needed};
         return reassembled_tcp_data;
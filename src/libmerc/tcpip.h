@@ -135,6 +135,7 @@ struct tcp_packet : public base_protocol {
     ip *ip_pkt = nullptr;          // TODO: make this const?
     uint32_t data_length = 0;
     uint32_t additional_bytes_needed = 0;
+    const char *reassembly_end_marker = nullptr;
 
     tcp_packet(datum &p, ip *outer=nullptr) : ip_pkt{outer} {
         parse(p);
@@ -156,6 +157,19 @@ struct tcp_packet : public base_protocol {
 
     void reassembly_needed(uint32_t num_bytes_needed) {
         additional_bytes_needed = num_bytes_needed;
+        reassembly_end_marker = nullptr;
+    }
+
+    // reassembly_needed_until(marker) requests the reassembly of a
+    // message whose length is not known, which ends with the bytes
+    // marker; the reassembler buffers as much of the flow as will fit,
+    // and stops once it sees marker
+    //
+    void reassembly_needed_until(const char *marker) {
+        if (data_length < tcp_segment::buffer_len) {
+            additional_bytes_needed = tcp_segment::buffer_len - data_length;
+            reassembly_end_marker = marker;
+        }
     }
 
     bool is_SYN() {
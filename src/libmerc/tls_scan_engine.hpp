@@ -0,0 +1,798 @@
+// tls_scan_engine.hpp
+//
+// Copyright (c) 2024 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef TLS_SCAN_ENGINE_HPP
+#define TLS_SCAN_ENGINE_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#include "verbosity.hpp"
+
+// class tls_scan_engine performs many concurrent TLS handshakes from
+// a single thread, using nonblocking sockets, epoll, and OpenSSL
+// memory BIOs, so that thousands of handshakes can be in flight at
+// once.  Each successful handshake delivers the peer certificate (in
+// DER format) to a callback, along with the name of the target that
+// was scanned.
+//
+// Scan targets are strings of the form host[:port]; the port
+// defaults to 443, and an IPv6 address that is followed by a port
+// must be enclosed in brackets, as in [2001:db8::1]:8443.  Host
+// names are resolved to IPv4 or IPv6 addresses by a small pool of
+// resolver threads, which feed resolved targets to the event loop
+// through an eventfd, so that slow DNS lookups do not stall the
+// handshakes that are in progress.
+//
+// The rate at which new connections are opened is bounded in two
+// ways: a global token bucket (connects_per_second), and a limit on
+// the number of concurrent connections to any single address
+// (max_per_address), so that a target that appears many times in a
+// host list is not flooded.  Each connection has a deadline; a
+// connection that has not completed its handshake by then is closed
+// and counted as timed out.
+//
+class tls_scan_engine {
+public:
+
+    // cert_callback is invoked from the event loop thread, once for
+    // each successful handshake, with the target name and the DER
+    // encoding of the peer certificate (if the server presented one)
+    //
+    using cert_callback = std::function<void (const std::string &target, const uint8_t *der, size_t der_len)>;
+
+    struct config {
+        size_t max_in_flight = 4096;           // concurrent connections
+        size_t max_per_address = 4;            // concurrent connections per address
+        double connects_per_second = 0.0;      // zero means unlimited
+        std::chrono::milliseconds timeout{10000};
+        size_t resolver_threads = 16;
+        bool omit_sni = false;
+    };
+
+    struct statistics {
+        size_t targets = 0;
+        size_t resolve_failures = 0;
+        size_t connect_failures = 0;
+        size_t handshake_failures = 0;
+        size_t timeouts = 0;
+        size_t succeeded = 0;
+
+        void fprint(FILE *f) const {
+            fprintf(f,
+                    "\rTLS scans\ttotal: %zu\tsucceeded: %zu\tresolve failures: %zu\t"
+                    "connect failures: %zu\thandshake failures: %zu\ttimeouts: %zu",
+                    targets, succeeded, resolve_failures, connect_failures, handshake_failures, timeouts);
+        }
+    };
+
+private:
+
+    using clock = std::chrono::steady_clock;
+
+    // struct address_key identifies the address of a connection, for
+    // the per-address limit; an IPv4 address is held in its
+    // IPv4-mapped IPv6 form, so that both families share one table
+    //
+    struct address_key {
+        uint8_t bytes[16] = {};
+
+        address_key() = default;
+
+        explicit address_key(const sockaddr_storage &a) {
+            if (a.ss_family == AF_INET6) {
+                memcpy(bytes, &((const sockaddr_in6 *)&a)->sin6_addr, sizeof(bytes));
+            } else {
+                bytes[10] = bytes[11] = 0xff;
+                memcpy(bytes + 12, &((const sockaddr_in *)&a)->sin_addr, 4);
+            }
+        }
+
+        bool operator==(const address_key &rhs) const { return memcmp(bytes, rhs.bytes, sizeof(bytes)) == 0; }
+
+        struct hash {
+            size_t operator()(const address_key &k) const {
+                uint64_t hi, lo;
+                memcpy(&hi, k.bytes, sizeof(hi));
+                memcpy(&lo, k.bytes + 8, sizeof(lo));
+                return std::hash<uint64_t>{}(hi ^ (lo * 0x9e3779b97f4a7c15));
+            }
+        };
+    };
+
+    // a target that has been resolved to an IPv4 or IPv6 address,
+    // and is waiting to be admitted into the event loop
+    //
+    struct resolved_target {
+        std::string name;
+        sockaddr_storage addr;
+        socklen_t addr_len;
+    };
+
+    enum class state : uint8_t {
+        unused,
+        connecting,
+        handshaking,
+    };
+
+    struct connection {
+        state st = state::unused;
+        uint32_t generation = 0;
+        int fd = -1;
+        SSL *ssl = nullptr;
+        BIO *rbio = nullptr;           // network -> ssl; owned by ssl
+        BIO *wbio = nullptr;           // ssl -> network; owned by ssl
+        address_key addr;
+        bool peer_closed = false;      // peer has shut down its side
+        std::string name;
+        std::string pending_output;    // ciphertext not yet accepted by send()
+        clock::time_point deadline;
+    };
+
+    config cfg;
+    verbosity_level verbosity;
+    cert_callback on_cert;
+
+    SSL_CTX *ctx = nullptr;
+    int epoll_fd = -1;
+    int event_fd = -1;
+
+    std::vector<connection> conns;
+    std::vector<uint32_t> free_slots;
+    size_t in_flight = 0;
+
+    // deadlines are added in nondecreasing order, since every
+    // connection has the same timeout, so a deque acts as a priority
+    // queue; stale entries are detected through the generation number
+    //
+    struct deadline_entry {
+        clock::time_point deadline;
+        uint32_t slot;
+        uint32_t generation;
+    };
+    std::deque<deadline_entry> deadlines;
+
+    std::unordered_map<address_key, size_t, address_key::hash> per_address_count;   // nonzero counts only
+
+    // resolver state, shared between the resolver threads and the
+    // event loop
+    //
+    std::mutex resolver_mutex;
+    std::deque<resolved_target> resolved;
+    std::atomic<size_t> resolver_failures{0};
+    std::atomic<size_t> resolvers_running{0};
+
+    // token bucket for connection admission
+    //
+    double tokens = 0.0;
+    clock::time_point last_refill;
+
+    statistics stats;
+    clock::time_point last_summary;
+
+    static constexpr size_t read_buffer_size = 16 * 1024;
+    static constexpr int max_events = 1024;
+
+public:
+
+    tls_scan_engine(const config &c, cert_callback cb, verbosity_level verb=verbosity_level::no_output) :
+        cfg{c},
+        verbosity{verb},
+        on_cert{std::move(cb)}
+    {
+        if (cfg.max_in_flight == 0) {
+            cfg.max_in_flight = 1;
+        }
+        if (cfg.resolver_threads == 0) {
+            cfg.resolver_threads = 1;
+        }
+        ctx = SSL_CTX_new(TLS_client_method());
+        if (ctx == nullptr) {
+            throw std::runtime_error{"could not create SSL_CTX"};
+        }
+
+        // don't perform certificate validation, so that we can
+        // obtain self-issued certificates
+        //
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            SSL_CTX_free(ctx);
+            throw std::runtime_error{"could not create epoll instance"};
+        }
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            close(epoll_fd);
+            SSL_CTX_free(ctx);
+            throw std::runtime_error{"could not create eventfd"};
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = event_fd_tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev);
+
+        conns.resize(cfg.max_in_flight);
+        free_slots.reserve(cfg.max_in_flight);
+        for (size_t i = cfg.max_in_flight; i > 0; i--) {
+            free_slots.push_back(i - 1);
+        }
+    }
+
+    ~tls_scan_engine() {
+        for (uint32_t i = 0; i < conns.size(); i++) {
+            if (conns[i].st != state::unused) {
+                release(i);
+            }
+        }
+        if (event_fd >= 0) { close(event_fd); }
+        if (epoll_fd >= 0) { close(epoll_fd); }
+        if (ctx != nullptr) { SSL_CTX_free(ctx); }
+    }
+
+    tls_scan_engine(const tls_scan_engine &) = delete;
+    tls_scan_engine &operator=(const tls_scan_engine &) = delete;
+
+    // scan(targets) scans all of the targets, and returns when every
+    // one of them has either succeeded, failed, or timed out
+    //
+    void scan(const std::vector<std::string> &targets) {
+        stats.targets += targets.size();
+
+        std::atomic<size_t> next_target{0};
+        size_t num_resolvers = std::min(cfg.resolver_threads, targets.size());
+        resolvers_running = num_resolvers;
+        std::vector<std::thread> resolvers;
+        resolvers.reserve(num_resolvers);
+        for (size_t i = 0; i < num_resolvers; i++) {
+            resolvers.emplace_back([this, &targets, &next_target]() { resolve_loop(targets, next_target); });
+        }
+
+        last_refill = clock::now();
+        tokens = std::max(1.0, cfg.connects_per_second);
+        std::deque<resolved_target> admission_queue;
+        epoll_event events[max_events];
+
+        while (true) {
+            take_resolved(admission_queue);
+            admit(admission_queue);
+
+            if (in_flight == 0 && admission_queue.empty() && resolvers_running == 0) {
+                take_resolved(admission_queue);  // pick up any final entries
+                if (admission_queue.empty()) {
+                    break;
+                }
+                continue;
+            }
+
+            int n = epoll_wait(epoll_fd, events, max_events, wait_time_ms(admission_queue));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (verbosity >= verbosity_level::errors) {
+                    fprintf(stderr, "error: epoll_wait() failed with errno %d\n", errno);
+                }
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                if (events[i].data.u64 == event_fd_tag) {
+                    uint64_t count;
+                    while (::read(event_fd, &count, sizeof(count)) > 0) { }
+                    continue;
+                }
+                uint32_t slot = events[i].data.u64 & 0xffffffff;
+                uint32_t generation = events[i].data.u64 >> 32;
+                if (slot < conns.size() && conns[slot].st != state::unused && conns[slot].generation == generation) {
+                    handle_event(slot, events[i].events);
+                }
+            }
+            expire_deadlines();
+
+            if (verbosity == verbosity_level::summary && clock::now() - last_summary >= std::chrono::seconds{1}) {
+                last_summary = clock::now();
+                stats.fprint(stderr);
+            }
+        }
+
+        for (auto &t : resolvers) {
+            t.join();
+        }
+        stats.resolve_failures = resolver_failures;
+    }
+
+    const statistics &get_statistics() const { return stats; }
+
+    // split_target(s) splits a string of the form host[:port] into
+    // its host and port components; an IPv6 address must be enclosed
+    // in brackets if it is followed by a port, and the brackets are
+    // removed from the host
+    //
+    static std::pair<std::string, uint16_t> split_target(const std::string &s, uint16_t default_port=443) {
+        size_t idx;
+        std::string host;
+        if (!s.empty() && s[0] == '[') {
+            size_t close = s.find(']');
+            if (close == std::string::npos) {
+                return { s, default_port };
+            }
+            host = s.substr(1, close - 1);
+            if (close + 1 == s.length() || s[close + 1] != ':') {
+                return { host, default_port };
+            }
+            idx = close + 1;
+        } else {
+            idx = s.rfind(':');
+            if (idx == std::string::npos || s.find(':') != idx) {
+                return { s, default_port };      // no port, or an IPv6 literal
+            }
+            host = s.substr(0, idx);
+        }
+        char *end = nullptr;
+        unsigned long port = strtoul(s.c_str() + idx + 1, &end, 10);
+        if (end == s.c_str() + idx + 1 || *end != '\0' || port == 0 || port > 0xffff) {
+            return { host, default_port };
+        }
+        return { host, (uint16_t)port };
+    }
+
+    // is_address_literal(host) returns true if host is an IPv4 or
+    // IPv6 address, rather than a name
+    //
+    static bool is_address_literal(const std::string &host) {
+        in6_addr tmp;
+        return inet_pton(AF_INET, host.c_str(), &tmp) == 1 || inet_pton(AF_INET6, host.c_str(), &tmp) == 1;
+    }
+
+    // resolve(target, r) sets r to the address of the host and port
+    // in target, which is either an address literal or a name that is
+    // resolved with getaddrinfo(), and returns true on success
+    //
+    bool resolve(const std::string &target, resolved_target &r) const {
+        auto [host, port] = split_target(target);
+        r.name = target;
+        r.addr = {};
+        sockaddr_in *sin = (sockaddr_in *)&r.addr;
+        sockaddr_in6 *sin6 = (sockaddr_in6 *)&r.addr;
+        if (inet_pton(AF_INET, host.c_str(), &sin->sin_addr) == 1) {
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(port);
+            r.addr_len = sizeof(sockaddr_in);
+            return true;
+        }
+        if (inet_pton(AF_INET6, host.c_str(), &sin6->sin6_addr) == 1) {
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = htons(port);
+            r.addr_len = sizeof(sockaddr_in6);
+            return true;
+        }
+        addrinfo hints{}, *addrs = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        hints.ai_flags = AI_ADDRCONFIG;
+        int err = getaddrinfo(host.c_str(), nullptr, &hints, &addrs);
+        if (err != 0 || addrs == nullptr) {
+            if (verbosity >= verbosity_level::warnings) {
+                fprintf(stderr, "warning: %s: %s\n", host.c_str(), gai_strerror(err));
+            }
+            return false;
+        }
+        bool found = false;
+        for (const addrinfo *a = addrs; a != nullptr; a = a->ai_next) {
+            if ((a->ai_family == AF_INET || a->ai_family == AF_INET6) && a->ai_addrlen <= sizeof(r.addr)) {
+                memcpy(&r.addr, a->ai_addr, a->ai_addrlen);
+                r.addr_len = a->ai_addrlen;
+                if (a->ai_family == AF_INET) {
+                    sin->sin_port = htons(port);
+                } else {
+                    sin6->sin6_port = htons(port);
+                }
+                found = true;
+                break;
+            }
+        }
+        freeaddrinfo(addrs);
+        return found;
+    }
+
+private:
+
+    static constexpr uint64_t event_fd_tag = 0xffffffffffffffff;
+
+    void resolve_loop(const std::vector<std::string> &targets, std::atomic<size_t> &next_target) {
+        while (true) {
+            size_t i = next_target++;
+            if (i >= targets.size()) {
+                break;
+            }
+            const std::string &t = targets[i];
+            if (t.empty()) {
+                ++resolver_failures;
+                continue;
+            }
+            resolved_target r;
+            if (!resolve(t, r)) {
+                ++resolver_failures;
+                continue;
+            }
+            {
+                std::lock_guard lock{resolver_mutex};
+                resolved.push_back(std::move(r));
+            }
+            wake();
+        }
+        --resolvers_running;
+        wake();
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t ignored = ::write(event_fd, &one, sizeof(one));
+    }
+
+    void take_resolved(std::deque<resolved_target> &queue) {
+        std::lock_guard lock{resolver_mutex};
+        while (!resolved.empty()) {
+            queue.push_back(std::move(resolved.front()));
+            resolved.pop_front();
+        }
+    }
+
+    void refill_tokens() {
+        if (cfg.connects_per_second <= 0.0) {
+            return;
+        }
+        clock::time_point now = clock::now();
+        std::chrono::duration<double> elapsed = now - last_refill;
+        last_refill = now;
+        tokens = std::min(tokens + elapsed.count() * cfg.connects_per_second,
+                          std::max(1.0, cfg.connects_per_second));
+    }
+
+    bool take_token() {
+        if (cfg.connects_per_second <= 0.0) {
+            return true;
+        }
+        if (tokens >= 1.0) {
+            tokens -= 1.0;
+            return true;
+        }
+        return false;
+    }
+
+    // admit(queue) starts connections for as many queued targets as
+    // the in-flight, rate, and per-address limits allow; targets
+    // whose address is at its limit are rotated to the back of the
+    // queue
+    //
+    void admit(std::deque<resolved_target> &queue) {
+        refill_tokens();
+        size_t blocked = 0;
+        while (!queue.empty() && in_flight < cfg.max_in_flight && blocked < queue.size()) {
+            resolved_target &t = queue.front();
+            auto it = per_address_count.find(address_key{t.addr});
+            size_t count = (it == per_address_count.end()) ? 0 : it->second;
+            if (cfg.max_per_address != 0 && count >= cfg.max_per_address) {
+                queue.push_back(std::move(t));
+                queue.pop_front();
+                ++blocked;
+                continue;
+            }
+            if (!take_token()) {
+                break;
+            }
+            blocked = 0;
+            start_connection(t);
+            queue.pop_front();
+        }
+    }
+
+    int wait_time_ms(const std::deque<resolved_target> &queue) const {
+        int wait = 100;
+        if (!deadlines.empty()) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadlines.front().deadline - clock::now()).count();
+            wait = std::clamp<long>(ms + 1, 0, wait);
+        }
+        if (!queue.empty() && in_flight < cfg.max_in_flight && cfg.connects_per_second > 0.0) {
+            wait = std::min(wait, std::max(1, (int)(1000.0 / cfg.connects_per_second)));
+        }
+        return wait;
+    }
+
+    void start_connection(const resolved_target &t) {
+        int fd = socket(t.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            if (verbosity >= verbosity_level::warnings) {
+                fprintf(stderr, "warning: could not create socket (errno %d)\n", errno);
+            }
+            ++stats.connect_failures;
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int retval = connect(fd, (const sockaddr *)&t.addr, t.addr_len);
+        if (retval != 0 && errno != EINPROGRESS) {
+            if (verbosity >= verbosity_level::warnings) {
+                fprintf(stderr, "warning: could not connect to %s (errno %d)\n", t.name.c_str(), errno);
+            }
+            close(fd);
+            ++stats.connect_failures;
+            return;
+        }
+
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        connection &c = conns[slot];
+        c.st = state::connecting;
+        c.fd = fd;
+        c.addr = address_key{t.addr};
+        c.peer_closed = false;
+        c.name = t.name;
+        c.pending_output.clear();
+        c.deadline = clock::now() + cfg.timeout;
+        ++in_flight;
+        ++per_address_count[c.addr];
+        deadlines.push_back({c.deadline, slot, c.generation});
+
+        epoll_event ev{};
+        ev.events = EPOLLOUT;
+        ev.data.u64 = ((uint64_t)c.generation << 32) | slot;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void release(uint32_t slot) {
+        connection &c = conns[slot];
+        if (c.fd >= 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+            close(c.fd);
+            c.fd = -1;
+        }
+        if (c.ssl != nullptr) {
+            SSL_free(c.ssl);       // frees rbio and wbio
+            c.ssl = nullptr;
+            c.rbio = c.wbio = nullptr;
+        }
+        auto it = per_address_count.find(c.addr);
+        if (it != per_address_count.end() && --it->second == 0) {
+            per_address_count.erase(it);
+        }
+        c.st = state::unused;
+        c.name.clear();
+        c.pending_output.clear();
+        ++c.generation;
+        free_slots.push_back(slot);
+        --in_flight;
+    }
+
+    void expire_deadlines() {
+        clock::time_point now = clock::now();
+        while (!deadlines.empty() && deadlines.front().deadline <= now) {
+            deadline_entry e = deadlines.front();
+            deadlines.pop_front();
+            connection &c = conns[e.slot];
+            if (c.st != state::unused && c.generation == e.generation) {
+                if (verbosity >= verbosity_level::warnings) {
+                    fprintf(stderr, "warning: scan of %s timed out\n", c.name.c_str());
+                }
+                ++stats.timeouts;
+                release(e.slot);
+            }
+        }
+    }
+
+    void set_interest(uint32_t slot, bool want_write) {
+        connection &c = conns[slot];
+        epoll_event ev{};
+        ev.events = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.u64 = ((uint64_t)c.generation << 32) | slot;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    void handle_event(uint32_t slot, uint32_t events) {
+        connection &c = conns[slot];
+        if (c.st == state::connecting) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+                if (verbosity >= verbosity_level::warnings) {
+                    fprintf(stderr, "warning: could not connect to %s (errno %d)\n", c.name.c_str(), err);
+                }
+                ++stats.connect_failures;
+                release(slot);
+                return;
+            }
+            if (!start_handshake(slot)) {
+                ++stats.handshake_failures;
+                release(slot);
+                return;
+            }
+            advance(slot);
+            return;
+        }
+
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            if (!receive(slot)) {
+                ++stats.handshake_failures;
+                if (verbosity >= verbosity_level::warnings) {
+                    fprintf(stderr, "warning: connection to %s failed during handshake (errno %d)\n", c.name.c_str(), errno);
+                }
+                release(slot);
+                return;
+            }
+        }
+        advance(slot);
+    }
+
+    bool start_handshake(uint32_t slot) {
+        connection &c = conns[slot];
+        c.ssl = SSL_new(ctx);
+        if (c.ssl == nullptr) {
+            return false;
+        }
+        c.rbio = BIO_new(BIO_s_mem());
+        c.wbio = BIO_new(BIO_s_mem());
+        if (c.rbio == nullptr || c.wbio == nullptr) {
+            BIO_free(c.rbio);
+            BIO_free(c.wbio);
+            c.rbio = c.wbio = nullptr;
+            return false;
+        }
+        SSL_set_bio(c.ssl, c.rbio, c.wbio);
+        SSL_set_connect_state(c.ssl);
+        if (!cfg.omit_sni) {
+            std::string host = split_target(c.name).first;
+            if (!is_address_literal(host)) {
+                SSL_set_tlsext_host_name(c.ssl, host.c_str());
+            }
+        }
+        c.st = state::handshaking;
+        return true;
+    }
+
+    // receive(slot) moves ciphertext from the socket into the read
+    // BIO, and returns false if an error occured.  If the peer has
+    // closed the connection, peer_closed is set, and true is
+    // returned, so that the ciphertext that arrived before the close
+    // is still passed to the handshake.
+    //
+    bool receive(uint32_t slot) {
+        connection &c = conns[slot];
+        uint8_t buffer[read_buffer_size];
+        while (true) {
+            ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                BIO_write(c.rbio, buffer, n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                c.peer_closed = true;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    // flush(slot) moves ciphertext from the write BIO to the socket,
+    // and returns false on a socket error
+    //
+    bool flush(uint32_t slot) {
+        connection &c = conns[slot];
+        char buffer[read_buffer_size];
+        int n;
+        while ((n = BIO_read(c.wbio, buffer, sizeof(buffer))) > 0) {
+            c.pending_output.append(buffer, n);
+        }
+        while (!c.pending_output.empty()) {
+            ssize_t sent = send(c.fd, c.pending_output.data(), c.pending_output.size(), MSG_NOSIGNAL);
+            if (sent > 0) {
+                c.pending_output.erase(0, sent);
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // advance(slot) runs the handshake as far as the ciphertext
+    // received so far allows.  A handshake that completes is counted
+    // as a success even if our last flight cannot be sent, since the
+    // peer certificate has been received; one that needs more data
+    // from a peer that has closed the connection is a failure.
+    //
+    void advance(uint32_t slot) {
+        connection &c = conns[slot];
+        int retval = SSL_do_handshake(c.ssl);
+        bool flushed = flush(slot);
+        if (retval == 1) {
+            deliver_certificate(slot);
+            ++stats.succeeded;
+            release(slot);
+            return;
+        }
+        if (!flushed) {
+            ++stats.handshake_failures;
+            release(slot);
+            return;
+        }
+        int err = SSL_get_error(c.ssl, retval);
+        if (c.peer_closed && (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)) {
+            if (verbosity >= verbosity_level::warnings) {
+                fprintf(stderr, "warning: connection to %s closed during handshake\n", c.name.c_str());
+            }
+            ++stats.handshake_failures;
+            release(slot);
+            return;
+        }
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            if (verbosity >= verbosity_level::warnings) {
+                fprintf(stderr, "warning: TLS handshake with %s failed (%d)\n", c.name.c_str(), err);
+            }
+            ERR_clear_error();
+            ++stats.handshake_failures;
+            release(slot);
+            return;
+        }
+        set_interest(slot, !c.pending_output.empty());
+    }
+
+    void deliver_certificate(uint32_t slot) {
+        connection &c = conns[slot];
+        X509 *cert = SSL_get_peer_certificate(c.ssl);
+        if (cert == nullptr) {
+            if (verbosity >= verbosity_level::notes) {
+                fprintf(stderr, "note: server %s did not present a certificate\n", c.name.c_str());
+            }
+            on_cert(c.name, nullptr, 0);
+            return;
+        }
+        uint8_t *der = nullptr;
+        int der_len = i2d_X509(cert, &der);
+        if (der_len > 0) {
+            on_cert(c.name, der, der_len);
+        }
+        OPENSSL_free(der);
+        X509_free(cert);
+    }
+
+};
+
+#endif // TLS_SCAN_ENGINE_HPP
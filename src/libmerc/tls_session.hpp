@@ -0,0 +1,127 @@
+// tls_session.hpp
+//
+// correlation of the server side of a TLS session with the client
+// hello that started it
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef TLS_SESSION_HPP
+#define TLS_SESSION_HPP
+
+#include <string.h>
+#include <string>
+#include "datum.h"
+#include "json_object.h"
+#include "tcp.h"
+#include "bounded_table.hpp"
+
+// class tls_session_table holds a summary of each TLS client hello,
+// keyed by its flow key, so that the records for the server hello
+// and certificate sent in response can report the client's
+// fingerprint and server name, instead of having to be joined with
+// the client hello records afterwards.
+//
+// The table holds at most max_entries sessions; when it is full, the
+// oldest one is discarded.  A session stays in the table until then,
+// so that a certificate that follows the server hello in a later
+// record is correlated as well.
+//
+class tls_session_table {
+
+    struct client_summary {
+        std::string fingerprint;
+        std::string server_name;
+    };
+
+    bounded_table<key, client_summary> table;
+
+public:
+
+    static constexpr size_t default_max_entries = 16384;
+
+    explicit tls_session_table(size_t max=default_max_entries) : table{max} { }
+
+    // add_client_hello(k, fp, server_name) records the fingerprint
+    // string fp and the server name of the client hello with flow
+    // key k, replacing those of any earlier client hello with that key
+    //
+    void add_client_hello(const key &k, const char *fp, datum server_name) {
+        auto it = table.find_or_insert(k);
+        it->second.fingerprint.assign(fp);
+        if (server_name.is_readable()) {
+            it->second.server_name.assign((const char *)server_name.data, server_name.length());
+        } else {
+            it->second.server_name.clear();
+        }
+    }
+
+    // write_client_json(record, k) writes a "tls_session" object that
+    // reports the client hello of the session to which the server
+    // message with flow key k belongs into record, and returns true,
+    // if that client hello is in the table; otherwise, it returns
+    // false
+    //
+    bool write_client_json(json_object &record, const key &k) const {
+        auto it = table.find(k.reverse());
+        if (it == table.end()) {
+            return false;
+        }
+        json_object session{record, "tls_session"};
+        if (!it->second.fingerprint.empty()) {
+            session.print_key_string("client_fingerprint", it->second.fingerprint.c_str());
+        }
+        if (!it->second.server_name.empty()) {
+            session.print_key_json_string("server_name",
+                                          (const uint8_t *)it->second.server_name.data(),
+                                          it->second.server_name.length());
+        }
+        session.close();
+        return true;
+    }
+
+    size_t size() const { return table.size(); }
+
+    static bool unit_test() {
+        tls_session_table t{2};
+        key client{50000, 443, 0x0100000a, 0x0200000a, 6};
+        const char sni[] = "example.com";
+        t.add_client_hello(client, "tls/1/(0303)(1301)", datum{(const uint8_t *)sni, (const uint8_t *)sni + strlen(sni)});
+
+        // write_json(k) returns the tls_session object written for a
+        // server message with key k, or "none" if there is none
+        //
+        auto write_json = [&t](const key &k) {
+            char buffer[256];
+            struct buffer_stream buf{buffer, sizeof(buffer)};
+            struct json_object record{&buf};
+            bool found = t.write_client_json(record, k);
+            record.close();
+            return found ? std::string{buffer, (size_t)buf.length()} : std::string{"none"};
+        };
+        if (write_json(client.reverse()) != "{\"tls_session\":{\"client_fingerprint\":\"tls/1/(0303)(1301)\",\"server_name\":\"example.com\"}}") {
+            return false;
+        }
+        if (write_json(client) != "none") {
+            return false;                     // a client message is not correlated
+        }
+
+        // a later client hello with the same key replaces the first
+        //
+        t.add_client_hello(client, "tls/1/(0303)(1302)", datum{nullptr, nullptr});
+        if (t.size() != 1 || write_json(client.reverse()) != "{\"tls_session\":{\"client_fingerprint\":\"tls/1/(0303)(1302)\"}}") {
+            return false;
+        }
+
+        // the oldest session is discarded when the table is full
+        //
+        key other{50001, 443, 0x0100000a, 0x0200000a, 6};
+        key third{50002, 443, 0x0100000a, 0x0200000a, 6};
+        t.add_client_hello(other, "tls/1/(0303)(1303)", datum{nullptr, nullptr});
+        t.add_client_hello(third, "tls/1/(0303)(1303)", datum{nullptr, nullptr});
+        return t.size() == 2 && write_json(client.reverse()) == "none" && write_json(third.reverse()) != "none";
+    }
+
+};
+
+#endif // TLS_SESSION_HPP
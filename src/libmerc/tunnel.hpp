@@ -0,0 +1,378 @@
+// tunnel.hpp
+//
+// iterative decapsulation of VXLAN, Geneve, GRE, GTP-U, and IP-in-IP
+// tunnels
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef TUNNEL_HPP
+#define TUNNEL_HPP
+
+#include <array>
+#include <algorithm>
+#include "datum.h"
+#include "json_object.h"
+#include "eth.h"
+#include "ip.h"
+#include "udp.h"
+#include "gre.h"
+#include "tunnel_depth.hpp"
+
+//   VXLAN, from RFC 7348
+//
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |R|R|R|R|I|R|R|R|            Reserved                           |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |                VXLAN Network Identifier (VNI) |   Reserved    |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+//   The header is followed by an Ethernet frame.
+//
+class vxlan_header {
+    encoded<uint32_t> flags_reserved;
+    encoded<uint32_t> vni_reserved;
+
+public:
+
+    static constexpr uint16_t port = 4789;
+
+    vxlan_header(datum &d) : flags_reserved{d}, vni_reserved{d} { }
+
+    bool is_valid() const { return flags_reserved.bit<4>(); }   // I flag
+
+    uint32_t get_vni() const { return vni_reserved >> 8; }
+};
+
+//   Geneve, from RFC 8926
+//
+//    0                   1                   2                   3
+//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |Ver|  Opt Len  |O|C|    Rsvd.  |          Protocol Type        |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |        Virtual Network Identifier (VNI)       |    Reserved   |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |                                                               |
+//   ~                    Variable-Length Options                    ~
+//   |                                                               |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+//   Opt Len is the length of the options in four-byte units, and the
+//   Protocol Type is an ethertype.
+//
+class geneve_header {
+    encoded<uint16_t> ver_optlen_flags;
+    encoded<uint16_t> protocol_type;
+    encoded<uint32_t> vni_reserved;
+    bool valid;
+
+public:
+
+    static constexpr uint16_t port = 6081;
+
+    geneve_header(datum &d) : ver_optlen_flags{d}, protocol_type{d}, vni_reserved{d} {
+        d.skip(ver_optlen_flags.slice<2,8>() * 4);
+        valid = d.is_not_null() && ver_optlen_flags.slice<0,2>() == 0;
+    }
+
+    bool is_valid() const { return valid; }
+
+    uint16_t get_protocol_type() const { return valid ? (uint16_t)protocol_type : ETH_TYPE_NONE; }
+
+    uint32_t get_vni() const { return vni_reserved >> 8; }
+};
+
+//   GTP-U, from 3GPP TS 29.281
+//
+//    0                   1                   2                   3
+//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |Ver|P|R|E|S|N|  Message Type |            Length             |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |               Tunnel Endpoint Identifier (TEID)               |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |        Sequence Number        | N-PDU Number  | Next Ext Type |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+//   The last word is present if any of the E, S, or N flags is set;
+//   it is followed by a chain of extension headers, each of which
+//   starts with its length in four-byte units and ends with the type
+//   of the next one.  Only G-PDU messages (type 255) carry a user
+//   packet, which is an IPv4 or IPv6 packet.
+//
+class gtpu_header {
+    encoded<uint8_t> flags;
+    encoded<uint8_t> message_type;
+    encoded<uint16_t> length;
+    encoded<uint32_t> teid;
+    bool valid;
+
+    static constexpr uint8_t g_pdu = 255;
+
+public:
+
+    static constexpr uint16_t port = 2152;
+
+    gtpu_header(datum &d) : flags{d}, message_type{d}, length{d}, teid{d} {
+        valid = d.is_not_null() && flags.slice<0,3>() == 1 && flags.bit<3>() && message_type == g_pdu;
+        if (!valid || (flags & 0x07) == 0) {
+            return;
+        }
+        d.skip(3);                        // Sequence Number and N-PDU Number
+        encoded<uint8_t> next_type{d};
+        while (next_type != 0 && d.is_not_empty()) {
+            encoded<uint8_t> ext_len{d};
+            if (ext_len == 0) {
+                valid = false;
+                return;
+            }
+            d.skip(ext_len * 4 - 2);
+            next_type = encoded<uint8_t>{d};
+        }
+        valid = d.is_not_null();
+    }
+
+    bool is_valid() const { return valid; }
+
+    uint32_t get_teid() const { return teid; }
+};
+
+// class decapsulator strips the outer headers of tunneled packets,
+// so that the inner packet is processed, and keyed, as if it had
+// been captured on its own.  It iterates over the layers of
+// encapsulation, up to a configurable depth, rather than re-entering
+// the ethernet and IP processing for each layer.  The tunnels that
+// it recognizes are
+//
+//    GRE (IP protocol 47), carrying IP or Ethernet,
+//    IPv4 or IPv6 in IP (IP protocols 4 and 41),
+//    VXLAN (UDP port 4789), carrying Ethernet,
+//    Geneve (UDP port 6081), carrying IP or Ethernet, and
+//    GTP-U (UDP port 2152), carrying IP.
+//
+// The tunnel type and its identifier (the VNI of VXLAN and Geneve,
+// the key of GRE, or the TEID of GTP-U) are kept for each layer that
+// is stripped from the current packet, so that they can be reported.
+//
+class decapsulator {
+public:
+
+    enum class tunnel_type : uint8_t { gre, ip_in_ip, vxlan, geneve, gtpu };
+
+    static constexpr size_t max_depth_limit = tunnel_depth::max_depth;
+    static constexpr size_t default_depth = tunnel_depth::default_depth;
+
+private:
+
+    struct layer {
+        tunnel_type type;
+        bool has_id;
+        uint32_t id;
+    };
+
+    size_t max_depth;
+    bool gre_only;
+    std::array<layer, max_depth_limit> layers;
+    size_t depth = 0;
+
+    // strip_layer(pkt, transport_proto, l) strips the tunnel header
+    // at the start of pkt, which is the payload of an IP packet with
+    // the given transport protocol, if there is one, and returns the
+    // ethertype of the packet that follows it; otherwise, it returns
+    // ETH_TYPE_NONE and leaves pkt unchanged
+    //
+    uint16_t strip_layer(datum &pkt, uint8_t transport_proto, layer &l) const {
+        datum inner{pkt};
+        uint16_t ethertype = ETH_TYPE_NONE;
+        switch (transport_proto) {
+        case ip::protocol::gre:
+            {
+                gre_header gre{inner};
+                ethertype = gre.get_protocol_type();
+                l = { tunnel_type::gre, gre.has_key(), gre.get_key() };
+            }
+            break;
+        case ip::protocol::ipv4:
+        case ip::protocol::ipv6:
+            if (gre_only) {
+                return ETH_TYPE_NONE;
+            }
+            ethertype = ETH_TYPE_IP;      // ip::parse() checks the version field
+            l = { tunnel_type::ip_in_ip, false, 0 };
+            break;
+        case ip::protocol::udp:
+            {
+                if (gre_only) {
+                    return ETH_TYPE_NONE;
+                }
+                class udp udp_pkt{inner};
+                uint16_t dst_port = ntoh(udp_pkt.get_ports().dst);
+                if (dst_port == vxlan_header::port) {
+                    vxlan_header vxlan{inner};
+                    if (vxlan.is_valid()) {
+                        ethertype = ETH_TYPE_TEB;
+                        l = { tunnel_type::vxlan, true, vxlan.get_vni() };
+                    }
+                } else if (dst_port == geneve_header::port) {
+                    geneve_header geneve{inner};
+                    ethertype = geneve.get_protocol_type();
+                    l = { tunnel_type::geneve, true, geneve.get_vni() };
+                } else if (dst_port == gtpu_header::port) {
+                    gtpu_header gtpu{inner};
+                    if (gtpu.is_valid()) {
+                        ethertype = ETH_TYPE_IP;
+                        l = { tunnel_type::gtpu, true, gtpu.get_teid() };
+                    }
+                }
+            }
+            break;
+        default:
+            return ETH_TYPE_NONE;
+        }
+        if (ethertype == ETH_TYPE_TEB) {
+            eth inner_frame{inner};
+            ethertype = inner_frame.get_ethertype();
+        }
+        if (ethertype != ETH_TYPE_IP && ethertype != ETH_TYPE_IPV6) {
+            return ETH_TYPE_NONE;
+        }
+        pkt = inner;
+        return ethertype;
+    }
+
+public:
+
+    // decapsulator(depth, gre_only) constructs a decapsulator that
+    // strips at most depth layers of tunnels, or, if gre_only is
+    // true, only GRE tunnels
+    //
+    explicit decapsulator(size_t depth=0, bool gre=false) :
+        max_depth{std::min(depth, max_depth_limit)},
+        gre_only{gre} { }
+
+    bool is_enabled() const { return max_depth > 0; }
+
+    // decapsulate(pkt, ip_pkt, k, transport_proto) strips the tunnel
+    // headers from the payload pkt of the IP packet ip_pkt, whose
+    // transport protocol is transport_proto, and parses the innermost
+    // IP packet into ip_pkt, overwriting the addresses in the key k.
+    // It returns the transport protocol of the innermost IP packet.
+    //
+    uint8_t decapsulate(datum &pkt, ip &ip_pkt, key &k, uint8_t transport_proto) {
+        depth = 0;
+        while (depth < max_depth) {
+            if (strip_layer(pkt, transport_proto, layers[depth]) == ETH_TYPE_NONE) {
+                break;
+            }
+            ip_pkt.parse(pkt, k);
+            transport_proto = ip_pkt.transport_protocol();
+            depth++;
+        }
+        return transport_proto;
+    }
+
+    // get_depth() returns the number of layers of tunnels that were
+    // stripped from the most recent packet
+    //
+    size_t get_depth() const { return depth; }
+
+    static const char *tunnel_type_name(tunnel_type t) {
+        switch (t) {
+        case tunnel_type::gre:      return "gre";
+        case tunnel_type::ip_in_ip: return "ip_in_ip";
+        case tunnel_type::vxlan:    return "vxlan";
+        case tunnel_type::geneve:   return "geneve";
+        case tunnel_type::gtpu:     return "gtpu";
+        }
+        return "unknown";
+    }
+
+    static const char *tunnel_id_name(tunnel_type t) {
+        switch (t) {
+        case tunnel_type::gre:      return "key";
+        case tunnel_type::gtpu:     return "teid";
+        default:
+            ;
+        }
+        return "vni";
+    }
+
+    // write_json(record) writes a "tunnels" array into record that
+    // reports the layers that were stripped from the most recent
+    // packet, outermost first, if there were any
+    //
+    void write_json(json_object &record) const {
+        if (depth == 0) {
+            return;
+        }
+        json_array tunnels{record, "tunnels"};
+        for (size_t i = 0; i < depth; i++) {
+            json_object t{tunnels};
+            t.print_key_string("type", tunnel_type_name(layers[i].type));
+            if (layers[i].has_id) {
+                t.print_key_uint(tunnel_id_name(layers[i].type), layers[i].id);
+            }
+            t.close();
+        }
+        tunnels.close();
+    }
+
+    static bool unit_test() {
+
+        // TCP SYN in IPv4 in VXLAN (VNI 0x123456) in UDP in IPv4
+        //
+        uint8_t vxlan_pkt[] = {
+            0x45, 0x00, 0x00, 0x5a, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+            0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+            0xc0, 0x00, 0x12, 0xb5, 0x00, 0x46, 0x00, 0x00,
+            0x08, 0x00, 0x00, 0x00, 0x12, 0x34, 0x56, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x08, 0x00,
+            0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+            0xc0, 0xa8, 0x01, 0x01, 0xc0, 0xa8, 0x01, 0x02,
+            0x30, 0x39, 0x01, 0xbb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00
+        };
+        decapsulator d{default_depth};
+        datum pkt{vxlan_pkt, vxlan_pkt + sizeof(vxlan_pkt)};
+        key k;
+        ip ip_pkt{pkt, k};
+        uint8_t proto = d.decapsulate(pkt, ip_pkt, k, ip_pkt.transport_protocol());
+        if (proto != ip::protocol::tcp || d.get_depth() != 1 || k.addr.ipv4.src != hton<uint32_t>(0xc0a80101)
+            || d.layers[0].type != tunnel_type::vxlan || d.layers[0].id != 0x123456) {
+            return false;
+        }
+
+        // UDP in IPv4 in GTP-U (TEID 0x01020304, with a PDU session
+        // container extension header) in UDP in IPv4
+        //
+        uint8_t gtpu_pkt[] = {
+            0x45, 0x00, 0x00, 0x48, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+            0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+            0x08, 0x68, 0x08, 0x68, 0x00, 0x34, 0x00, 0x00,
+            0x34, 0xff, 0x00, 0x24, 0x01, 0x02, 0x03, 0x04,
+            0x00, 0x00, 0x00, 0x85, 0x01, 0x00, 0x01, 0x00,
+            0x45, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+            0xc0, 0xa8, 0x01, 0x01, 0xc0, 0xa8, 0x01, 0x02,
+            0x30, 0x39, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00
+        };
+        pkt = datum{gtpu_pkt, gtpu_pkt + sizeof(gtpu_pkt)};
+        ip_pkt.parse(pkt, k);
+        proto = d.decapsulate(pkt, ip_pkt, k, ip_pkt.transport_protocol());
+        if (proto != ip::protocol::udp || d.get_depth() != 1 || d.layers[0].id != 0x01020304) {
+            return false;
+        }
+
+        // a decapsulator that handles only GRE leaves the VXLAN
+        // packet alone
+        //
+        decapsulator gre_only{1, true};
+        pkt = datum{vxlan_pkt, vxlan_pkt + sizeof(vxlan_pkt)};
+        ip_pkt.parse(pkt, k);
+        proto = gre_only.decapsulate(pkt, ip_pkt, k, ip_pkt.transport_protocol());
+        return proto == ip::protocol::udp && gre_only.get_depth() == 0;
+    }
+
+};
+
+#endif // TUNNEL_HPP
@@ -0,0 +1,24 @@
+// tunnel_depth.hpp
+//
+// limits on the number of tunnel layers stripped by the decapsulator
+//
+// Copyright (c) 2023 Cisco Systems, Inc. License at
+// https://github.com/cisco/mercury/blob/master/LICENSE
+
+#ifndef TUNNEL_DEPTH_HPP
+#define TUNNEL_DEPTH_HPP
+
+#include <cstddef>
+
+// the configuration needs only these limits, so they are kept apart
+// from the decapsulator (see tunnel.hpp) and the protocol headers
+// that it depends on
+//
+namespace tunnel_depth {
+
+    static constexpr size_t default_depth = 2;   // --decapsulate without a depth
+    static constexpr size_t max_depth = 8;
+
+} // namespace tunnel_depth
+
+#endif // TUNNEL_DEPTH_HPP
@@ -9,6 +9,7 @@
 #ifndef UTIL_OBJ_H
 #define UTIL_OBJ_H
 
+#include <utility>
 #include "datum.h"
 #include "buffer_stream.h"
 #include "utils.h"
@@ -120,6 +121,21 @@ struct key {
     bool is_zero() const {
         return ip_vers == 0;
     }
+
+    // reverse() returns the key of the packets that flow in the
+    // opposite direction, with the source and destination swapped
+    //
+    key reverse() const {
+        key r{*this};
+        std::swap(r.src_port, r.dst_port);
+        if (ip_vers == 4) {
+            std::swap(r.addr.ipv4.src, r.addr.ipv4.dst);
+        } else {
+            std::swap(r.addr.ipv6.src, r.addr.ipv6.dst);
+        }
+        return r;
+    }
+
     bool operator==(const key &k) const {
         switch (ip_vers) {
         case 4:
@@ -6,10 +6,17 @@
 #define WATCHLIST_HPP
 
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <unordered_set>
 #include <variant>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <iostream>
 #include <fstream>
 #include "datum.h"
@@ -520,21 +527,213 @@ static inline host_identifier host_identifier_constructor(datum d) {
 }
 
 // class watchlist implements a watchlist of host identifiers,
-// including IPv4 and IPv6 addresses and DNS names
+// including IPv4 and IPv6 addresses and DNS names.  A DNS name entry
+// matches that name exactly; an entry of the form *.example.com
+// matches all of the subdomains of example.com, but not example.com
+// itself, and an entry of the form .example.com matches both.  DNS
+// names are matched without regard to case.
+//
+// Entries are read with process_line(), and then compiled by
+// process_final() into a compact, read-only image, which holds
+//
+//    * a sorted array of IPv4 addresses,
+//    * a sorted array of IPv6 addresses,
+//    * an open-addressing hash table of DNS names, keyed by a hash
+//      computed over each name from its last character to its first,
+//      so that the hashes of all of the suffixes of a name are
+//      computed on the way to the hash of the whole name, and
+//    * a pool of null-terminated DNS names, which are referenced by
+//      the hash table, and are used to confirm matches.
+//
+// Looking up a name takes one probe per label, and looking up an
+// address takes a binary search, and neither allocates memory.  The
+// image can be written to a file with write(), and later mapped into
+// memory with map(), so that a large watchlist need not be parsed,
+// or held in private memory, by each process that uses it.  An image
+// is in host byte order, and can only be mapped on a host with the
+// same byte order as the one that wrote it.
 //
 class watchlist {
-    std::unordered_set<uint32_t> ipv4_addrs;
-    std::unordered_set<ipv6_array_t> ipv6_addrs;
-    std::unordered_set<std::string> dns_names;
 
-    //    std::unordered_set<host_identifier> hosts;
+    enum name_flags : uint32_t {
+        match_name       = 1,
+        match_subdomains = 2
+    };
+
+    struct header {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t reserved;
+        uint64_t num_ipv4;
+        uint64_t num_ipv6;
+        uint64_t num_slots;
+        uint64_t names_length;
+    };
+
+    struct slot {
+        uint64_t hash;
+        uint32_t name_offset;
+        uint32_t flags;         // zero in an empty slot
+    };
 
-    // TODO: for performance, try using perfect_hash in place of
-    // unordered_map
+    static constexpr char image_magic[8] = { 'M', 'E', 'R', 'C', 'W', 'L', 'S', 'T' };
+    static constexpr uint32_t byte_order_mark = 0x01020304;
+
+    // struct tables holds the locations of the sections of an image
     //
-    // TODO: for performance, replace std:string with const char *,
-    // using a dynamically allocated buffer holding null-terminated
-    // strings
+    struct tables {
+        const uint8_t *image = nullptr;
+        size_t image_length = 0;
+        const uint32_t *ipv4_addrs = nullptr;
+        size_t num_ipv4 = 0;
+        const ipv6_array_t *ipv6_addrs = nullptr;
+        size_t num_ipv6 = 0;
+        const slot *slots = nullptr;
+        size_t num_slots = 0;
+        const char *names = nullptr;
+        size_t names_length = 0;
+    };
+
+    // entries read by process_line(), which have not yet been
+    // compiled by process_final()
+    //
+    std::vector<uint32_t> ipv4_input;
+    std::vector<ipv6_array_t> ipv6_input;
+    std::vector<std::pair<std::string, uint32_t>> dns_input;
+
+    std::vector<uint8_t> image;     // compiled image, unless mapped
+    void *mapping = nullptr;        // mapped image, if any
+    size_t mapping_length = 0;
+    tables t;
+
+    static size_t align8(size_t x) { return (x + 7) & ~(size_t)7; }
+
+    static uint8_t to_lower(uint8_t c) {
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    static constexpr uint64_t hash_basis = 0xcbf29ce484222325;
+    static constexpr uint64_t hash_prime = 0x100000001b3;
+
+    static uint64_t hash_step(uint64_t h, uint8_t c) {
+        return (h ^ to_lower(c)) * hash_prime;
+    }
+
+    static uint64_t hash_name(const std::string &name) {
+        uint64_t h = hash_basis;
+        for (auto c = name.rbegin(); c != name.rend(); c++) {
+            h = hash_step(h, *c);
+        }
+        return h;
+    }
+
+    // parse_image(data, length, tbl) sets tbl to the sections of the
+    // image at data, and returns true if that image is valid
+    //
+    static bool parse_image(const uint8_t *data, size_t length, tables &tbl) {
+        header h;
+        if (length < sizeof(h)) {
+            return false;
+        }
+        memcpy(&h, data, sizeof(h));
+        if (memcmp(h.magic, image_magic, sizeof(image_magic)) != 0 || h.byte_order != byte_order_mark) {
+            return false;
+        }
+        if (h.num_ipv4 > length || h.num_ipv6 > length || h.num_slots > length || h.names_length > length) {
+            return false;
+        }
+        if ((h.num_slots & (h.num_slots - 1)) != 0) {
+            return false;   // number of slots must be zero or a power of two
+        }
+        size_t ipv4_offset = sizeof(header);
+        size_t ipv6_offset = ipv4_offset + h.num_ipv4 * sizeof(uint32_t);
+        size_t slots_offset = align8(ipv6_offset + h.num_ipv6 * sizeof(ipv6_array_t));
+        size_t names_offset = slots_offset + h.num_slots * sizeof(slot);
+        if (names_offset + h.names_length != length) {
+            return false;
+        }
+        if (h.names_length > 0 && data[length - 1] != '\0') {
+            return false;
+        }
+        tbl.image = data;
+        tbl.image_length = length;
+        tbl.ipv4_addrs = (const uint32_t *)(data + ipv4_offset);
+        tbl.num_ipv4 = h.num_ipv4;
+        tbl.ipv6_addrs = (const ipv6_array_t *)(data + ipv6_offset);
+        tbl.num_ipv6 = h.num_ipv6;
+        tbl.slots = (const slot *)(data + slots_offset);
+        tbl.num_slots = h.num_slots;
+        tbl.names = (const char *)(data + names_offset);
+        tbl.names_length = h.names_length;
+
+        // every name must lie within the pool, and there must be an
+        // empty slot, so that every probe sequence terminates
+        //
+        size_t empty_slots = 0;
+        for (size_t i = 0; i < tbl.num_slots; i++) {
+            if (tbl.slots[i].flags == 0) {
+                empty_slots++;
+            } else if (tbl.slots[i].name_offset >= tbl.names_length) {
+                return false;
+            }
+        }
+        return tbl.num_slots == 0 || empty_slots > 0;
+    }
+
+    // name_equals(entry, name, length) returns true if the
+    // null-terminated, lowercase entry matches name
+    //
+    static bool name_equals(const char *entry, const char *name, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            if (entry[i] != (char)to_lower(name[i])) {
+                return false;   // also handles the end of entry
+            }
+        }
+        return entry[length] == '\0';
+    }
+
+    bool lookup(uint64_t h, const char *name, size_t length, uint32_t flag) const {
+        size_t mask = t.num_slots - 1;
+        for (size_t i = h & mask; t.slots[i].flags != 0; i = (i + 1) & mask) {
+            if (t.slots[i].hash == h
+                && (t.slots[i].flags & flag)
+                && name_equals(t.names + t.slots[i].name_offset, name, length)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void unmap() {
+        if (mapping) {
+            munmap(mapping, mapping_length);
+            mapping = nullptr;
+            mapping_length = 0;
+        }
+    }
+
+    bool map_fd(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+            return false;
+        }
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        tables tmp;
+        if (!parse_image((const uint8_t *)addr, st.st_size, tmp)) {
+            munmap(addr, st.st_size);
+            return false;
+        }
+        unmap();
+        image.clear();
+        image.shrink_to_fit();
+        mapping = addr;
+        mapping_length = st.st_size;
+        t = tmp;
+        return true;
+    }
 
 public:
 
@@ -551,51 +750,101 @@ public:
             if (process_line(d) == false) {
                 throw std::runtime_error{"could not read watchlist file"};
             }
-            // d = get_datum(line);
-            // host_identifier hid = host_identifier_constructor(d);
-            // hosts.insert(hid);
         }
+        process_final();
     }
 
     watchlist() { }
 
+    watchlist(const watchlist &) = delete;
+    watchlist &operator=(const watchlist &) = delete;
+
+    ~watchlist() { unmap(); }
+
     // contains(x) returns true if this watchlist contains x, and
     // false otherwise.
     //
     bool contains(uint32_t addr) const {
-        return ipv4_addrs.find(addr) != ipv4_addrs.end();
+        return std::binary_search(t.ipv4_addrs, t.ipv4_addrs + t.num_ipv4, addr);
     }
     bool contains(std::string &name) const {
-        return dns_names.find(name) != dns_names.end();
+        return contains_dns_name(name.data(), name.length());
     }
     bool contains(ipv6_array_t addr) const {
-        return ipv6_addrs.find(addr) != ipv6_addrs.end();
+        return std::binary_search(t.ipv6_addrs, t.ipv6_addrs + t.num_ipv6, addr);
     }
     bool contains(host_identifier hid) const {
         return std::visit(*this, hid);
     }
 
+    // contains_dns_name(name, length) returns true if the DNS name,
+    // or one of its parent domains, matches an entry in this
+    // watchlist, and false otherwise.  The labels of name are hashed
+    // from right to left, and the hash table is probed at each label
+    // boundary.
+    //
+    bool contains_dns_name(const char *name, size_t length) const {
+        if (t.num_slots == 0) {
+            return false;
+        }
+        if (length > 0 && name[length - 1] == '.') {
+            length--;   // ignore trailing dot of absolute name
+        }
+        uint64_t h = hash_basis;
+        for (size_t i = length; i > 0; i--) {
+            if (name[i - 1] == '.' && lookup(h, name + i, length - i, match_subdomains)) {
+                return true;
+            }
+            h = hash_step(h, name[i - 1]);
+        }
+        return length > 0 && lookup(h, name, length, match_name);
+    }
+
+    bool contains_dns_name(const char *name) const {
+        return name != nullptr && contains_dns_name(name, strlen(name));
+    }
+
+    // contains_addr(ip_vers, addr) returns true if this watchlist
+    // contains the address addr, which is in network byte order and
+    // has four bytes if ip_vers is 4 and sixteen bytes if ip_vers is
+    // 6, as in a flow key, and false otherwise.
+    //
+    bool contains_addr(uint8_t ip_vers, const uint8_t *addr) const {
+        if (ip_vers == 4) {
+            return contains((uint32_t)addr[0] << 24 | (uint32_t)addr[1] << 16 | (uint32_t)addr[2] << 8 | addr[3]);
+        } else if (ip_vers == 6) {
+            ipv6_array_t tmp;
+            memcpy(tmp.data(), addr, tmp.size());
+            return contains(tmp);
+        }
+        return false;
+    }
+
     // contains_addr(a) returns true if this watchlist contains the
     // IPv4 or IPv6 address string a, and false otherwise.
     //
     bool contains_addr(const char *addr) const {
-        datum d = get_datum(addr);
-        if (lookahead<ipv4_address_string> ipv4{d}) {
-            return contains(ipv4.value.get_value());
-        } else if (lookahead<ipv6_address_string> ipv6{d}) {
-            return contains(ipv6.value.get_value_array());
+        if (addr == nullptr) {
+            return false;
+        }
+        uint8_t tmp[16];
+        if (t.num_ipv4 > 0 && inet_pton(AF_INET, addr, tmp) == 1) {
+            return contains_addr(4, tmp);
+        }
+        if (t.num_ipv6 > 0 && inet_pton(AF_INET6, addr, tmp) == 1) {
+            return contains_addr(6, tmp);
         }
         return false;
     }
 
     bool operator()(ipv4_t addr) const {
-        return ipv4_addrs.find(addr) != ipv4_addrs.end();
+        return contains(addr);
     }
     bool operator()(dns_name_t &name) const {
-        return dns_names.find(name) != dns_names.end();
+        return contains(name);
     }
     bool operator()(ipv6_array_t addr) const {
-        return ipv6_addrs.find(addr) != ipv6_addrs.end();
+        return contains(addr);
     }
     bool operator()(std::monostate) const {
         return false;
@@ -609,7 +858,8 @@ public:
 
     // process_line() parses and processes a single line of a
     // watchlist file, and returns true on success and false on
-    // failure
+    // failure; the entry is not matched until process_final() is
+    // called
     //
     bool process_line(datum d, int verbose=0) {
         if (d.is_null()) {
@@ -621,36 +871,180 @@ public:
         if (*d.data == '#') {
             return true;      // comment line
         }
-        if (lookahead<ipv4_address_string> ipv4{d}) {
-            // fprintf(stdout, "ipv4_address_string:\t");  ipv4.value.print();
-            ipv4_addrs.insert(ipv4.value.get_value());
-            d = ipv4.advance();
 
-        } else if (lookahead<dns_string> dns{d}) {
-            // fprintf(stdout, "dns_string:\t");  dns.value.print();
-            dns_names.insert(dns.value.get_string());
-            d = dns.advance();
+        // check for a wildcard or leading dot, which can only precede
+        // a DNS name
+        //
+        uint32_t flags = 0;
+        if (d.length() > 2 && d.data[0] == '*' && d.data[1] == '.') {
+            flags = match_subdomains;
+            d.data += 2;
+        } else if (d.length() > 1 && d.data[0] == '.') {
+            flags = match_name | match_subdomains;
+            d.data += 1;
+        }
+
+        if (flags == 0) {
+            if (lookahead<ipv4_address_string> ipv4{d}) {
+                ipv4_input.push_back(ipv4.value.get_value());
+                return true;
+            }
+        }
+        if (lookahead<dns_string> dns{d}) {
+            std::string name = dns.value.get_string();
+            for (auto &c : name) {
+                c = to_lower(c);
+            }
+            dns_input.emplace_back(name, flags ? flags : (uint32_t)match_name);
+            return true;
+        }
+        if (flags == 0) {
+            if (lookahead<ipv6_address_string> ipv6{d}) {
+                ipv6_input.push_back(ipv6.value.get_value_array());
+                return true;
+            }
+        }
+        if (verbose) { printf_err(log_warning, "warning: invalid line in watchlist::process_line\n"); }
+        return false;
+    }
+
+    // process_final() compiles the entries read by process_line(),
+    // along with those already compiled, if any, into a new image;
+    // it must be called after the last call to process_line(), and
+    // before this watchlist is used
+    //
+    void process_final() {
 
-        } else if (lookahead<ipv6_address_string> ipv6{d}) {
-            // fprintf(stdout, "ipv6_address_string:\t");  ipv6.value.print();
-            ipv6_addrs.insert(ipv6.value.get_value_array());
-            d = ipv6.advance();
+        // retain entries from the current image
+        //
+        ipv4_input.insert(ipv4_input.end(), t.ipv4_addrs, t.ipv4_addrs + t.num_ipv4);
+        ipv6_input.insert(ipv6_input.end(), t.ipv6_addrs, t.ipv6_addrs + t.num_ipv6);
+        for (size_t i = 0; i < t.num_slots; i++) {
+            if (t.slots[i].flags != 0) {
+                dns_input.emplace_back(t.names + t.slots[i].name_offset, t.slots[i].flags);
+            }
+        }
 
-        } else {
-            if (verbose) { printf_err(log_warning, "warning: invalid line in watchlist::process_line\n"); }
+        std::sort(ipv4_input.begin(), ipv4_input.end());
+        ipv4_input.erase(std::unique(ipv4_input.begin(), ipv4_input.end()), ipv4_input.end());
+        std::sort(ipv6_input.begin(), ipv6_input.end());
+        ipv6_input.erase(std::unique(ipv6_input.begin(), ipv6_input.end()), ipv6_input.end());
+
+        // merge the flags of duplicate names
+        //
+        std::sort(dns_input.begin(), dns_input.end());
+        size_t num_names = 0;
+        for (size_t i = 0; i < dns_input.size(); i++) {
+            if (num_names > 0 && dns_input[num_names - 1].first == dns_input[i].first) {
+                dns_input[num_names - 1].second |= dns_input[i].second;
+            } else {
+                if (num_names != i) {
+                    dns_input[num_names] = std::move(dns_input[i]);
+                }
+                num_names++;
+            }
+        }
+        dns_input.resize(num_names);
+
+        size_t num_slots = 0;
+        size_t names_length = 0;
+        if (num_names > 0) {
+            num_slots = 1;
+            while (num_slots < 2 * num_names) {
+                num_slots *= 2;   // keep load factor at or below one half
+            }
+            for (const auto &n : dns_input) {
+                names_length += n.first.length() + 1;
+            }
+        }
+
+        size_t ipv4_offset = sizeof(header);
+        size_t ipv6_offset = ipv4_offset + ipv4_input.size() * sizeof(uint32_t);
+        size_t slots_offset = align8(ipv6_offset + ipv6_input.size() * sizeof(ipv6_array_t));
+        size_t names_offset = slots_offset + num_slots * sizeof(slot);
+        std::vector<uint8_t> tmp(names_offset + names_length, 0);
+
+        header h;
+        memcpy(h.magic, image_magic, sizeof(image_magic));
+        h.byte_order = byte_order_mark;
+        h.reserved = 0;
+        h.num_ipv4 = ipv4_input.size();
+        h.num_ipv6 = ipv6_input.size();
+        h.num_slots = num_slots;
+        h.names_length = names_length;
+        memcpy(tmp.data(), &h, sizeof(h));
+        if (!ipv4_input.empty()) {
+            memcpy(tmp.data() + ipv4_offset, ipv4_input.data(), ipv4_input.size() * sizeof(uint32_t));
+        }
+        if (!ipv6_input.empty()) {
+            memcpy(tmp.data() + ipv6_offset, ipv6_input.data(), ipv6_input.size() * sizeof(ipv6_array_t));
+        }
+        slot *slots = (slot *)(tmp.data() + slots_offset);
+        char *names = (char *)(tmp.data() + names_offset);
+        size_t name_offset = 0;
+        for (const auto &n : dns_input) {
+            memcpy(names + name_offset, n.first.c_str(), n.first.length() + 1);
+            uint64_t hash = hash_name(n.first);
+            size_t i = hash & (num_slots - 1);
+            while (slots[i].flags != 0) {
+                i = (i + 1) & (num_slots - 1);
+            }
+            slots[i] = { hash, (uint32_t)name_offset, n.second };
+            name_offset += n.first.length() + 1;
+        }
+
+        ipv4_input = {};
+        ipv6_input = {};
+        dns_input = {};
+        unmap();
+        image.swap(tmp);
+        parse_image(image.data(), image.size(), t);
+    }
+
+    // write(f) writes the compiled image of this watchlist to the
+    // file f, and returns true on success
+    //
+    bool write(FILE *f) const {
+        if (t.image == nullptr) {
             return false;
         }
-        return true;
+        return fwrite(t.image, 1, t.image_length, f) == t.image_length && fflush(f) == 0;
+    }
+
+    // map(filename) replaces the entries of this watchlist with those
+    // in the compiled image in the file filename, which is mapped
+    // into memory rather than read, and returns true on success
+    //
+    bool map(const char *filename) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            printf_err(log_err, "could not open watchlist file %s\n", filename);
+            return false;
+        }
+        bool result = map_fd(fd);
+        close(fd);
+        if (!result) {
+            printf_err(log_err, "file %s does not hold a valid compiled watchlist\n", filename);
+        }
+        return result;
     }
 
     void print() const {
-        for (const auto & dns : dns_names) {
-            fprintf(stdout, "%s\n", dns.c_str());
+        for (size_t i = 0; i < t.num_slots; i++) {
+            if (t.slots[i].flags == match_subdomains) {
+                fprintf(stdout, "*.");
+            } else if (t.slots[i].flags == (match_name | match_subdomains)) {
+                fputc('.', stdout);
+            }
+            if (t.slots[i].flags != 0) {
+                fprintf(stdout, "%s\n", t.names + t.slots[i].name_offset);
+            }
         }
-        for (const auto & ipv4 : ipv4_addrs) {
-            fprintf(stdout, "%u\n", ipv4);
+        for (size_t i = 0; i < t.num_ipv4; i++) {
+            fprintf(stdout, "%u\n", t.ipv4_addrs[i]);
         }
-        for (const auto & ipv6 : ipv6_addrs) {
+        for (size_t i = 0; i < t.num_ipv6; i++) {
+            const ipv6_array_t &ipv6 = t.ipv6_addrs[i];
             fprintf(stdout,
                     "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x\n",
                     ipv6[0], ipv6[1], ipv6[2], ipv6[3], ipv6[4], ipv6[5], ipv6[6], ipv6[7],
@@ -658,6 +1052,70 @@ public:
         }
     }
 
+    // unit_test() returns true if the name and address matching of
+    // this class works as expected, both for a compiled watchlist
+    // and for one mapped from a file, and false otherwise
+    //
+    static bool unit_test() {
+        std::string entries[] = {
+            "# comment",
+            "",
+            "dns.example.com",
+            "*.doh.example.net",
+            ".resolver.example.org",
+            "192.0.2.1",
+            "2001:db8::53",
+        };
+        watchlist w;
+        for (auto &e : entries) {
+            if (w.process_line(e) == false) {
+                return false;
+            }
+        }
+        w.process_final();
+
+        auto check = [](const watchlist &wl) {
+            const std::pair<const char *, bool> names[] = {
+                { "dns.example.com",          true  },
+                { "DNS.Example.COM.",         true  },
+                { "a.dns.example.com",        false },
+                { "example.com",              false },
+                { "doh.example.net",          false },
+                { "a.doh.example.net",        true  },
+                { "a.b.doh.example.net",      true  },
+                { "xdoh.example.net",         false },
+                { "resolver.example.org",     true  },
+                { "x.resolver.example.org",   true  },
+                { "",                         false },
+            };
+            for (const auto &n : names) {
+                if (wl.contains_dns_name(n.first) != n.second) {
+                    return false;
+                }
+            }
+            const uint8_t v4[] = { 192, 0, 2, 1 };
+            const uint8_t v6[] = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x53 };
+            return wl.contains_addr(4, v4)
+                && wl.contains_addr(6, v6)
+                && wl.contains_addr("192.0.2.1")
+                && !wl.contains_addr("192.0.2.2")
+                && wl.contains_addr("2001:db8::53")
+                && !wl.contains_addr("2001:db8::54");
+        };
+        if (!check(w)) {
+            return false;
+        }
+
+        FILE *f = tmpfile();
+        if (f == nullptr) {
+            return false;
+        }
+        watchlist mapped;
+        bool passed = w.write(f) && mapped.map_fd(fileno(f)) && check(mapped);
+        fclose(f);
+        return passed;
+    }
+
 };
 
 #endif // WATCHLIST_HPP
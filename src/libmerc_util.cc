@@ -1,13 +1,19 @@
 // libmerc_util.cc
 //
 // a wrapper around libmerc.so that processes pcap files and can be
-// used for testing and debugging that library
+// used for testing and debugging that library, and for load testing
+// it by replaying packet captures at a controlled rate
 //
 // compile as:
 //
 //   g++ -Wall -Wno-narrowing libmerc_util.cc pcap_file_io.c -pthread -ldl -std=c++17 -o libmerc_util
 
 
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cmath>
 #include "options.h"
 #include "libmerc_api.h"
 #include "pcap.h"
@@ -94,6 +100,8 @@ struct libmerc_printer : public libmerc_api {
             fprintf(f, "fingerprint_status: randomized\n");
         } else if (fp_status == fingerprint_status_unanalyzed) {
             fprintf(f, "fingerprint_status: unanalyzed\n");
+        } else if (fp_status == fingerprint_status_approximate) {
+            fprintf(f, "fingerprint_status: approximate\n");
         } else if (fp_status == fingerprint_status_no_info_available) {
             fprintf(f, "fingerprint_status: no info available\n");
         } else {
@@ -177,6 +185,8 @@ struct libmerc_printer : public libmerc_api {
                fp_status_string = "randomized";
             } else if (fp_status == fingerprint_status_unanalyzed) {
                 fp_status_string = "unanalyzed";
+            } else if (fp_status == fingerprint_status_approximate) {
+                fp_status_string = "approximate";
             } else if (fp_status == fingerprint_status_no_info_available) {
                 fp_status_string = "no info available";
             } else {
@@ -250,12 +260,424 @@ struct libmerc_printer : public libmerc_api {
     }
 };
 
+// class replay_trace holds all of the packets of a PCAP or PCAP-NG
+// file in memory, along with their timestamps, so that they can be
+// replayed without reading the file during the replay
+//
+class replay_trace {
+public:
+
+    struct packet {
+        size_t offset;           // offset of data in storage
+        uint32_t length;
+        uint16_t linktype;
+        uint64_t time;           // nanoseconds since first packet
+    };
+
+private:
+
+    std::vector<uint8_t> storage;
+    std::vector<packet> packets;
+    uint64_t duration = 0;
+
+    static uint64_t to_nsec(const struct timespec &ts) {
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    void add(const uint8_t *data, uint32_t length, uint16_t linktype, const struct timespec &ts) {
+        packets.push_back({ storage.size(), length, linktype, to_nsec(ts) });
+        storage.insert(storage.end(), data, data + length);
+    }
+
+public:
+
+    replay_trace(const char *filename) {
+        file_datum file{filename};
+        if (file.length() >= 4 && memcmp(file.data, "\x0a\x0d\x0d\x0a", 4) == 0) {
+            pcap::ng::block_index index{file};
+            pcap::ng::block_index::packet pkt;
+            for (size_t i = 0; i < index.size(); i++) {
+                if (index.decode(i, pkt)) {
+                    add(pkt.data, pkt.caplen, pkt.linktype, pkt.ts);
+                }
+            }
+        } else {
+            pcap::file_header header{file};
+            bool swap = header.byteswap_needed();
+            bool nsec = header.has_nanosecond_timestamps();
+            uint16_t linktype = header.get_linktype();
+            while (file.is_not_empty()) {
+                pcap::packet_record record{file, swap};
+                if (!record.is_valid()) {
+                    break;
+                }
+                datum d = record.get_packet();
+                add(d.data, d.length(), linktype, record.get_timestamp(nsec));
+            }
+        }
+        if (packets.empty()) {
+            return;
+        }
+
+        // make times relative to the first packet; a packet that is
+        // earlier than the one before it is given the same time as
+        // that one, so that the schedule never goes backwards
+        //
+        uint64_t start = packets[0].time;
+        uint64_t prev = 0;
+        for (auto &p : packets) {
+            p.time = p.time > start ? p.time - start : 0;
+            if (p.time < prev) {
+                p.time = prev;
+            }
+            prev = p.time;
+        }
+
+        // the duration of a pass over the trace includes the average
+        // gap between packets, so that consecutive passes do not
+        // overlap
+        //
+        duration = prev + (packets.size() > 1 ? prev / (packets.size() - 1) : 0);
+    }
+
+    const std::vector<packet> &get_packets() const { return packets; }
+
+    uint8_t *data(const packet &p) { return storage.data() + p.offset; }
+
+    uint64_t get_duration() const { return duration; }
+
+    size_t bytes() const { return storage.size(); }
+
+};
+
+// rewrite_addresses(frame, length, linktype, id) rewrites the IPv4
+// or IPv6 source and destination addresses of a packet by XORing
+// their last two bytes with id, so that each distinct id turns the
+// flows of a trace into a distinct set of flows.  The same rewrite is
+// applied to both addresses, so both directions of a flow are mapped
+// to the same new flow.  The IPv4 header checksum is recomputed;
+// TCP and UDP checksums are left as they are, since libmerc does
+// not check them.
+//
+static void rewrite_addresses(uint8_t *frame, size_t length, uint16_t linktype, uint16_t id) {
+    size_t offset;
+    uint16_t ethertype;
+    if (linktype == pcap::LINKTYPE::ETHERNET) {
+        offset = 12;
+        if (length < offset + 2) {
+            return;
+        }
+        ethertype = (frame[offset] << 8) | frame[offset + 1];
+        while ((ethertype == 0x8100 || ethertype == 0x88a8) && length >= offset + 6) {
+            offset += 4;
+            ethertype = (frame[offset] << 8) | frame[offset + 1];
+        }
+        offset += 2;
+    } else if (linktype == pcap::LINKTYPE::RAW || linktype == pcap::LINKTYPE::NULL_) {
+        offset = (linktype == pcap::LINKTYPE::NULL_) ? 4 : 0;
+        if (length <= offset) {
+            return;
+        }
+        ethertype = (frame[offset] >> 4) == 4 ? 0x0800 : 0x86dd;
+    } else {
+        return;
+    }
+
+    uint8_t hi = id >> 8;
+    uint8_t lo = id & 0xff;
+    uint8_t *ip = frame + offset;
+    if (ethertype == 0x0800 && length >= offset + 20 && (ip[0] >> 4) == 4) {
+        size_t header_length = (ip[0] & 0x0f) * 4;
+        if (header_length < 20 || length < offset + header_length) {
+            return;
+        }
+        ip[14] ^= hi; ip[15] ^= lo;       // source address
+        ip[18] ^= hi; ip[19] ^= lo;       // destination address
+        ip[10] = ip[11] = 0;
+        uint32_t sum = 0;
+        for (size_t i = 0; i < header_length; i += 2) {
+            sum += (ip[i] << 8) | ip[i + 1];
+        }
+        while (sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+        ip[10] = ~sum >> 8;
+        ip[11] = ~sum & 0xff;
+
+    } else if (ethertype == 0x86dd && length >= offset + 40 && (ip[0] >> 4) == 6) {
+        ip[22] ^= hi; ip[23] ^= lo;       // source address
+        ip[38] ^= hi; ip[39] ^= lo;       // destination address
+    }
+}
+
+// class latency_histogram counts nanosecond durations in buckets
+// whose width is one eighth of the power of two below them, so that
+// percentiles are accurate to within 12.5% over the whole range
+//
+class latency_histogram {
+    static constexpr size_t sub_buckets = 8;
+    uint64_t counts[64 * sub_buckets] = { 0, };
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    static size_t bucket(uint64_t x) {
+        if (x < sub_buckets) {
+            return x;
+        }
+        size_t msb = 63 - __builtin_clzll(x);
+        return msb * sub_buckets + ((x >> (msb - 3)) & (sub_buckets - 1));
+    }
+
+    // upper_bound(b) returns the largest value in bucket b
+    //
+    static uint64_t upper_bound(size_t b) {
+        if (b < sub_buckets) {
+            return b;
+        }
+        size_t msb = b / sub_buckets;
+        uint64_t low = ((uint64_t)(sub_buckets + b % sub_buckets)) << (msb - 3);
+        return low + ((uint64_t)1 << (msb - 3)) - 1;
+    }
+
+public:
+
+    void add(uint64_t x) {
+        counts[bucket(x)]++;
+        total++;
+        if (x > max) {
+            max = x;
+        }
+    }
+
+    void merge(const latency_histogram &h) {
+        for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+            counts[i] += h.counts[i];
+        }
+        total += h.total;
+        if (h.max > max) {
+            max = h.max;
+        }
+    }
+
+    // percentile(q) returns an upper bound on the value below which
+    // a fraction q of the durations fall
+    //
+    uint64_t percentile(double q) const {
+        uint64_t rank = (uint64_t)ceil(q * total);
+        uint64_t count = 0;
+        for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+            count += counts[i];
+            if (count >= rank && count > 0) {
+                return std::min(upper_bound(i), max);
+            }
+        }
+        return max;
+    }
+
+    void write_json(json_object &o, const char *name) const {
+        json_object h{o, name};
+        h.print_key_uint("p50", percentile(0.50));
+        h.print_key_uint("p90", percentile(0.90));
+        h.print_key_uint("p99", percentile(0.99));
+        h.print_key_uint("p99.9", percentile(0.999));
+        h.print_key_uint("max", max);
+        h.close();
+    }
+
+};
+
+// class replay_driver replays a trace through a number of libmerc
+// packet processors, each in its own thread.  Each thread replays
+// the whole trace passes times, and the addresses of its packets are
+// rewritten so that each pass of each thread has its own flows
+// (pass 0 of thread 0 is not rewritten).
+//
+// If speed is positive, packets are replayed with the gaps between
+// their timestamps divided by speed, starting at the same time in all
+// threads; a packet that a thread gets to more than max_lag
+// nanoseconds after its scheduled time is counted as dropped and is
+// not processed, which models a capture buffer that overflows when
+// the processor cannot keep up.  If speed is zero, packets are
+// replayed as fast as possible, and none are dropped.
+//
+// For each packet that is processed, the processing latency (the
+// time spent in the libmerc call) and the schedule lag (the time
+// between when the packet was scheduled and when it was processed)
+// are counted in histograms.
+//
+class replay_driver {
+    libmerc_api &merc;
+    mercury_context mc;
+    replay_trace &trace;
+    size_t num_threads;
+    size_t passes;
+    double speed;
+    uint64_t max_lag;
+
+    struct thread_stats {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        uint64_t dropped = 0;
+        uint64_t results = 0;
+        latency_histogram latency;
+        latency_histogram lag;
+    };
+    std::vector<thread_stats> stats;
+    uint64_t elapsed = 0;
+
+    static uint64_t now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // wait_until(t) returns at monotonic time t, sleeping while t is
+    // far enough away and spinning for the rest, since a sleeping
+    // thread can wake up late by much more than the gaps between
+    // packets
+    //
+    static uint64_t wait_until(uint64_t t) {
+        constexpr uint64_t spin_time = 1000000;
+        uint64_t current = now();
+        if (current + 2 * spin_time < t) {
+            uint64_t sleep_until = t - spin_time;
+            struct timespec ts{ (time_t)(sleep_until / 1000000000), (long)(sleep_until % 1000000000) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+            current = now();
+        }
+        while (current < t) {
+            current = now();
+        }
+        return current;
+    }
+
+    void run_thread(size_t index, uint64_t start) {
+        thread_stats &s = stats[index];
+        mercury_packet_processor mpp = merc.packet_processor_construct(mc);
+        if (mpp == nullptr) {
+            fprintf(stderr, "error in mercury_packet_processor_construct()\n");
+            return;
+        }
+        std::vector<uint8_t> buffer(65536);
+        for (size_t pass = 0; pass < passes; pass++) {
+            uint16_t id = pass * num_threads + index;
+            for (const auto &p : trace.get_packets()) {
+                uint8_t *data = trace.data(p);
+                size_t length = std::min((size_t)p.length, buffer.size());
+                if (id != 0) {
+                    memcpy(buffer.data(), data, length);
+                    rewrite_addresses(buffer.data(), length, p.linktype, id);
+                    data = buffer.data();
+                }
+
+                uint64_t offset = pass * trace.get_duration() + p.time;
+                struct timespec ts{ (time_t)(offset / 1000000000), (long)(offset % 1000000000) };
+                uint64_t begin;
+                if (speed > 0) {
+                    uint64_t scheduled = start + (uint64_t)(offset / speed);
+                    begin = wait_until(scheduled);
+                    if (begin - scheduled > max_lag) {
+                        s.dropped++;
+                        continue;
+                    }
+                    s.lag.add(begin - scheduled);
+                } else {
+                    begin = now();
+                }
+                if (merc.get_analysis_context_linktype(mpp, data, length, &ts, p.linktype)) {
+                    s.results++;
+                }
+                s.latency.add(now() - begin);
+                s.packets++;
+                s.bytes += length;
+            }
+        }
+        merc.packet_processor_destruct(mpp);
+    }
+
+public:
+
+    replay_driver(libmerc_api &api, mercury_context ctx, replay_trace &t, size_t threads, size_t num_passes, double replay_speed, uint64_t max_lag_nsec) :
+        merc{api},
+        mc{ctx},
+        trace{t},
+        num_threads{threads},
+        passes{num_passes},
+        speed{replay_speed},
+        max_lag{max_lag_nsec},
+        stats(threads)
+    { }
+
+    void run() {
+        constexpr uint64_t startup_delay = 10000000;  // time for threads to start
+        uint64_t start = now() + startup_delay;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < num_threads; i++) {
+            threads.emplace_back(&replay_driver::run_thread, this, i, start);
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        uint64_t end = now();
+        elapsed = end > start ? end - start : 1;
+    }
+
+    // write_json(f) writes out a summary of the replay as a single
+    // line of JSON; the sustainable rate has been reached if no
+    // packets were dropped
+    //
+    void write_json(FILE *f) const {
+        thread_stats total;
+        for (const auto &s : stats) {
+            total.packets += s.packets;
+            total.bytes += s.bytes;
+            total.dropped += s.dropped;
+            total.results += s.results;
+            total.latency.merge(s.latency);
+            total.lag.merge(s.lag);
+        }
+        double seconds = elapsed / 1e9;
+        double offered = (double)trace.get_packets().size() * num_threads * passes;
+
+        char buffer[4096];
+        buffer_stream buf{buffer, sizeof(buffer)};
+        json_object json{&buf};
+        json.print_key_uint("threads", num_threads);
+        json.print_key_uint("passes", passes);
+        if (speed > 0) {
+            json.print_key_float("speed", speed);
+        } else {
+            json.print_key_string("speed", "max");
+        }
+        json.print_key_uint("packets_offered", (uint64_t)offered);
+        json.print_key_uint("packets_processed", total.packets);
+        json.print_key_uint("packets_dropped", total.dropped);
+        json.print_key_uint("analysis_results", total.results);
+        json.print_key_bool("drop_free", total.dropped == 0);
+        json.print_key_float("seconds", seconds);
+        json.print_key_float("packets_per_second", total.packets / seconds);
+        json.print_key_float("bits_per_second", total.bytes * 8.0 / seconds);
+        total.latency.write_json(json, "latency_nsec");
+        if (speed > 0) {
+            total.lag.write_json(json, "schedule_lag_nsec");
+        }
+        json.close();
+        buf.write_line(f);
+    }
+
+};
+
 int main(int argc, char *argv[]) {
 
     const char summary[] =
         "usage:\n"
         "   libmerc_util --read <pcap file> --libmerc <shared object file> [OPTIONS]\n"
         "\n"
+        "   With --replay, the packets are loaded into memory and replayed with their\n"
+        "   original gaps divided by <arg>, or as fast as possible, through --threads\n"
+        "   packet processors, and a JSON summary with the rates, drops, and latency\n"
+        "   percentiles is written instead of the analysis of each packet.\n"
+        "\n"
         "OPTIONS\n";
 
     class option_processor opt({
@@ -263,6 +685,10 @@ int main(int argc, char *argv[]) {
         { argument::required,   "--libmerc",   "use libmerc.so file <arg>" },
         { argument::required,   "--resources", "use resource file <arg>" },
         { argument::none,       "--stats",     "generate stats.json.gz file" },
+        { argument::required,   "--replay",    "replay packets at <arg> times their original rate, or \"max\"" },
+        { argument::required,   "--threads",   "replay with <arg> packet processors" },
+        { argument::required,   "--loop",      "replay packets <arg> times, with rewritten addresses" },
+        { argument::required,   "--max-lag",   "count packets more than <arg> usec late as dropped" },
         { argument::none,       "--verbose",   "turn on verbose output" },
         { argument::none,       "--help",      "print out help message" }
     });
@@ -274,6 +700,10 @@ int main(int argc, char *argv[]) {
     auto [ pcap_is_set, pcap_file ] = opt.get_value("--read");
     auto [ libmerc_is_set, libmerc_file ] = opt.get_value("--libmerc");
     auto [ resources_is_set, resources_file ] = opt.get_value("--resources");
+    auto [ replay_is_set, replay_speed ] = opt.get_value("--replay");
+    auto [ threads_is_set, threads_str ] = opt.get_value("--threads");
+    auto [ loop_is_set, loop_str ] = opt.get_value("--loop");
+    auto [ max_lag_is_set, max_lag_str ] = opt.get_value("--max-lag");
     bool verbose = opt.is_set("--verbose");
     bool do_stats = opt.is_set("--stats");
     bool print_help = opt.is_set("--help");
@@ -294,6 +724,26 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    double speed = 0.0;
+    if (replay_is_set && replay_speed != "max") {
+        speed = strtod(replay_speed.c_str(), nullptr);
+        if (!(speed > 0.0)) {
+            fprintf(stderr, "error: --replay requires a positive number or \"max\"\n");
+            return EXIT_FAILURE;
+        }
+    }
+    size_t num_threads = threads_is_set ? strtoul(threads_str.c_str(), nullptr, 10) : 1;
+    size_t passes = loop_is_set ? strtoul(loop_str.c_str(), nullptr, 10) : 1;
+    uint64_t max_lag_usec = max_lag_is_set ? strtoull(max_lag_str.c_str(), nullptr, 10) : 10000;
+    if (num_threads == 0 || passes == 0 || num_threads * passes > 65536) {
+        fprintf(stderr, "error: --threads and --loop must be positive, and their product at most 65536\n");
+        return EXIT_FAILURE;
+    }
+    if ((threads_is_set || loop_is_set || max_lag_is_set) && !replay_is_set) {
+        fprintf(stderr, "error: --threads, --loop, and --max-lag require --replay\n");
+        return EXIT_FAILURE;
+    }
+
     char *resources_path = (char *)"../resources/resources.tgz";
     if (resources_is_set) {
         resources_path = (char *)resources_file.c_str();
@@ -311,6 +761,9 @@ int main(int argc, char *argv[]) {
         config.resources = resources_path;
         config.do_analysis = true;
         config.do_stats = do_stats;
+        if (replay_is_set) {
+            config.packet_filter_cfg = (char *)"select=all;eager-resources;";  // keep resource loading out of the timed replay
+        }
 
         // initalize mercury library
         //
@@ -319,6 +772,21 @@ int main(int argc, char *argv[]) {
             throw std::runtime_error("mercury_init() returned null");
         }
 
+        if (replay_is_set) {
+            replay_trace trace{pcap_file.c_str()};
+            if (verbose) {
+                fprintf(stderr, "loaded %zu packets (%zu bytes) from %s\n", trace.get_packets().size(), trace.bytes(), pcap_file.c_str());
+            }
+            replay_driver replay{mercury, mc, trace, num_threads, passes, speed, max_lag_usec * 1000};
+            replay.run();
+            replay.write_json(stdout);
+            if (do_stats) {
+                mercury.write_stats_data(mc, "stats.json.gz");
+            }
+            mercury.finalize(mc);
+            return 0;
+        }
+
         // create mercury packet processor
         //
         mercury_packet_processor mpp = mercury.packet_processor_construct(mc);
@@ -53,8 +53,17 @@ char mercury_help[] =
     "   --nonselected-tcp-data                # tcp data for nonselected traffic\n"
     "   --nonselected-udp-data                # udp data for nonselected traffic\n"
     "   --tcp-reassembly                      # reassemble tcp data segments\n"
+    "   --os-identification                   # report operating system of each host\n"
+    "   --approximate-matching                # analyze fingerprints close to known ones\n"
+    "   --eager-resources                     # load analysis resources at startup\n"
+    "   --tls-sessions                        # report client hello with tls server\n"
+    "   --flow-records                        # report a summary of each flow\n"
+    "   --decapsulate[=d]                     # strip up to d layers of tunnels\n"
     "   [-l or --limit] l                     # rotate output file after l records\n"
     "   --output-time=T                       # rotate output file after T seconds\n"
+    "   --output-size=S                       # rotate output file after S bytes\n"
+    "   --pcapng                              # write packets in PCAP-NG format\n"
+    "   --capture-flows=N                     # write only packets of interesting flows\n"
     "   --dns-json                            # output DNS as JSON, not base64\n"
     "   --certs-json                          # output certs as JSON, not base64\n"
     "   --metadata                            # output more protocol metadata in JSON\n"
@@ -84,7 +93,10 @@ char mercury_extended_help[] =
     "   option [-s or --select], packets are filtered so that only ones with\n"
     "   fingerprint metadata are written.\n"
     "\n"
-    "   \"[r or --read] r\" reads packets from the file r, in PCAP format.\n"
+    "   \"[r or --read] r\" reads packets from the file r, in PCAP or PCAP-NG format.\n"
+    "   When r is a PCAP-NG file, \"[-t or --thread] t\" processes its packets with t\n"
+    "   worker threads, each of which handles all of the packets of a subset of the\n"
+    "   flows.\n"
     "\n"
     "   if neither -r nor -c is specified, then packets are read from standard input,\n"
     "   in PCAP format.\n"
@@ -143,6 +155,11 @@ char mercury_extended_help[] =
     "   This option allows mercury to keep track of tcp segment state and \n"
     "   and reassemble these segments based on the application in tcp payload\n"
     "\n"
+    "   --os-identification accumulates the TCP, TLS, and HTTP fingerprints\n"
+    "   observed from each source address, and writes an \"os_identification\"\n"
+    "   record that reports its most likely operating system, once that verdict\n"
+    "   is stable.  The resource file must contain an OS identification model.\n"
+    "\n"
     "   \"[-u or --user] u\" sets the UID and GID to those of user u, so that\n"
     "   output file(s) are owned by this user.  If this option is not set, then\n"
     "   the UID is set to SUDO_UID, so that privileges are dropped to those of\n"
@@ -160,12 +177,52 @@ char mercury_extended_help[] =
     "   object in the JSON records.   This option only works with the option\n"
     "   [-f or --fingerprint].\n"
     "\n"
+    "   --approximate-matching, with [-a or --analysis], analyzes a fingerprint that\n"
+    "   is not in the resource file with the data of the closest one that is, if\n"
+    "   they differ in at most one tenth of their elements; the analysis object\n"
+    "   then has the status \"approximate_fingerprint\".\n"
+    "\n"
+    "   By default, with [-a or --analysis], the resource file is read in the\n"
+    "   background, and only if a protocol that is analyzed (tls, http, or quic)\n"
+    "   is selected; otherwise, it is read when it is first needed.\n"
+    "   --eager-resources reads it completely before any packets are processed.\n"
+    "\n"
+    "   --tls-sessions reports, in each TLS server hello and certificate record,\n"
+    "   the fingerprint and server name of the client hello of the same session\n"
+    "   in a \"tls_session\" object, so that the client and server records do not\n"
+    "   need to be joined afterwards.\n"
+    "\n"
+    "   --flow-records reports a \"flow\" record for each flow when it ends, with\n"
+    "   the packet and byte counts, the union of the TCP flags, and the start and\n"
+    "   end times of each direction, along with the fingerprints and analysis of\n"
+    "   that flow.  A flow ends after 60 seconds without packets, shortly after a\n"
+    "   TCP RST or a FIN in each direction, or when mercury exits; flows that last\n"
+    "   longer than 30 minutes are reported in 30 minute intervals.\n"
+    "\n"
+    "   \"--decapsulate[=d]\" strips the headers of VXLAN, Geneve, GRE, GTP-U, and\n"
+    "   IP-in-IP tunnels, up to d layers deep (default: 2, maximum: 8), and processes\n"
+    "   the innermost packet.  Records report the innermost flow key, and the type\n"
+    "   and identifier (VNI, GRE key, or TEID) of each tunnel in a \"tunnels\" array.\n"
+    "   Without this option, only GRE is stripped, and only if it is selected.\n"
+    "\n"
     "   \"--format=f\" reports fingerprints with formats(s) f, where f is either a\n"
     "   fingerprint protocol and format like \"tls/1\", or is a sequence of protocol\n"
     "   and format strings.\n"
     "\n"
     "   \"[-l or --limit] l\" rotates output files so that each file has at most\n"
     "   l records or packets; filenames include a sequence number, date and time.\n"
+    "   \"--output-time=T\" and \"--output-size=S\" rotate output files every T\n"
+    "   seconds, or when a file reaches S bytes, respectively.\n"
+    "\n"
+    "   --pcapng, with [-w or --write], writes packets in PCAP-NG format, with\n"
+    "   microsecond timestamps, instead of PCAP format.\n"
+    "\n"
+    "   \"--capture-flows=N\", with [-w or --write] and [-a or --analysis], writes\n"
+    "   only the packets of flows that have an unknown fingerprint, a malware\n"
+    "   verdict, or an attribute such as a watchlist hit, in PCAP-NG format.  The\n"
+    "   first N packets of each flow are held until the flow is found to be\n"
+    "   interesting, and all of its later packets are written; the packets of\n"
+    "   other flows are discarded.\n"
     "\n"
     "   --dns-json writes out DNS responses as a JSON object; otherwise,\n"
     "   that data is output in base64 format, as a string with the key \"base64\".\n"
@@ -234,7 +291,7 @@ int main(int argc, char *argv[]) {
     std::string additional_args;
 
     while(1) {
-        enum opt { config=1, version=2, license=3, dns_json=4, certs_json=5, metadata=6, resources=7, tcp_init_data=8, udp_init_data=9, write_stats=10, stats_limit=11, stats_time=12, output_time=13, tcp_reassembly=14, format=15 };
+        enum opt { config=1, version=2, license=3, dns_json=4, certs_json=5, metadata=6, resources=7, tcp_init_data=8, udp_init_data=9, write_stats=10, stats_limit=11, stats_time=12, output_time=13, tcp_reassembly=14, format=15, os_identification=16, approximate_matching=17, eager_resources=18, output_size=19, pcapng=20, capture_flows=21, tls_sessions=22, flow_records=23, decapsulate=24 };
         int opt_idx = 0;
         static struct option long_opts[] = {
             { "config",      required_argument, NULL, config  },
@@ -250,7 +307,16 @@ int main(int argc, char *argv[]) {
             { "stats-limit", required_argument, NULL, stats_limit },
             { "stats-time",  required_argument, NULL, stats_time },
             { "output-time", required_argument, NULL, output_time },
+            { "output-size", required_argument, NULL, output_size },
+            { "pcapng",      no_argument,       NULL, pcapng },
+            { "capture-flows", required_argument, NULL, capture_flows },
             { "tcp-reassembly", no_argument,    NULL, tcp_reassembly },
+            { "os-identification", no_argument, NULL, os_identification },
+            { "approximate-matching", no_argument, NULL, approximate_matching },
+            { "eager-resources", no_argument, NULL, eager_resources },
+            { "tls-sessions", no_argument,      NULL, tls_sessions },
+            { "flow-records", no_argument,      NULL, flow_records },
+            { "decapsulate",  optional_argument, NULL, decapsulate },
             { "format",      required_argument, NULL, format },
             { "read",        required_argument, NULL, 'r' },
             { "write",       required_argument, NULL, 'w' },
@@ -346,6 +412,48 @@ int main(int argc, char *argv[]) {
                 additional_args.append("tcp-reassembly;");
             }
             break;
+        case os_identification:
+            if (optarg) {
+                usage(argv[0], "option os-identification does not use an argument", extended_help_off);
+            } else {
+                additional_args.append("os-identification;");
+            }
+            break;
+        case approximate_matching:
+            if (optarg) {
+                usage(argv[0], "option approximate-matching does not use an argument", extended_help_off);
+            } else {
+                additional_args.append("approximate-matching;");
+            }
+            break;
+        case eager_resources:
+            if (optarg) {
+                usage(argv[0], "option eager-resources does not use an argument", extended_help_off);
+            } else {
+                additional_args.append("eager-resources;");
+            }
+            break;
+        case tls_sessions:
+            if (optarg) {
+                usage(argv[0], "option tls-sessions does not use an argument", extended_help_off);
+            } else {
+                additional_args.append("tls-sessions;");
+            }
+            break;
+        case flow_records:
+            if (optarg) {
+                usage(argv[0], "option flow-records does not use an argument", extended_help_off);
+            } else {
+                additional_args.append("flow-records;");
+            }
+            break;
+        case decapsulate:
+            if (optarg) {
+                additional_args.append("decapsulate=").append(optarg).append(";");
+            } else {
+                additional_args.append("decapsulate;");
+            }
+            break;
         case format:
             if (option_is_valid(optarg)) {
                 additional_args.append("format=").append(optarg).append(";");
@@ -513,6 +621,35 @@ int main(int argc, char *argv[]) {
                 usage(argv[0], "option output-time requires a numeric argument", extended_help_off);
             }
             break;
+        case output_size:
+            if (option_is_valid(optarg)) {
+                errno = 0;
+                cfg.out_rotation_size = strtoull(optarg, NULL, 10);
+                if (errno) {
+                    printf("%s: could not convert argument \"%s\" to a number\n", strerror(errno), optarg);
+                }
+            } else {
+                usage(argv[0], "option output-size requires a numeric argument", extended_help_off);
+            }
+            break;
+        case pcapng:
+            if (optarg) {
+                usage(argv[0], "option pcapng does not use an argument", extended_help_off);
+            } else {
+                cfg.write_pcapng = true;
+            }
+            break;
+        case capture_flows:
+            if (option_is_valid(optarg)) {
+                errno = 0;
+                cfg.capture_flows = strtoul(optarg, NULL, 10);
+                if (errno || cfg.capture_flows == 0) {
+                    usage(argv[0], "option capture-flows requires a positive number of packets", extended_help_off);
+                }
+            } else {
+                usage(argv[0], "option capture-flows requires a numeric argument", extended_help_off);
+            }
+            break;
         case 'p':
             if (option_is_valid(optarg)) {
                 errno = 0;
@@ -591,6 +728,12 @@ int main(int argc, char *argv[]) {
     if (cfg.stats_filename != NULL && !libmerc_cfg.do_analysis) {
         usage(argv[0], "stats option requires --analysis", extended_help_off);
     }
+    if (cfg.capture_flows) {
+        if (cfg.write_filename == NULL || !libmerc_cfg.do_analysis) {
+            usage(argv[0], "option capture-flows requires [-w or --write] and --analysis", extended_help_off);
+        }
+        cfg.write_pcapng = true;
+    }
 
     if (cfg.read_filename) {
         cfg.output_block = true;      // use blocking output, so that no packets are lost in copying
@@ -61,10 +61,13 @@ struct mercury_config {
     int adaptive;                   /* adaptively accept/skip packets for PCAP output */
     bool output_block;              /* use blocking output                            */
     size_t stats_rotation_duration; /* number of seconds between stats file rotation  */
-    size_t out_rotation_duration;   /* number of seconds between json file rotation  */}
-;
+    size_t out_rotation_duration;   /* number of seconds between json file rotation  */
+    uint64_t out_rotation_size;     /* number of bytes per output file rotation, or 0 */
+    bool write_pcapng;              /* write packets in PCAP-NG format                */
+    size_t capture_flows;           /* packets buffered per flow for flow capture, or 0 */
+};
 
-#define mercury_config_init() { NULL, NULL, NULL, NULL, NULL, NULL, O_EXCL, (char *)"w", 0, 8, 1, 0, NULL, 1, 0, 0, 0, false, 300, 0 }
+#define mercury_config_init() { NULL, NULL, NULL, NULL, NULL, NULL, O_EXCL, (char *)"w", 0, 8, 1, 0, NULL, 1, 0, 0, 0, false, 300, 0, 0, false, 0 }
 
 
 #endif /* MERCURY_H */
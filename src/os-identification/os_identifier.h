@@ -6,69 +6,21 @@
 #include <fstream>
 #include <math.h>
 #include <zlib.h>
+#include <cinttypes>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include "datum.h"
-
-#include "rapidjson/document.h"
-#include "rapidjson/stringbuffer.h"
-#include "rapidjson/istreamwrapper.h"
-#include "rapidjson/ostreamwrapper.h"
-
-
-rapidjson::Document tcp_os_fp_db;
-rapidjson::Document tls_os_fp_db;
-rapidjson::Document http_os_fp_db;
-
-#ifndef DEFAULT_RESOURCE_DIR
-#define DEFAULT_RESOURCE_DIR "/usr/local/share/mercury"
-#endif
-
-
-int gzgetline(gzFile f, std::vector<char>& v) {
-    v = std::vector<char>(256);
-    unsigned pos = 0;
-    for (;;) {
-        if (gzgets(f, &v[pos], v.size()-pos) == 0) {
-            // EOF
-            return 0;
-        }
-        unsigned read = strlen(&v[pos]);
-        if (v[pos+read-1] == '\n') {
-            pos = pos + read - 1;
-            break;
-        }
-        pos = v.size() - 1;
-        v.resize(v.size() * 2);
-    }
-    v.resize(pos);
-    return 1;
-}
-
-
-int database_init(const char *resource_file, rapidjson::Document &fp_db) {
-    fp_db.SetObject();
-    rapidjson::Document::AllocatorType& allocator = fp_db.GetAllocator();
-
-    gzFile in_file = gzopen(resource_file, "r");
-    if (in_file == NULL) {
-        return -1;
-    }
-    std::vector<char> line;
-    while (gzgetline(in_file, line)) {
-        std::string line_str(line.begin(), line.end());
-        rapidjson::Document fp(&allocator);
-        fp.Parse(line_str.c_str());
-
-        fp_db.AddMember(fp["str_repr"], fp, allocator);
-    }
-    gzclose(in_file);
-
-    return 0;  /* success */
-}
+#include "os_identification.hpp"
 
 
 struct mercury_record {
@@ -129,6 +81,23 @@ struct mercury_record {
 
     bool is_valid() { return valid; }
 
+    std::string_view get_fp_type() const { return { (const char *)fp_type.data, (size_t)fp_type.length() }; }
+
+    std::string_view get_fingerprint() const { return { (const char *)fingerprint.data, (size_t)fingerprint.length() }; }
+
+    std::string_view get_src_ip() const { return { (const char *)src_ip.data, (size_t)src_ip.length() }; }
+
+    // get_event_start() returns the event_start timestamp in seconds,
+    // or zero if it could not be parsed
+    //
+    double get_event_start() const {
+        char tmp[32];
+        size_t len = std::min(sizeof(tmp) - 1, (size_t)event_start.length());
+        memcpy(tmp, event_start.data, len);
+        tmp[len] = '\0';
+        return strtod(tmp, nullptr);
+    }
+
     void write_json(FILE *output) {
         if (valid) {
             fprintf(output, "{\"fp_type\":\"%.*s\"", (int)fp_type.length(), fp_type.data);
@@ -143,235 +112,207 @@ struct mercury_record {
 };
 
 
-struct os_result {
-    std::string os_name;
-    double probability;
-};
 
-struct os_classifier {
-    double *coefficients;
-    double *intercepts;
-    std::string *labels;
-    int os_len;
-    int label_len;
-    std::unordered_map<std::string, int> os_map;
+// class os_identification_pipeline ingests mercury JSON records on
+// the calling thread, and shards them by source address across a set
+// of worker threads, each of which owns an os_host_table.  Because
+// every record for a given host goes to the same worker, no locking
+// is needed on the host data.  Records are handed to the workers in
+// batches, to amortize the cost of synchronization.
+//
+// If window is nonzero, each worker classifies its hosts every window
+// seconds (as measured by the event_start timestamps of the records),
+// and emits the verdicts of the hosts that have stabilized, so that
+// results are available while a continuous feed is still being read.
+//
+class os_identification_pipeline {
+
+    struct observation {
+        std::string src_ip;
+        std::string fingerprint;
+        double timestamp;
+        os_fp_type type;
+    };
 
-    os_classifier() = default;
+    struct worker {
+        std::mutex m;
+        std::condition_variable cv;
+        std::vector<std::vector<observation>> pending;   // batches waiting to be processed
+        std::vector<observation> batch;                  // batch being filled by the reader
+        bool done = false;
+        std::thread thread;
+    };
 
-    os_classifier(const char *os_classifier_file) {
-        rapidjson::Document clf_params;
+    const os_model &model;
+    double window;
+    size_t max_hosts_per_worker;
+    std::vector<std::unique_ptr<worker>> workers;
 
-        /* read OS classifiers parameters in rapidjson object */
-        std::ifstream ifs {os_classifier_file};
-        if (!ifs.is_open()) {
-            std::cerr << "Could not open file for reading!\n";
-            return ;
-        }
-        rapidjson::IStreamWrapper isw{ifs};
-        clf_params.ParseStream(isw);
+    std::mutex output_mutex;
+    FILE *output;
 
-        os_len = clf_params["os_len"].GetInt();
+    static constexpr size_t batch_size = 1024;
+    static constexpr size_t max_pending_batches = 64;
 
-        /* read in labels */
-        const rapidjson::Value& lbls = clf_params["labels"];
-        label_len = lbls.Size();
-        labels = new std::string[label_len];
-        for (rapidjson::SizeType i = 0; i < lbls.Size(); i++) {
-            labels[i] = lbls[i].GetString();
-        }
+public:
 
-        /* read in intercepts */
-        intercepts = new double[label_len];
-        const rapidjson::Value& intc = clf_params["intercepts"];
-        for (rapidjson::SizeType i = 0; i < intc.Size(); i++) {
-            intercepts[i] = intc[i].GetDouble();
+    os_identification_pipeline(const os_model &m, size_t num_workers, double window_seconds=0.0, size_t max_hosts=0, FILE *out=stdout) :
+        model{m},
+        window{window_seconds},
+        max_hosts_per_worker{0},
+        output{out}
+    {
+        if (num_workers == 0) {
+            num_workers = 1;
         }
-
-        /* read in coefficients */
-        coefficients = new double[label_len*os_len*3];
-        const rapidjson::Value& cff = clf_params["coefficients"];
-        for (rapidjson::SizeType i = 0; i < cff.Size(); i++) {
-            const rapidjson::Value& cff_inner = cff[i];
-            for (rapidjson::SizeType j = 0; j < cff_inner.Size(); j++) {
-                coefficients[i*os_len*3+j] = cff_inner[j].GetDouble();
-            }
+        if (max_hosts != 0) {
+            max_hosts_per_worker = std::max((size_t)1, max_hosts / num_workers);
         }
-
-        /* read in os_map */
-        const rapidjson::Value& os_m = clf_params["os_map"];
-        for (rapidjson::Value::ConstMemberIterator iter = os_m.MemberBegin(); iter != os_m.MemberEnd(); ++iter){
-            os_map[iter->name.GetString()] = iter->value.GetInt();
+        for (size_t i = 0; i < num_workers; i++) {
+            workers.emplace_back(std::make_unique<worker>());
+            workers.back()->batch.reserve(batch_size);
         }
-    };
-
-    void classify(double *features, struct os_result *r) {
-        double *scores = new double[label_len];
-        double score_sum = 0.0;
-        for (int i = 0; i < label_len; i++) {
-            scores[i] = intercepts[i];
-            for (int j = 0; j < os_len*3; j++) {
-                scores[i] += coefficients[i*os_len*3+j]*features[j];
-            }
-            score_sum += exp(scores[i]);
+        for (auto &w : workers) {
+            w->thread = std::thread{[this, wp = w.get()]() { run(*wp); }};
         }
-
-        double prob = 0.0;
-        double tmp_prob;
-        int label_idx = 0;
-        for (int i = 0; i < label_len; i++) {
-            tmp_prob = exp(scores[i])/score_sum;
-            if (tmp_prob > prob) {
-                prob = tmp_prob;
-                label_idx = i;
-            }
-        }
-
-        r->os_name = labels[label_idx];
-        r->probability = prob;
-
-        delete[] scores;
     }
 
-} os_clf;
-
-
-int os_analysis_init(const char *resource_dir) {
-    const char *resource_dir_list[] =
-      {
-       DEFAULT_RESOURCE_DIR,
-       "resources",
-       "../resources",
-       NULL
-      };
-    if (resource_dir) {
-        resource_dir_list[0] = resource_dir;  // use directory from configuration
-        resource_dir_list[1] = NULL;          // fail otherwise
+    ~os_identification_pipeline() {
+        finish();
     }
 
-    char resource_file_name[PATH_MAX];
-
-    unsigned int index = 0;
-    while (resource_dir_list[index] != NULL) {
-        strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
-        strncat(resource_file_name, "/fingerprint-db-tcp-os.json.gz", PATH_MAX-1);
-        int retcode = database_init(resource_file_name, tcp_os_fp_db);
-
-        strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
-        strncat(resource_file_name, "/fingerprint-db-tls-os.json.gz", PATH_MAX-1);
-        retcode = database_init(resource_file_name, tls_os_fp_db);
-
-        strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
-        strncat(resource_file_name, "/fingerprint-db-http-os.json.gz", PATH_MAX-1);
-        retcode = database_init(resource_file_name, http_os_fp_db);
-
-        strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
-        strncat(resource_file_name, "/os_detection_model.json", PATH_MAX-1);
-        os_clf = os_classifier(resource_file_name);
-
-        if (retcode == 0) {
-            return 0;
+    // process_line(line) parses a mercury JSON record and dispatches
+    // it to the worker that owns its source address
+    //
+    void process_line(const std::string &line, bool verbose=false) {
+        const unsigned char *buf = (const unsigned char*)line.data();
+        struct datum d{buf, buf + line.length()};
+        struct mercury_record r{d};
+        if (!r.is_valid()) {
+            if (verbose) {
+                fprintf(stderr, "warning: mercury record is invalid or incomplete (%s)\n", line.c_str());
+            }
+            return;
         }
-        index++;  /* try next directory in the list */
-    }
-    fprintf(stderr, "warning: could not initialize OS analysis module\n");
-    return -1;
-}
-
-
-void update_features(double **features, const char *fp_type, const char *str_repr) {
-    rapidjson::Value::ConstMemberIterator matcher;
-    int multiplier = 0;
-    if (strcmp(fp_type, "tcp") == 0) {
-        matcher = tcp_os_fp_db.FindMember(str_repr);
-        if (matcher == tcp_os_fp_db.MemberEnd()) {
-            return ;
+        os_fp_type type = os_fp_type_from_string(r.get_fp_type());
+        if (type == os_fp_unknown) {
+            return;
         }
-    } else if (strcmp(fp_type, "tls") == 0) {
-        matcher = tls_os_fp_db.FindMember(str_repr);
-        if (matcher == tls_os_fp_db.MemberEnd()) {
-            return ;
+        std::string_view src_ip = r.get_src_ip();
+        worker &w = *workers[std::hash<std::string_view>{}(src_ip) % workers.size()];
+        w.batch.push_back({ std::string{src_ip}, std::string{r.get_fingerprint()}, r.get_event_start(), type });
+        if (w.batch.size() >= batch_size) {
+            submit(w);
         }
-        multiplier = 1;
-    } else if (strcmp(fp_type, "http") == 0) {
-        matcher = http_os_fp_db.FindMember(str_repr);
-        if (matcher == http_os_fp_db.MemberEnd()) {
-            return ;
+    }
+
+    // finish() processes all outstanding records, emits the verdicts
+    // for all remaining hosts, and stops the workers
+    //
+    void finish() {
+        for (auto &w : workers) {
+            if (w->thread.joinable()) {
+                submit(*w);
+                {
+                    std::lock_guard lock{w->m};
+                    w->done = true;
+                }
+                w->cv.notify_all();
+                w->thread.join();
+            }
         }
-        multiplier = 2;
-    } else {
-        return ;
+        fflush(output);
     }
 
-    const rapidjson::Value& fp = (multiplier == 0 ? tcp_os_fp_db[str_repr] :
-                                  (multiplier == 1 ? tls_os_fp_db[str_repr] : http_os_fp_db[str_repr]));
+private:
 
-    const rapidjson::Value& os_keys = fp["os_info"];
-    for (rapidjson::Value::ConstMemberIterator iter = os_keys.MemberBegin(); iter != os_keys.MemberEnd(); ++iter){
-        const char* os_name = iter->name.GetString();
-        double os_perc = iter->value.GetDouble();
-        auto it = os_clf.os_map.find(os_name);
-        if (it != os_clf.os_map.end()) {
-            (*features)[it->second+multiplier*os_clf.os_len] += os_perc;
+    void submit(worker &w) {
+        if (w.batch.empty()) {
+            return;
         }
+        std::unique_lock lock{w.m};
+        w.cv.wait(lock, [&w]() { return w.pending.size() < max_pending_batches; });
+        w.pending.emplace_back(std::move(w.batch));
+        lock.unlock();
+        w.cv.notify_all();
+        w.batch = std::vector<observation>{};
+        w.batch.reserve(batch_size);
     }
-}
 
-
-std::unordered_set<std::string> os_fp_types = {"tcp", "tls", "http"};
-std::unordered_map<std::string, double*> host_data;
-void update_host_data(const char *fp_type, const char *str_repr, const char *src_ip) {
-    if (os_fp_types.find(fp_type) == os_fp_types.end()) {
-        return ;
+    void write_result(const std::string &src_ip, const os_result &r, uint64_t observations) {
+        std::lock_guard lock{output_mutex};
+        fprintf(output, "{\"src_ip\":\"%s\",\"os\":\"%s\",\"probability\":%g,\"observations\":%" PRIu64 "}\n",
+                src_ip.c_str(), r.os_name.c_str(), r.probability, observations);
     }
 
-    auto it = host_data.find(src_ip);
-    if (it == host_data.end()) {
-        double *features = new double[os_clf.os_len*3]();
-        update_features(&features, fp_type, str_repr);
-        host_data[src_ip] = features;
-    } else {
-        update_features(&it->second, fp_type, str_repr);
+    void run(worker &w) {
+        os_host_table hosts{model,
+                            [this](const std::string &src_ip, const os_result &r, uint64_t n) { write_result(src_ip, r, n); },
+                            max_hosts_per_worker};
+        double next_tick = 0.0;
+        std::vector<std::vector<observation>> work;
+        while (true) {
+            {
+                std::unique_lock lock{w.m};
+                w.cv.wait(lock, [&w]() { return w.done || !w.pending.empty(); });
+                if (w.pending.empty() && w.done) {
+                    break;
+                }
+                work.swap(w.pending);
+            }
+            w.cv.notify_all();   // reader may be waiting for room
+
+            for (const auto &batch : work) {
+                for (const auto &o : batch) {
+                    const auto *c = model.lookup_or_empty(o.type, o.fingerprint);
+                    if (window > 0.0) {
+                        if (next_tick == 0.0) {
+                            next_tick = o.timestamp + window;
+                        } else if (o.timestamp >= next_tick) {
+                            hosts.classify_stable();
+                            next_tick = o.timestamp + window;
+                        }
+                    }
+                    hosts.update(o.src_ip, *c, o.timestamp);
+                }
+            }
+            work.clear();
+        }
+        hosts.flush();
     }
-}
 
+};
 
-void os_classify_all_samples() {
-    for (auto it = host_data.begin(); it != host_data.end(); ++it) {
-        std::cout << "{\"src_ip\":\"" << it->first << "\"";
-        double *features = it->second;
-
-        // normalize sample
-        double tcp_sum = 0.0, tls_sum = 0.0, http_sum = 0.0;
-        for (int i = 0; i < os_clf.os_len; i++) {
-            tcp_sum += features[i];
-            tls_sum += features[os_clf.os_len+i];
-            http_sum += features[os_clf.os_len*2+i];
-        }
-        for (int i = 0; i < os_clf.os_len; i++) {
-            features[i] = (tcp_sum > 0.0) ? features[i]/tcp_sum : features[i];
-            features[os_clf.os_len+i] = (tls_sum > 0.0) ? features[os_clf.os_len+i]/tls_sum : features[os_clf.os_len+i];
-            features[os_clf.os_len*2+i] = (http_sum > 0.0) ? features[os_clf.os_len*2+i]/http_sum : features[os_clf.os_len*2+i];
-        }
 
-        // classify sample
-        struct os_result r;
-        os_clf.classify(features, &r);
-        std::cout << ",\"os\":\"" << r.os_name << "\"";
-        std::cout << ",\"probability\":" << r.probability << "}\n";
+// the functions below provide the original, single-threaded
+// interface to OS identification
+//
 
-        delete features;
-    }
+os_model os_identification_model;
+
+int os_analysis_init(const char *resource_dir) {
+    return os_identification_model.init(resource_dir);
 }
 
+os_host_table &os_default_host_table() {
+    static os_host_table host_data{
+        os_identification_model,
+        [](const std::string &src_ip, const os_result &r, uint64_t) {
+            std::cout << "{\"src_ip\":\"" << src_ip << "\"";
+            std::cout << ",\"os\":\"" << r.os_name << "\"";
+            std::cout << ",\"probability\":" << r.probability << "}\n";
+        }
+    };
+    return host_data;
+}
 
-#define FP_BUFFER_SIZE 512
-#define FP_TYPE_BUFFER_SIZE 32
-#define SRC_IP_BUFFER_SIZE 64
-#define EVENT_START_BUFFER_SIZE 32
+void os_classify_all_samples() {
+    os_default_host_table().flush();
+}
 
 void os_process_line(std::string line, bool verbose=false) {
-    unsigned char *buf = (unsigned char*)line.c_str();
-    struct datum d{buf, buf + strlen((char*)buf)};
+    const unsigned char *buf = (const unsigned char*)line.data();
+    struct datum d{buf, buf + line.length()};
     struct mercury_record r{d};
 
     if (!r.is_valid()) {
@@ -381,17 +322,12 @@ void os_process_line(std::string line, bool verbose=false) {
         return;
     }
 
-    char fp_buffer[FP_BUFFER_SIZE];
-    char fp_type_buffer[FP_TYPE_BUFFER_SIZE];
-    char src_ip_buffer[SRC_IP_BUFFER_SIZE];
-    char event_start_buffer[EVENT_START_BUFFER_SIZE];
-
-    snprintf(fp_buffer, FP_BUFFER_SIZE, "%.*s", (int)r.fingerprint.length(), r.fingerprint.data);
-    snprintf(fp_type_buffer, FP_TYPE_BUFFER_SIZE, "%.*s", (int)r.fp_type.length(), r.fp_type.data);
-    snprintf(src_ip_buffer, SRC_IP_BUFFER_SIZE, "%.*s", (int)r.src_ip.length(), r.src_ip.data);
-    snprintf(event_start_buffer, EVENT_START_BUFFER_SIZE, "%.*s", (int)r.event_start.length(), r.event_start.data);
-
-    update_host_data(fp_type_buffer, fp_buffer, src_ip_buffer);
+    os_fp_type type = os_fp_type_from_string(r.get_fp_type());
+    if (type == os_fp_unknown) {
+        return;
+    }
+    const auto *c = os_identification_model.lookup_or_empty(type, r.get_fingerprint());
+    os_default_host_table().update(r.get_src_ip(), *c, r.get_event_start());
 }
 
 #endif /* OS_IDENTIFIER_H */
@@ -3,13 +3,18 @@
  * driver program for os_identifier.h
  *
  * compile as:
- *    g++ -I ../libmerc/ -Wall os_identifier.cc -o os_identifier ../libmerc/datum.cc -lz
+ *    make os_identifier
  *
  * run as:
  *
+ *    ./os_identifier --read <json-file> [--threads <n>] [--window <seconds>] [--max-hosts <n>]
+ *
+ * where <json-file> is a mercury JSON output file containing
+ * fingerprints, or "-" for standard input; the original form
+ *
  *    ./os_identifier <json-file>
  *
- * where <json-file> is a mercury JSON output file containing fingerprints
+ * is also accepted
  *
  * Copyright (c) 2021 Cisco Systems, Inc.  All rights reserved.  License at
  * https://github.com/cisco/mercury/blob/master/LICENSE
@@ -19,32 +24,100 @@
 #include <fstream>
 
 #include "os-identification/os_identifier.h"
+#include "options.h"
 
-bool verbose = false;  // set to true for details about incomplete mercury_records
+using namespace mercury_option;
 
 int main(int argc, char *argv[]) {
-    if (argc != 2 || argv[1] == NULL) {
-        printf("error: please supply mercury output file\n");
-        return -1;
+
+    const char summary[] =
+        "usage:\n"
+        "\tos_identifier [OPTIONS]\n\n"
+        "Reads mercury JSON output, accumulates the TCP, TLS, and HTTP fingerprints\n"
+        "observed from each source address, and reports the most likely operating\n"
+        "system of each one.  Records are sharded by source address across worker\n"
+        "threads.  With --window, hosts are classified every <arg> seconds of\n"
+        "event time, and each host is reported as soon as its verdict is stable, so\n"
+        "that continuous feeds (--read -) produce output as they are read.  With\n"
+        "--max-hosts, at most <arg> hosts are held in memory, and the least recently\n"
+        "seen hosts are reported and evicted to make room for new ones.\n\n"
+        "OPTIONS\n";
+
+    option_processor opt({
+        { argument::required,   "--read",       "read mercury JSON from file <arg> ('-' for stdin)" },
+        { argument::required,   "--resources",  "read OS models from directory <arg>" },
+        { argument::required,   "--threads",    "use <arg> worker threads (default: 1)" },
+        { argument::required,   "--window",     "report stable verdicts every <arg> seconds" },
+        { argument::required,   "--max-hosts",  "hold at most <arg> hosts in memory" },
+        { argument::none,       "--verbose",    "report incomplete mercury records" },
+        { argument::none,       "--help",       "prints out help message" }
+    });
+
+    // accept the original invocation, with a single file argument
+    //
+    std::string input_file;
+    bool legacy_invocation = (argc == 2 && argv[1] != NULL && argv[1][0] != '-');
+    if (legacy_invocation) {
+        input_file = argv[1];
+    } else {
+        if (!opt.process_argv(argc, argv)) {
+            opt.usage(stderr, argv[0], summary);
+            return EXIT_FAILURE;
+        }
+        if (opt.is_set("--help")) {
+            opt.usage(stdout, argv[0], summary);
+            return 0;
+        }
+        auto [ read_is_set, read_file ] = opt.get_value("--read");
+        if (!read_is_set) {
+            fprintf(stderr, "error: please supply mercury output file\n");
+            opt.usage(stderr, argv[0], summary);
+            return EXIT_FAILURE;
+        }
+        input_file = read_file;
     }
-    fprintf(stderr, "processing: %s\n",argv[1]);
+    auto [ resources_is_set, resource_dir ] = opt.get_value("--resources");
+    auto [ threads_is_set, threads ] = opt.get_value("--threads");
+    auto [ window_is_set, window ] = opt.get_value("--window");
+    auto [ max_hosts_is_set, max_hosts ] = opt.get_value("--max-hosts");
+    bool verbose = opt.is_set("--verbose");  // report details about incomplete mercury_records
 
-    /* initialize OS identification models */
-    os_analysis_init("../resources");
+    fprintf(stderr, "processing: %s\n", input_file.c_str());
 
-    std::ifstream ifs {argv[1]};
-    if (!ifs.is_open()) {
-        std::cerr << "Could not open file for reading!\n";
-        return -1;
+    /* initialize OS identification models */
+    if (os_analysis_init(resources_is_set ? resource_dir.c_str() : "../resources") != 0) {
+        return EXIT_FAILURE;
     }
-    std::string line;
-    while (getline(ifs,line)) {
-        /* extract features and update host data */
-        os_process_line(line, verbose);
+
+    std::ifstream ifs;
+    std::istream *input = &std::cin;
+    if (input_file != "-") {
+        ifs.open(input_file);
+        if (!ifs.is_open()) {
+            std::cerr << "Could not open file for reading!\n";
+            return -1;
+        }
+        input = &ifs;
     }
 
-    /* classify all src_ip's */
-    os_classify_all_samples();
+    try {
+        os_identification_pipeline pipeline{os_identification_model,
+                                            threads_is_set ? std::stoul(threads) : 1,
+                                            window_is_set ? std::stod(window) : 0.0,
+                                            max_hosts_is_set ? std::stoul(max_hosts) : 0};
+        std::string line;
+        while (getline(*input, line)) {
+            /* extract features and dispatch to the worker for its src_ip */
+            pipeline.process_line(line, verbose);
+        }
+
+        /* classify all remaining src_ip's */
+        pipeline.finish();
+    }
+    catch (std::exception &e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
 
     return 0;
 }
@@ -224,6 +224,39 @@ void debug_print_tour_tree(struct tourn_tree *t_tree, const struct thread_queues
     fprintf(stderr, "\n");
 }
 
+/*
+ * write_file_header() writes the file header appropriate for the type
+ * of the output file ojf, if there is one, to the file f
+ */
+static enum status write_file_header(struct output_file *ojf, FILE *f) {
+    enum status status = status_ok;
+    if (ojf->type == file_type_pcap) {
+        status = write_pcap_file_header(f);
+    } else if (ojf->type == file_type_pcapng) {
+        status = write_pcapng_file_header(f);
+    }
+    if (status) {
+        perror("error: could not write pcap file header");
+        ojf->file_error = true;
+    }
+    return status;
+}
+
+/*
+ * output files are written through the output block, if one could be
+ * allocated, so stdio buffering is turned off, which causes each
+ * block to be written with a single write() call; otherwise, records
+ * are written through the stdio buffer of the file
+ */
+static void set_buffering(struct output_file *ojf, FILE *f) {
+    if (ojf->block == nullptr) {
+        return;
+    }
+    if (setvbuf(f, NULL, _IONBF, 0) != 0) {
+        perror("warning: could not turn off buffering for output file");
+    }
+}
+
 enum status open_outfile(struct output_file *ojf, bool is_pri) {
     char outfile[FILENAME_MAX];
     char file_num[MAX_HEX];
@@ -251,6 +284,7 @@ enum status open_outfile(struct output_file *ojf, bool is_pri) {
         ojf->file_error = true;
         return status_err;
     }
+    set_buffering(ojf, file);
 
     if (is_pri) {
         ojf->file_pri = file;
@@ -272,7 +306,7 @@ enum status output_file_rotate(struct output_file *ojf) {
 
     enum status status = status_ok;
     
-    if (ojf->max_records == UINT64_MAX && ojf->rotate_time == UINT64_MAX) {
+    if (ojf->max_records == UINT64_MAX && ojf->rotate_time == UINT64_MAX && ojf->max_bytes == UINT64_MAX) {
         char outfile[FILENAME_MAX];
         strncpy(outfile, ojf->outfile_name, FILENAME_MAX - 1);
         ojf->file_pri = fopen(outfile, ojf->mode);
@@ -281,14 +315,11 @@ enum status output_file_rotate(struct output_file *ojf) {
             ojf->file_error = true;
             return status_err;
         }
+        set_buffering(ojf, ojf->file_pri);
 
-        if (ojf->type == file_type_pcap) {
-            status = write_pcap_file_header(ojf->file_pri);
-            if (status) {
-                perror("error: could not write pcap file header");
-                ojf->file_error = true;
-                return status_err;
-            }
+        status = write_file_header(ojf, ojf->file_pri);
+        if (status) {
+            return status_err;
         }
     }
     else {
@@ -306,20 +337,13 @@ enum status output_file_rotate(struct output_file *ojf) {
                 return status_err;
             }
 
-            if (ojf->type == file_type_pcap) {
-                status = write_pcap_file_header(ojf->file_pri);
-                if (status) {
-                    perror("error: could not write pcap file header");
-                    ojf->file_error = true;
-                    return status_err;
-                }
-
-                status = write_pcap_file_header(ojf->file_sec);
-                if (status) {
-                    perror("error: could not write pcap file header");
-                    ojf->file_error = true;
-                    return status_err;
-                }
+            status = write_file_header(ojf, ojf->file_pri);
+            if (status) {
+                return status_err;
+            }
+            status = write_file_header(ojf, ojf->file_sec);
+            if (status) {
+                return status_err;
             }
         }
         else {
@@ -328,13 +352,9 @@ enum status output_file_rotate(struct output_file *ojf) {
                 return status_err;
             }
 
-            if (ojf->type == file_type_pcap) {
-                status = write_pcap_file_header(ojf->file_sec);
-                if (status) {
-                    perror("error: could not write pcap file header");
-                    ojf->file_error = true;
-                    return status_err;
-                }
+            status = write_file_header(ojf, ojf->file_sec);
+            if (status) {
+                return status_err;
             }
         }
     }
@@ -353,16 +373,74 @@ enum status output_file_rotate(struct output_file *ojf) {
     return status_ok;
 }
 
+/*
+ * output_file_flush() writes out the data in the output block to the
+ * primary output file; if that fails, file_error is set
+ */
+static void output_file_flush(struct output_file *out_ctx) {
+    if (out_ctx->block_used == 0) {
+        return;
+    }
+    if (fwrite(out_ctx->block, out_ctx->block_used, 1, out_ctx->file_pri) != 1) {
+        perror("error: could not write to output file");
+        out_ctx->file_error = true;
+    }
+    out_ctx->block_used = 0;
+}
+
+/*
+ * output_file_write() copies a record into the output block, after
+ * converting it to an enhanced packet block for PCAP-NG output, and
+ * writes the block out whenever it is full; output blocks are thus
+ * written out in whole, aligned blocks of OUTPUT_BLOCK_SIZE bytes,
+ * except at the end of a file or after a period of inactivity
+ */
+static void output_file_write(struct output_file *out_ctx, const void *record, size_t length) {
+    uint8_t packet_block[LLQ_MSG_SIZE + 64];
+    if (out_ctx->type == file_type_pcapng) {
+        length = write_pcapng_packet_block(packet_block, sizeof(packet_block), record, length);
+        record = packet_block;
+    }
+    out_ctx->bytes_in_file += length;
+
+    if (out_ctx->block == nullptr) {
+        if (fwrite(record, length, 1, out_ctx->file_pri) != 1) {
+            perror("error: could not write to output file");
+            out_ctx->file_error = true;
+        }
+        return;
+    }
+    const uint8_t *data = (const uint8_t *)record;
+    while (length > 0) {
+        if (out_ctx->block_used == 0) {
+            out_ctx->block_time = time(NULL);
+        }
+        size_t n = OUTPUT_BLOCK_SIZE - out_ctx->block_used;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(out_ctx->block + out_ctx->block_used, data, n);
+        out_ctx->block_used += n;
+        data += n;
+        length -= n;
+        if (out_ctx->block_used == OUTPUT_BLOCK_SIZE) {
+            output_file_flush(out_ctx);
+        }
+    }
+}
+
 enum status swap_rotated_files(struct output_file* out_ctx) {
     if (out_ctx->file_error.load() == true) {
         return status_err;
     }
 
+    output_file_flush(out_ctx);
     out_ctx->file_used = out_ctx->file_pri;
     out_ctx->file_pri = out_ctx->file_sec;
     out_ctx->file_sec = nullptr;
     out_ctx->rotation_req = true;
     out_ctx->record_countdown = out_ctx->max_records;
+    out_ctx->bytes_in_file = 0;
 
     if (out_ctx->file_pri == nullptr) {
         return status_err;
@@ -392,7 +470,7 @@ void close_outfiles (struct output_file* out_ctx) {
 }
 
 enum status limit_rotate (output_file* out_ctx) {
-    if (out_ctx->max_records == UINT64_MAX) {
+    if (out_ctx->max_records == UINT64_MAX && out_ctx->max_bytes == UINT64_MAX) {
         out_ctx->record_countdown = out_ctx->max_records;
         return status_ok;
     }
@@ -429,6 +507,34 @@ enum status time_rotate (output_file* out_ctx) {
     return status_ok;
 } 
 
+/*
+ * output_file_write_msg() writes the message wmsg to the output file,
+ * releases its queue entry, and rotates the output file if needed
+ */
+static enum status output_file_write_msg(struct output_file *out_ctx, struct llq_msg *wmsg) {
+    output_file_write(out_ctx, wmsg->buf, wmsg->len);
+
+    /* A full memory barrier prevents the following flag (un)set from happening too soon */
+    __sync_synchronize();
+    wmsg->used = 0;
+
+    /* Handle rotating file if needed */
+    if (output_file_needs_rotation(out_ctx) || out_ctx->bytes_in_file >= out_ctx->max_bytes) {
+        enum status status = limit_rotate(out_ctx);
+        if (status) {
+            return status;
+        }
+    }
+
+    if (out_ctx->time_rotation_req.load() == true) {
+        enum status status = time_rotate(out_ctx);
+        if (status) {
+            return status;
+        }
+    }
+    return status_ok;
+}
+
 void *output_thread_func(void *arg) {
 
     struct output_file *out_ctx = (struct output_file *)arg;
@@ -452,6 +558,22 @@ void *output_thread_func(void *arg) {
         exit(255);
     }
 
+    /* Output to files is accumulated in an aligned block; if it
+     * cannot be allocated, records are written through stdio
+     * buffers instead.  The block is allocated before any output
+     * file is opened, since that determines how the files are
+     * buffered.
+     */
+    if (out_ctx->type != file_type_stdout) {
+        void *block = nullptr;
+        if (posix_memalign(&block, OUTPUT_BLOCK_ALIGN, OUTPUT_BLOCK_SIZE) != 0) {
+            fprintf(stderr, "warning: could not allocate output block\n");
+            block = nullptr;
+        }
+        out_ctx->block = (uint8_t *)block;
+        out_ctx->block_used = 0;
+    }
+
     // note: we wait until we get an output start condition before we
     // open any output files, so that drop_privileges() can be called
     // before file creation
@@ -464,6 +586,7 @@ void *output_thread_func(void *arg) {
         }
     }
     out_ctx->record_countdown = out_ctx->max_records;
+
     /* This output thread uses a "tournament tree" algorithm
      * to perform a k-way merge of the lockless queues.
      *
@@ -545,25 +668,9 @@ void *output_thread_func(void *arg) {
 
             struct llq_msg *wmsg = &(out_ctx->qs.queue[wq].msgs[out_ctx->qs.queue[wq].ridx]);
             if (wmsg->used == 1) {
-                fwrite(wmsg->buf, wmsg->len, 1, out_ctx->file_pri);
-
-                /* A full memory barrier prevents the following flag (un)set from happening too soon */
-                __sync_synchronize();
-                wmsg->used = 0;
-
-                /* Handle rotating file if needed */
-                if (output_file_needs_rotation(out_ctx)) {
-                    status = limit_rotate(out_ctx);
-                    if (status) {
-                        break;
-                    }
-                }
-
-                if (out_ctx->time_rotation_req.load() == true) {
-                    status = time_rotate(out_ctx);
-                    if (status) {
-                        break;
-                    }
+                status = output_file_write_msg(out_ctx, wmsg);
+                if (status) {
+                    break;
                 }
 
                 out_ctx->qs.queue[wq].ridx = (out_ctx->qs.queue[wq].ridx + 1) % LLQ_DEPTH;
@@ -609,25 +716,9 @@ void *output_thread_func(void *arg) {
                 break;
             } else if (time_less(&(wmsg->ts), &old_ts) == 1) {
                 //fprintf(stderr, "DEBUG: writing old message from queue %d\n", wq);
-                fwrite(wmsg->buf, wmsg->len, 1, out_ctx->file_pri);
-
-                /* A full memory barrier prevents the following flag (un)set from happening too soon */
-                __sync_synchronize();
-                wmsg->used = 0;
-
-                /* Handle rotating file if needed */
-                if (output_file_needs_rotation(out_ctx)) {
-                    status = limit_rotate(out_ctx);
-                    if (status) {
-                        break;
-                    }
-                }
-
-                if (out_ctx->time_rotation_req.load() == true) {
-                    status = time_rotate(out_ctx);
-                    if (status) {
-                        break;
-                    }
+                status = output_file_write_msg(out_ctx, wmsg);
+                if (status) {
+                    break;
                 }
 
                 out_ctx->qs.queue[wq].ridx = (out_ctx->qs.queue[wq].ridx + 1) % LLQ_DEPTH;
@@ -638,6 +729,13 @@ void *output_thread_func(void *arg) {
             }
         }
 
+        /* Write out the output block if its data is getting old,
+         * so that output does not lag behind input for long
+         */
+        if (out_ctx->block_used != 0 && time(NULL) - out_ctx->block_time >= OUTPUT_BLOCK_MAX_AGE) {
+            output_file_flush(out_ctx);
+        }
+
         /* This sleep slows us down so we don't spin the CPU.
          * We probably could afford to call fflush() here
          * the first time instead of sleeping and only sleep
@@ -655,8 +753,11 @@ void *output_thread_func(void *arg) {
     }
     
     if (out_ctx->type != file_type_stdout) {
+        output_file_flush(out_ctx);
         close_outfiles(out_ctx);
     }
+    free(out_ctx->block);
+    out_ctx->block = nullptr;
 
     return NULL;
 }
@@ -18,9 +18,20 @@ enum file_type {
    file_type_unknown=0,
    file_type_json,
    file_type_pcap,
+   file_type_pcapng,
    file_type_stdout
 };
 
+/*
+ * output is accumulated in a block of OUTPUT_BLOCK_SIZE bytes, which
+ * is written to the output file when it is full, when the file is
+ * rotated or closed, or when its oldest data is more than
+ * OUTPUT_BLOCK_MAX_AGE seconds old
+ */
+#define OUTPUT_BLOCK_SIZE    (4 * 1024 * 1024)
+#define OUTPUT_BLOCK_ALIGN   4096
+#define OUTPUT_BLOCK_MAX_AGE 1
+
 struct output_file {
     FILE *file_pri = nullptr;
     FILE *file_sec = nullptr;
@@ -31,6 +42,11 @@ struct output_file {
     int64_t record_countdown;
     uint64_t max_records;
     uint64_t rotate_time;
+    uint64_t max_bytes;
+    uint64_t bytes_in_file = 0;
+    uint8_t *block = nullptr;
+    size_t block_used = 0;
+    time_t block_time = 0;
     uint32_t file_num = 0;
     char *outfile_name;
     const char *mode;
@@ -22,7 +22,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 #include <variant>
+#include <vector>
 #include <cassert>
 #include <stdexcept>
 
@@ -318,6 +320,15 @@ namespace pcap {
 
         bool byteswap_needed() const { return byteswap; }
 
+        // has_nanosecond_timestamps() returns true if the timestamps
+        // in the packet records of the file are in seconds and
+        // nanoseconds, and false if they are in seconds and
+        // microseconds
+        //
+        bool has_nanosecond_timestamps() const {
+            return magic_number.equals_any_byte_order(magic_values::magic_nsec);
+        }
+
         static bool is_magic(uint32_t x) {
             magic_values mx{x};
             return mx.equals_any_byte_order(magic_values::magic) || mx.equals_any_byte_order(magic_values::magic_nsec);
@@ -377,6 +388,14 @@ namespace pcap {
 
         bool is_valid() const { return packet_data.is_not_null(); }
 
+        // get_timestamp(nsec) returns the timestamp of this record,
+        // where nsec indicates whether the file has nanosecond
+        // timestamps (see file_header::has_nanosecond_timestamps())
+        //
+        struct timespec get_timestamp(bool nsec) const {
+            return { (time_t)timestamp_sec.value(), (long)(nsec ? timestamp_usec.value() : timestamp_usec.value() * 1000) };
+        }
+
         void write(writeable &buf) {
 
             if (!is_valid()) {
@@ -508,6 +527,7 @@ namespace pcap::ng {
 
     enum type_code {
         interface_description = 1,
+        obsolete_packet       = 2,
         simple_packet         = 3,
         name_resolution       = 4,
         interface_statistics  = 5,
@@ -1531,6 +1551,413 @@ namespace pcap::ng {
         }
     };
 
+    // class pcap::ng::block_scanner walks through the blocks of a
+    // PCAP-NG file that has been mapped into memory, one block at a
+    // time, following the section header blocks from one section to
+    // the next.  Each section can have its own byte order and
+    // interfaces; the scanner keeps a single table of the interfaces
+    // of all of the sections, so that a packet block can be identified
+    // by its location and an index into that table, and decoded later.
+    //
+    // The timestamp resolution (if_tsresol) and offset (if_tsoffset)
+    // of each interface are turned into a scale factor when its
+    // interface description block is scanned, so that decoding a
+    // packet does not involve looking at the options of its interface.
+    //
+    // A block_scanner refers to the data of the file that it scans,
+    // which must outlive it.  It stops at the first truncated or
+    // malformed block, leaving the remaining bytes unscanned, and it
+    // throws a std::runtime_error if a section header block has an
+    // invalid byte order magic.
+    //
+    class block_scanner {
+    public:
+
+        // struct interface holds the link type of an interface, and
+        // the scale factors that convert its timestamps into seconds
+        // and nanoseconds: the nanoseconds are (units % units_per_sec)
+        // * nsec_mul / nsec_div
+        //
+        struct interface {
+            uint16_t linktype;
+            bool swap;                  // byte order of its section
+            uint64_t units_per_sec;
+            uint64_t nsec_mul;
+            uint64_t nsec_div;
+            int64_t offset;             // if_tsoffset, in seconds
+        };
+
+        struct packet {
+            const uint8_t *data;
+            uint32_t caplen;
+            uint32_t len;
+            struct timespec ts;
+            uint16_t linktype;
+        };
+
+        static constexpr uint32_t no_interface = UINT32_MAX;
+
+        // struct block represents a single block of the file; for a
+        // packet block, interface is the index of its interface in
+        // get_interfaces(), or no_interface if the block does not
+        // refer to an interface described in its section
+        //
+        struct block {
+            const uint8_t *data;
+            uint32_t length;
+            uint32_t type;
+            uint32_t interface;
+            bool swap;                  // byte order of its section
+        };
+
+    private:
+
+        datum file;
+        std::vector<interface> interfaces;
+        bool swap = false;
+        size_t first_interface = 0;     // index of first interface in current section
+        bool have_section = false;
+
+        static constexpr uint32_t byte_order_magic         = 0x1a2b3c4d;
+        static constexpr uint32_t swapped_byte_order_magic = 0x4d3c2b1a;
+
+        static uint16_t get_uint16(const uint8_t *p, bool swap) {
+            uint16_t x;
+            memcpy(&x, p, sizeof(x));
+            return swap ? __builtin_bswap16(x) : x;
+        }
+
+        static uint32_t get_uint32(const uint8_t *p, bool swap) {
+            uint32_t x;
+            memcpy(&x, p, sizeof(x));
+            return swap ? __builtin_bswap32(x) : x;
+        }
+
+        static uint64_t get_uint64(const uint8_t *p, bool swap) {
+            uint64_t x;
+            memcpy(&x, p, sizeof(x));
+            return swap ? __builtin_bswap64(x) : x;
+        }
+
+        // add_interface(block, length, swap) adds the interface of an
+        // interface description block to the table of interfaces
+        //
+        void add_interface(const uint8_t *block, uint32_t length, bool swap) {
+            interface ifc{get_uint16(block + 8, swap), swap, 1000000, 1000, 1, 0};
+            uint8_t tsresol = 6;
+
+            // scan options, which start after the snaplen field
+            //
+            const uint8_t *opt = block + 16;
+            const uint8_t *opt_end = block + length - 4;
+            while (opt_end - opt >= 4) {
+                uint16_t code = get_uint16(opt, swap);
+                uint16_t opt_len = get_uint16(opt + 2, swap);
+                if (code == 0 || opt_end - opt - 4 < opt_len) {
+                    break;
+                }
+                if (code == 9 && opt_len >= 1) {            // if_tsresol
+                    tsresol = opt[4];
+                } else if (code == 14 && opt_len >= 8) {    // if_tsoffset
+                    ifc.offset = (int64_t)get_uint64(opt + 4, swap);
+                }
+                opt += 4 + ((opt_len + 3) & ~3);
+            }
+
+            if (tsresol & 0x80) {
+                unsigned int exp = tsresol & 0x7f;
+                if (exp < 64) {
+                    ifc.units_per_sec = (uint64_t)1 << exp;
+                    ifc.nsec_mul = 1000000000;
+                    ifc.nsec_div = ifc.units_per_sec;
+                }
+            } else if (tsresol <= 19) {
+                uint64_t units = 1;
+                for (unsigned int i = 0; i < tsresol; i++) {
+                    units *= 10;
+                }
+                ifc.units_per_sec = units;
+                if (tsresol <= 9) {
+                    ifc.nsec_mul = 1000000000 / units;
+                    ifc.nsec_div = 1;
+                } else {
+                    ifc.nsec_mul = 1;
+                    ifc.nsec_div = units / 1000000000;
+                }
+            }
+            interfaces.push_back(ifc);
+        }
+
+    public:
+
+        block_scanner(const datum &f) : file{f} { }
+
+        // next(b) sets b to the next block in the file and returns
+        // true, or returns false if there are no more blocks, or the
+        // next one is truncated or malformed
+        //
+        bool next(block &b) {
+            if (file.length() < 12) {
+                return false;
+            }
+            const uint8_t *p = file.data;
+            uint32_t type = get_uint32(p, false);
+            if (type == section_header_block::type) {
+                uint32_t magic = get_uint32(p + 8, false);
+                if (magic == byte_order_magic) {
+                    swap = false;
+                } else if (magic == swapped_byte_order_magic) {
+                    swap = true;
+                } else {
+                    throw std::runtime_error("invalid byte order magic in section header block");
+                }
+                first_interface = interfaces.size();
+                have_section = true;
+            } else if (!have_section) {
+                return false;
+            } else {
+                type = get_uint32(p, swap);
+            }
+            uint32_t length = get_uint32(p + 4, swap);
+            if (length < 12 || length % 4 != 0 || length > (size_t)file.length()) {
+                return false;
+            }
+            b = { p, length, type, no_interface, swap };
+
+            switch(type) {
+            case interface_description:
+                if (length >= 20) {
+                    add_interface(p, length, swap);
+                }
+                break;
+            case enhanced_packet:
+            case obsolete_packet:
+                if (length >= 32) {
+                    uint32_t if_id = (type == enhanced_packet) ? get_uint32(p + 8, swap) : get_uint16(p + 8, swap);
+                    if (if_id < interfaces.size() - first_interface) {
+                        b.interface = first_interface + if_id;
+                    }
+                }
+                break;
+            case simple_packet:
+                if (first_interface < interfaces.size()) {
+                    b.interface = first_interface;
+                }
+                break;
+            default:
+                ;
+            }
+            file.skip(length);
+            return true;
+        }
+
+        // remaining() returns the number of bytes of the file that
+        // have not been scanned, which is nonzero after next() has
+        // returned false if the file ends with a truncated block
+        //
+        size_t remaining() const { return file.length(); }
+
+        const std::vector<interface> &get_interfaces() const { return interfaces; }
+
+        static bool is_packet(uint32_t type) {
+            return type == enhanced_packet || type == obsolete_packet || type == simple_packet;
+        }
+
+        // decode(block, ifc, pkt) sets pkt to the packet in the packet
+        // block that starts at block, whose interface is ifc, and
+        // returns true if that block is well-formed
+        //
+        static bool decode(const uint8_t *block, const interface &ifc, packet &pkt) {
+            uint32_t type = get_uint32(block, ifc.swap);
+            uint32_t length = get_uint32(block + 4, ifc.swap);
+            pkt.linktype = ifc.linktype;
+
+            if (type == simple_packet) {
+                if (length < 16) {
+                    return false;
+                }
+                pkt.len = get_uint32(block + 8, ifc.swap);
+                pkt.caplen = std::min(pkt.len, length - 16);
+                pkt.data = block + 12;
+                pkt.ts = { 0, 0 };
+                return true;
+            }
+
+            // enhanced and obsolete packet blocks share a layout
+            //
+            if (length < 32) {
+                return false;
+            }
+            pkt.caplen = get_uint32(block + 20, ifc.swap);
+            pkt.len = get_uint32(block + 24, ifc.swap);
+            pkt.data = block + 28;
+            if (pkt.caplen > length - 32) {
+                return false;
+            }
+            uint64_t units = ((uint64_t)get_uint32(block + 12, ifc.swap) << 32) | get_uint32(block + 16, ifc.swap);
+            uint64_t frac = units % ifc.units_per_sec;
+            pkt.ts.tv_sec = units / ifc.units_per_sec + ifc.offset;
+            if (ifc.nsec_div == 1) {
+                pkt.ts.tv_nsec = frac * ifc.nsec_mul;
+            } else {
+                pkt.ts.tv_nsec = (unsigned __int128)frac * ifc.nsec_mul / ifc.nsec_div;
+            }
+            return true;
+        }
+
+        // decode(b, pkt) sets pkt to the packet in the packet block b,
+        // and returns true if that block is well-formed; if b does not
+        // refer to a known interface, the link type of pkt is NONE
+        //
+        bool decode(const block &b, packet &pkt) const {
+            if (b.interface == no_interface) {
+                return decode(b.data, interface{LINKTYPE::NONE, b.swap, 1000000, 1000, 1, 0}, pkt);
+            }
+            return decode(b.data, interfaces[b.interface], pkt);
+        }
+
+    };
+
+    // class pcap::ng::block_index locates all of the packet blocks in
+    // a PCAP-NG file in a single pass of a block_scanner, without
+    // decoding the packets, so that they can then be decoded in any
+    // order, by any number of threads at once.  Packet blocks that do
+    // not refer to an interface are not indexed.
+    //
+    // A block_index refers to the data of the file that it indexes,
+    // which must outlive it.  Indexing stops at the first malformed or
+    // truncated block, so a file that is still being written can be
+    // indexed.
+    //
+    class block_index {
+    public:
+
+        using interface = block_scanner::interface;
+        using packet = block_scanner::packet;
+
+        struct location {
+            uint64_t offset;            // offset of block in file
+            uint32_t interface;         // index into interfaces
+        };
+
+    private:
+
+        const uint8_t *base;
+        std::vector<interface> interfaces;
+        std::vector<location> locations;
+
+    public:
+
+        block_index(const datum &file) : base{file.data} {
+            block_scanner scanner{file};
+            block_scanner::block b;
+            try {
+                while (scanner.next(b)) {
+                    if (block_scanner::is_packet(b.type) && b.interface != block_scanner::no_interface) {
+                        locations.push_back({ (uint64_t)(b.data - base), b.interface });
+                    }
+                }
+            }
+            catch (const std::runtime_error &) {
+                ;   // malformed section header block; index what came before it
+            }
+            interfaces = scanner.get_interfaces();
+        }
+
+        size_t size() const { return locations.size(); }
+
+        const std::vector<interface> &get_interfaces() const { return interfaces; }
+
+        // decode(i, pkt) sets pkt to the i-th packet in the file, and
+        // returns true if that packet is well-formed
+        //
+        bool decode(size_t i, packet &pkt) const {
+            const location &loc = locations[i];
+            return block_scanner::decode(base + loc.offset, interfaces[loc.interface], pkt);
+        }
+
+        // unit_test() indexes a capture with two sections of opposite
+        // byte order, a packet block whose interface is not described in
+        // its section, and a truncated block at the end
+        //
+        static bool unit_test() {
+            std::vector<uint8_t> buf;
+            bool swap = false;
+            auto put32 = [&](uint32_t x) {
+                x = swap ? __builtin_bswap32(x) : x;
+                buf.insert(buf.end(), (uint8_t *)&x, (uint8_t *)&x + sizeof(x));
+            };
+            auto put16 = [&](uint16_t x) {
+                x = swap ? __builtin_bswap16(x) : x;
+                buf.insert(buf.end(), (uint8_t *)&x, (uint8_t *)&x + sizeof(x));
+            };
+            auto shb = [&](uint32_t magic) {
+                put32(section_header_block::type); put32(28); put32(magic);
+                put16(1); put16(0); put32(0xffffffff); put32(0xffffffff); put32(28);
+            };
+            auto idb = [&](uint16_t linktype, uint8_t tsresol) {
+                put32(interface_description); put32(32); put16(linktype); put16(0); put32(0);
+                put16(9); put16(1); buf.insert(buf.end(), { tsresol, 0, 0, 0 }); put16(0); put16(0); put32(32);
+            };
+            auto epb = [&](uint32_t if_id, uint64_t ts, uint32_t len) {
+                put32(enhanced_packet); put32(36); put32(if_id); put32(ts >> 32); put32(ts & 0xffffffff);
+                put32(4); put32(len); buf.insert(buf.end(), { 0xde, 0xad, 0xbe, 0xef }); put32(36);
+            };
+
+            shb(0x1a2b3c4d);
+            idb(LINKTYPE::ETHERNET, 9);
+            epb(0, 1500000000123456789, 60);
+            put32(simple_packet); put32(20); put32(60); buf.insert(buf.end(), { 0xde, 0xad, 0xbe, 0xef }); put32(20);
+            size_t first_section_length = buf.size();
+            swap = true;
+            shb(0x1a2b3c4d);
+            idb(LINKTYPE::RAW, 6);
+            epb(1, 0, 1500);                // interface 1 is not in this section
+            epb(0, 2000001, 1500);
+            put32(enhanced_packet); put32(36); put32(0);   // truncated
+
+            block_index index{datum{buf.data(), buf.data() + buf.size()}};
+            packet pkt;
+            if (index.size() != 3 || index.get_interfaces().size() != 2) {
+                return false;
+            }
+            if (!index.decode(0, pkt) || pkt.linktype != LINKTYPE::ETHERNET || pkt.caplen != 4 || pkt.len != 60
+                || pkt.ts.tv_sec != 1500000000 || pkt.ts.tv_nsec != 123456789 || pkt.data[0] != 0xde) {
+                return false;
+            }
+            if (!index.decode(1, pkt) || pkt.linktype != LINKTYPE::ETHERNET || pkt.caplen != 4 || pkt.len != 60) {
+                return false;
+            }
+            if (!index.decode(2, pkt) || pkt.linktype != LINKTYPE::RAW || pkt.caplen != 4 || pkt.len != 1500
+                || pkt.ts.tv_sec != 2 || pkt.ts.tv_nsec != 1000 || pkt.data[0] != 0xde) {
+                return false;
+            }
+
+            // the scanner returns every complete block, and leaves the
+            // truncated one unscanned
+            //
+            block_scanner scanner{datum{buf.data(), buf.data() + buf.size()}};
+            block_scanner::block b;
+            size_t blocks = 0;
+            while (scanner.next(b)) {
+                blocks++;
+            }
+            if (blocks != 8 || scanner.remaining() != 12) {
+                return false;
+            }
+
+            // a section header block with an invalid byte order magic
+            // ends the index
+            //
+            buf.resize(first_section_length);
+            swap = false;
+            shb(0);
+            block_index truncated{datum{buf.data(), buf.data() + buf.size()}};
+            return truncated.size() == 2;
+        }
+
+    };
+
     // class pcap::ng::file_writer implements a file writer for the
     // PCAP-NG format
     //
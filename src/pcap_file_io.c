@@ -103,6 +103,38 @@ enum status write_pcap_file_header(FILE *f) {
     return status_ok;
 }
 
+enum status write_pcapng_file_header(FILE *f) {
+    data_buffer<128> buf;
+    pcap::ng::section_header_block shb;
+    shb.write(buf);
+    pcap::ng::interface_description_block idb{pcap::LINKTYPE::ETHERNET, 65535};
+    idb.write(buf);
+    datum header = buf.contents();
+    if (header.is_null() || fwrite(header.data, header.length(), 1, f) != 1) {
+        perror("error writing pcapng file header");
+        return status_err;
+    }
+    return status_ok;
+}
+
+size_t write_pcapng_packet_block(uint8_t *output, size_t output_len, const void *pcap_record, size_t length) {
+    struct pcap_packet_hdr packet_hdr;
+    if (length < sizeof(packet_hdr)) {
+        return 0;
+    }
+    memcpy(&packet_hdr, pcap_record, sizeof(packet_hdr));
+    size_t caplen = packet_hdr.incl_len < length - sizeof(packet_hdr) ? packet_hdr.incl_len : length - sizeof(packet_hdr);
+    datum pkt{(const uint8_t *)pcap_record + sizeof(packet_hdr), (const uint8_t *)pcap_record + sizeof(packet_hdr) + caplen};
+    uint64_t timestamp = (uint64_t)packet_hdr.ts_sec * 1000000 + packet_hdr.ts_usec;
+    pcap::ng::enhanced_packet_block epb{pkt, 0, (uint32_t)(timestamp >> 32), (uint32_t)timestamp};
+    writeable w{output, output + output_len};
+    epb.write(w);
+    if (w.is_null()) {
+        return 0;
+    }
+    return w.data - output;
+}
+
 enum status pcap_file_open(struct pcap_file *f,
                            const char *fname,
                            enum io_direction dir,
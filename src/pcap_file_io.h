@@ -113,5 +113,18 @@ void pcap_queue_write(struct ll_queue *llq,
 
 enum status write_pcap_file_header(FILE *f);
 
+// write_pcapng_file_header(f) writes a PCAP-NG section header block
+// and an ethernet interface description block to f
+//
+enum status write_pcapng_file_header(FILE *f);
+
+// write_pcapng_packet_block(output, output_len, pcap_record, length)
+// writes the PCAP-NG enhanced packet block corresponding to the PCAP
+// packet record (header and data) at pcap_record into output, and
+// returns the number of bytes written, or zero if output_len is too
+// short
+//
+size_t write_pcapng_packet_block(uint8_t *output, size_t output_len, const void *pcap_record, size_t length);
+
 
 #endif /* PCAP_FILE_IO_H */
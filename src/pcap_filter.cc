@@ -1,12 +1,22 @@
 // pcap_filter.cc
 //
-// a pcap file filter
+// a pcap file filter and splitter
 //
 // compile as:
 //
-//   g++ -Wall -Wno-narrowing pcap_filter.cc pcap_file_io.c -o pcap_filter -std=c++17
+//   g++ -Wall -Wno-narrowing pcap_filter.cc libmerc/libmerc.a -lz -lcrypto -pthread -o pcap_filter -std=c++17
 
-#include "pcap_file_io.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+#include <deque>
+#include <cinttypes>
+#include <exception>
+#include <arpa/inet.h>
+
+#include "pcap.h"
 #include "libmerc/eth.h"
 #include "libmerc/ip.h"
 #include "libmerc/tcpip.h"
@@ -16,6 +26,8 @@
 #include "libmerc/quic.h"
 #include "libmerc/tls.h"
 #include "libmerc/http.h"
+#include "libmerc/tcp.h"
+#include "libmerc/proto_identify.h"
 #include "options.h"
 
 using namespace mercury_option;
@@ -24,14 +36,767 @@ datum get_udp_data(struct datum eth_pkt);
 
 datum get_tcp_data(struct datum eth_pkt);
 
+// struct capture_record represents a single packet record (PCAP) or
+// block (PCAP-NG) in a packet capture file that has been mapped into
+// memory.  The bytes field refers to the entire record, so that it
+// can be copied into an output file without being re-encoded, which
+// preserves the format, byte order, and timestamp resolution of the
+// input file.  For blocks that do not hold a packet, packet is
+// nullptr.
+//
+struct capture_record {
+    const uint8_t *bytes;
+    uint32_t length;
+    const uint8_t *packet;
+    uint32_t packet_length;
+    uint16_t linktype;
+    bool starts_section;          // PCAP-NG section header block
+    bool describes_interface;     // PCAP-NG interface description block
+    uint64_t timestamp;           // seconds since the epoch
+};
+
+// class capture_scanner walks through a packet capture file in either
+// the PCAP or PCAP-NG format, and returns a capture_record for each
+// record or block in the file.  Unlike pcap::file_reader, it retains
+// the location of each record and its timestamp, and it handles
+// multiple sections and interfaces in PCAP-NG files, which it walks
+// with a pcap::ng::block_scanner.
+//
+class capture_scanner {
+    datum file;
+    bool ng = false;
+    bool byteswap = false;
+    uint16_t linktype = pcap::LINKTYPE::NONE;
+    pcap::ng::block_scanner blocks;
+    uint64_t last_timestamp = 0;
+    datum file_header;
+
+    uint32_t get_uint32(const uint8_t *p) const {
+        uint32_t x;
+        memcpy(&x, p, sizeof(x));
+        return byteswap ? __builtin_bswap32(x) : x;
+    }
+
+    bool next_pcap(capture_record &r) {
+        if (file.length() < 16) {
+            return false;
+        }
+        const uint8_t *p = file.data;
+        uint32_t caplen = get_uint32(p + 8);
+        if (caplen > file.length() - 16) {
+            fprintf(stderr, "warning: truncated packet record at end of file\n");
+            return false;
+        }
+        r = { p, 16 + caplen, p + 16, caplen, linktype, false, false, get_uint32(p) };
+        file.skip(16 + caplen);
+        return true;
+    }
+
+    bool next_pcapng(capture_record &r) {
+        pcap::ng::block_scanner::block b;
+        if (!blocks.next(b)) {
+            if (blocks.remaining() != 0) {
+                fprintf(stderr, "warning: invalid or truncated block at end of file\n");
+            }
+            return false;
+        }
+        r = { b.data, b.length, nullptr, 0, pcap::LINKTYPE::NONE, false, false, last_timestamp };
+        if (b.type == pcap::ng::section_header_block::type) {
+            r.starts_section = true;
+        } else if (b.type == pcap::ng::interface_description) {
+            r.describes_interface = true;
+        } else if (pcap::ng::block_scanner::is_packet(b.type)) {
+            pcap::ng::block_scanner::packet pkt;
+            if (blocks.decode(b, pkt)) {
+                r.packet = pkt.data;
+                r.packet_length = pkt.caplen;
+                r.linktype = pkt.linktype;
+                if (b.type != pcap::ng::simple_packet && b.interface != pcap::ng::block_scanner::no_interface) {
+                    r.timestamp = last_timestamp = pkt.ts.tv_sec;
+                }
+            }
+        }
+        return true;
+    }
+
+public:
+
+    capture_scanner(datum f) : file{f}, blocks{f} {
+        uint32_t magic = 0;
+        if (file.length() >= 4) {
+            memcpy(&magic, file.data, sizeof(magic));
+        }
+        if (magic == pcap::ng::section_header_block::type) {
+            ng = true;
+            return;
+        }
+        if (file.length() < 24) {
+            throw std::runtime_error("file too short for a pcap file header");
+        }
+        if (magic == pcap::magic_values::magic || magic == pcap::magic_values::magic_nsec) {
+            byteswap = false;
+        } else if (magic == __builtin_bswap32(pcap::magic_values::magic) || magic == __builtin_bswap32(pcap::magic_values::magic_nsec)) {
+            byteswap = true;
+        } else {
+            throw std::runtime_error("unrecognized file format");
+        }
+        linktype = get_uint32(file.data + 20) & 0xffff;
+        file_header = datum{file.data, file.data + 24};
+        file.skip(24);
+    }
+
+    bool is_pcapng() const { return ng; }
+
+    // get_file_header() returns the file header of a PCAP file, which
+    // must be written at the start of each output file; PCAP-NG files
+    // have no file header, and their section header blocks are
+    // returned by next() instead
+    //
+    datum get_file_header() const { return file_header; }
+
+    bool next(capture_record &r) {
+        return ng ? next_pcapng(r) : next_pcap(r);
+    }
+
+};
+
+// class packet_classifier decides whether a packet should be written
+// out, and if so, to which output.  It applies an optional protocol
+// selection (using a traffic_selector, as in mercury) and optional
+// address and port predicates on the flow key, and then maps the
+// packet to an output tag according to the split type.  It is not
+// changed by classify(), so a single instance can be used by all of
+// the worker threads.
+//
+class packet_classifier {
+public:
+
+    enum class split_type { none, protocol, flow, time };
+
+    static constexpr uint64_t discard = UINT64_MAX;
+
+private:
+
+    std::unique_ptr<traffic_selector> selector;
+    bool invert;
+    split_type split;
+    uint64_t split_param;           // number of flow outputs, or window length in seconds
+    uint8_t addr_vers = 0;
+    uint8_t addr[16] = { 0, };
+    uint16_t port = 0;
+
+    // protocol tags: tcp message types map to themselves, udp message
+    // types to udp_base + type, and zero means 'unknown'
+    //
+    static constexpr uint64_t tcp_syn_tag     = 62;
+    static constexpr uint64_t tcp_syn_ack_tag = 63;
+    static constexpr uint64_t udp_base        = 64;
+
+    bool address_matches(const key &k) const {
+        if (addr_vers == 0) {
+            return true;
+        }
+        if (k.ip_vers != addr_vers) {
+            return false;
+        }
+        if (addr_vers == 4) {
+            return memcmp(&k.addr.ipv4.src, addr, 4) == 0 || memcmp(&k.addr.ipv4.dst, addr, 4) == 0;
+        }
+        return memcmp(&k.addr.ipv6.src, addr, 16) == 0 || memcmp(&k.addr.ipv6.dst, addr, 16) == 0;
+    }
+
+public:
+
+    packet_classifier(const std::string &protocols, bool nonmatching, split_type s, uint64_t param) :
+        invert{nonmatching},
+        split{s},
+        split_param{param}
+    {
+        if (!protocols.empty()) {
+            std::map<std::string, bool> selection;
+            size_t start = 0;
+            while (start <= protocols.length()) {
+                size_t end = protocols.find(',', start);
+                if (end == std::string::npos) {
+                    end = protocols.length();
+                }
+                if (end > start) {
+                    selection[protocols.substr(start, end - start)] = true;
+                }
+                start = end + 1;
+            }
+            selector = std::make_unique<traffic_selector>(selection);
+        }
+    }
+
+    // set_address(a) restricts the selection to packets with a source
+    // or destination address of a, and returns false if a is not a
+    // valid IPv4 or IPv6 address
+    //
+    bool set_address(const char *a) {
+        if (inet_pton(AF_INET, a, addr) == 1) {
+            addr_vers = 4;
+        } else if (inet_pton(AF_INET6, a, addr) == 1) {
+            addr_vers = 6;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void set_port(uint16_t p) { port = p; }
+
+    uint64_t classify(const capture_record &r) const {
+
+        datum pkt{r.packet, r.packet + r.packet_length};
+        key k;
+        uint64_t protocol_tag = 0;
+        bool is_ip = false;
+
+        bool ip_packet = false;
+        switch(r.linktype) {
+        case pcap::LINKTYPE::ETHERNET:
+            {
+                eth ethernet{pkt};
+                uint16_t ethertype = ethernet.get_ethertype();
+                ip_packet = (ethertype == ETH_TYPE_IP || ethertype == ETH_TYPE_IPV6);
+            }
+            break;
+        case pcap::LINKTYPE::NULL_:
+            ip_packet = pkt.skip(4);
+            break;
+        case pcap::LINKTYPE::RAW:
+            ip_packet = true;
+            break;
+        default:
+            ;
+        }
+
+        if (ip_packet) {
+            ip ip_pkt{pkt, k};
+            is_ip = (k.ip_vers != 0);
+            ip::protocol protocol = ip_pkt.transport_protocol();
+            if (protocol == ip::protocol::tcp) {
+                tcp_packet tcp{pkt, &ip_pkt};
+                tcp.set_key(k);
+                if (selector && tcp.header) {
+                    if (selector->tcp_syn() && tcp.is_SYN()) {
+                        protocol_tag = tcp_syn_tag;
+                    } else if (selector->tcp_syn_ack() && tcp.is_SYN_ACK()) {
+                        protocol_tag = tcp_syn_ack_tag;
+                    } else {
+                        protocol_tag = selector->get_tcp_msg_type(pkt);
+                        if (protocol_tag == tcp_msg_type_unknown) {
+                            protocol_tag = selector->get_tcp_msg_type_from_ports(&tcp);
+                        }
+                        if (protocol_tag == tcp_msg_type_dns) {
+                            protocol_tag = udp_base + udp_msg_type_dns;  // write DNS over TCP and UDP together
+                        }
+                    }
+                }
+            } else if (protocol == ip::protocol::udp) {
+                class udp udp_pkt{pkt};
+                udp_pkt.set_key(k);
+                if (selector) {
+                    size_t type = selector->get_udp_msg_type(pkt);
+                    if (type == udp_msg_type_unknown) {
+                        type = selector->get_udp_msg_type_from_ports(udp_pkt.get_ports());
+                    }
+                    if (type != udp_msg_type_unknown) {
+                        protocol_tag = udp_base + type;
+                    }
+                }
+            }
+        }
+
+        bool match = (selector == nullptr || protocol_tag != 0)
+            && address_matches(k)
+            && (port == 0 || (is_ip && (k.src_port == port || k.dst_port == port)));
+        if (match == invert) {
+            return discard;
+        }
+
+        switch(split) {
+        case split_type::protocol:
+            return protocol_tag;
+        case split_type::flow:
+            return is_ip ? 1 + std::hash<key>{}(k) % split_param : 0;
+        case split_type::time:
+            return r.timestamp / split_param;
+        case split_type::none:
+        default:
+            ;
+        }
+        return 0;
+    }
+
+    // get_name(tag) returns the name used for the output file for
+    // the output tag returned by classify()
+    //
+    std::string get_name(uint64_t tag) const {
+        switch(split) {
+        case split_type::protocol:
+            return protocol_name(tag);
+        case split_type::flow:
+            return tag == 0 ? "other" : "flow" + std::to_string(tag - 1);
+        case split_type::time:
+            return std::to_string(tag * split_param);
+        case split_type::none:
+        default:
+            ;
+        }
+        return "";
+    }
+
+    split_type get_split_type() const { return split; }
+
+    static const char *protocol_name(uint64_t tag) {
+        switch(tag) {
+        case tcp_msg_type_http_request:           return "http.request";
+        case tcp_msg_type_http_response:          return "http.response";
+        case tcp_msg_type_tls_client_hello:       return "tls.client_hello";
+        case tcp_msg_type_tls_server_hello:       return "tls.server_hello";
+        case tcp_msg_type_tls_certificate:        return "tls.certificate";
+        case tcp_msg_type_ssh:                    return "ssh";
+        case tcp_msg_type_ssh_kex:                return "ssh.kex";
+        case tcp_msg_type_smtp_client:            return "smtp.client";
+        case tcp_msg_type_smtp_server:            return "smtp.server";
+        case tcp_msg_type_smb1:                   return "smb1";
+        case tcp_msg_type_smb2:                   return "smb2";
+        case tcp_msg_type_iec:                    return "iec";
+        case tcp_msg_type_dnp3:                   return "dnp3";
+        case tcp_msg_type_nbss:                   return "nbss";
+        case tcp_msg_type_openvpn:                return "openvpn_tcp";
+        case tcp_msg_type_bittorrent:             return "bittorrent";
+        case tcp_msg_type_mysql_server:           return "mysql.server";
+        case tcp_msg_type_tofsee_initial_message: return "tofsee";
+        case tcp_syn_tag:                         return "tcp.syn";
+        case tcp_syn_ack_tag:                     return "tcp.syn_ack";
+        case udp_base + udp_msg_type_dns:               return "dns";
+        case udp_base + udp_msg_type_dhcp:              return "dhcp";
+        case udp_base + udp_msg_type_dtls_client_hello: return "dtls.client_hello";
+        case udp_base + udp_msg_type_dtls_server_hello: return "dtls.server_hello";
+        case udp_base + udp_msg_type_dtls_certificate:  return "dtls.certificate";
+        case udp_base + udp_msg_type_wireguard:         return "wireguard";
+        case udp_base + udp_msg_type_quic:              return "quic";
+        case udp_base + udp_msg_type_vxlan:             return "vxlan";
+        case udp_base + udp_msg_type_ssdp:              return "ssdp";
+        case udp_base + udp_msg_type_stun:              return "stun";
+        case udp_base + udp_msg_type_nbds:              return "nbds";
+        case udp_base + udp_msg_type_dht:               return "bittorrent.dht";
+        case udp_base + udp_msg_type_lsd:               return "bittorrent.lsd";
+        default:
+            ;
+        }
+        return "other";
+    }
+
+};
+
+// class buffered_output writes an output file through a large buffer,
+// so that data reaches the operating system in a small number of
+// large write() calls, regardless of the size of the packets
+//
+class buffered_output {
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t used = 0;
+
+    void write_all(const uint8_t *data, size_t len) {
+        while (len > 0) {
+            ssize_t result = ::write(fd, data, len);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw errno_exception();
+            }
+            data += result;
+            len -= result;
+        }
+    }
+
+public:
+
+    buffered_output(const std::string &filename, bool append, size_t buffer_size) :
+        fd{open(filename.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)},
+        buffer(buffer_size)
+    {
+        if (fd < 0) {
+            throw errno_exception();
+        }
+    }
+
+    buffered_output(const buffered_output &) = delete;
+
+    ~buffered_output() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    void write(const uint8_t *data, size_t len) {
+        if (used + len > buffer.size()) {
+            flush();
+            if (len > buffer.size()) {
+                write_all(data, len);
+                return;
+            }
+        }
+        memcpy(buffer.data() + used, data, len);
+        used += len;
+    }
+
+    void flush() {
+        write_all(buffer.data(), used);
+        used = 0;
+    }
+
+    // close() writes out any buffered data and closes the file
+    //
+    void close() {
+        flush();
+        if (::close(fd) != 0) {
+            fd = -1;
+            throw errno_exception();
+        }
+        fd = -1;
+    }
+
+};
+
+// class capture_splitter reads a packet capture file, classifies its
+// packets in parallel, and writes each packet to the output file
+// chosen by a packet_classifier.  The input file is scanned on the
+// calling thread, which hands batches of records to a set of worker
+// threads for classification; a writer thread then writes the
+// batches out in their original order, so that the packets in each
+// output file appear in the same order as in the input file.  Blocks
+// that do not hold packets (in PCAP-NG files) are written to every
+// open output file.
+//
+class capture_splitter {
+
+    struct batch {
+        std::vector<capture_record> records;
+        std::vector<uint64_t> tags;
+        std::vector<uint8_t> preamble;       // file header, in first batch
+        size_t sequence;
+    };
+
+    struct output_file {
+        std::unique_ptr<buffered_output> out;
+        uint64_t packets = 0;
+    };
+
+    const packet_classifier &classifier;
+    std::string output_name;
+    std::string extension;
+    size_t num_workers;
+
+    static constexpr size_t batch_size = 8192;
+    static constexpr size_t output_buffer_size = 1 << 20;
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<batch *> free_batches;
+    std::deque<batch *> work;
+    std::map<size_t, batch *> done;
+    bool finished_reading = false;
+
+    // state used only by the writer thread
+    //
+    std::map<uint64_t, output_file> outputs;
+    std::vector<uint8_t> preamble;
+    uint64_t newest_window = 0;
+    std::string error;
+
+    std::string get_filename(uint64_t tag) const {
+        if (classifier.get_split_type() == packet_classifier::split_type::none) {
+            return output_name;
+        }
+        return output_name + "." + classifier.get_name(tag) + extension;
+    }
+
+    output_file &get_output(uint64_t tag) {
+        auto it = outputs.find(tag);
+        if (it != outputs.end() && it->second.out) {
+            return it->second;
+        }
+        bool reopen = (it != outputs.end());
+        output_file &o = outputs[tag];
+        o.out = std::make_unique<buffered_output>(get_filename(tag), reopen, output_buffer_size);
+        if (!reopen) {
+            o.out->write(preamble.data(), preamble.size());
+        }
+        return o;
+    }
+
+    // write_batch(b) writes out the records in b; in time split mode,
+    // the outputs for time windows that are more than one window older
+    // than the newest one are closed, so that the number of open files
+    // stays small, and reopened if a late packet arrives
+    //
+    void write_batch(batch &b) {
+        if (!b.preamble.empty()) {
+            preamble = b.preamble;
+        }
+        if (b.sequence == 0 && classifier.get_split_type() == packet_classifier::split_type::none) {
+            get_output(0);     // create the output file even if no packets are selected
+        }
+        bool time_split = classifier.get_split_type() == packet_classifier::split_type::time;
+        for (size_t i = 0; i < b.records.size(); i++) {
+            const capture_record &r = b.records[i];
+            if (r.packet == nullptr) {
+                if (r.starts_section) {
+                    preamble.assign(r.bytes, r.bytes + r.length);
+                } else if (r.describes_interface) {
+                    preamble.insert(preamble.end(), r.bytes, r.bytes + r.length);
+                }
+                for (auto &o : outputs) {
+                    if (o.second.out) {
+                        o.second.out->write(r.bytes, r.length);
+                    }
+                }
+                continue;
+            }
+            uint64_t tag = b.tags[i];
+            if (tag == packet_classifier::discard) {
+                continue;
+            }
+            output_file &o = get_output(tag);
+            o.out->write(r.bytes, r.length);
+            o.packets++;
+            if (time_split && tag > newest_window) {
+                newest_window = tag;
+                for (auto &old : outputs) {
+                    if (old.first + 1 < newest_window && old.second.out) {
+                        old.second.out->close();
+                        old.second.out.reset();
+                    }
+                }
+            }
+        }
+    }
+
+    void run_worker() {
+        while (true) {
+            batch *b = nullptr;
+            {
+                std::unique_lock lock{m};
+                cv.wait(lock, [this]() { return !work.empty() || finished_reading; });
+                if (work.empty()) {
+                    return;
+                }
+                b = work.front();
+                work.pop_front();
+            }
+            b->tags.resize(b->records.size());
+            for (size_t i = 0; i < b->records.size(); i++) {
+                const capture_record &r = b->records[i];
+                b->tags[i] = r.packet ? classifier.classify(r) : packet_classifier::discard;
+            }
+            {
+                std::lock_guard lock{m};
+                done[b->sequence] = b;
+            }
+            cv.notify_all();
+        }
+    }
+
+    void run_writer(size_t &num_batches) {
+        size_t next = 0;
+        while (true) {
+            batch *b = nullptr;
+            {
+                std::unique_lock lock{m};
+                cv.wait(lock, [this, next, &num_batches]() {
+                    return done.count(next) || (finished_reading && next == num_batches);
+                });
+                auto it = done.find(next);
+                if (it == done.end()) {
+                    break;
+                }
+                b = it->second;
+                done.erase(it);
+            }
+            if (error.empty()) {
+                try {
+                    write_batch(*b);
+                }
+                catch (std::exception &e) {
+                    error = e.what();
+                }
+            }
+            ++next;
+            {
+                std::lock_guard lock{m};
+                free_batches.push_back(b);
+            }
+            cv.notify_all();
+        }
+        try {
+            for (auto &o : outputs) {
+                if (o.second.out) {
+                    o.second.out->close();
+                }
+            }
+        }
+        catch (std::exception &e) {
+            error = e.what();
+        }
+    }
+
+public:
+
+    capture_splitter(const packet_classifier &c, const std::string &output, bool pcapng, size_t threads) :
+        classifier{c},
+        output_name{output},
+        extension{pcapng ? ".pcapng" : ".pcap"},
+        num_workers{threads ? threads : 1}
+    {
+        if (output_name.length() > extension.length()
+            && output_name.compare(output_name.length() - extension.length(), extension.length(), extension) == 0
+            && classifier.get_split_type() != packet_classifier::split_type::none) {
+            output_name.erase(output_name.length() - extension.length());
+        }
+    }
+
+    // run(scanner) splits the capture file read by scanner, and returns
+    // the total number of packets read; it throws an exception if an
+    // output file could not be written, or if the input is malformed,
+    // in which case the packets read before the malformed record are
+    // written out first
+    //
+    uint64_t run(capture_scanner &scanner) {
+
+        std::vector<batch> batches(2 * num_workers + 2);
+        for (auto &b : batches) {
+            b.records.reserve(batch_size);
+            free_batches.push_back(&b);
+        }
+        size_t num_batches = 0;
+        std::thread writer{[this, &num_batches]() { run_writer(num_batches); }};
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < num_workers; i++) {
+            workers.emplace_back([this]() { run_worker(); });
+        }
+
+        uint64_t total = 0;
+        bool more = true;
+        std::exception_ptr read_error;
+        while (more) {
+            batch *b = nullptr;
+            {
+                std::unique_lock lock{m};
+                cv.wait(lock, [this]() { return !free_batches.empty(); });
+                b = free_batches.front();
+                free_batches.pop_front();
+            }
+            b->records.clear();
+            b->preamble.clear();
+            if (num_batches == 0) {
+                datum header = scanner.get_file_header();
+                b->preamble.assign(header.data, header.data_end);
+            }
+            b->sequence = num_batches;
+            capture_record r;
+            try {
+                while (b->records.size() < batch_size && (more = scanner.next(r))) {
+                    b->records.push_back(r);
+                    total += (r.packet != nullptr);
+                }
+            }
+            catch (...) {
+                read_error = std::current_exception();   // rethrown after the threads are joined
+                more = false;
+            }
+            {
+                std::lock_guard lock{m};
+                work.push_back(b);
+                ++num_batches;
+                if (!more) {
+                    finished_reading = true;
+                }
+            }
+            cv.notify_all();
+        }
+
+        for (auto &w : workers) {
+            w.join();
+        }
+        writer.join();
+
+        if (read_error) {
+            std::rethrow_exception(read_error);
+        }
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+        return total;
+    }
+
+    // print_summary(f) prints the number of packets written to each
+    // output file
+    //
+    void print_summary(FILE *f) const {
+        for (const auto &o : outputs) {
+            fprintf(f, "%s:\t%" PRIu64 " packets\n", get_filename(o.first).c_str(), o.second.packets);
+        }
+    }
+
+};
+
+// split_capture_file() implements the filter and split mode of
+// pcap_filter
+//
+int split_capture_file(const std::string &input_file,
+                       const std::string &output_file,
+                       const packet_classifier &classifier,
+                       size_t threads,
+                       bool verbose) {
+    try {
+        file_datum input{input_file.c_str()};
+        capture_scanner scanner{input};
+        capture_splitter splitter{classifier, output_file, scanner.is_pcapng(), threads};
+        uint64_t total = splitter.run(scanner);
+        if (verbose) {
+            splitter.print_summary(stdout);
+        }
+        fprintf(stdout, "total packet count:     %" PRIu64 "\n", total);
+    }
+    catch (std::exception &e) {
+        fprintf(stderr, "error processing pcap_file %s (%s)\n", input_file.c_str(), e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
 
-    const char summary[] = "usage: %s --input <infile> --output <outfile>\n\n";
+    const char summary[] =
+        "usage: %s --input <infile> --output <outfile> [OPTIONS]\n"
+        "\n"
+        "If none of --select, --split, --address, or --port is given, the\n"
+        "packets of each of the protocols dns, quic, tls.client_hello, and\n"
+        "http.request are written to <proto>.<outfile>.pcap.  Otherwise,\n"
+        "the selected packets are written to <outfile>, or, if --split is\n"
+        "given, to <outfile>.<name>.pcap[ng], where <name> is the protocol,\n"
+        "flow number, or start time of the time window.  The output files\n"
+        "have the same format as the input file.\n"
+        "\n"
+        "OPTIONS\n";
 
     class option_processor opt({{ argument::required, "--input",       "input file" },
                                 { argument::required, "--output",      "output file" },
                                 { argument::none,     "--json",        "output JSON representation"},
-                                { argument::none,     "--nonmatching", "output non-matching packets"}});
+                                { argument::none,     "--nonmatching", "output non-matching packets"},
+                                { argument::required, "--select",      "select packets of protocols in comma-separated list <arg>" },
+                                { argument::required, "--address",     "select packets with source or destination address <arg>" },
+                                { argument::required, "--port",        "select packets with source or destination port <arg>" },
+                                { argument::required, "--split",       "split output by protocol, flow:<n>, or time:<seconds>" },
+                                { argument::required, "--threads",     "use <arg> threads to classify packets" },
+                                { argument::none,     "--verbose",     "report the number of packets in each output file" }});
 
     if (!opt.process_argv(argc, argv)) {
         opt.usage(stderr, argv[0], summary);
@@ -49,25 +814,89 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    auto [ select_is_set, select ] = opt.get_value("--select");
+    auto [ address_is_set, address ] = opt.get_value("--address");
+    auto [ port_is_set, port ] = opt.get_value("--port");
+    auto [ split_is_set, split ] = opt.get_value("--split");
+    auto [ threads_is_set, threads ] = opt.get_value("--threads");
+    if (select_is_set || address_is_set || port_is_set || split_is_set) {
+
+        packet_classifier::split_type split_type = packet_classifier::split_type::none;
+        uint64_t split_param = 0;
+        if (split_is_set) {
+            size_t colon = split.find(':');
+            std::string type = split.substr(0, colon);
+            if (colon != std::string::npos) {
+                split_param = strtoull(split.c_str() + colon + 1, nullptr, 10);
+            }
+            if (type == "protocol") {
+                split_type = packet_classifier::split_type::protocol;
+                if (!select_is_set) {
+                    select = "all";
+                }
+            } else if (type == "flow" && split_param > 0) {
+                split_type = packet_classifier::split_type::flow;
+            } else if (type == "time" && split_param > 0) {
+                split_type = packet_classifier::split_type::time;
+            } else {
+                fprintf(stderr, "error: invalid --split argument '%s'\n", split.c_str());
+                return EXIT_FAILURE;
+            }
+        }
+        packet_classifier classifier{select, nonmatching, split_type, split_param};
+        if (address_is_set && !classifier.set_address(address.c_str())) {
+            fprintf(stderr, "error: invalid address '%s'\n", address.c_str());
+            return EXIT_FAILURE;
+        }
+        if (port_is_set) {
+            unsigned long p = strtoul(port.c_str(), nullptr, 10);
+            if (p == 0 || p > UINT16_MAX) {
+                fprintf(stderr, "error: invalid port '%s'\n", port.c_str());
+                return EXIT_FAILURE;
+            }
+            classifier.set_port(p);
+        }
+        size_t num_threads = std::thread::hardware_concurrency();
+        if (threads_is_set) {
+            num_threads = strtoul(threads.c_str(), nullptr, 10);
+        }
+        return split_capture_file(input_file, output_file, classifier, num_threads, opt.is_set("--verbose"));
+    }
+
     quic_crypto_engine quic_crypto{}; // initialize quic_crypto_engine for quic decryption
 
     size_t i=0, total=0, transport=0;
     try {
 
-        // create input and output pcap files
+        // map the input file, and create output files with the same
+        // file header
         //
-        struct pcap_file pcap(input_file.c_str(), io_direction_reader);
-        struct pcap_file dns_out(("dns." + output_file + ".pcap").c_str(), io_direction_writer);
-        struct pcap_file bad_dns_out(("bad_dns." + output_file + ".pcap").c_str(), io_direction_writer);
-        struct pcap_file quic_out(("quic." + output_file + ".pcap").c_str(), io_direction_writer);
-        struct pcap_file tls_out(("tls.client_hello." + output_file + ".pcap").c_str(), io_direction_writer);
-        struct pcap_file http_out(("http.request." + output_file + ".pcap").c_str(), io_direction_writer);
-
-        packet<65536> pkt;
-        while (true) {
-            datum pkt_data = pkt.get_next(pcap);
-            if (!pkt_data.is_not_empty()) {
-                break;
+        file_datum input{input_file.c_str()};
+        capture_scanner scanner{input};
+        constexpr size_t buffer_size = 1 << 20;
+        buffered_output dns_out{"dns." + output_file + ".pcap", false, buffer_size};
+        buffered_output bad_dns_out{"bad_dns." + output_file + ".pcap", false, buffer_size};
+        buffered_output quic_out{"quic." + output_file + ".pcap", false, buffer_size};
+        buffered_output tls_out{"tls.client_hello." + output_file + ".pcap", false, buffer_size};
+        buffered_output http_out{"http.request." + output_file + ".pcap", false, buffer_size};
+        buffered_output *outputs[] = { &dns_out, &bad_dns_out, &quic_out, &tls_out, &http_out };
+        datum header = scanner.get_file_header();
+        for (auto *o : outputs) {
+            o->write(header.data, header.length());
+        }
+
+        capture_record r;
+        while (scanner.next(r)) {
+            if (r.packet == nullptr) {
+                for (auto *o : outputs) {
+                    o->write(r.bytes, r.length);   // pcapng section or interface block
+                }
+                continue;
+            }
+            datum pkt_data{r.packet, r.packet + r.packet_length};
+            if (r.linktype != pcap::LINKTYPE::ETHERNET || !pkt_data.is_not_empty()) {
+                ++total;
+                continue;
             }
 
             datum pkt_data_copy = pkt_data; // temporary copy
@@ -78,7 +907,7 @@ int main(int argc, char *argv[]) {
                 datum udp_data_copy = udp_data;
                 dns_packet dns{udp_data_copy};
                 if (dns.is_not_empty() == expected_value) {
-                    pkt.write(dns_out);
+                    dns_out.write(r.bytes, r.length);
 
                     // verify that this PDU matches the appropriate bitmask
                     if (dns_packet::matcher.matches(udp_data.data, udp_data.length()) == false) {
@@ -89,7 +918,7 @@ int main(int argc, char *argv[]) {
                         fprintf(stderr, "nonmatching:                                    \t");
                         for (const auto &c : x) { fprintf(stderr, "%02x", c); }
                         fputc('\n', stderr);
-                        pkt.write(bad_dns_out);
+                        bad_dns_out.write(r.bytes, r.length);
                     }
 
                     ++i;
@@ -110,7 +939,7 @@ int main(int argc, char *argv[]) {
                         buf.write_line(stdout);
                     }
 
-                    pkt.write(quic_out);
+                    quic_out.write(r.bytes, r.length);
 
                     // verify that this PDU matches the appropriate bitmask
                     if (quic_initial_packet::matcher.matches(udp_data.data, udp_data.length()) == false) {
@@ -135,7 +964,7 @@ int main(int argc, char *argv[]) {
                         tls_client_hello client_hello;
                         client_hello.parse(handshake.body);
                         if (client_hello.is_not_empty() == expected_value) {
-                            pkt.write(tls_out);
+                            tls_out.write(r.bytes, r.length);
 
                             // verify that this PDU matches the appropriate bitmask
                             if (tls_client_hello::matcher.matches(tcp_data.data, tcp_data.length()) == false) {
@@ -150,7 +979,7 @@ int main(int argc, char *argv[]) {
                 tcp_data_copy = tcp_data;
                 http_request request{tcp_data_copy};
                 if (request.is_not_empty() == expected_value) {
-                    pkt.write(http_out);
+                    http_out.write(r.bytes, r.length);
 
                     // verify that this PDU matches the appropriate bitmask
                     if (http_request::matcher.matches(tcp_data.data, tcp_data.length()) == false) {
@@ -164,6 +993,9 @@ int main(int argc, char *argv[]) {
 
             ++total;
         }
+        for (auto *o : outputs) {
+            o->close();
+        }
     }
     catch (std::exception &e) {
         fprintf(stderr, "error processing pcap_file %s (%s)\n", input_file.c_str(), e.what());
@@ -6,9 +6,15 @@
  */
 
 #include <errno.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 #include "pcap_reader.h"
 #include "output.h"
 #include "pkt_processing.h"
+#include "flow_capture.hpp"
+#include "pcap.h"
 #include "libmerc/utils.h"
 
 extern int sig_close_flag;  // defined in signal_handling.c
@@ -64,6 +70,247 @@ void *pcap_file_processing_thread_func(void *userdata) {
     return NULL;
 }
 
+// class pcapng_dispatcher feeds the packets of an indexed PCAP-NG
+// file to a pool of packet processors, each of which runs in its own
+// thread and writes to its own output queue.  Packets are sharded by
+// their bidirectional flow key, so that all of the packets of a flow
+// go to the same processor, in the order in which they appear in the
+// file.
+//
+// The packet index is divided into chunks, which are decoded and
+// sharded by a set of decoder threads, in parallel, into a ring of
+// slots; each processor thread works through the slots in chunk
+// order, and processes the packets of its own shard.  A slot is
+// reused once every processor is done with it, which bounds the
+// number of chunks in flight.  Packet data is never copied, since
+// the decoded packets point into the (memory mapped) file.
+//
+class pcapng_dispatcher {
+    static constexpr size_t chunk_size = 4096;
+
+    struct slot {
+        size_t chunk;                // chunk that this slot holds or will hold next
+        bool ready = false;
+        size_t pending = 0;          // number of processors that have not yet used slot
+        std::vector<std::vector<pcap::ng::block_index::packet>> shards;
+    };
+
+    const pcap::ng::block_index &index;
+    std::vector<struct pkt_proc *> &processors;
+    const decapsulator tunnels;      // as configured for the processors
+    size_t num_chunks;               // per pass over the file
+    size_t last_chunk;               // chunks in all passes, or fewer if stopped
+    size_t next_chunk = 0;
+    std::vector<slot> slots;
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<uint64_t> bytes;
+    std::vector<uint64_t> packets;
+
+    void decode(size_t chunk, slot &s) {
+        size_t shards = processors.size();
+        for (auto &v : s.shards) {
+            v.clear();
+        }
+        size_t begin = (chunk % num_chunks) * chunk_size;
+        size_t end = std::min(begin + chunk_size, index.size());
+        pcap::ng::block_index::packet pkt;
+        for (size_t i = begin; i < end; i++) {
+            if (!index.decode(i, pkt)) {
+                continue;
+            }
+            size_t shard = 0;
+            if (shards > 1) {
+                key k = get_flow_key(pkt.data, pkt.caplen, pkt.linktype, tunnels);
+                if (!k.is_zero()) {
+                    shard = std::hash<key>{}(flow_capture_buffer::canonical_key(k)) % shards;
+                }
+            }
+            s.shards[shard].push_back(pkt);
+        }
+    }
+
+    void run_decoder() {
+        while (true) {
+            size_t chunk;
+            slot *s;
+            {
+                std::unique_lock lock{m};
+                if (sig_close_flag) {
+                    last_chunk = std::min(last_chunk, next_chunk);
+                    cv.notify_all();
+                }
+                if (next_chunk >= last_chunk) {
+                    return;
+                }
+                chunk = next_chunk++;
+                s = &slots[chunk % slots.size()];
+                cv.wait(lock, [s, chunk]() { return s->chunk == chunk && !s->ready; });
+            }
+            decode(chunk, *s);
+            {
+                std::lock_guard lock{m};
+                s->ready = true;
+                s->pending = processors.size();
+            }
+            cv.notify_all();
+        }
+    }
+
+    void run_processor(size_t shard) {
+        struct pkt_proc *processor = processors[shard];
+        struct packet_info pi;
+        for (size_t chunk = 0; ; chunk++) {
+            slot *s = &slots[chunk % slots.size()];
+            {
+                std::unique_lock lock{m};
+                cv.wait(lock, [this, s, chunk]() { return (s->chunk == chunk && s->ready) || chunk >= last_chunk; });
+                if (chunk >= last_chunk) {
+                    break;
+                }
+            }
+            for (const auto &pkt : s->shards[shard]) {
+                pi.ts = pkt.ts;
+                pi.caplen = pkt.caplen;
+                pi.len = pkt.len;
+                pi.linktype = pkt.linktype;
+                processor->apply(&pi, (uint8_t *)pkt.data);
+                bytes[shard] += pkt.caplen;
+                packets[shard]++;
+            }
+            {
+                std::lock_guard lock{m};
+                if (--s->pending == 0) {
+                    s->ready = false;
+                    s->chunk += slots.size();
+                }
+            }
+            cv.notify_all();
+        }
+    }
+
+public:
+
+    pcapng_dispatcher(const pcap::ng::block_index &idx, std::vector<struct pkt_proc *> &procs, int loop_count, const decapsulator &d) :
+        index{idx},
+        processors{procs},
+        tunnels{d},
+        num_chunks{(idx.size() + chunk_size - 1) / chunk_size},
+        last_chunk{num_chunks * loop_count},
+        slots(2 * procs.size() + 2),
+        bytes(procs.size(), 0),
+        packets(procs.size(), 0)
+    {
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].chunk = i;
+            slots[i].shards.resize(procs.size());
+        }
+    }
+
+    // run() processes all of the packets, and returns once every
+    // processor has seen all of the packets in its shard
+    //
+    void run() {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < processors.size(); i++) {
+            threads.emplace_back(&pcapng_dispatcher::run_decoder, this);
+        }
+        for (size_t i = 0; i < processors.size(); i++) {
+            threads.emplace_back(&pcapng_dispatcher::run_processor, this, i);
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    uint64_t bytes_processed(size_t shard) const { return bytes[shard]; }
+
+    uint64_t packets_processed(size_t shard) const { return packets[shard]; }
+
+};
+
+// is_pcapng_file(filename) returns true if the file filename starts
+// with a PCAP-NG section header block
+//
+static bool is_pcapng_file(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (f == nullptr) {
+        return false;
+    }
+    uint8_t prefix[4];
+    bool result = fread(prefix, 1, sizeof(prefix), f) == sizeof(prefix)
+        && memcmp(prefix, "\x0a\x0d\x0d\x0a", sizeof(prefix)) == 0;
+    fclose(f);
+    return result;
+}
+
+// open_and_dispatch_pcapng() reads a PCAP-NG file, and processes its
+// packets with cfg->num_threads packet processors, each of which
+// writes to its own output queue
+//
+static enum status open_and_dispatch_pcapng(struct mercury_config *cfg, mercury_context mc, struct output_file *of) {
+    struct timer t;
+    timer_start(&t);
+
+    char input_filename[FILENAME_MAX];
+    enum status status = filename_append(input_filename, cfg->read_filename, "/", NULL);
+    if (status) {
+        return status;
+    }
+
+    try {
+        file_datum file{input_filename};
+        pcap::ng::block_index index{file};
+
+        size_t num_processors = cfg->num_threads > 0 ? cfg->num_threads : 1;
+        std::vector<struct pkt_proc *> processors;
+        for (size_t i = 0; i < num_processors; i++) {
+            struct pkt_proc *p = pkt_proc_new_from_config(cfg, mc, i, &of->qs.queue[i]);
+            if (p == nullptr) {
+                printf("error: could not initialize frame handler\n");
+                for (auto &q : processors) {
+                    delete q;
+                }
+                return status_err;
+            }
+            processors.push_back(p);
+        }
+
+        /* Wake up output thread so it's polling the queues waiting for data */
+        of->t_output_p = 1;
+        int err = pthread_cond_broadcast(&(of->t_output_c)); /* Wake up output */
+        if (err != 0) {
+            printf("%s: error broadcasting all clear on output start condition\n", strerror(err));
+            exit(255);
+        }
+
+        pcapng_dispatcher dispatcher{index, processors, cfg->loop_count, mc->get_decapsulator()};
+        dispatcher.run();
+
+        uint64_t bytes_written = 0;
+        uint64_t packets_written = 0;
+        for (size_t i = 0; i < processors.size(); i++) {
+            processors[i]->finalize();
+            bytes_written += dispatcher.bytes_processed(i);
+            packets_written += dispatcher.packets_processed(i);
+            delete processors[i];
+        }
+
+        u_int64_t nano_seconds = timer_stop(&t);
+        if (cfg->verbosity) {
+            double byte_rate = ((double)bytes_written * BILLION) / (double)nano_seconds;
+            double packet_rate = ((double)packets_written * BILLION) / (double)nano_seconds;
+            fprintf(stderr, "Packets processed: %" PRIu64 ", packets per second: %.4e, bytes processed: %" PRIu64 ", nano sec: %" PRIu64 ", bytes per second: %.4e\n",
+                    packets_written, packet_rate, bytes_written, nano_seconds, byte_rate);
+        }
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "error: could not read pcapng input file %s (%s)\n", cfg->read_filename, e.what());
+        return status_err;
+    }
+    return status_ok;
+}
+
 enum status open_and_dispatch(struct mercury_config *cfg, mercury_context mc, struct output_file *of) {
     enum status status;
     struct timer t;
@@ -71,6 +318,10 @@ enum status open_and_dispatch(struct mercury_config *cfg, mercury_context mc, st
 	u_int64_t bytes_written = 0;
 	u_int64_t packets_written = 0;
 
+    if (cfg->read_filename && is_pcapng_file(cfg->read_filename)) {
+        return open_and_dispatch_pcapng(cfg, mc, of);
+    }
+
     timer_start(&t); // get timestamp before we start processing
 
     struct pcap_reader_thread_context tc;
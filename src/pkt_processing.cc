@@ -34,8 +34,13 @@ struct pkt_proc *pkt_proc_new_from_config(struct mercury_config *cfg,
             }
 
             /*
-             * write (filtered, if configured that way) packets to capture file
+             * write the packets of interesting flows, if configured
+             * that way, or (filtered, if configured that way)
+             * packets to capture file
              */
+            if (cfg->capture_flows) {
+                return new pkt_proc_flow_capture_writer_llq(mc, llq, cfg->output_block, cfg->capture_flows);
+            }
             return new pkt_proc_filter_pcap_writer_llq(mc, llq, cfg->output_block);
 
         } else {
@@ -17,6 +17,7 @@
 #include "llq.h"
 #include "libmerc/libmerc.h"
 #include "libmerc/pkt_proc.h"
+#include "flow_capture.hpp"
 
 constexpr static size_t PREALLOC_SIZE = 65536;
 
@@ -164,6 +165,7 @@ struct pkt_proc_json_writer_llq : public pkt_proc {
     struct ll_queue *llq;
     bool block;
     mercury_packet_processor processor;
+    struct timespec last_ts{0, 0};
 
     /*
      * pkt_proc_json_writer(outfile_name, mode, max_records)
@@ -187,6 +189,7 @@ struct pkt_proc_json_writer_llq : public pkt_proc {
     }
 
     void apply(struct packet_info *pi, uint8_t *eth) override {
+        last_ts = pi->ts;
         struct llq_msg *msg = llq->init_msg(block, pi->ts.tv_sec, pi->ts.tv_nsec);
         if (msg) {
             size_t write_len = mercury_packet_processor_write_json_linktype(processor, msg->buf, LLQ_MSG_SIZE, eth, pi->len, &(msg->ts), pi->linktype);
@@ -198,6 +201,29 @@ struct pkt_proc_json_writer_llq : public pkt_proc {
     }
 
     void finalize() override {
+        // write out the os identification verdicts of any hosts
+        // that have not yet been reported, any SSH KEXINITs still
+        // waiting for their peers, and the records of any flows that
+        // have not yet ended
+        //
+        while (true) {
+            struct llq_msg *msg = llq->init_msg(block, last_ts.tv_sec, last_ts.tv_nsec);
+            if (msg == nullptr) {
+                break;
+            }
+            size_t write_len = mercury_packet_processor_write_os_identification(processor, msg->buf, LLQ_MSG_SIZE, &(msg->ts));
+            if (write_len == 0) {
+                write_len = mercury_packet_processor_write_ssh_kex(processor, msg->buf, LLQ_MSG_SIZE);
+            }
+            if (write_len == 0) {
+                write_len = mercury_packet_processor_write_flow_records(processor, msg->buf, LLQ_MSG_SIZE);
+            }
+            if (write_len == 0) {
+                break;
+            }
+            msg->send(write_len);
+            llq->increment_widx();
+        }
         mercury_packet_processor_destruct(processor);
     }
 
@@ -300,6 +326,62 @@ struct pkt_proc_filter_pcap_writer_llq : public pkt_proc {
 
 };
 
+/*
+ * struct pkt_proc_flow_capture_writer_llq represents a packet
+ * processing object that analyzes each packet, and writes out only
+ * the packets of flows that have an unknown fingerprint, a malware
+ * verdict, or an attribute (such as a watchlist hit).  The first
+ * packets of each flow are held in a flow_capture_buffer until the
+ * flow is found to be interesting, or is discarded.
+ */
+struct pkt_proc_flow_capture_writer_llq : public pkt_proc {
+    struct ll_queue *llq;
+    bool block;
+    struct stateful_pkt_proc processor;
+    flow_capture_buffer flows;
+
+    explicit pkt_proc_flow_capture_writer_llq(mercury_context mc,
+                                              struct ll_queue *llq_ptr,
+                                              bool blocking,
+                                              size_t packets_per_flow) :
+        block{blocking},
+        processor{mc, PREALLOC_SIZE},
+        flows{packets_per_flow}
+    {
+        llq = llq_ptr;
+    }
+
+    // is_interesting() returns true if the most recent analysis
+    // result of the processor should cause its flow to be captured
+    //
+    bool is_interesting() const {
+        const analysis_context &a = processor.analysis;
+        if (a.fp.get_type() == fingerprint_type_unknown || !a.result.is_valid()) {
+            return false;
+        }
+        return a.result.status == fingerprint_status_randomized
+            || a.result.status == fingerprint_status_unlabled
+            || (a.result.classify_malware && a.result.max_mal)
+            || a.result.attr.is_valid();
+    }
+
+    void apply(struct packet_info *pi, uint8_t *eth) override {
+        uint8_t buf[LLQ_MSG_SIZE];
+        bool interesting = processor.write_json(buf, LLQ_MSG_SIZE, eth, pi->len, &pi->ts) != 0 && is_interesting();
+
+        flows.process(get_flow_key(eth, pi->len, pi->linktype, processor.tunnels), eth, pi->len, pi->ts, interesting,
+                      [this](const uint8_t *data, size_t length, uint32_t sec, uint32_t usec) {
+                          pcap_queue_write(llq, (uint8_t *)data, length, sec, usec, block);
+                      });
+    }
+
+    void finalize() override { }
+
+    void flush() override {
+    }
+
+};
+
 /*
  * the function pkt_proc_new_from_config() takes as input a
  * configuration structure, a thread number, and a pointer to a
@@ -39,12 +39,15 @@ int main(int argc, char *argv[]) {
         { argument::required,   "--read",          "read strings from input file <arg>" },
         { argument::none,       "--edit-distance", "method: compute edit distance" },
         { argument::none,       "--subsequence",   "method: compute longest common subsequence" },
+        { argument::none,       "--lcs-length",    "method: compute length of longest common subsequence" },
         { argument::none,       "--substring",     "method: compute longest common substring" },
         { argument::none,       "--matching",      "method: compute matching substrings" },
         { argument::none,       "--hamming",       "method: compute hamming distance" },
         { argument::none,       "--find-mask",     "method: find common mask and value" },
         { argument::none,       "--average",       "report average distance to all other strings" },
         { argument::none,       "--normalize",     "normalize distance to [0,1]" },
+        { argument::required,   "--max-distance",  "report only pairs with edit distance <arg> or less" },
+        { argument::none,       "--self-test",     "check bit-parallel kernels against matrix methods" },
         { argument::none,       "--help",          "prints out help message" }
     });
 
@@ -58,15 +61,36 @@ int main(int argc, char *argv[]) {
     auto [ input_file_is_set, filename ] = opt.get_value("--read");
     bool edit_dist   = opt.is_set("--edit-distance");
     bool lcsubseq    = opt.is_set("--subsequence");
+    bool lcs_length  = opt.is_set("--lcs-length");
     bool lcsubstr    = opt.is_set("--substring");
     bool match_str   = opt.is_set("--matching");
     bool hamming     = opt.is_set("--hamming");
     bool find_mask   = opt.is_set("--find-mask");
     bool average     = opt.is_set("--average");
     bool normalize   = opt.is_set("--normalize");
+    bool self_test   = opt.is_set("--self-test");
     bool print_help  = opt.is_set("--help");
+    auto [ max_distance_is_set, max_distance_str ] = opt.get_value("--max-distance");
 
-    if (!edit_dist && !lcsubseq && !lcsubstr && !match_str && !find_mask && !hamming && !print_help) {
+    if (self_test) {
+        if (bit_parallel_pattern::unit_test(stderr) == false) {
+            fprintf(stderr, "error: bit_parallel_pattern::unit_test() failed\n");
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "bit_parallel_pattern::unit_test() passed\n");
+        return 0;
+    }
+
+    size_t max_distance = SIZE_MAX;
+    if (max_distance_is_set) {
+        if (!edit_dist) {
+            fprintf(stderr, "error: --max-distance requires --edit-distance\n");
+            return EXIT_FAILURE;
+        }
+        max_distance = strtoul(max_distance_str.c_str(), NULL, 10);
+    }
+
+    if (!edit_dist && !lcsubseq && !lcs_length && !lcsubstr && !match_str && !find_mask && !hamming && !print_help) {
         fprintf(stderr, "error: no analysis method specified\n");
         opt.usage(stderr, progname, summary);
         return EXIT_FAILURE;
@@ -115,10 +139,31 @@ int main(int argc, char *argv[]) {
     //
     std::vector<size_t> sum(s.size(), 0);
 
-    // loop over each pair of strings, and apply method
+    // loop over each pair of strings, and apply method; the edit
+    // distances between s[i] and all of the strings before it are
+    // computed in a single batch
     //
     size_t s_len = s.size();
+    std::vector<size_t> distances(s_len);
     for (size_t i=0; i<s_len; i++) {
+        if (edit_dist || lcs_length) {
+            bit_parallel_pattern pattern{s[i].data(), s[i].size()};
+            if (edit_dist) {
+                pattern.edit_distance(s.data(), i, distances.data(), max_distance);
+            }
+            if (lcs_length) {
+                for (size_t j=0; j<i; j++) {
+                    size_t length = pattern.lcs_length(s[j].data(), s[j].size());
+                    if (normalize) {
+                        // normalize by max string size
+                        float normed_length = (float)length / ((float)std::max(s[i].size(), s[j].size()));
+                        fprintf(stdout, "%f\t'%s'\t'%s'\n", normed_length, s[i].c_str(), s[j].c_str());
+                    } else {
+                        fprintf(stdout, "%zu\t'%s'\t'%s'\n", length, s[i].c_str(), s[j].c_str());
+                    }
+                }
+            }
+        }
         for (size_t j=0; j<s_len; j++) {
             if (i == j) {
                 break;
@@ -153,14 +198,13 @@ int main(int argc, char *argv[]) {
                     fprintf(stdout, "%d\t'%s'\t'%s'\t'%s'\n", m.length(), m.value().c_str(), s[i].c_str(), s[j].c_str());
                 }
             }
-            if (edit_dist) {
-                struct edit_distance<uint32_t> ed(s[i].c_str(), s[i].size(), s[j].c_str(), s[j].size());
+            if (edit_dist && distances[j] <= max_distance) {
                 if (normalize) {
                     // normalize by the sum of string sizes
-                    float normed_dist = (float)ed.value() / ((float) s[i].size() + s[j].size());
+                    float normed_dist = (float)distances[j] / ((float) s[i].size() + s[j].size());
                     fprintf(stdout, "%f\t'%s'\t'%s'\n", normed_dist, s[i].c_str(), s[j].c_str());
                 } else {
-                    fprintf(stdout, "%d\t'%s'\t'%s'\n", ed.value(), s[i].c_str(), s[j].c_str());
+                    fprintf(stdout, "%zu\t'%s'\t'%s'\n", distances[j], s[i].c_str(), s[j].c_str());
                 }
             }
             if (hamming) {
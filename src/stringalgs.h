@@ -6,10 +6,15 @@
 #define STRINGALGS_H
 
 #include <string>
+#include <vector>
+#include <iterator>
+#include <cstdint>
+#include <cstdio>
 #include <algorithm>
 #include <memory>
 #include <stdexcept>
 #include <cassert>
+#include "libmerc/bit_parallel.hpp"
 
 // class matrix<T> is a dynamically-allocated two dimensional array of
 // type T, which is indexed starting at zero.  For efficient access,
@@ -428,6 +433,353 @@ template <typename T> struct matching_substrings {
     }
 };
 
+
+/*
+ * class bit_parallel_pattern preprocesses a byte string (the pattern)
+ * so that its edit distance to, and the length of its longest common
+ * subsequence with, other byte strings (the texts) can be computed
+ * with bit-parallel kernels.  The pattern is split into blocks of 64
+ * characters, and each column of the dynamic programming matrix is
+ * represented by a pair of bit vectors per block, which encode the
+ * vertical differences between adjacent cells.  Computing a column
+ * takes a handful of word operations per block, so that comparing a
+ * pattern of length m to a text of length n takes O(ceil(m/64) * n)
+ * time, instead of the O(m*n) time and space of the matrix-based
+ * edit_distance<T> and longest_common_subsequence<T>, which remain
+ * the right choice when an alignment is needed.
+ *
+ * The edit distance kernel is Myers' algorithm, in the block-based
+ * form given by Hyyro, whose column step (libmerc/bit_parallel.hpp)
+ * is shared with the approximate fingerprint matching of libmerc;
+ * the LCS kernel is the Allison-Dix/Hyyro algorithm.  When a maximum
+ * distance k is given, only the diagonal band of the matrix that can
+ * lie on an alignment of cost k or less is computed, and the
+ * computation stops as soon as the distance is known to exceed k, in
+ * which case k+1 is returned.  The batch form of edit_distance()
+ * compares the pattern to many texts; for patterns of up to 64
+ * characters, it processes several texts at once in the lanes of a
+ * vector register.
+ *
+ * A bit_parallel_pattern is not modified by any of the kernels, and
+ * can be used from several threads at once.
+ */
+
+class bit_parallel_pattern {
+    size_t m;                    // pattern length
+    size_t blocks;               // number of 64-bit blocks
+    std::vector<uint64_t> peq;   // match vectors, indexed by (character * blocks + block)
+
+    static constexpr size_t word_bits = 64;
+    static constexpr size_t lanes = 4;
+
+    // high_bit(b) returns the bit corresponding to the last row of
+    // block b
+    //
+    uint64_t high_bit(size_t b) const {
+        if (b == blocks - 1) {
+            return (uint64_t)1 << ((m - 1) % word_bits);
+        }
+        return (uint64_t)1 << (word_bits - 1);
+    }
+
+    size_t rows(size_t b) const {
+        return b == blocks - 1 ? m - b * word_bits : word_bits;
+    }
+
+    size_t edit_distance_single_word(const uint8_t *t, size_t n, size_t k) const {
+        const uint64_t high = high_bit(0);
+        uint64_t pv = ~(uint64_t)0;
+        uint64_t mv = 0;
+        size_t score = m;
+        for (size_t j = 0; j < n; j++) {
+            score += bit_parallel::advance_block(pv, mv, peq[t[j]], 1, high);
+
+            // each of the remaining columns can reduce the score by at most one
+            //
+            if (score > k + (n - j - 1)) {
+                return k + 1;
+            }
+        }
+        return score <= k ? score : k + 1;
+    }
+
+    size_t edit_distance_banded(const uint8_t *t, size_t n, size_t k) const {
+
+        // cells outside of the band [lo, hi] in column j can't lie on
+        // an alignment with cost k or less; blocks below the band are
+        // initialized lazily, by assuming that each cell in them is
+        // one more than the cell above it, and blocks above the band
+        // are dropped, by assuming that the horizontal difference
+        // entering the first computed block is +1.  Both assumptions
+        // overestimate the cells that they stand in for, so every
+        // cell on an alignment of cost k or less is computed exactly
+        //
+        std::vector<uint64_t> pv(blocks), mv(blocks);
+        std::vector<size_t> score(blocks);
+        const size_t excess_rows = m > n ? m - n : 0;
+        const size_t excess_columns = n > m ? n - m : 0;
+        size_t initialized = 0;
+        for (size_t j = 1; j <= n; j++) {
+            size_t lo = j + excess_rows > k ? j + excess_rows - k : 1;
+            size_t hi = std::min(j + k - excess_columns, m);
+            if (lo > hi) {
+                return k + 1;
+            }
+            size_t first = (lo - 1) / word_bits;
+            size_t last = (hi - 1) / word_bits;
+            while (initialized <= last) {
+                pv[initialized] = ~(uint64_t)0;
+                mv[initialized] = 0;
+                score[initialized] = (initialized == 0 ? 0 : score[initialized - 1]) + rows(initialized);
+                initialized++;
+            }
+            const uint64_t *eq = &peq[t[j - 1] * blocks];
+            int h = 1;
+            for (size_t b = first; b <= last; b++) {
+                h = bit_parallel::advance_block(pv[b], mv[b], eq[b], h, high_bit(b));
+                score[b] += h;
+            }
+            if (last == blocks - 1 && score[last] > k + (n - j)) {
+                return k + 1;
+            }
+        }
+        return score[blocks - 1] <= k ? score[blocks - 1] : k + 1;
+    }
+
+    // edit_distance_lanes() computes the edit distances between a
+    // single-word pattern and up to four texts at once
+    //
+    void edit_distance_lanes(const uint8_t *t[lanes], const size_t n[lanes], size_t count, size_t k, size_t d[lanes]) const {
+        typedef uint64_t u64xN __attribute__ ((vector_size (sizeof(uint64_t) * lanes)));
+
+        const unsigned int shift = (m - 1) % word_bits;
+        u64xN pv, mv, score, length, one, zero;
+        size_t n_max = 0;
+        for (size_t l = 0; l < lanes; l++) {
+            pv[l] = ~(uint64_t)0;
+            mv[l] = 0;
+            score[l] = m;
+            length[l] = l < count ? n[l] : 0;
+            one[l] = 1;
+            zero[l] = 0;
+            n_max = std::max(n_max, (size_t)length[l]);
+        }
+        for (size_t j = 0; j < n_max; j++) {
+            u64xN eq, column;
+            for (size_t l = 0; l < lanes; l++) {
+                eq[l] = j < length[l] ? peq[t[l][j]] : 0;
+                column[l] = j;
+            }
+            const u64xN active = (u64xN)(column < length);   // all ones in lanes that have not ended
+            u64xN pv_next = pv, mv_next = mv, ph, mh;
+            bit_parallel::myers_step<u64xN>(pv_next, mv_next, eq, one, zero, ph, mh);
+            score += ((ph >> shift) & 1) & active;
+            score -= ((mh >> shift) & 1) & active;
+            pv = (pv_next & active) | (pv & ~active);
+            mv = (mv_next & active) | (mv & ~active);
+
+            if ((j & 7) == 7) {
+                bool all_exceeded = true;
+                for (size_t l = 0; l < count; l++) {
+                    if (score[l] <= k + (length[l] - std::min((size_t)length[l], j + 1))) {
+                        all_exceeded = false;
+                        break;
+                    }
+                }
+                if (all_exceeded) {
+                    break;
+                }
+            }
+        }
+        for (size_t l = 0; l < count; l++) {
+            d[l] = score[l] <= k ? score[l] : k + 1;
+        }
+    }
+
+public:
+
+    bit_parallel_pattern(const uint8_t *p, size_t length) :
+        m{length},
+        blocks{(length + word_bits - 1) / word_bits},
+        peq(256 * blocks, 0)
+    {
+        for (size_t i = 0; i < m; i++) {
+            peq[p[i] * blocks + i / word_bits] |= (uint64_t)1 << (i % word_bits);
+        }
+    }
+
+    size_t length() const { return m; }
+
+    // edit_distance(t, n, max_distance) returns the edit distance
+    // between the pattern and the text t of length n, if it is at
+    // most max_distance, and returns max_distance+1 otherwise
+    //
+    size_t edit_distance(const uint8_t *t, size_t n, size_t max_distance=SIZE_MAX) const {
+        size_t k = std::min(max_distance, std::max(m, n));
+        if (m == 0 || n == 0) {
+            return m + n <= k ? m + n : k + 1;
+        }
+        if ((m > n ? m - n : n - m) > k) {
+            return k + 1;  // every alignment needs at least |m - n| insertions or deletions
+        }
+        if (blocks == 1) {
+            return edit_distance_single_word(t, n, k);
+        }
+        return edit_distance_banded(t, n, k);
+    }
+
+    // edit_distance(texts, count, distances, max_distance) computes
+    // the edit distance between the pattern and each of the count
+    // texts, as above, and writes them into distances[]
+    //
+    void edit_distance(const std::basic_string<uint8_t> *texts,
+                       size_t count,
+                       size_t *distances,
+                       size_t max_distance=SIZE_MAX) const {
+
+        if (blocks != 1) {
+            for (size_t i = 0; i < count; i++) {
+                distances[i] = edit_distance(texts[i].data(), texts[i].length(), max_distance);
+            }
+            return;
+        }
+
+        // texts that can be rejected by their length alone are not
+        // assigned to a lane
+        //
+        const uint8_t *t[lanes];
+        size_t n[lanes];
+        size_t index[lanes];
+        size_t filled = 0;
+        auto flush = [&]() {
+            size_t d[lanes];
+            size_t k = std::min(max_distance, std::max(m, *std::max_element(n, n + filled)));
+            edit_distance_lanes(t, n, filled, k, d);
+            for (size_t l = 0; l < filled; l++) {
+                distances[index[l]] = d[l] <= max_distance ? d[l] : max_distance + 1;
+            }
+            filled = 0;
+        };
+        for (size_t i = 0; i < count; i++) {
+            size_t len = texts[i].length();
+            size_t k = std::min(max_distance, std::max(m, len));
+            if (len == 0 || (m > len ? m - len : len - m) > k) {
+                distances[i] = edit_distance(texts[i].data(), len, max_distance);
+                continue;
+            }
+            t[filled] = texts[i].data();
+            n[filled] = len;
+            index[filled] = i;
+            if (++filled == lanes) {
+                flush();
+            }
+        }
+        if (filled) {
+            flush();
+        }
+    }
+
+    // lcs_length(t, n) returns the length of the longest common
+    // subsequence of the pattern and the text t of length n
+    //
+    size_t lcs_length(const uint8_t *t, size_t n) const {
+        if (m == 0) {
+            return 0;
+        }
+        if (blocks == 1) {
+            uint64_t v = ~(uint64_t)0;
+            for (size_t j = 0; j < n; j++) {
+                uint64_t u = v & peq[t[j]];
+                v = (v + u) | (v - u);
+            }
+            return m - __builtin_popcountll(v & (~(uint64_t)0 >> (word_bits - m)));
+        }
+
+        std::vector<uint64_t> v(blocks, ~(uint64_t)0);
+        for (size_t j = 0; j < n; j++) {
+            const uint64_t *eq = &peq[t[j] * blocks];
+            uint64_t carry = 0;
+            for (size_t b = 0; b < blocks; b++) {
+                uint64_t u = v[b] & eq[b];
+                uint64_t sum = v[b] + u;
+                uint64_t carry_out = sum < u;
+                sum += carry;
+                carry_out |= sum < carry;
+                v[b] = sum | (v[b] - u);
+                carry = carry_out;
+            }
+        }
+        size_t zeros = 0;
+        for (size_t b = 0; b < blocks; b++) {
+            uint64_t mask = ~(uint64_t)0 >> (word_bits - rows(b));
+            zeros += rows(b) - __builtin_popcountll(v[b] & mask);
+        }
+        return zeros;
+    }
+
+    // unit_test() compares the bit-parallel kernels to the matrix
+    // based implementations on pseudorandom strings, and returns
+    // true if they agree
+    //
+    static bool unit_test(FILE *f=nullptr) {
+        uint64_t state = 0x9e3779b97f4a7c15;
+        auto random = [&state](size_t bound) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return (size_t)(state % bound);
+        };
+        auto random_string = [&random](size_t len, size_t alphabet) {
+            std::basic_string<uint8_t> s;
+            for (size_t i = 0; i < len; i++) {
+                s.push_back('a' + random(alphabet));
+            }
+            return s;
+        };
+        const size_t lengths[] = { 0, 1, 7, 63, 64, 65, 100, 128, 129, 200 };
+        bool passed = true;
+        for (size_t trial = 0; trial < 400; trial++) {
+            size_t alphabet = 2 + random(6);
+            std::basic_string<uint8_t> a = random_string(lengths[random(std::size(lengths))], alphabet);
+            std::vector<std::basic_string<uint8_t>> texts;
+            for (size_t i = 0; i < 9; i++) {
+                std::basic_string<uint8_t> b = random_string(lengths[random(std::size(lengths))], alphabet);
+                if (random(2) && a.length() > 0) {
+                    b = a;  // mutate a copy of the pattern, to get small distances
+                    for (size_t e = random(8); e > 0 && b.length() > 0; e--) {
+                        b[random(b.length())] = 'a' + random(alphabet);
+                    }
+                    if (random(2)) {
+                        b.erase(random(b.length()), 1);
+                    }
+                }
+                texts.push_back(b);
+            }
+            size_t max_distance = random(2) ? random(40) : SIZE_MAX;
+            bit_parallel_pattern p{a.data(), a.length()};
+            std::vector<size_t> batch(texts.size());
+            p.edit_distance(texts.data(), texts.size(), batch.data(), max_distance);
+            for (size_t i = 0; i < texts.size(); i++) {
+                const auto &b = texts[i];
+                struct ::edit_distance<uint32_t> ed(a.data(), a.length(), b.data(), b.length());
+                struct longest_common_subsequence<uint32_t> lcs(a.data(), a.length(), b.data(), b.length());
+                size_t expected = ed.value() <= max_distance ? ed.value() : max_distance + 1;
+                size_t single = p.edit_distance(b.data(), b.length(), max_distance);
+                size_t lcs_len = p.lcs_length(b.data(), b.length());
+                if (single != expected || batch[i] != expected || lcs_len != lcs.length()) {
+                    if (f) {
+                        fprintf(f, "error: m=%zu n=%zu k=%zu: edit distance %zu/%zu (expected %zu), lcs %zu (expected %u)\n",
+                                a.length(), b.length(), max_distance, single, batch[i], expected, lcs_len, lcs.length());
+                    }
+                    passed = false;
+                }
+            }
+        }
+        return passed;
+    }
+
+};
+
 inline uint8_t hamming_weight(uint8_t x)  {
     uint8_t w[] = {
         0,  // 00000000
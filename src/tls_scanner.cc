@@ -33,6 +33,7 @@
 #include "libmerc/crypto_hash.hpp"
 #include "libmerc/verbosity.hpp"
 #include "libmerc/tls_connection.hpp"
+#include "libmerc/tls_scan_engine.hpp"
 #include "options.h"
 #include "pkcs8.hpp"
 
@@ -307,6 +308,36 @@ public:
 
     }
 
+    // scan_concurrently(targets, cfg) obtains the certificates of
+    // all of the targets using a tls_scan_engine, which keeps many
+    // handshakes in flight at once; no HTTP requests are sent
+    //
+    void scan_concurrently(const std::vector<std::string> &scan_targets, tls_scan_engine::config cfg) {
+        cfg.omit_sni = omit_sni;
+        auto process_cert = [this](const std::string &target, const uint8_t *der, size_t der_len) {
+            if (der == nullptr) {
+                return;
+            }
+            std::basic_string<uint8_t> cert_string{der, der_len};
+            data.insert(cert_string, target);
+            if (print_cert) {
+                struct x509_cert cc;
+                cc.parse(der, der_len);
+                cc.print_as_json(stdout);
+            }
+        };
+        tls_scan_engine engine{cfg, process_cert, verbosity};
+        engine.scan(scan_targets);
+
+        const tls_scan_engine::statistics &s = engine.get_statistics();
+        scans += s.targets;
+        scans_succeded += s.succeeded;
+        if (verbosity == verbosity_level::summary) {
+            s.fprint(stderr);
+            fputc('\n', stderr); // terminate summary line
+        }
+    }
+
     bool was_previously_visited(std::string &) const {
         //
         // TODO: connect this to host_data
@@ -869,6 +900,10 @@ int main(int argc, char *argv[]) {
         "which contains the host names and the SHA1 hash of the corresponding\n"
         "certificates.\n"
         "\n"
+        "With --concurrency, certificates are obtained by an event-driven engine\n"
+        "that keeps up to <arg> TLS handshakes in flight at once; in that mode,\n"
+        "targets may be given as host:port, and no HTTP requests are sent.\n"
+        "\n"
         "OPTIONS\n";
 
     option_processor opt({
@@ -884,6 +919,10 @@ int main(int argc, char *argv[]) {
         { argument::none,       "--body",             "prints out HTTP response body" },
         { argument::none,       "--recurse",          "recursively follow src links and redirects" },
         { argument::required,   "--doh",              "send DoH query about <arg>" },
+        { argument::required,   "--concurrency",      "keep up to <arg> handshakes in flight (certificates only)" },
+        { argument::required,   "--rate",             "open at most <arg> connections per second (with --concurrency)" },
+        { argument::required,   "--per-host",         "at most <arg> concurrent connections per address (default: 4)" },
+        { argument::required,   "--timeout",          "abandon handshakes after <arg> milliseconds (default: 10000)" },
         { argument::none,       "--help",             "prints out help message" },
         { argument::none,       "--version",          "prints out version" }
     });
@@ -900,6 +939,10 @@ int main(int argc, char *argv[]) {
     auto [ write_certs, pem_outfile ] = opt.get_value("--write-certs");
     auto [ verb_is_set, verb ] = opt.get_value("--verbosity");
     auto [ doh, doh_query ] = opt.get_value("--doh");
+    auto [ concurrency_is_set, concurrency ] = opt.get_value("--concurrency");
+    auto [ rate_is_set, rate ] = opt.get_value("--rate");
+    auto [ per_host_is_set, per_host ] = opt.get_value("--per-host");
+    auto [ timeout_is_set, timeout ] = opt.get_value("--timeout");
     bool list_uas    = opt.is_set("--list-user-agents");
     bool omit_sni    = opt.is_set("--no-server-name");
     bool print_certs = opt.is_set("--certs");
@@ -929,6 +972,16 @@ int main(int argc, char *argv[]) {
     if (doh) {
         inner_hostname = doh_query;
     }
+    if (concurrency_is_set && (doh || inner_hostname_is_set)) {
+        fprintf(stderr, "error: --concurrency cannot be used with --doh or --inner-host\n");
+        opt.usage(stderr, argv[0], summary);
+        return EXIT_FAILURE;
+    }
+    if (!concurrency_is_set && (rate_is_set || per_host_is_set || timeout_is_set)) {
+        fprintf(stderr, "error: --rate, --per-host, and --timeout require --concurrency\n");
+        opt.usage(stderr, argv[0], summary);
+        return EXIT_FAILURE;
+    }
 
     // select a verbosity level, to be passed to scanner
     //
@@ -976,7 +1029,38 @@ int main(int argc, char *argv[]) {
         if (ua_is_set) {
             scanner.set_user_agent(ua_search_string);
         }
-        if (host_file_is_set) {
+        if (concurrency_is_set) {
+
+            tls_scan_engine::config cfg;
+            cfg.max_in_flight = std::stoul(concurrency);
+            if (rate_is_set) {
+                cfg.connects_per_second = std::stod(rate);
+            }
+            if (per_host_is_set) {
+                cfg.max_per_address = std::stoul(per_host);
+            }
+            if (timeout_is_set) {
+                cfg.timeout = std::chrono::milliseconds{std::stoul(timeout)};
+            }
+
+            std::vector<std::string> scan_targets;
+            if (host_file_is_set) {
+                std::ifstream host_list{host_file};
+                if (!host_list) {
+                    throw std::runtime_error{"could not open file '" + host_file + "'"};
+                }
+                std::string h;
+                while (std::getline(host_list, h)) {
+                    if (!h.empty()) {
+                        scan_targets.emplace_back(h);
+                    }
+                }
+            } else {
+                scan_targets.emplace_back(hostname);
+            }
+            scanner.scan_concurrently(scan_targets, cfg);
+
+        } else if (host_file_is_set) {
 
             std::ifstream host_list{host_file};
             if (!host_list) {
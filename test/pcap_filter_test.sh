@@ -0,0 +1,74 @@
+#!/bin/bash
+#
+# pcap_filter_test.sh
+#
+# checks that pcap_filter partitions the packets of each test capture
+# between its matching and nonmatching outputs, that its output does
+# not depend on the number of classifier threads, and that it fails
+# cleanly on malformed PCAP-NG input
+
+# definitions for colorized output
+COLOR_RED="\033[0;31m"
+COLOR_GREEN="\033[0;32m"
+COLOR_YELLOW="\033[0;33m"
+COLOR_OFF="\033[0m"
+
+PCAP_FILTER=../src/pcap_filter
+
+if [ -x "$PCAP_FILTER" ]; then
+    echo "using executable $PCAP_FILTER"
+else
+    echo "error: executable $PCAP_FILTER not found (run 'make pcap_filter --dir=../src')"
+    exit 1
+fi
+
+TMPDIR=$(mktemp -d)
+trap "rm -rf $TMPDIR" EXIT
+
+fail() {
+    echo -e $COLOR_RED "error: $1" $COLOR_OFF
+    exit 1
+}
+
+# each packet is written to exactly one of the matching and the
+# nonmatching outputs, so their sizes add up to that of the input,
+# plus one extra file header
+#
+for f in data/*.pcap; do
+    $PCAP_FILTER --input $f --output $TMPDIR/match.pcap --select all > /dev/null || fail "could not filter $f"
+    $PCAP_FILTER --input $f --output $TMPDIR/nonmatch.pcap --select all --nonmatching > /dev/null || fail "could not filter $f"
+    in=$(stat -c %s $f)
+    out=$(( $(stat -c %s $TMPDIR/match.pcap) + $(stat -c %s $TMPDIR/nonmatch.pcap) - 24 ))
+    if [ "$in" -ne "$out" ]; then
+        fail "outputs of $f hold $out bytes, expected $in"
+    fi
+done
+
+# splitting by protocol gives the same files with one thread as with
+# many
+#
+f=data/top-https.pcap
+$PCAP_FILTER --input $f --output $TMPDIR/one.pcap --split protocol --threads 1 > /dev/null || fail "could not split $f"
+$PCAP_FILTER --input $f --output $TMPDIR/many.pcap --split protocol --threads 8 > /dev/null || fail "could not split $f"
+for one in $TMPDIR/one.*.pcap; do
+    cmp -s $one ${one/one./many.} || fail "$(basename $one) differs between one and many threads"
+done
+
+# a malformed section header block is reported as an error, after the
+# packets before it have been written, rather than aborting
+#
+shb() {
+    printf '\x0a\x0d\x0d\x0a\x1c\x00\x00\x00'$1'\x01\x00\x00\x00\xff\xff\xff\xff\xff\xff\xff\xff\x1c\x00\x00\x00'
+}
+idb='\x01\x00\x00\x00\x14\x00\x00\x00\x01\x00\x00\x00\xff\xff\x00\x00\x14\x00\x00\x00'
+{ shb '\x4d\x3c\x2b\x1a'; printf $idb; shb '\x00\x00\x00\x00'; } > $TMPDIR/bad.pcapng
+$PCAP_FILTER --input $TMPDIR/bad.pcapng --output $TMPDIR/bad.out.pcapng --select all > /dev/null 2> $TMPDIR/stderr.txt
+status=$?
+if [ "$status" -ne 1 ] || ! grep -q "invalid byte order magic" $TMPDIR/stderr.txt; then
+    fail "malformed pcapng input gave exit status $status"
+fi
+if [ "$(stat -c %s $TMPDIR/bad.out.pcapng)" -ne 48 ]; then
+    fail "the valid section of the malformed pcapng input was not written"
+fi
+
+echo -e $COLOR_GREEN "passed pcap_filter test" $COLOR_OFF
@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# tls_scanner_test.sh
+#
+# starts a pool of local openssl s_server instances that share a
+# self-signed certificate, scans them with tls_scanner in concurrent
+# mode, and checks that every target is reported in the index file
+
+# definitions for colorized output
+COLOR_RED="\033[0;31m"
+COLOR_GREEN="\033[0;32m"
+COLOR_YELLOW="\033[0;33m"
+COLOR_OFF="\033[0m"
+
+SCANNER=../src/tls_scanner
+SERVERS=${SERVERS:-8}
+REPEATS=${REPEATS:-16}
+BASE_PORT=${BASE_PORT:-24430}
+
+if [ -x "$SCANNER" ]; then
+    echo "using executable $SCANNER"
+else
+    echo "error: executable $SCANNER not found (run 'make tls_scanner --dir=../src')"
+    exit 1
+fi
+
+if ! command -v openssl > /dev/null; then
+    echo -e $COLOR_YELLOW "warning: openssl not found; skipping tls_scanner test" $COLOR_OFF
+    exit 0
+fi
+
+TMPDIR=$(mktemp -d)
+SERVER_PIDS=()
+cleanup() {
+    for pid in "${SERVER_PIDS[@]}"; do
+        kill $pid 2> /dev/null
+    done
+    wait 2> /dev/null
+    rm -rf $TMPDIR
+}
+trap cleanup EXIT
+
+openssl req -x509 -newkey rsa:2048 -nodes -subj "/CN=localhost" -days 1 \
+        -keyout $TMPDIR/key.pem -out $TMPDIR/cert.pem 2> /dev/null || exit 1
+
+# start the server pool, and write a host file in which each server
+# appears REPEATS times, to exercise the per-address limit
+#
+for ((i = 0; i < SERVERS; i++)); do
+    port=$((BASE_PORT + i))
+    openssl s_server -quiet -accept $port -cert $TMPDIR/cert.pem -key $TMPDIR/key.pem > /dev/null 2>&1 < /dev/null &
+    SERVER_PIDS+=($!)
+done
+for ((r = 0; r < REPEATS; r++)); do
+    for ((i = 0; i < SERVERS; i++)); do
+        echo "127.0.0.1:$((BASE_PORT + i))"
+    done
+done > $TMPDIR/hosts.txt
+sleep 1
+
+$SCANNER --host-file $TMPDIR/hosts.txt --concurrency 64 --per-host 2 --timeout 5000 \
+         --write-certs $TMPDIR/scan --verbosity summary || exit 1
+
+# all servers share one certificate, so the index should contain one
+# line for each distinct server, all with the same hash
+#
+lines=$(wc -l < $TMPDIR/scan.idx)
+hashes=$(cut -d, -f1 $TMPDIR/scan.idx | sort -u | wc -l)
+if [ "$lines" -ne "$SERVERS" ] || [ "$hashes" -ne 1 ]; then
+    echo -e $COLOR_RED "error: expected $SERVERS index entries with one hash, found $lines entries and $hashes hashes" $COLOR_OFF
+    exit 1
+fi
+echo -e $COLOR_GREEN "passed tls_scanner test" $COLOR_OFF
@@ -0,0 +1,304 @@
+/*
+ * archive_test.cc
+ *
+ * tests of the readers of compressed (and possibly encrypted)
+ * resource archives
+ *
+ * Copyright (c) 2023 Cisco Systems, Inc. All rights reserved.  License at
+ * https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "catch.hpp"
+#include "archive.h"
+#include "indexed_archive.hpp"
+
+// class temp_file creates a uniquely named file, which is removed
+// when the temp_file goes out of scope
+//
+class temp_file {
+    std::string name;
+
+public:
+
+    temp_file() : name{"/tmp/archive_test_XXXXXX"} {
+        int fd = mkstemp(name.data());
+        REQUIRE(fd >= 0);
+        close(fd);
+    }
+
+    ~temp_file() { unlink(name.c_str()); }
+
+    const char *path() const { return name.c_str(); }
+};
+
+// gzip(data) returns data compressed in the gzip format
+//
+static std::vector<uint8_t> gzip(const std::string &data) {
+    z_stream z = {};
+    REQUIRE(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    std::vector<uint8_t> out(deflateBound(&z, data.size()));
+    z.next_in = (uint8_t *)data.data();
+    z.avail_in = data.size();
+    z.next_out = out.data();
+    z.avail_out = out.size();
+    REQUIRE(deflate(&z, Z_FINISH) == Z_STREAM_END);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+static void write_file(const temp_file &f, const std::vector<uint8_t> &data) {
+    FILE *fp = fopen(f.path(), "w");
+    REQUIRE(fp != nullptr);
+    REQUIRE(fwrite(data.data(), 1, data.size(), fp) == data.size());
+    fclose(fp);
+}
+
+// lines(n) returns n numbered lines of text
+//
+static std::string lines(size_t n) {
+    std::string s;
+    for (size_t i = 0; i < n; i++) {
+        s += "line " + std::to_string(i) + "\n";
+    }
+    return s;
+}
+
+// random_bytes(n) returns n bytes that do not compress, so that the
+// compressed file is about as large as the original
+//
+static std::string random_bytes(size_t n) {
+    std::string s(n, '\0');
+    uint64_t x = 0x9e3779b97f4a7c15;
+    for (auto &c : s) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        c = x;
+    }
+    return s;
+}
+
+static std::string read_all(gz_file &gz) {
+    std::string s;
+    uint8_t buf[4096];
+    ssize_t n;
+    while ((n = gz.read(buf, sizeof(buf))) > 0) {
+        s.append((char *)buf, n);
+    }
+    REQUIRE(n == 0);
+    return s;
+}
+
+TEST_CASE("Testing gz_file on a small file") {
+    temp_file f;
+    std::string text = lines(1000);
+    write_file(f, gzip(text));
+
+    gz_file gz{f.path(), nullptr};
+    CHECK(gz.is_pipelined() == false);
+    CHECK((bool)gz == true);
+    std::string line;
+    for (size_t i = 0; i < 1000; i++) {
+        gz.getline(line, SSIZE_MAX);
+        CHECK(line == "line " + std::to_string(i));
+    }
+    CHECK(gz.getline(line, SSIZE_MAX) == 0);
+    CHECK((bool)gz == true);               // readable, although there is nothing left to read
+}
+
+TEST_CASE("Testing gz_file on a large file") {
+    temp_file f;
+    std::string data = random_bytes(3 * gz_file::pipeline_threshold / 2);
+    write_file(f, gzip(data));
+
+    gz_file gz{f.path(), nullptr};
+    CHECK(gz.is_pipelined() == true);
+    CHECK(gz.seek(100000) == 100000);
+    uint8_t buf[16];
+    REQUIRE(gz.read(buf, sizeof(buf)) == sizeof(buf));
+    CHECK(memcmp(buf, data.data() + 100000, sizeof(buf)) == 0);
+    CHECK(read_all(gz) == data.substr(100000 + sizeof(buf)));
+    CHECK((bool)gz == true);
+}
+
+TEST_CASE("Testing gz_file on a segment of a file") {
+    temp_file f;
+    std::string text = lines(100);
+    std::vector<uint8_t> file(37, 'x');
+    std::vector<uint8_t> compressed = gzip(text);
+    file.insert(file.end(), compressed.begin(), compressed.end());
+    file.insert(file.end(), 11, 'y');
+    write_file(f, file);
+
+    gz_file gz{f.path(), nullptr, 37, compressed.size()};
+    CHECK(read_all(gz) == text);
+}
+
+TEST_CASE("Testing gz_file on a corrupt file") {
+    for (size_t length : { (size_t)10000, 3 * gz_file::pipeline_threshold / 2 }) {
+        temp_file f;
+        std::vector<uint8_t> compressed = gzip(random_bytes(length));
+        compressed[compressed.size() - 8] ^= 0xff;     // corrupt the CRC
+        write_file(f, compressed);
+
+        gz_file gz{f.path(), nullptr};
+        CHECK((bool)gz == true);
+        uint8_t buf[4096];
+        ssize_t n;
+        while ((n = gz.read(buf, sizeof(buf))) > 0) {
+            ;
+        }
+        CHECK(n == -1);
+        CHECK((bool)gz == false);
+    }
+}
+
+static std::string read_member(indexed_archive::member &m) {
+    std::string s;
+    uint8_t buf[4096];
+    ssize_t n;
+    while ((n = m.read(buf, sizeof(buf))) > 0) {
+        s.append((char *)buf, n);
+    }
+    REQUIRE(n == 0);
+    return s;
+}
+
+// check_round_trip(key) writes an indexed archive with and reads it
+// back with key, which may be nullptr
+//
+static void check_round_trip(const uint8_t *key) {
+    temp_file f;
+    std::string text = lines(100);
+    std::string data = random_bytes(3 * gz_file::pipeline_threshold / 2);
+
+    indexed_archive_writer w{f.path(), key};
+    REQUIRE(w.is_valid());
+    CHECK(w.add_member("text.txt", (const uint8_t *)text.data(), text.size()));
+    CHECK(w.add_member("data.bin", (const uint8_t *)data.data(), data.size()));
+    CHECK(w.add_member("empty", nullptr, 0));
+    CHECK(w.add_member("", (const uint8_t *)text.data(), text.size()) == false);
+    CHECK(w.add_member("tab\tname", (const uint8_t *)text.data(), text.size()) == false);
+    REQUIRE(w.close());
+
+    CHECK(indexed_archive::is_indexed_archive(f.path()));
+    indexed_archive a{f.path(), key};
+    REQUIRE(a.is_valid());
+    REQUIRE(a.get_members().size() == 3);
+    CHECK(a.find("no such member") == nullptr);
+
+    const indexed_archive::member_info *info = a.find("text.txt");
+    REQUIRE(info != nullptr);
+    CHECK(info->size == text.size());
+    auto m = a.open(*info);
+    std::string line;
+    CHECK(m->getline(line) > 0);
+    CHECK(line == "line 0");
+    CHECK(read_member(*m) == text.substr(strlen("line 0\n")));
+
+    // members can be read in any order, and at the same time
+    //
+    info = a.find("data.bin");
+    REQUIRE(info != nullptr);
+    CHECK(info->size == data.size());
+    auto d1 = a.open(*info);
+    auto d2 = a.open(*info);
+    uint8_t buf[16];
+    REQUIRE(d1->read(buf, sizeof(buf)) == sizeof(buf));
+    CHECK(read_member(*d2) == data);
+    CHECK(memcmp(buf, data.data(), sizeof(buf)) == 0);
+
+    info = a.find("empty");
+    REQUIRE(info != nullptr);
+    CHECK(read_member(*a.open(*info)).empty());
+}
+
+TEST_CASE("Testing indexed_archive round trip without a key") {
+    check_round_trip(nullptr);
+}
+
+TEST_CASE("Testing indexed_archive round trip with a key") {
+    const uint8_t key[16] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+    };
+    check_round_trip(key);
+
+    // the index cannot be read without the key
+    //
+    temp_file f;
+    std::string text = lines(10);
+    indexed_archive_writer w{f.path(), key};
+    CHECK(w.add_member("text.txt", (const uint8_t *)text.data(), text.size()));
+    REQUIRE(w.close());
+    CHECK(indexed_archive::is_indexed_archive(f.path()));
+    CHECK(indexed_archive{f.path(), nullptr}.is_valid() == false);
+}
+
+// indexed_file(index, index_offset, index_length) returns an archive
+// holding a single gzipped member followed by an index with the given
+// text, and a footer that locates the index at index_offset and
+// index_length, or at the actual index if those are zero
+//
+static std::vector<uint8_t> indexed_file(const std::string &index_text, uint64_t index_offset=0, uint64_t index_length=0) {
+    std::vector<uint8_t> file = gzip(lines(10));
+    std::vector<uint8_t> index = gzip(index_text);
+    if (index_offset == 0 && index_length == 0) {
+        index_offset = file.size();
+        index_length = index.size();
+    }
+    file.insert(file.end(), index.begin(), index.end());
+    uint8_t footer[indexed_archive_format::footer_length];
+    memcpy(footer, indexed_archive_format::magic, sizeof(indexed_archive_format::magic));
+    indexed_archive_format::encode_uint64(footer + 8, index_offset);
+    indexed_archive_format::encode_uint64(footer + 16, index_length);
+    file.insert(file.end(), footer, footer + sizeof(footer));
+    return file;
+}
+
+static bool is_valid_archive(const std::vector<uint8_t> &contents) {
+    temp_file f;
+    write_file(f, contents);
+    return indexed_archive::is_indexed_archive(f.path()) && indexed_archive{f.path()}.is_valid();
+}
+
+TEST_CASE("Testing indexed_archive bounds checks") {
+    const size_t member_length = gzip(lines(10)).size();
+    const std::string entry = "a\t0\t" + std::to_string(member_length) + "\t" + std::to_string(lines(10).size()) + "\n";
+    REQUIRE(is_valid_archive(indexed_file(entry)));
+
+    // the footer must locate the index within the file
+    //
+    std::vector<uint8_t> file = indexed_file(entry);
+    CHECK(is_valid_archive(indexed_file(entry, file.size(), 1)) == false);
+    CHECK(is_valid_archive(indexed_file(entry, member_length, file.size())) == false);
+    CHECK(is_valid_archive(indexed_file(entry, UINT64_MAX, 2)) == false);
+    CHECK(is_valid_archive(indexed_file(entry, 1, UINT64_MAX)) == false);
+
+    // each member must lie before the index, even if its offset and
+    // length would overflow when added
+    //
+    CHECK(is_valid_archive(indexed_file("a\t0\t" + std::to_string(member_length + 1) + "\t1\n")) == false);
+    CHECK(is_valid_archive(indexed_file("a\t1\t" + std::to_string(member_length) + "\t1\n")) == false);
+    CHECK(is_valid_archive(indexed_file("a\t18446744073709551615\t2\t1\n")) == false);
+    CHECK(is_valid_archive(indexed_file("a\t2\t18446744073709551615\t1\n")) == false);
+
+    // malformed index entries
+    //
+    CHECK(is_valid_archive(indexed_file("a\t0\t" + std::to_string(member_length) + "\n")) == false);
+    CHECK(is_valid_archive(indexed_file("a\t0\tx\t1\n")) == false);
+    CHECK(is_valid_archive(indexed_file("a\t\t1\t1\n")) == false);
+    CHECK(is_valid_archive(indexed_file("")) == false);
+
+    // files without a footer
+    //
+    CHECK(is_valid_archive(gzip(lines(10))) == false);
+    CHECK(is_valid_archive(std::vector<uint8_t>(file.end() - 8, file.end())) == false);
+    file[file.size() - indexed_archive_format::footer_length] ^= 0xff;
+    CHECK(is_valid_archive(file) == false);         // bad magic
+}
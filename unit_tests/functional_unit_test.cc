@@ -10,6 +10,22 @@
 #include "bencode.h"
 #include "snmp.h"
 #include "tofsee.hpp"
+#include "handshake_buffer.hpp"
+#include "ssh.h"
+#include "reassembly_hints.hpp"
+#include "flow_record.hpp"
+#include "tunnel.hpp"
+#include "media_session.hpp"
+#include "mysql.hpp"
+#include "fingerprint_index.hpp"
+#include "watchlist.hpp"
+#include "flow_capture.hpp"
+#include "public_suffix_list.hpp"
+#include "tls_session.hpp"
+#include "pcap.h"
+#include "proto_identify.h"
+#include "smb2.h"
+#include "os_identification.hpp"
 
 /*
  * The unit_test() functions defined in header files
@@ -21,4 +37,20 @@ TEST_CASE("Testing unit_test() defined in class") {
     CHECK(bencoding::dictionary::unit_test() == true);
     CHECK(snmp::unit_test() == true);
     CHECK(tofsee_initial_message::unit_test() == true);
+    CHECK(handshake_buffer::unit_test() == true);
+    CHECK(ssh_kex_correlator::unit_test() == true);
+    CHECK(reassembly_hint_counters::unit_test() == true);
+    CHECK(flow_record_table::unit_test() == true);
+    CHECK(decapsulator::unit_test() == true);
+    CHECK(media_session_table::unit_test() == true);
+    CHECK(mysql_server_greet::unit_test() == true);
+    CHECK(approximate_fingerprint_index<int>::unit_test() == true);
+    CHECK(watchlist::unit_test() == true);
+    CHECK(flow_capture_buffer::unit_test() == true);
+    CHECK(public_suffix_list::unit_test() == true);
+    CHECK(tls_session_table::unit_test() == true);
+    CHECK(pcap::ng::block_index::unit_test() == true);
+    CHECK(traffic_selector::unit_test() == true);
+    CHECK(smb2_packet::unit_test() == true);
+    CHECK(os_identification_stage::unit_test() == true);
 }
@@ -648,3 +648,50 @@ TEST_CASE_METHOD(LibmercTestFixture, "mysql with resources-mp")
         mysql_check(count, config.m_lc);
     }
 }
+
+TEST_CASE_METHOD(LibmercTestFixture, "tcp reassembly of split messages with resources-mp")
+{
+    // tcp_reassembly.pcap holds an HTTP request whose headers span two
+    // segments, one whose headers span three segments with a first
+    // segment longer than 4 KB, a DNS over TCP query, an SMB2
+    // negotiate request, and a MySQL server greeting, each split
+    // across segments, along with data that matches the MySQL
+    // greeting matcher but has a bogus length
+    //
+    auto reassembled_count = [&](const struct libmerc_config &config)
+    {
+        initialize(config);
+        int count = 0;
+        char output[8192];
+        while (read_next_data_packet() == 0) {
+            size_t len = mercury_packet_processor_write_json(m_mpp, output, sizeof(output),
+                                                             (unsigned char *)m_data_packet.first,
+                                                             m_data_packet.second - m_data_packet.first,
+                                                             &m_time);
+            if (len > 0 && std::string{output, len}.find("\"reassembled\":true") != std::string::npos) {
+                count++;
+            }
+        }
+        deinitialize();
+        return count;
+    };
+
+    std::vector<std::pair<test_config, int>> test_set_up{
+        {test_config{
+             .m_lc{.resources = resources_mp_path,
+                .packet_filter_cfg = (char *)"select=http,dns,smb,mysql"},
+             .m_pc{"tcp_reassembly.pcap"}},
+         0},
+        {test_config{
+             .m_lc{.resources = resources_mp_path,
+                .packet_filter_cfg = (char *)"select=http,dns,smb,mysql;tcp-reassembly"},
+             .m_pc{"tcp_reassembly.pcap"}},
+         5},
+    };
+
+    for (auto &[config, count] : test_set_up)
+    {
+        set_pcap(config.m_pc.c_str());
+        CHECK(reassembled_count(config.m_lc) == count);
+    }
+}
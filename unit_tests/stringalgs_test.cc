@@ -0,0 +1,16 @@
+/*
+ * stringalgs_test.cc
+ *
+ * stringalgs.h is kept in its own translation unit, because its
+ * mask_and_value class differs from the one in libmerc
+ *
+ * Copyright (c) 2023 Cisco Systems, Inc. All rights reserved.  License at
+ * https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include "catch.hpp"
+#include "stringalgs.h"
+
+TEST_CASE("Testing bit-parallel string kernels") {
+    CHECK(bit_parallel_pattern::unit_test() == true);
+}